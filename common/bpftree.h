@@ -0,0 +1,160 @@
+// Compiles a table of per-syscall seccomp actions into a BPF program that
+// finds a syscall's action by binary search over runs of syscall numbers, so
+// that deciding any syscall takes O(log runs) instructions instead of walking
+// a linear chain of compares.
+//
+// Optionally, syscalls made from one range of instruction pointers (e.g. the
+// function a SIGSYS handler uses to make its real syscalls) are always
+// allowed. That check only happens on the way to a non-allow action, so
+// allowed syscalls don't pay for it.
+#pragma once
+
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A maximal run of consecutive syscall numbers with the same action. It
+// starts at `first` and ends where the next run starts; the last run goes on
+// forever.
+struct bpftree_run {
+  uint32_t first;
+  uint32_t action;
+};
+
+#define BPFTREE_MAX_BLOCKS 64
+
+struct bpftree {
+  // Syscalls made with an instruction pointer in [exempt_lo, exempt_hi) are
+  // allowed regardless of their action. Both 0 for no exemption. Must not
+  // straddle a 4 GiB boundary, since BPF compares 32 bits at a time.
+  uint64_t exempt_lo;
+  uint64_t exempt_hi;
+
+  struct sock_filter insns[BPF_MAXINSNS];
+  unsigned len;
+
+  // Non-allow actions that need an instruction pointer check, each of which
+  // gets one shared block of instructions after the tree.
+  uint32_t block_actions[BPFTREE_MAX_BLOCKS];
+  int nblocks;
+};
+
+// Collapses `actions` (indexed by syscall number, `n` entries) into runs.
+// Syscalls >= n get `default_action`. `runs` needs room for n + 1 entries.
+// Returns the number of runs.
+static inline int bpftree_runs(const uint32_t *actions, uint32_t n, uint32_t default_action,
+                               struct bpftree_run *runs) {
+  int nruns = 0;
+  for (uint32_t nr = 0; nr <= n; ++nr) {
+    uint32_t action = nr < n ? actions[nr] : default_action;
+    if (nruns == 0 || runs[nruns - 1].action != action) {
+      runs[nruns++] = (struct bpftree_run){.first = nr, .action = action};
+    }
+  }
+  return nruns;
+}
+
+// Length of the tree for runs [lo, hi). Has to agree with _bpftree_emit.
+static inline unsigned _bpftree_size(const struct bpftree_run *runs, int lo, int hi) {
+  if (hi - lo == 1) {
+    return 1;
+  }
+  int mid = lo + (hi - lo) / 2;
+  unsigned left = _bpftree_size(runs, lo, mid);
+  // Conditional jumps only reach 255 instructions; past that we need a JA.
+  return 1 + (left > 255) + left + _bpftree_size(runs, mid, hi);
+}
+
+static inline void _bpftree_emit_leaf(struct bpftree *t, unsigned blocks_start, uint32_t action) {
+  if (action == SECCOMP_RET_ALLOW || t->exempt_lo == t->exempt_hi) {
+    t->insns[t->len++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, action);
+    return;
+  }
+  int b = 0;
+  while (t->block_actions[b] != action) {
+    ++b;
+  }
+  unsigned target = blocks_start + b * 7;
+  t->insns[t->len] = (struct sock_filter)BPF_STMT(BPF_JMP | BPF_JA, target - (t->len + 1));
+  t->len++;
+}
+
+static inline void _bpftree_emit(struct bpftree *t, const struct bpftree_run *runs, int lo, int hi,
+                                 unsigned blocks_start) {
+  if (hi - lo == 1) {
+    _bpftree_emit_leaf(t, blocks_start, runs[lo].action);
+    return;
+  }
+  // nr >= runs[mid].first goes right; the left subtree comes first.
+  int mid = lo + (hi - lo) / 2;
+  unsigned left = _bpftree_size(runs, lo, mid);
+  if (left <= 255) {
+    t->insns[t->len++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, runs[mid].first,
+                                                      left, 0);
+  } else {
+    t->insns[t->len++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, runs[mid].first,
+                                                      0, 1);
+    t->insns[t->len++] = (struct sock_filter)BPF_STMT(BPF_JMP | BPF_JA, left);
+  }
+  _bpftree_emit(t, runs, lo, mid, blocks_start);
+  _bpftree_emit(t, runs, mid, hi, blocks_start);
+}
+
+// Appends the instruction pointer check that guards `action`.
+static inline void _bpftree_emit_block(struct bpftree *t, uint32_t action) {
+  const uint32_t ip = offsetof(struct seccomp_data, instruction_pointer);
+  struct sock_filter block[] = {
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, ip + 4),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint32_t)(t->exempt_lo >> 32), 0, 4),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, ip),
+    BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, (uint32_t)t->exempt_lo, 0, 2),
+    BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, (uint32_t)t->exempt_hi, 1, 0),
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+    BPF_STMT(BPF_RET | BPF_K, action),
+  };
+  for (size_t i = 0; i < sizeof(block) / sizeof(block[0]); ++i) {
+    t->insns[t->len++] = block[i];
+  }
+}
+
+// Compiles `runs` (as from bpftree_runs) into t->insns. Set t->exempt_lo and
+// t->exempt_hi first. Doesn't check the architecture; callers that care should
+// prepend that themselves. Returns 0 on success, or -1 if the program would be
+// too long or the exempt range is unusable.
+static inline int bpftree_compile(struct bpftree *t, const struct bpftree_run *runs, int nruns) {
+  if (t->exempt_lo != t->exempt_hi &&
+      (t->exempt_lo >> 32) != ((t->exempt_hi - 1) >> 32)) {
+    return -1;
+  }
+  t->nblocks = 0;
+  if (t->exempt_lo != t->exempt_hi) {
+    for (int i = 0; i < nruns; ++i) {
+      uint32_t action = runs[i].action;
+      int b = 0;
+      while (b < t->nblocks && t->block_actions[b] != action) {
+        ++b;
+      }
+      if (action == SECCOMP_RET_ALLOW || b < t->nblocks) {
+        continue;
+      }
+      if (t->nblocks == BPFTREE_MAX_BLOCKS) {
+        return -1;
+      }
+      t->block_actions[t->nblocks++] = action;
+    }
+  }
+
+  unsigned blocks_start = 1 + _bpftree_size(runs, 0, nruns);
+  if (blocks_start + 7 * t->nblocks > BPF_MAXINSNS) {
+    return -1;
+  }
+  t->len = 0;
+  t->insns[t->len++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+                                                    offsetof(struct seccomp_data, nr));
+  _bpftree_emit(t, runs, 0, nruns, blocks_start);
+  for (int b = 0; b < t->nblocks; ++b) {
+    _bpftree_emit_block(t, t->block_actions[b]);
+  }
+  return 0;
+}
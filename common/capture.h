@@ -0,0 +1,196 @@
+// Captures what a process writes to stdout and stderr into a file of its own,
+// mmap'd, instead of writing it: for write interposers
+// (interposing-internal-libc-calls/interpose_write.c and friends, and
+// patching-libc-to-interpose-syscalls/interpose.c). capcat
+// (interposing-internal-libc-calls/capcat.c) turns captures back into text.
+//
+// On when CAPTURE_DIR is set. Each process, forked children included, gets
+// CAPTURE_DIR/<pid>.cap: a header page, then a ring of CAPTURE_SIZE bytes (K,
+// M or G suffixes are fine; default 16M, rounded up to a power of 2) of
+// records. A write claims room with a compare-and-swap on `head`, copies
+// itself in, and commits by storing its position in the record header last,
+// so there are no syscalls after the first.
+//
+// The ring overwrites its oldest records when it's full. A reader that falls
+// behind can tell (`head` is more than a ring ahead of it), and says how much
+// it lost.
+//
+// An exec keeps the pid, so the new image would find the old one's file. We
+// never reuse a file: if <pid>.cap exists, the new one is <pid>.1.cap, then
+// <pid>.2.cap and so on, and capcat merges them all by timestamp. (The same
+// goes for leftovers of an earlier run whose pid came around again; start
+// with an empty CAPTURE_DIR.)
+//
+// Children that don't go through fork's atfork handlers (vfork, posix_spawn,
+// raw clone) share their parent's file, under the parent's pid, until they
+// exec. posix_spawn's children don't write anything before they do; the
+// others write into the parent's capture.
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CAPTURE_MAGIC UINT64_C(0x3170616365727574) /* "ture" "cap1", little-endian */
+#define CAPTURE_VERSION 1
+#define CAPTURE_HEADER 4096
+// Longer writes are split into records of at most this many bytes.
+#define CAPTURE_MAX_RECORD (64 << 10)
+
+struct capture_header {
+  uint64_t magic;
+  uint32_t version;
+  int32_t pid;
+  // Bytes in the ring. A power of 2.
+  uint64_t size;
+  // Bytes ever claimed. Records start at multiples of 8.
+  uint64_t head __attribute__((aligned(64)));
+};
+
+struct capture_record {
+  // Offset of this record since the start of the capture, stored last (with
+  // release) once the rest is there. Anything else means not written yet, or
+  // overwritten since.
+  uint64_t pos;
+  // CLOCK_REALTIME.
+  uint64_t ns;
+  // Bytes of data that follow; the record is padded to a multiple of 8.
+  uint32_t len;
+  // 1 or 2; -1 for padding up to the end of the ring. Less room than a
+  // header at the end of the ring is padding too, without one.
+  int32_t fd;
+};
+
+static inline uint64_t capture_record_size(uint32_t len) {
+  return (sizeof(struct capture_record) + len + 7) & ~UINT64_C(7);
+}
+
+static struct capture_header *_capture;
+
+static void _capture_open(void) {
+  const char *dir = getenv("CAPTURE_DIR");
+  const char *size = getenv("CAPTURE_SIZE");
+  uint64_t ring = 16 << 20;
+  if (size && size[0]) {
+    char *unit;
+    ring = strtoull(size, &unit, 0);
+    ring <<= *unit == 'K' ? 10 : *unit == 'M' ? 20 : *unit == 'G' ? 30 : 0;
+  }
+  uint64_t pow = 4 * CAPTURE_MAX_RECORD;
+  while (pow < ring) {
+    pow <<= 1;
+  }
+  char path[4096];
+  _capture = NULL;
+  int fd = -1;
+  for (int n = 0; fd < 0 && n < 1000; ++n) {
+    if (n == 0) {
+      snprintf(path, sizeof(path), "%s/%d.cap", dir, getpid());
+    } else {
+      snprintf(path, sizeof(path), "%s/%d.%d.cap", dir, getpid(), n);
+    }
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0 && errno != EEXIST) {
+      return;
+    }
+  }
+  if (fd < 0) {
+    return;
+  }
+  void *p = MAP_FAILED;
+  if (ftruncate(fd, CAPTURE_HEADER + pow) == 0) {
+    p = mmap(NULL, CAPTURE_HEADER + pow, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (p == MAP_FAILED) {
+    return;
+  }
+  struct capture_header *h = p;
+  h->version = CAPTURE_VERSION;
+  h->pid = getpid();
+  h->size = pow;
+  h->head = 0;
+  // Last, so that a reader doesn't go by a half-written header.
+  __atomic_store_n(&h->magic, CAPTURE_MAGIC, __ATOMIC_RELEASE);
+  _capture = h;
+}
+
+// A forked child doesn't write into its parent's file.
+static void _capture_atfork_child(void) {
+  if (_capture) {
+    munmap(_capture, CAPTURE_HEADER + _capture->size);
+    _capture_open();
+  }
+}
+
+// capcat includes this too, for the layout, so these may go unused.
+__attribute__((unused)) static void capture_init(void) {
+  const char *dir = getenv("CAPTURE_DIR");
+  if (!dir || !dir[0]) {
+    return;
+  }
+  _capture_open();
+  pthread_atfork(NULL, NULL, _capture_atfork_child);
+}
+
+__attribute__((unused)) static inline bool capture_wants(int fd) {
+  return _capture && (fd == 1 || fd == 2);
+}
+
+static void _capture_record(int fd, const char *buf, uint32_t len, uint64_t ns) {
+  struct capture_header *h = _capture;
+  char *ring = (char*)h + CAPTURE_HEADER;
+  uint64_t need = capture_record_size(len);
+  while (1) {
+    uint64_t pos = __atomic_load_n(&h->head, __ATOMIC_RELAXED);
+    uint64_t off = pos & (h->size - 1);
+    uint64_t room = h->size - off;
+    uint64_t claim = room < need ? room : need;
+    if (!__atomic_compare_exchange_n(&h->head, &pos, pos + claim, false, __ATOMIC_ACQ_REL,
+                                     __ATOMIC_RELAXED)) {
+      continue;
+    }
+    if (room < sizeof(struct capture_record)) {
+      // Not even room for a header; readers skip it without one.
+      continue;
+    }
+    struct capture_record *r = (struct capture_record*)(ring + off);
+    // Ours now; make sure nobody takes the old contents for this record.
+    __atomic_store_n(&r->pos, UINT64_MAX, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    r->ns = ns;
+    if (claim < need) {
+      // Doesn't fit before the end of the ring: pad, and go around.
+      r->len = claim - sizeof(*r);
+      r->fd = -1;
+      __atomic_store_n(&r->pos, pos, __ATOMIC_RELEASE);
+      continue;
+    }
+    r->len = len;
+    r->fd = fd;
+    memcpy(r + 1, buf, len);
+    __atomic_store_n(&r->pos, pos, __ATOMIC_RELEASE);
+    return;
+  }
+}
+
+// For fds that capture_wants. Always succeeds.
+__attribute__((unused)) static ssize_t capture_write(int fd, const void *buf, size_t n) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  uint64_t ns = ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+  for (size_t done = 0; done < n;) {
+    uint32_t len = n - done < CAPTURE_MAX_RECORD ? n - done : CAPTURE_MAX_RECORD;
+    _capture_record(fd, (const char*)buf + done, len, ns);
+    done += len;
+  }
+  return n;
+}
@@ -0,0 +1,315 @@
+// Gathers small writes to chosen fds (stdout and stderr, say) into a buffer
+// per thread, and writes them out together with one writev, for interposers
+// of write: interposing-internal-libc-calls/coalesce_write.c and
+// patching-libc-to-interpose-syscalls/coalesce.c.
+//
+// Off unless COALESCE_FDS is set, to a comma-separated list of fds below 64.
+// A thread's buffer goes out when:
+//
+// * it reaches COALESCE_BYTES (default 4096, at most COALESCE_BUF). A write
+//   that doesn't fit goes out along with it, straight from the caller's
+//   buffer, as the second iovec;
+// * the thread writes to a different fd, so that stdout and stderr stay in
+//   order with each other;
+// * the thread writes again COALESCE_USEC (default 10000) or more after the
+//   buffer's first write. There's no timer, so a thread that goes quiet keeps
+//   its buffer until the next of these;
+// * the interposer calls coalesce_flush() or coalesce_flush_all(), which it
+//   should do before anything that could block, or that would care about the
+//   output being there: reads, fsyncs, sleeps, forks, execs and exits.
+//
+// We also flush every buffer before a fork, and a thread's at its exit. The
+// interposer should also call coalesce_before_write() before syscalls that
+// write to an fd some other way (writev, pwrite, sendmsg, splice...), and
+// coalesce_before_dup() before ones that change what an fd refers to, or give
+// another fd the same file (dup*, close, fcntl F_DUPFD).
+//
+// Writes to the same fd from different threads stay in order within each
+// thread, but not between them. A buffered write always "succeeds". If the fd
+// is non-blocking and full when we flush, we wait for it with poll; if the
+// writev fails any other way later, the error and the data are dropped.
+//
+// write is async-signal-safe, so a signal handler may write while its thread
+// is in the middle of buffering or flushing. Those writes (and flushes) skip
+// the buffer and go straight out, ahead of whatever's in it.
+//
+// The includer supplies the real writev, with libc's conventions (-1 and
+// errno), to coalesce_init().
+#pragma once
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#define COALESCE_BUF (64 << 10)
+#define COALESCE_THREADS 1024
+
+typedef ssize_t (*coalesce_writev_fn)(int fd, const struct iovec *iov, int iovcnt);
+
+struct coalesce_buf {
+  // Held by the owning thread while it writes, or by whoever's flushing it.
+  int lock;
+  // Whether a thread has it.
+  int owned;
+  // Where `bytes` are going. Meaningless while `len` is 0.
+  int fd;
+  size_t len;
+  // When the first of `bytes` were written, CLOCK_MONOTONIC_COARSE.
+  uint64_t first_ns;
+  char bytes[COALESCE_BUF];
+};
+
+static struct {
+  uint64_t fds;
+  size_t bytes;
+  uint64_t ns;
+  coalesce_writev_fn writev;
+  pthread_key_t key;
+  // Every thread's buffer, for coalesce_flush_all(). Claimed with atomics.
+  struct coalesce_buf *bufs[COALESCE_THREADS];
+} _coalesce;
+static __thread struct coalesce_buf *_coalesce_mine;
+// Set while this thread holds its own buffer's lock, so that a signal handler
+// that interrupts it doesn't wait for the lock forever.
+static __thread int _coalesce_busy;
+
+static void _coalesce_lock(struct coalesce_buf *b) {
+  while (__atomic_exchange_n(&b->lock, 1, __ATOMIC_ACQUIRE)) {
+    sched_yield();
+  }
+}
+
+static void _coalesce_unlock(struct coalesce_buf *b) {
+  __atomic_store_n(&b->lock, 0, __ATOMIC_RELEASE);
+}
+
+static uint64_t _coalesce_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+// Writes out `b`, then `extra`, which isn't buffered. Returns how much of
+// `extra` got written, or -1.
+static ssize_t _coalesce_flush_locked(struct coalesce_buf *b, const void *extra, size_t n) {
+  struct iovec iov[2] = {
+    {.iov_base = b->bytes, .iov_len = b->len},
+    {.iov_base = (void*)extra, .iov_len = n},
+  };
+  int fd = b->fd;
+  b->len = 0;
+  struct iovec *v = iov[0].iov_len ? &iov[0] : &iov[1];
+  int cnt = &iov[2] - v;
+  while (cnt > 0 && v[cnt - 1].iov_len == 0) {
+    --cnt;
+  }
+  while (cnt > 0) {
+    ssize_t rv = _coalesce.writev(fd, v, cnt);
+    if (rv < 0 && errno == EINTR) {
+      continue;
+    }
+    if (rv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      // Non-blocking and full. Not losing it is worth the wait.
+      struct pollfd p = {.fd = fd, .events = POLLOUT};
+      if (poll(&p, 1, -1) >= 0 || errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (rv < 0) {
+      return -1;
+    }
+    while (cnt > 0 && (size_t)rv >= v->iov_len) {
+      rv -= v->iov_len;
+      ++v;
+      --cnt;
+    }
+    if (cnt > 0) {
+      v->iov_base = (char*)v->iov_base + rv;
+      v->iov_len -= rv;
+    }
+  }
+  return n;
+}
+
+// Takes this thread's own buffer, unless we're a signal handler that
+// interrupted it with the lock held. Returns whether it did.
+static bool _coalesce_lock_mine(struct coalesce_buf *b) {
+  if (_coalesce_busy) {
+    return false;
+  }
+  _coalesce_busy = 1;
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+  _coalesce_lock(b);
+  return true;
+}
+
+static void _coalesce_unlock_mine(struct coalesce_buf *b) {
+  _coalesce_unlock(b);
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+  _coalesce_busy = 0;
+}
+
+static void coalesce_flush(void) {
+  struct coalesce_buf *b = _coalesce_mine;
+  if (b && b->len && _coalesce_lock_mine(b)) {
+    _coalesce_flush_locked(b, NULL, 0);
+    _coalesce_unlock_mine(b);
+  }
+}
+
+static void coalesce_flush_all(void) {
+  for (int i = 0; i < COALESCE_THREADS; ++i) {
+    struct coalesce_buf *b = __atomic_load_n(&_coalesce.bufs[i], __ATOMIC_ACQUIRE);
+    if (!b || !__atomic_load_n(&b->len, __ATOMIC_RELAXED)) {
+      continue;
+    }
+    if (b == _coalesce_mine) {
+      coalesce_flush();
+      continue;
+    }
+    _coalesce_lock(b);
+    _coalesce_flush_locked(b, NULL, 0);
+    _coalesce_unlock(b);
+  }
+}
+
+// Buffers are never freed, since another thread may be flushing it, just
+// given up for the next new thread to take.
+static void _coalesce_thread_exit(void *arg) {
+  struct coalesce_buf *b = arg;
+  if (!_coalesce_lock_mine(b)) {
+    return;
+  }
+  _coalesce_flush_locked(b, NULL, 0);
+  _coalesce_unlock_mine(b);
+  _coalesce_mine = NULL;
+  __atomic_store_n(&b->owned, 0, __ATOMIC_RELEASE);
+}
+
+// The other threads are gone in the child. Their buffers were flushed just
+// before the fork, unless they wrote in between, in which case the parent
+// will write it.
+static void _coalesce_atfork_child(void) {
+  for (int i = 0; i < COALESCE_THREADS; ++i) {
+    struct coalesce_buf *b = _coalesce.bufs[i];
+    if (b && b != _coalesce_mine) {
+      b->lock = 0;
+      b->len = 0;
+      b->owned = 0;
+    }
+  }
+}
+
+static struct coalesce_buf *_coalesce_claim(struct coalesce_buf *b) {
+  pthread_setspecific(_coalesce.key, b);
+  _coalesce_mine = b;
+  return b;
+}
+
+static struct coalesce_buf *_coalesce_get(void) {
+  if (_coalesce_mine) {
+    return _coalesce_mine;
+  }
+  for (int i = 0; i < COALESCE_THREADS; ++i) {
+    struct coalesce_buf *b = __atomic_load_n(&_coalesce.bufs[i], __ATOMIC_ACQUIRE);
+    int expected = 0;
+    if (b && __atomic_compare_exchange_n(&b->owned, &expected, 1, false, __ATOMIC_ACQ_REL,
+                                         __ATOMIC_RELAXED)) {
+      return _coalesce_claim(b);
+    }
+  }
+  struct coalesce_buf *b = malloc(sizeof(*b));
+  if (!b) {
+    return NULL;
+  }
+  b->lock = 0;
+  b->owned = 1;
+  b->len = 0;
+  for (int i = 0; i < COALESCE_THREADS; ++i) {
+    struct coalesce_buf *expected = NULL;
+    if (__atomic_compare_exchange_n(&_coalesce.bufs[i], &expected, b, false, __ATOMIC_ACQ_REL,
+                                    __ATOMIC_RELAXED)) {
+      return _coalesce_claim(b);
+    }
+  }
+  free(b);
+  return NULL;
+}
+
+static void coalesce_init(coalesce_writev_fn writev) {
+  const char *fds = getenv("COALESCE_FDS");
+  const char *bytes = getenv("COALESCE_BYTES");
+  const char *usec = getenv("COALESCE_USEC");
+  for (char *p = (char*)fds; p && *p;) {
+    long fd = strtol(p, &p, 10);
+    if (fd >= 0 && fd < 64) {
+      _coalesce.fds |= UINT64_C(1) << fd;
+    }
+    p += *p == ',';
+  }
+  _coalesce.bytes = bytes && bytes[0] ? strtoul(bytes, NULL, 0) : 4096;
+  if (_coalesce.bytes > COALESCE_BUF) {
+    _coalesce.bytes = COALESCE_BUF;
+  }
+  _coalesce.ns = (usec && usec[0] ? strtoull(usec, NULL, 0) : 10000) * 1000;
+  _coalesce.writev = writev;
+  if (_coalesce.fds) {
+    pthread_key_create(&_coalesce.key, _coalesce_thread_exit);
+    pthread_atfork(coalesce_flush_all, NULL, _coalesce_atfork_child);
+  }
+}
+
+static bool coalesce_wants(int fd) {
+  return fd >= 0 && fd < 64 && (_coalesce.fds & (UINT64_C(1) << fd));
+}
+
+// Call before a syscall that writes to `fd` without going through
+// coalesce_write.
+static void coalesce_before_write(int fd) {
+  if (coalesce_wants(fd)) {
+    coalesce_flush();
+  }
+}
+
+// Call before a syscall that changes what `fd` refers to, or gives another fd
+// the same file. Any thread's buffer may be headed for it.
+static void coalesce_before_dup(int fd) {
+  if (coalesce_wants(fd)) {
+    coalesce_flush_all();
+  }
+}
+
+// For fds that coalesce_wants.
+static ssize_t coalesce_write(int fd, const void *buf, size_t n) {
+  struct coalesce_buf *b = _coalesce_busy ? NULL : _coalesce_get();
+  if (!b || !_coalesce_lock_mine(b)) {
+    struct iovec iov = {.iov_base = (void*)buf, .iov_len = n};
+    return _coalesce.writev(fd, &iov, 1);
+  }
+  uint64_t now = _coalesce_now();
+  if (b->len && (b->fd != fd || now - b->first_ns >= _coalesce.ns)) {
+    _coalesce_flush_locked(b, NULL, 0);
+  }
+  ssize_t rv = n;
+  if (b->len + n < _coalesce.bytes) {
+    if (b->len == 0) {
+      b->fd = fd;
+      b->first_ns = now;
+    }
+    memcpy(b->bytes + b->len, buf, n);
+    b->len += n;
+  } else {
+    b->fd = fd;
+    rv = _coalesce_flush_locked(b, buf, n);
+  }
+  _coalesce_unlock_mine(b);
+  return rv;
+}
@@ -0,0 +1,184 @@
+// A table of libc's unistd and stdio entry points, for LD_PRELOAD wrappers
+// that need to call the functions they're wrapping. Each is looked up once,
+// rather than with a dlsym on every call: the first time anybody asks, or in
+// a constructor, whichever comes first. After that the table is read-only.
+//
+//   ssize_t write(int fd, const void *buf, size_t count) {
+//       return LIBCNEXT(write)(fd, buf, count);
+//   }
+//
+// Lookups are in RTLD_NEXT unless LIBCNEXT_HANDLE() is defined to return a
+// handle (it's called once) before including this. Variadic functions are
+// here as their v- variants, except for open and openat, whose optional mode
+// can always be passed, and fcntl, whose optional argument is an int or a
+// pointer and can be passed as a long.
+//
+// Some symbols have several versions, and a plain dlsym may find an old one.
+// Those have the version to look for in the list; everything else has NULL.
+//
+// With LIBCNEXT_DLSYM defined, LIBCNEXT does a dlsym on every call instead,
+// which is only good for comparing against.
+//
+// Wants _GNU_SOURCE, and -ldl on older glibc.
+#pragma once
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef LIBCNEXT_HANDLE
+#define LIBCNEXT_HANDLE() RTLD_NEXT
+#endif
+
+// X(return type, name, parameters, version)
+#define LIBCNEXT_SYMBOLS(X) \
+  /* unistd.h, and the fcntl.h and sys/ ones that go with it */ \
+  X(ssize_t, read, (int, void*, size_t), NULL) \
+  X(ssize_t, write, (int, const void*, size_t), NULL) \
+  X(ssize_t, pread, (int, void*, size_t, off_t), NULL) \
+  X(ssize_t, pwrite, (int, const void*, size_t, off_t), NULL) \
+  X(ssize_t, readv, (int, const struct iovec*, int), NULL) \
+  X(ssize_t, writev, (int, const struct iovec*, int), NULL) \
+  X(ssize_t, pwritev, (int, const struct iovec*, int, off_t), NULL) \
+  X(ssize_t, pwritev2, (int, const struct iovec*, int, off_t, int), NULL) \
+  X(int, open, (const char*, int, ...), NULL) \
+  X(int, openat, (int, const char*, int, ...), NULL) \
+  X(int, creat, (const char*, mode_t), NULL) \
+  X(int, close, (int), NULL) \
+  X(int, close_range, (unsigned, unsigned, int), NULL) \
+  X(int, fcntl, (int, int, ...), NULL) \
+  X(off_t, lseek, (int, off_t, int), NULL) \
+  X(int, dup, (int), NULL) \
+  X(int, dup2, (int, int), NULL) \
+  X(int, dup3, (int, int, int), NULL) \
+  X(int, pipe, (int[2]), NULL) \
+  X(int, pipe2, (int[2], int), NULL) \
+  X(ssize_t, splice, (int, loff_t*, int, loff_t*, size_t, unsigned), NULL) \
+  X(ssize_t, sendfile, (int, int, off_t*, size_t), NULL) \
+  /* sys/socket.h */ \
+  X(ssize_t, send, (int, const void*, size_t, int), NULL) \
+  X(ssize_t, sendto, (int, const void*, size_t, int, const struct sockaddr*, socklen_t), NULL) \
+  X(ssize_t, sendmsg, (int, const struct msghdr*, int), NULL) \
+  X(int, fsync, (int), NULL) \
+  X(int, fdatasync, (int), NULL) \
+  X(int, ftruncate, (int, off_t), NULL) \
+  X(int, truncate, (const char*, off_t), NULL) \
+  X(int, fstat, (int, struct stat*), NULL) \
+  X(int, stat, (const char*, struct stat*), NULL) \
+  X(int, lstat, (const char*, struct stat*), NULL) \
+  X(int, access, (const char*, int), NULL) \
+  X(int, unlink, (const char*), NULL) \
+  X(int, unlinkat, (int, const char*, int), NULL) \
+  X(int, link, (const char*, const char*), NULL) \
+  X(int, symlink, (const char*, const char*), NULL) \
+  X(ssize_t, readlink, (const char*, char*, size_t), NULL) \
+  X(int, mkdir, (const char*, mode_t), NULL) \
+  X(int, rmdir, (const char*), NULL) \
+  X(int, chdir, (const char*), NULL) \
+  X(int, fchdir, (int), NULL) \
+  X(char*, getcwd, (char*, size_t), NULL) \
+  X(int, isatty, (int), NULL) \
+  X(pid_t, getpid, (void), NULL) \
+  X(pid_t, getppid, (void), NULL) \
+  X(pid_t, gettid, (void), NULL) \
+  X(pid_t, fork, (void), NULL) \
+  X(pid_t, vfork, (void), NULL) \
+  X(int, execve, (const char*, char* const[], char* const[]), NULL) \
+  X(void, _exit, (int), NULL) \
+  X(unsigned, sleep, (unsigned), NULL) \
+  X(int, usleep, (useconds_t), NULL) \
+  X(int, nanosleep, (const struct timespec*, struct timespec*), NULL) \
+  /* spawn.h and stdlib.h */ \
+  X(int, posix_spawn, (pid_t*, const char*, const posix_spawn_file_actions_t*, \
+                       const posix_spawnattr_t*, char* const[], char* const[]), "GLIBC_2.15") \
+  X(int, posix_spawnp, (pid_t*, const char*, const posix_spawn_file_actions_t*, \
+                        const posix_spawnattr_t*, char* const[], char* const[]), "GLIBC_2.15") \
+  X(int, system, (const char*), NULL) \
+  /* stdio.h */ \
+  X(FILE*, fopen, (const char*, const char*), NULL) \
+  X(FILE*, fdopen, (int, const char*), NULL) \
+  X(FILE*, freopen, (const char*, const char*, FILE*), NULL) \
+  X(FILE*, fmemopen, (void*, size_t, const char*), "GLIBC_2.22") \
+  X(int, fclose, (FILE*), NULL) \
+  X(int, fflush, (FILE*), NULL) \
+  X(size_t, fread, (void*, size_t, size_t, FILE*), NULL) \
+  X(size_t, fwrite, (const void*, size_t, size_t, FILE*), NULL) \
+  X(int, fgetc, (FILE*), NULL) \
+  X(int, getc, (FILE*), NULL) \
+  X(int, getchar, (void), NULL) \
+  X(char*, fgets, (char*, int, FILE*), NULL) \
+  X(int, ungetc, (int, FILE*), NULL) \
+  X(int, fputc, (int, FILE*), NULL) \
+  X(int, putc, (int, FILE*), NULL) \
+  X(int, putchar, (int), NULL) \
+  X(int, fputs, (const char*, FILE*), NULL) \
+  X(int, puts, (const char*), NULL) \
+  X(int, vprintf, (const char*, va_list), NULL) \
+  X(int, vfprintf, (FILE*, const char*, va_list), NULL) \
+  X(int, vdprintf, (int, const char*, va_list), NULL) \
+  X(int, vsprintf, (char*, const char*, va_list), NULL) \
+  X(int, vsnprintf, (char*, size_t, const char*, va_list), NULL) \
+  X(int, fseek, (FILE*, long, int), NULL) \
+  X(long, ftell, (FILE*), NULL) \
+  X(void, rewind, (FILE*), NULL) \
+  X(int, fileno, (FILE*), NULL) \
+  X(int, setvbuf, (FILE*, char*, int, size_t), NULL) \
+  X(void, perror, (const char*), NULL) \
+  X(int, remove, (const char*), NULL) \
+  X(int, rename, (const char*, const char*), NULL)
+
+#define LIBCNEXT_FIELD(ret, name, params, version) ret (*name) params;
+struct libcnext {
+  LIBCNEXT_SYMBOLS(LIBCNEXT_FIELD)
+};
+
+// On pages of its own, so that they can be made read-only.
+#define LIBCNEXT_PAGE 4096
+static union {
+  struct libcnext fns;
+  char pages[(sizeof(struct libcnext) + LIBCNEXT_PAGE - 1) / LIBCNEXT_PAGE * LIBCNEXT_PAGE];
+} _libcnext __attribute__((aligned(LIBCNEXT_PAGE)));
+static int _libcnext_ready;
+static pthread_once_t _libcnext_once = PTHREAD_ONCE_INIT;
+
+static void _libcnext_resolve(void) {
+  void *handle = LIBCNEXT_HANDLE();
+  // The casts are through void* since ISO C doesn't convert object pointers
+  // to function pointers.
+#define LIBCNEXT_LOOKUP(ret, name, params, version) \
+  *(void**)&_libcnext.fns.name = \
+      version ? dlvsym(handle, #name, version ? version : "") : dlsym(handle, #name);
+  LIBCNEXT_SYMBOLS(LIBCNEXT_LOOKUP)
+#undef LIBCNEXT_LOOKUP
+  mprotect(&_libcnext, sizeof(_libcnext), PROT_READ);
+  __atomic_store_n(&_libcnext_ready, 1, __ATOMIC_RELEASE);
+}
+
+__attribute__((constructor)) static void _libcnext_load(void) {
+  pthread_once(&_libcnext_once, _libcnext_resolve);
+}
+
+// For calls that beat the constructor. Another library's constructor, say.
+__attribute__((noinline, unused)) static const struct libcnext *_libcnext_slow(void) {
+  _libcnext_load();
+  return &_libcnext.fns;
+}
+
+#ifdef LIBCNEXT_DLSYM
+// The old way, for comparison: a dlsym on every call.
+#define LIBCNEXT(name) ((__typeof__(_libcnext.fns.name))dlsym(LIBCNEXT_HANDLE(), #name))
+#else
+#define LIBCNEXT(name) \
+  (__builtin_expect(__atomic_load_n(&_libcnext_ready, __ATOMIC_ACQUIRE), 1) \
+       ? _libcnext.fns.name : _libcnext_slow()->name)
+#endif
@@ -0,0 +1,81 @@
+// A shared-memory syscall channel between a process running under
+// golang-seccomp/seccomp.so and a controller (golang-seccomp/shimchan.c).
+//
+// The shim maps one segment per process and hands its fd to the controller.
+// Each thread gets a slot holding a single-producer, single-consumer ring:
+// the thread submits syscalls at `head`, the controller answers them in order
+// and advances `done`. Either side that runs out of work spins for a while and
+// then sleeps on a futex; the other side wakes it only if it says it's
+// sleeping, so a busy channel makes no syscalls at all.
+#pragma once
+
+#include <linux/futex.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+#define SHMCHAN_MAGIC UINT64_C(0x6e616863636d6873) /* "shmchan" */
+#define SHMCHAN_VERSION 2
+
+#define SHMCHAN_THREADS 128
+// Entries per thread. Power of 2.
+#define SHMCHAN_RING 64
+// Payload bytes per entry. Reads and writes longer than this are cut short.
+#define SHMCHAN_SLOT 4096
+
+// The shim doesn't wait for the answer; the controller's `ret` is ignored.
+#define SHMCHAN_ASYNC 1
+
+// fds for files that the controller opened for the process start here, above
+// anything the kernel hands out (fs.nr_open can't go higher), so that the
+// shim can tell them apart with a comparison.
+#define SHMCHAN_VFD_BASE (1 << 20)
+#define SHMCHAN_VFDS 1024
+
+struct shmchan_entry {
+  int64_t nr;
+  int64_t args[6];
+  // Written by the controller.
+  int64_t ret;
+  uint32_t flags;
+  // Bytes of payload in the thread's data[] slot for this entry. Going in:
+  // the buffer of a write (which the program may reuse before an async
+  // entry's handled), or the path of an open. Coming back: room for what a
+  // read or fstat returns, which the controller writes there.
+  uint32_t len;
+};
+
+struct shmchan_thread {
+  // Owning thread, or 0 if the slot is free. Written with atomics.
+  int32_t tid;
+  // Entries submitted. Written by the shim.
+  uint32_t head __attribute__((aligned(64)));
+  // Entries answered. Written by the controller; the shim sleeps on it.
+  uint32_t done __attribute__((aligned(64)));
+  // Set by the shim when it's going to sleep on `done`.
+  uint32_t waiting;
+  struct shmchan_entry ring[SHMCHAN_RING] __attribute__((aligned(64)));
+  char data[SHMCHAN_RING][SHMCHAN_SLOT];
+};
+
+struct shmchan_segment {
+  uint64_t magic;
+  uint32_t version;
+  int32_t pid;
+  // Bumped by shims with work for a sleeping controller, which sleeps on it.
+  uint32_t doorbell __attribute__((aligned(64)));
+  // Set by the controller when it's going to sleep on `doorbell`.
+  uint32_t sleeping;
+  struct shmchan_thread threads[SHMCHAN_THREADS] __attribute__((aligned(64)));
+};
+
+// Shared (not FUTEX_PRIVATE) futex ops, since the two sides are different
+// processes. `sys` makes the syscall: the shim has to use its own.
+static inline long shmchan_futex_wait(long (*sys)(long, ...), uint32_t *addr, uint32_t val,
+                                      const struct timespec *timeout) {
+  return sys(SYS_futex, addr, FUTEX_WAIT, val, timeout, 0, 0);
+}
+
+static inline void shmchan_futex_wake(long (*sys)(long, ...), uint32_t *addr) {
+  sys(SYS_futex, addr, FUTEX_WAKE, 1, 0, 0, 0);
+}
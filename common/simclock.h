@@ -0,0 +1,57 @@
+// A simulated clock in a shared-memory page. A controller writes it (see
+// golang-seccomp/shimclock.c); any number of processes read it without
+// syscalls, e.g. from patched vDSO entry points.
+#pragma once
+
+#include <stdint.h>
+#include <x86intrin.h>
+
+#define SIMCLOCK_MAGIC UINT64_C(0x6b636f6c636d6973) /* "simclock" */
+#define SIMCLOCK_VERSION 1
+
+struct simclock {
+  uint64_t magic;
+  uint32_t version;
+  // Seqlock: odd while the controller is updating the fields below.
+  uint32_t seq;
+  // Simulated CLOCK_MONOTONIC is base_ns + ((tsc - base_tsc) * mult >> 32).
+  // mult is 0 while the clock is stopped.
+  uint64_t base_ns;
+  uint64_t base_tsc;
+  uint64_t mult;
+  // Real nanoseconds per TSC cycle, << 32, as measured by the controller. Only
+  // the controller uses this, to work out `mult` for a given rate.
+  uint64_t tsc_mult;
+  // Simulated CLOCK_REALTIME minus simulated CLOCK_MONOTONIC.
+  int64_t realtime_offset_ns;
+};
+
+// Simulated CLOCK_MONOTONIC in ns. *realtime_offset_ns, if not NULL, gets the
+// offset from a consistent snapshot.
+static inline uint64_t simclock_read(const struct simclock *c, int64_t *realtime_offset_ns) {
+  uint32_t seq;
+  uint64_t ns;
+  int64_t offset;
+  do {
+    seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+    uint64_t base_ns = c->base_ns, base_tsc = c->base_tsc, mult = c->mult;
+    offset = c->realtime_offset_ns;
+    uint64_t tsc = __rdtsc();
+    ns = base_ns + (tsc > base_tsc ? (uint64_t)(((unsigned __int128)(tsc - base_tsc) * mult) >> 32) : 0);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((seq & 1) || __atomic_load_n(&c->seq, __ATOMIC_RELAXED) != seq);
+  if (realtime_offset_ns) {
+    *realtime_offset_ns = offset;
+  }
+  return ns;
+}
+
+// For the controller: bracket updates with these.
+static inline void simclock_write_begin(struct simclock *c) {
+  __atomic_store_n(&c->seq, c->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void simclock_write_end(struct simclock *c) {
+  __atomic_store_n(&c->seq, c->seq + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,20 @@
+# Turns `cc -E -dM` output for <sys/syscall.h> into a C table of syscall
+# names, indexed by number:
+#
+#   echo '#include <sys/syscall.h>' | cc -E -dM - | awk -f syscallnames.awk > syscallnames.h
+$1 == "#define" && $2 ~ /^__NR_/ && $3 ~ /^[0-9]+$/ {
+    names[$3 + 0] = substr($2, 6)
+    if ($3 + 0 > max)
+        max = $3 + 0
+}
+END {
+    print "// Generated by common/syscallnames.awk. Do not edit."
+    print "#pragma once"
+    print ""
+    printf "#define SYSCALL_NAMES_LEN %d\n\n", max + 1
+    print "static const char *const syscall_names[SYSCALL_NAMES_LEN] = {"
+    for (i = 0; i <= max; ++i)
+        if (i in names)
+            printf "    [%d] = \"%s\",\n", i, names[i]
+    print "};"
+}
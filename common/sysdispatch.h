@@ -0,0 +1,71 @@
+// Per-syscall dispatch for interposers (golang-seccomp/seccomp.c,
+// patching-libc-to-interpose-syscalls/interpose.c), generated at compile time
+// instead of an if-chain on the syscall number.
+//
+// An interposer lists the syscalls it handles, X-macro style:
+//
+//   #define MY_SYSCALLS(TYPED, RAW, p) TYPED(p, write) RAW(p, clone, my_clone)
+//
+// and SYSDISPATCH_TABLE(my, MY_SYSCALLS, my_default) makes `my_table`, with
+// an entry for every syscall number. A TYPED syscall gets a thunk that decodes
+// its arguments per the list below and calls
+//
+//   long my_write(void *ctx, int fd, const void *buf, size_t count);
+//
+// A RAW one calls my_clone(ctx, n, args) as is, which suits handlers shared
+// between syscalls. Everything else calls my_default(ctx, n, args), which
+// typically makes the syscall. sysdispatch() is then one indexed indirect
+// call, with no compares on the syscall number: numbers past the end of the
+// table land on an extra my_default slot.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+#define SYSDISPATCH_NR 512
+
+typedef long (*sysdispatch_fn)(void *ctx, long n, long args[6]);
+
+// Argument types of the syscalls that someone handles with TYPED. Add lines
+// as needed.
+#define SYSDISPATCH_ARGS_read(a) (int)(a)[0], (void*)(a)[1], (size_t)(a)[2]
+#define SYSDISPATCH_ARGS_write(a) (int)(a)[0], (const void*)(a)[1], (size_t)(a)[2]
+#define SYSDISPATCH_ARGS_openat(a) (int)(a)[0], (const char*)(a)[1], (int)(a)[2], (mode_t)(a)[3]
+#define SYSDISPATCH_ARGS_close(a) (int)(a)[0]
+#define SYSDISPATCH_ARGS_getpid(a)
+#define SYSDISPATCH_ARGS_gettid(a)
+#define SYSDISPATCH_ARGS_rt_sigaction(a) \
+  (int)(a)[0], (const void*)(a)[1], (void*)(a)[2], (size_t)(a)[3]
+// The kernel's sigset_t is 64 bits on x86-64; libc's is bigger.
+#define SYSDISPATCH_ARGS_rt_sigprocmask(a) \
+  (int)(a)[0], (const uint64_t*)(a)[1], (uint64_t*)(a)[2], (size_t)(a)[3]
+
+#define SYSDISPATCH_THUNK(p, name) \
+  static long p##_thunk_##name(void *ctx, long n, long a[6]) { \
+    return p##_##name(ctx SYSDISPATCH_COMMA_ARGS(SYSDISPATCH_ARGS_##name(a))); \
+  }
+#define SYSDISPATCH_NO_THUNK(p, name, fn)
+#define SYSDISPATCH_ENTRY(p, name) [SYS_##name] = p##_thunk_##name,
+#define SYSDISPATCH_RAW_ENTRY(p, name, fn) [SYS_##name] = fn,
+
+// `, args`, or nothing for syscalls without any.
+#define SYSDISPATCH_COMMA_ARGS(...) __VA_OPT__(,) __VA_ARGS__
+
+// Later designators override the default range, which is the point.
+#define SYSDISPATCH_TABLE(p, LIST, fallthrough) \
+  LIST(SYSDISPATCH_THUNK, SYSDISPATCH_NO_THUNK, p) \
+  _Pragma("GCC diagnostic push") \
+  _Pragma("GCC diagnostic ignored \"-Woverride-init\"") \
+  static sysdispatch_fn const p##_table[SYSDISPATCH_NR + 1] = { \
+    [0 ... SYSDISPATCH_NR] = fallthrough, \
+    LIST(SYSDISPATCH_ENTRY, SYSDISPATCH_RAW_ENTRY, p) \
+  }; \
+  _Pragma("GCC diagnostic pop")
+
+static inline long sysdispatch(sysdispatch_fn const *table, void *ctx, long n, long args[6]) {
+  // A cmov, not a branch.
+  unsigned long i = (unsigned long)n < SYSDISPATCH_NR ? (unsigned long)n : SYSDISPATCH_NR;
+  return table[i](ctx, n, args);
+}
@@ -0,0 +1,187 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "shim.h"
+
+#ifndef SS_AUTODISARM
+#define SS_AUTODISARM (1U << 31)
+#endif
+
+// Signal stacks for the SIGSYS handler.
+//
+// We used to give every thread an 8 MiB __thread buffer. glibc zeroes a new
+// thread's static TLS when it creates it, so that was 8 MiB of RSS per thread
+// whether or not the thread ever trapped, and thread creation paid for the
+// memset.
+//
+// Instead each thread gets its stack on its first trap: an mmap with a
+// PROT_NONE guard page below it, so that running off the end faults instead of
+// scribbling on whatever's mapped there. Pages are only committed as the
+// handler touches them. When the thread exits its stack goes on a free list
+// for the next new thread, rather than back to the kernel.
+//
+// SHIM_ALTSTACK_SIZE sets the usable size in bytes (default 64 KiB). Building
+// with -DSHIM_TLS_ALTSTACK brings back the old scheme, for comparison.
+//
+// Other parts of the shim can shim_altstack_reserve a second per-thread stack
+// (patch.c does, for patched syscall sites). It goes in the same mapping,
+// below the signal stack and behind a guard page of its own:
+//
+//   | guard | reserved | guard | signal stack |
+//
+// so it's pooled the same way, and costs nothing unless it's asked for.
+//
+// Threads that exit without going through pthread (raw clone) don't give
+// their stack back.
+
+#define DEFAULT_SIZE (64 << 10)
+
+struct free_stack {
+  struct free_stack *next;
+};
+
+static size_t _page_size;
+static size_t _size = DEFAULT_SIZE;
+// Size of the reserved stack, or 0 for none.
+static size_t _extra = 0;
+
+#ifndef SHIM_TLS_ALTSTACK
+// Free list. Only touched outside the handler (thread exit), or in it while
+// this thread has no stack (its first trap), so a thread can't interrupt
+// itself while holding the lock.
+static atomic_flag _lock = ATOMIC_FLAG_INIT;
+static struct free_stack *_free = NULL;
+
+static pthread_key_t _key;
+
+static void _lock_acquire() {
+  while (atomic_flag_test_and_set_explicit(&_lock, memory_order_acquire)) {
+    _syscall(SYS_sched_yield);
+  }
+}
+
+static void _lock_release() {
+  atomic_flag_clear_explicit(&_lock, memory_order_release);
+}
+
+// Runs from pthread's thread exit, on the thread's own stack, before its final
+// exit syscall.
+static void _thread_exit(void *stack) {
+  // pthread_exit from a handler that's running on this stack (or the reserved
+  // one). Leave it be.
+  char here;
+  char *bottom = _extra ? (char*)stack - _page_size - _extra : stack;
+  if (&here >= bottom && &here < (char*)stack + _size) {
+    return;
+  }
+
+  // Stop using it first: once it's on the free list another thread may take
+  // it. Any traps from here until exit run on the thread's stack, and patched
+  // sites go back to trapping.
+  if (_extra) {
+    shim_patch_thread_init(NULL);
+  }
+  stack_t ss = {.ss_flags = SS_DISABLE};
+  _syscall(SYS_sigaltstack, &ss, NULL);
+
+  struct free_stack *f = stack;
+  _lock_acquire();
+  f->next = _free;
+  _free = f;
+  _lock_release();
+}
+
+static void *_get() {
+  _lock_acquire();
+  struct free_stack *f = _free;
+  if (f) {
+    _free = f->next;
+  }
+  _lock_release();
+  if (f) {
+    return f;
+  }
+
+  size_t below = _extra ? 2 * _page_size + _extra : _page_size;
+  long p = _syscall(SYS_mmap, NULL, below + _size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+  if (p < 0 && p > -4096) {
+    return NULL;
+  }
+  if (_syscall(SYS_mprotect, p, _page_size, PROT_NONE) != 0 ||
+      (_extra && _syscall(SYS_mprotect, p + below - _page_size, _page_size, PROT_NONE) != 0)) {
+    _syscall(SYS_munmap, p, below + _size);
+    return NULL;
+  }
+  return (char*)p + below;
+}
+#endif
+
+void shim_altstack_reserve(size_t size) {
+  _extra = size;
+}
+
+void shim_altstack_init() {
+  _page_size = sysconf(_SC_PAGESIZE);
+  const char *env = getenv("SHIM_ALTSTACK_SIZE");
+  if (env && env[0]) {
+    size_t min = sysconf(_SC_MINSIGSTKSZ);
+    _size = strtoul(env, NULL, 0);
+    if (_size < min) {
+      fprintf(stderr, "seccomp.so: SHIM_ALTSTACK_SIZE must be at least %zu\n", min);
+      abort();
+    }
+  }
+  _size = (_size + _page_size - 1) & ~(_page_size - 1);
+  _extra = (_extra + _page_size - 1) & ~(_page_size - 1);
+#ifndef SHIM_TLS_ALTSTACK
+  if (pthread_key_create(&_key, _thread_exit) != 0) {
+    abort();
+  }
+#endif
+}
+
+void* shim_altstack_thread_init() {
+#ifdef SHIM_TLS_ALTSTACK
+  static __thread char stack_buf[8 * 1<<20];
+  void *sp = stack_buf;
+  size_t size = sizeof(stack_buf);
+  void *extra = NULL;
+  if (_extra) {
+    // Never given back, like the TLS buffer.
+    long p = _syscall(SYS_mmap, NULL, _extra, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (p < 0 && p > -4096) {
+      abort();
+    }
+    extra = (char*)p + _extra;
+  }
+#else
+  void *sp = _get();
+  size_t size = _size;
+  if (!sp) {
+    abort();
+  }
+  // Key values live in the thread descriptor for the first few keys, so this
+  // doesn't allocate.
+  pthread_setspecific(_key, sp);
+  void *extra = _extra ? (char*)sp - _page_size : NULL;
+#endif
+  stack_t stack = {
+    .ss_sp = sp,
+    .ss_size = size,
+    .ss_flags = SS_AUTODISARM,
+  };
+  if (_syscall(SYS_sigaltstack, &stack, NULL) != 0) {
+    abort();
+  }
+  return extra;
+}
@@ -0,0 +1,128 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// Thread creation rate and memory use under seccomp.so, to compare its signal
+// stack schemes (see altstack.c). Run it under seccomp.so or seccomp_tls.so,
+// or natively for a baseline; altstack_bench.sh does all three.
+//
+// Usage: altstack_bench [-t threads] [-r rounds] [-s stack KiB] [-m max MiB of address space]
+//
+// Each round starts `threads` threads that each make one syscall (so that the
+// shim has to give them a signal stack) and then wait until they're all up.
+// With all of them alive we read our RSS, and then they all exit. Later rounds
+// show the effect of recycling stacks.
+//
+// Thread stacks are 64 KiB by default. glibc carves static TLS out of the
+// thread's stack, so seccomp_tls.so needs -s of over 8 MiB.
+
+#define CHECK(x) { \
+  if (!(x)) {\
+    perror(#x);\
+    exit(EXIT_FAILURE);\
+  }\
+}
+
+static atomic_int up;
+// Write-locked by main until it's time for the threads to exit.
+static pthread_rwlock_t done = PTHREAD_RWLOCK_INITIALIZER;
+
+static void *thread_main(void *arg) {
+  syscall(SYS_getppid);
+  atomic_fetch_add(&up, 1);
+  pthread_rwlock_rdlock(&done);
+  pthread_rwlock_unlock(&done);
+  return NULL;
+}
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// `field` from /proc/self/status, in kB.
+static long status_kb(const char *field) {
+  FILE *f = fopen("/proc/self/status", "r");
+  CHECK(f);
+  char line[256];
+  long kb = -1;
+  size_t len = strlen(field);
+  while (fgets(line, sizeof(line), f)) {
+    if (strncmp(line, field, len) == 0 && line[len] == ':') {
+      kb = atol(line + len + 1);
+    }
+  }
+  fclose(f);
+  return kb;
+}
+
+int main(int argc, char **argv) {
+  int threads = 1000, rounds = 2;
+  long stack_kb = 64, max_mb = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:r:s:m:")) != -1) {
+    switch (opt) {
+      case 't': threads = atoi(optarg); break;
+      case 'r': rounds = atoi(optarg); break;
+      case 's': stack_kb = atol(optarg); break;
+      case 'm': max_mb = atol(optarg); break;
+      default:
+        fprintf(stderr,
+                "Usage: %s [-t threads] [-r rounds] [-s stack KiB] [-m max MiB of address space]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if (max_mb) {
+    // Fail thread creation instead of getting OOM-killed.
+    struct rlimit lim = {.rlim_cur = max_mb << 20, .rlim_max = max_mb << 20};
+    CHECK(setrlimit(RLIMIT_AS, &lim) == 0);
+  }
+
+  pthread_attr_t attr;
+  CHECK(pthread_attr_init(&attr) == 0);
+  CHECK(pthread_attr_setstacksize(&attr, stack_kb << 10) == 0);
+  pthread_t *tids = calloc(threads, sizeof(*tids));
+  CHECK(tids);
+
+  long rss0 = status_kb("VmRSS");
+  for (int r = 0; r < rounds; ++r) {
+    atomic_store(&up, 0);
+    pthread_rwlock_wrlock(&done);
+    double start = now();
+    int created, err = 0;
+    for (created = 0; created < threads; ++created) {
+      if ((err = pthread_create(&tids[created], &attr, thread_main, NULL)) != 0) {
+        break;
+      }
+    }
+    while (atomic_load(&up) < created) {
+      sched_yield();
+    }
+    double elapsed = now() - start;
+    long rss = status_kb("VmRSS");
+    pthread_rwlock_unlock(&done);
+    for (int i = 0; i < created; ++i) {
+      pthread_join(tids[i], NULL);
+    }
+    printf("threads=%d round=%d create_rate=%.0f/s rss_kb=%ld per_thread_kb=%.1f", threads, r,
+           created / elapsed, rss, created ? (double)(rss - rss0) / created : 0);
+    if (err) {
+      printf(" FAILED after %d threads: %s\n", created, strerror(err));
+      return EXIT_FAILURE;
+    }
+    printf("\n");
+  }
+  printf("threads=%d peak_rss_kb=%ld\n", threads, status_kb("VmHWM"));
+  return 0;
+}
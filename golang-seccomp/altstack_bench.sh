@@ -0,0 +1,32 @@
+#!/bin/bash
+#
+# Runs altstack_bench natively, under seccomp.so (pooled signal stacks) and
+# under seccomp_tls.so (8 MiB of TLS per thread), at 1k and 10k threads.
+#
+# Knobs (environment):
+#   THREADS  default "1000 10000"
+#   MAX_MB   address space limit per run, so that runs that would need more
+#            memory than we have fail instead of getting OOM-killed. Default
+#            4096.
+
+set -u
+
+cd "$(dirname "$0")"
+
+THREADS=${THREADS:-"1000 10000"}
+MAX_MB=${MAX_MB:-4096}
+
+# glibc puts static TLS on the thread's stack, so seccomp_tls.so needs stacks
+# big enough to hold its 8 MiB buffer.
+MECHANISMS=(
+  "native||-s 64"
+  "pooled|$PWD/seccomp.so|-s 64"
+  "tls|$PWD/seccomp_tls.so|-s 8256"
+)
+
+for m in "${MECHANISMS[@]}"; do
+  IFS='|' read -r name so args <<< "$m"
+  for t in $THREADS; do
+    env LD_PRELOAD="$so" ./altstack_bench -t "$t" -m "$MAX_MB" $args 2>/dev/null | sed "s/^/$name\t/"
+  done
+done
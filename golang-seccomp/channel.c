@@ -0,0 +1,289 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysinfo.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../common/shmchan.h"
+#include "shim.h"
+
+// Forwarding syscalls to a controller process over shared memory, for policy
+// actions `remote`, `remote-async` and `hybrid` (see policy.c). SHIM_CHANNEL=<path> is
+// the controller's unix socket; shimchan sets it up.
+//
+// At startup we make a segment (see ../common/shmchan.h) in a memfd, connect,
+// and send the controller the fd. After that, a forwarded syscall is a store
+// into this thread's ring, and a wait for the answer: spin for a bit, then
+// sleep on a futex. With `remote-async` we don't wait at all (unless the ring
+// is full): the syscall "succeeds" as soon as it's queued. That's meant for
+// writes to logs and the like, whose results nobody looks at, and the policy
+// only allows it for write and pwrite64.
+//
+// We copy the buffer of write and pwrite64 into the ring, up to SHMCHAN_SLOT
+// bytes (a longer write comes back short), and the path of open and openat.
+// The controller puts what read, pread64 and fstat return in the ring too,
+// and we copy it out; reads are cut short the same way. Bad pointers fail with
+// EFAULT, as the kernel would have it (see progmem.c). newfstatat with
+// AT_EMPTY_PATH and an empty path goes over as fstat. For anything else the
+// controller gets the raw arguments, and can use process_vm_readv and friends
+// on pointers.
+//
+// SHIM_CHANNEL_SPIN sets how many times to poll before sleeping. The default
+// is 0 on a single CPU, where spinning just keeps the controller from
+// running.
+
+static struct shmchan_segment *_seg = NULL;
+static __thread struct shmchan_thread *_thread = NULL;
+static int _sock = -1;
+static unsigned _spin;
+
+// Sends our segment's fd to whoever's listening at SHIM_CHANNEL.
+static int _connect(int memfd) {
+  const char *path = getenv("SHIM_CHANNEL");
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (path == NULL || strlen(path) >= sizeof(addr.sun_path)) {
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+  int sock = _syscall(SYS_socket, AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (sock < 0 || _syscall(SYS_connect, sock, &addr, sizeof(addr)) != 0) {
+    return -1;
+  }
+
+  char buf[CMSG_SPACE(sizeof(int))] = {0}, c = 'c';
+  struct iovec io = {.iov_base = &c, .iov_len = 1};
+  struct msghdr msg = {
+    .msg_iov = &io,
+    .msg_iovlen = 1,
+    .msg_control = buf,
+    .msg_controllen = sizeof(buf),
+  };
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+  if (_syscall(SYS_sendmsg, sock, &msg, 0) < 0) {
+    _syscall(SYS_close, sock);
+    return -1;
+  }
+  // Kept open; the controller notices that we're gone when it closes.
+  return sock;
+}
+
+static struct shmchan_segment* _create_segment() {
+  int fd = _syscall(SYS_memfd_create, "shmchan", MFD_CLOEXEC);
+  if (fd < 0) {
+    return NULL;
+  }
+  // Big, but sparse.
+  struct shmchan_segment *seg = NULL;
+  if (_syscall(SYS_ftruncate, fd, sizeof(struct shmchan_segment)) == 0) {
+    long p = _syscall(SYS_mmap, NULL, sizeof(struct shmchan_segment), PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+    seg = p < 0 && p > -4096 ? NULL : (struct shmchan_segment*)p;
+  }
+  if (seg) {
+    seg->version = SHMCHAN_VERSION;
+    seg->pid = _syscall(SYS_getpid);
+    seg->magic = SHMCHAN_MAGIC;
+    _sock = _connect(fd);
+    if (_sock < 0) {
+      _syscall(SYS_munmap, seg, sizeof(*seg));
+      seg = NULL;
+    }
+  }
+  _syscall(SYS_close, fd);
+  return seg;
+}
+
+// After fork the child shares our segment; give it its own.
+static void _channel_atfork_child() {
+  struct shmchan_segment *parent = _seg;
+  _seg = NULL;
+  _thread = NULL;
+  _syscall(SYS_close, _sock);
+  _syscall(SYS_munmap, parent, sizeof(*parent));
+  _seg = _create_segment();
+}
+
+void shim_channel_init() {
+  if (!shim_policy_remote_used()) {
+    return;
+  }
+  const char *spin = getenv("SHIM_CHANNEL_SPIN");
+  _spin = spin && spin[0] ? strtoul(spin, NULL, 0) : get_nprocs() > 1 ? 1000 : 0;
+  _seg = _create_segment();
+  if (!_seg) {
+    fprintf(stderr, "seccomp.so: policy forwards syscalls, but there's no controller at "
+                    "SHIM_CHANNEL\n");
+    abort();
+  }
+  pthread_atfork(NULL, NULL, _channel_atfork_child);
+}
+
+static struct shmchan_thread* _get_thread() {
+  if (_thread) {
+    return _thread;
+  }
+  int32_t tid = _syscall(SYS_gettid);
+  for (int i = 0; i < SHMCHAN_THREADS; ++i) {
+    int32_t expected = 0;
+    if (__atomic_compare_exchange_n(&_seg->threads[i].tid, &expected, tid, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      _thread = &_seg->threads[i];
+      return _thread;
+    }
+  }
+  return NULL;
+}
+
+// Waits until the controller has answered entry number `n`. Sleeps with a
+// timeout, in case another thread draining our ring at exit took our wakeup.
+static void _wait(struct shmchan_thread *t, uint32_t n) {
+  const struct timespec timeout = {.tv_nsec = 10 * 1000 * 1000};
+  for (unsigned i = 0; i < _spin; ++i) {
+    if ((int32_t)(__atomic_load_n(&t->done, __ATOMIC_ACQUIRE) - n) > 0) {
+      return;
+    }
+    __builtin_ia32_pause();
+  }
+  while (1) {
+    __atomic_store_n(&t->waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint32_t done = __atomic_load_n(&t->done, __ATOMIC_ACQUIRE);
+    if ((int32_t)(done - n) > 0) {
+      break;
+    }
+    shmchan_futex_wait(_syscall, &t->done, done, &timeout);
+  }
+  __atomic_store_n(&t->waiting, 0, __ATOMIC_RELAXED);
+}
+
+// Waits for the controller to get through everything we've queued in `t`.
+static void _drain(struct shmchan_thread *t) {
+  uint32_t head = __atomic_load_n(&t->head, __ATOMIC_ACQUIRE);
+  if (head != __atomic_load_n(&t->done, __ATOMIC_ACQUIRE)) {
+    _wait(t, head - 1);
+  }
+}
+
+// Set while this thread is in _forward. A signal handler that made a
+// forwarded syscall in the middle of one would take the same entry, or reuse
+// it before we've read our answer out of it, so its calls go to the kernel
+// instead, after whatever we've queued. The kernel doesn't know the
+// controller's fds or paths, so those fail.
+static __thread bool _busy = false;
+
+static long _forward(struct shmchan_thread *t, long n, const long args[6], bool async) {
+  long a[6];
+  memcpy(a, args, sizeof(a));
+  if (n == SYS_newfstatat && (a[3] & AT_EMPTY_PATH)) {
+    // glibc's fstat. The controller only knows it by its old name.
+    char c = '\0';
+    if (a[1] != 0 && shim_progmem_read(&c, (const char*)a[1], 1) != 0) {
+      return -EFAULT;
+    }
+    if (c == '\0') {
+      n = SYS_fstat;
+      a[1] = a[2];
+    }
+  }
+
+  uint32_t head = t->head;
+  if (head - __atomic_load_n(&t->done, __ATOMIC_ACQUIRE) >= SHMCHAN_RING) {
+    _wait(t, head - SHMCHAN_RING);
+  }
+  uint32_t i = head % SHMCHAN_RING;
+  struct shmchan_entry *e = &t->ring[i];
+  e->nr = n;
+  memcpy(e->args, a, sizeof(e->args));
+  e->flags = async ? SHMCHAN_ASYNC : 0;
+  e->len = 0;
+  // Nothing's published until head moves, so we can still bail out.
+  if ((n == SYS_write || n == SYS_pwrite64) && a[2] > 0) {
+    e->len = a[2] < SHMCHAN_SLOT ? a[2] : SHMCHAN_SLOT;
+    if (shim_progmem_read(t->data[i], (const void*)a[1], e->len) != 0) {
+      return -EFAULT;
+    }
+  } else if (n == SYS_open || n == SYS_openat) {
+    long len = shim_progmem_string(t->data[i], (const char*)a[n == SYS_open ? 0 : 1],
+                                   SHMCHAN_SLOT);
+    if (len < 0) {
+      return len;
+    }
+    e->len = len + 1;
+  } else if ((n == SYS_read || n == SYS_pread64) && a[2] > 0) {
+    e->len = a[2] < SHMCHAN_SLOT ? a[2] : SHMCHAN_SLOT;
+  } else if (n == SYS_fstat) {
+    e->len = sizeof(struct stat);
+  }
+  __atomic_store_n(&t->head, head + 1, __ATOMIC_RELEASE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&_seg->sleeping, __ATOMIC_RELAXED)) {
+    __atomic_fetch_add(&_seg->doorbell, 1, __ATOMIC_RELEASE);
+    shmchan_futex_wake(_syscall, &_seg->doorbell);
+  }
+
+  if (async) {
+    return e->len;
+  }
+  _wait(t, head);
+  long rv = e->ret;
+  if ((n == SYS_read || n == SYS_pread64) && rv > 0 && rv <= e->len) {
+    if (shim_progmem_write((void*)a[1], t->data[i], rv) != 0) {
+      rv = -EFAULT;
+    }
+  } else if (n == SYS_fstat && rv == 0) {
+    rv = shim_progmem_write((void*)a[1], t->data[i], sizeof(struct stat));
+  }
+  return rv;
+}
+
+long shim_channel_syscall(long n, const long args[6], bool async) {
+  struct shmchan_thread *t = _seg ? _get_thread() : NULL;
+  if (t && _busy) {
+    _drain(t);
+    t = NULL;
+  }
+  if (!t) {
+    // Out of slots (or the controller went away after a fork, or we're
+    // nested). Better the kernel than nothing.
+    return _syscall(n, args[0], args[1], args[2], args[3], args[4], args[5]);
+  }
+  _busy = true;
+  long rv = _forward(t, n, args, async);
+  _busy = false;
+  return rv;
+}
+
+void shim_channel_thread_exit() {
+  if (!_seg || !_thread) {
+    return;
+  }
+  _drain(_thread);
+  __atomic_store_n(&_thread->tid, 0, __ATOMIC_RELEASE);
+  _thread = NULL;
+}
+
+void shim_channel_exit() {
+  if (!_seg) {
+    return;
+  }
+  // Don't let async entries die with us.
+  for (int i = 0; i < SHMCHAN_THREADS; ++i) {
+    if (__atomic_load_n(&_seg->threads[i].tid, __ATOMIC_ACQUIRE)) {
+      _drain(&_seg->threads[i]);
+    }
+  }
+}
@@ -0,0 +1,196 @@
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <link.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../common/simclock.h"
+#include "shim.h"
+
+// Simulated time. Set SHIM_CLOCK=<path> to a clock page made by shimclock, and
+// CLOCK_REALTIME, CLOCK_MONOTONIC and friends all come from it.
+//
+// Most time reads never make a syscall: they go through the vDSO. So at
+// startup we overwrite the vDSO's clock_gettime, gettimeofday and time with
+// jumps to our own versions, which read the page. glibc and the Go runtime
+// both call through the vDSO's own entry points, so that catches them both,
+// at vDSO speed: no trap, no syscall. Time syscalls that do get made (and
+// trap) are answered from the page too.
+//
+// Clocks that the page doesn't cover (CPU time clocks, and anything we don't
+// know about) still go to the kernel.
+
+static const struct simclock *_clock = NULL;
+
+static bool _simulated(clockid_t clk, bool *realtime) {
+  switch (clk) {
+    case CLOCK_REALTIME:
+    case CLOCK_REALTIME_COARSE:
+    case CLOCK_TAI:
+      *realtime = true;
+      return true;
+    case CLOCK_MONOTONIC:
+    case CLOCK_MONOTONIC_RAW:
+    case CLOCK_MONOTONIC_COARSE:
+    case CLOCK_BOOTTIME:
+      *realtime = false;
+      return true;
+    default:
+      return false;
+  }
+}
+
+static uint64_t _now(bool realtime) {
+  int64_t offset;
+  uint64_t ns = simclock_read(_clock, &offset);
+  return realtime ? ns + offset : ns;
+}
+
+// These replace the vDSO's functions, so they follow its conventions: errors
+// are returned as -errno.
+
+static int _clock_gettime(clockid_t clk, struct timespec *ts) {
+  bool realtime;
+  if (!_simulated(clk, &realtime)) {
+    return _syscall(SYS_clock_gettime, clk, ts);
+  }
+  uint64_t ns = _now(realtime);
+  ts->tv_sec = ns / 1000000000;
+  ts->tv_nsec = ns % 1000000000;
+  return 0;
+}
+
+static int _gettimeofday(struct timeval *tv, struct timezone *tz) {
+  if (tv) {
+    uint64_t ns = _now(true);
+    tv->tv_sec = ns / 1000000000;
+    tv->tv_usec = ns % 1000000000 / 1000;
+  }
+  if (tz) {
+    tz->tz_minuteswest = 0;
+    tz->tz_dsttime = 0;
+  }
+  return 0;
+}
+
+static time_t _time(time_t *t) {
+  time_t now = _now(true) / 1000000000;
+  if (t) {
+    *t = now;
+  }
+  return now;
+}
+
+// Overwrites the start of vDSO function `name` with a jmp to `to`.
+static void _patch_vdso(void *vdso, int mem, const char *name, void *to) {
+  unsigned char *from = dlvsym(vdso, name, "LINUX_2.6");
+  Dl_info info;
+  const ElfW(Sym) *sym = NULL;
+  if (!from || !dladdr1(from, &info, (void**)&sym, RTLD_DL_SYMENT) || !sym || sym->st_size < 5) {
+    fprintf(stderr, "seccomp.so: couldn't find vDSO %s to patch\n", name);
+    return;
+  }
+  // Entry points can be as small as a 5-byte jmp, so that's all we have room
+  // for. If we're out of reach of a rel32, go via a trampoline that is.
+  uintptr_t target = (uintptr_t)to;
+  int64_t rel = target - ((uintptr_t)from + 5);
+  if (rel != (int32_t)rel) {
+    unsigned char *t = (unsigned char*)shim_patch_tramp((uintptr_t)from);
+    if (!t) {
+      fprintf(stderr, "seccomp.so: no room near the vDSO to patch %s\n", name);
+      return;
+    }
+    t[0] = 0x48; // movabs $to,%rax
+    t[1] = 0xb8;
+    memcpy(t + 2, &target, 8);
+    t[10] = 0xff; // jmp *%rax
+    t[11] = 0xe0;
+    target = (uintptr_t)t;
+    rel = target - ((uintptr_t)from + 5);
+  }
+  unsigned char code[5] = {0xe9};
+  int32_t rel32 = rel;
+  memcpy(code + 1, &rel32, 4);
+  // The vDSO can't be made writable with mprotect on recent kernels, but
+  // /proc/self/mem writes through. We run before there are any other threads,
+  // so nobody's running this code as we change it.
+  if (pwrite(mem, code, sizeof(code), (uintptr_t)from) != sizeof(code)) {
+    perror("seccomp.so: patching vDSO");
+  }
+}
+
+void shim_clock_init() {
+  const char *path = getenv("SHIM_CLOCK");
+  if (path == NULL || path[0] == '\0') {
+    return;
+  }
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    perror("seccomp.so: SHIM_CLOCK");
+    abort();
+  }
+  const struct simclock *clock = mmap(NULL, sizeof(*clock), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (clock == MAP_FAILED || clock->magic != SIMCLOCK_MAGIC || clock->version != SIMCLOCK_VERSION) {
+    fprintf(stderr, "seccomp.so: %s isn't a clock page made by shimclock\n", path);
+    abort();
+  }
+  _clock = clock;
+
+  void *vdso = dlopen("linux-vdso.so.1", RTLD_LAZY | RTLD_NOLOAD);
+  int mem = open("/proc/self/mem", O_RDWR | O_CLOEXEC);
+  if (!vdso || mem < 0) {
+    fprintf(stderr, "seccomp.so: can't patch the vDSO; only time syscalls will be simulated\n");
+    return;
+  }
+  _patch_vdso(vdso, mem, "__vdso_clock_gettime", _clock_gettime);
+  _patch_vdso(vdso, mem, "__vdso_gettimeofday", _gettimeofday);
+  _patch_vdso(vdso, mem, "__vdso_time", _time);
+  close(mem);
+  dlclose(vdso);
+}
+
+bool shim_clock_emulates(long n, const long args[6]) {
+  bool realtime;
+  return _clock && (n == SYS_gettimeofday || n == SYS_time ||
+                    (n == SYS_clock_gettime && _simulated(args[0], &realtime)));
+}
+
+// Unlike the vDSO, the syscalls fail bad pointers with EFAULT, so these go
+// into locals and out through shim_progmem_write.
+long shim_clock_syscall(long n, const long args[6]) {
+  switch (n) {
+    case SYS_clock_gettime: {
+      struct timespec ts;
+      _clock_gettime(args[0], &ts);
+      return shim_progmem_write((void*)args[1], &ts, sizeof(ts));
+    }
+    case SYS_gettimeofday: {
+      struct timeval tv;
+      struct timezone tz;
+      _gettimeofday(&tv, &tz);
+      if (args[0] && shim_progmem_write((void*)args[0], &tv, sizeof(tv)) != 0) {
+        return -EFAULT;
+      }
+      return args[1] ? shim_progmem_write((void*)args[1], &tz, sizeof(tz)) : 0;
+    }
+    case SYS_time: {
+      time_t now = _time(NULL);
+      if (args[0] && shim_progmem_write((void*)args[0], &now, sizeof(now)) != 0) {
+        return -EFAULT;
+      }
+      return now;
+    }
+    default:
+      return -ENOSYS;
+  }
+}
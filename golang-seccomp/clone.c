@@ -0,0 +1,183 @@
+#define _GNU_SOURCE
+
+#include <linux/sched.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <sys/ucontext.h>
+
+#include "shim.h"
+
+// clone, clone3 and vfork from the SIGSYS handler.
+//
+// The child of a clone that gets a new stack (a thread), or that shares our
+// memory (vfork), can't return through the handler: the handler's frames
+// either aren't on its stack, or are the parent's. Instead it has to pick up
+// right where the program trapped, with the program's registers.
+//
+// The syscall itself preserves everything but %rax, %rcx and %r11, and the
+// argument registers already hold the program's values, so we load the
+// program's callee-saved registers before making it. That leaves the place to
+// resume, and (for vfork) the stack to resume on, which we carry across in
+// %xmm15 and %xmm14. The child's SSE registers are the handler's anyway,
+// since the kernel resets them for the handler, and no thread-start code
+// depends on them.
+//
+// A child with a stack of its own but not our memory is a new process that
+// skips the handler's bookkeeping for fork children, so it calls shim_forked
+// before resuming, carried in %xmm13. It runs on the child's new stack, below
+// the red zone.
+//
+// All of this state is in registers, so any number of threads can be cloning
+// at once.
+//
+// The child needs no new signal stack: while SS_AUTODISARM has ours disarmed
+// in the handler, the kernel gives children none.
+//
+// A plain fork (no new stack, own memory) gets a copy of the handler's stack,
+// so its child returns from the handler the usual way.
+
+struct clone_regs {
+  long rbx, rbp, r12, r13, r14, r15;
+  long rip;
+  // Where the child resumes its stack, or 0 to leave it where the kernel put
+  // it (the new stack).
+  long rsp;
+  // Called in the child before it resumes, or 0.
+  long child_hook;
+};
+
+// long _shim_clone(long n, const long args[6], const struct clone_regs *regs)
+// Goes in shim_syscall, so that the filter lets its syscall through.
+__asm__(
+    ".pushsection shim_syscall,\"ax\",@progbits\n"
+    ".globl _shim_clone\n"
+    ".hidden _shim_clone\n"
+    ".type _shim_clone, @function\n"
+    "_shim_clone:\n"
+    "  pushq %rbx\n"
+    "  pushq %rbp\n"
+    "  pushq %r12\n"
+    "  pushq %r13\n"
+    "  pushq %r14\n"
+    "  pushq %r15\n"
+    "  movq %rdi, %rax\n"
+    "  movq 48(%rdx), %xmm15\n"
+    "  movq 56(%rdx), %xmm14\n"
+    "  movq 64(%rdx), %xmm13\n"
+    "  movq 0(%rdx), %rbx\n"
+    "  movq 8(%rdx), %rbp\n"
+    "  movq 16(%rdx), %r12\n"
+    "  movq 24(%rdx), %r13\n"
+    "  movq 32(%rdx), %r14\n"
+    "  movq 40(%rdx), %r15\n"
+    "  movq %rsi, %r11\n"
+    "  movq 0(%r11), %rdi\n"
+    "  movq 8(%r11), %rsi\n"
+    "  movq 16(%r11), %rdx\n"
+    "  movq 24(%r11), %r10\n"
+    "  movq 32(%r11), %r8\n"
+    "  movq 40(%r11), %r9\n"
+    "  syscall\n"
+    "  testq %rax, %rax\n"
+    "  jz 1f\n"
+    "  popq %r15\n"
+    "  popq %r14\n"
+    "  popq %r13\n"
+    "  popq %r12\n"
+    "  popq %rbp\n"
+    "  popq %rbx\n"
+    "  ret\n"
+    // Child.
+    "1:\n"
+    "  movq %xmm14, %rcx\n"
+    "  testq %rcx, %rcx\n"
+    "  jz 2f\n"
+    "  movq %rcx, %rsp\n"
+    "2:\n"
+    "  movq %xmm15, %r11\n"
+    "  movq %xmm13, %rcx\n"
+    "  testq %rcx, %rcx\n"
+    "  jz 3f\n"
+    // Keep what the syscall would have: the arguments, and %rax = 0.
+    "  movq %rsp, %rax\n"
+    "  leaq -128(%rsp), %rsp\n"
+    "  andq $-16, %rsp\n"
+    "  pushq %rax\n"
+    "  pushq %r11\n"
+    "  pushq %rdi\n"
+    "  pushq %rsi\n"
+    "  pushq %rdx\n"
+    "  pushq %r10\n"
+    "  pushq %r8\n"
+    "  pushq %r9\n"
+    "  call *%rcx\n"
+    "  popq %r9\n"
+    "  popq %r8\n"
+    "  popq %r10\n"
+    "  popq %rdx\n"
+    "  popq %rsi\n"
+    "  popq %rdi\n"
+    "  popq %r11\n"
+    "  popq %rsp\n"
+    "  xorl %eax, %eax\n"
+    "3:\n"
+    "  jmp *%r11\n"
+    ".size _shim_clone, .-_shim_clone\n"
+    ".popsection\n");
+
+SHIM_HIDDEN long _shim_clone(long n, const long args[6], const struct clone_regs *regs);
+
+bool shim_clone_is_clone(long n) {
+  return n == SYS_clone || n == SYS_clone3 || n == SYS_vfork;
+}
+
+bool shim_clone_flags(long n, const long args[6], uint64_t *flags, long *stack) {
+  switch (n) {
+    case SYS_clone:
+      *flags = args[0];
+      *stack = args[1];
+      return true;
+    case SYS_clone3: {
+      // A bad pointer is the kernel's to fail.
+      struct clone_args ca;
+      if (args[1] < CLONE_ARGS_SIZE_VER0 ||
+          shim_progmem_read(&ca, (const void*)args[0], CLONE_ARGS_SIZE_VER0) != 0) {
+        return false;
+      }
+      *flags = ca.flags;
+      *stack = ca.stack ? ca.stack + ca.stack_size : 0;
+      return true;
+    }
+    case SYS_vfork:
+      *flags = CLONE_VM | CLONE_VFORK;
+      *stack = 0;
+      return true;
+    default:
+      return false;
+  }
+}
+
+long shim_clone_syscall(long n, const long args[6], const greg_t *gregs) {
+  uint64_t flags;
+  long stack;
+  if (!shim_clone_flags(n, args, &flags, &stack) || (!(flags & CLONE_VM) && !stack)) {
+    // Returns in the child like any other syscall (or fails, e.g. a clone3
+    // with too small a size, which we let the kernel complain about).
+    return _syscall(n, args[0], args[1], args[2], args[3], args[4], args[5]);
+  }
+
+  struct clone_regs regs = {
+    .rbx = gregs[REG_RBX],
+    .rbp = gregs[REG_RBP],
+    .r12 = gregs[REG_R12],
+    .r13 = gregs[REG_R13],
+    .r14 = gregs[REG_R14],
+    .r15 = gregs[REG_R15],
+    .rip = gregs[REG_RIP],
+    .rsp = stack ? 0 : gregs[REG_RSP],
+    .child_hook = (flags & CLONE_VM) ? 0 : (long)shim_forked,
+  };
+  return _shim_clone(n, args, &regs);
+}
@@ -0,0 +1,85 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// Stress test for clone under seccomp.so: many threads creating threads at
+// once.
+//
+// Usage: clone_bench [-p parents] [-n threads per parent]
+//
+// Starts `parents` threads, which all start together and each create and join
+// `threads` short-lived threads, one after another. Prints the overall thread
+// creation rate. Compare against a native run, e.g.:
+//
+//   for p in 1 2 4 8; do ./clone_bench -p $p; LD_PRELOAD=./seccomp.so ./clone_bench -p $p; done
+
+#define CHECK(x) { \
+  if (!(x)) {\
+    perror(#x);\
+    exit(EXIT_FAILURE);\
+  }\
+}
+
+static int threads = 10000;
+static pthread_barrier_t start;
+
+static void *child_main(void *arg) {
+  // Make sure the child can make syscalls of its own.
+  return (void*)syscall(SYS_gettid);
+}
+
+static void *parent_main(void *arg) {
+  pthread_attr_t attr;
+  CHECK(pthread_attr_init(&attr) == 0);
+  CHECK(pthread_attr_setstacksize(&attr, 64 << 10) == 0);
+  pthread_barrier_wait(&start);
+  for (int i = 0; i < threads; ++i) {
+    pthread_t t;
+    void *tid;
+    CHECK(pthread_create(&t, &attr, child_main, NULL) == 0);
+    CHECK(pthread_join(t, &tid) == 0);
+    CHECK((long)tid > 0);
+  }
+  return NULL;
+}
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+  int parents = 4;
+  int opt;
+  while ((opt = getopt(argc, argv, "p:n:")) != -1) {
+    switch (opt) {
+      case 'p': parents = atoi(optarg); break;
+      case 'n': threads = atoi(optarg); break;
+      default:
+        fprintf(stderr, "Usage: %s [-p parents] [-n threads per parent]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  pthread_t *tids = calloc(parents, sizeof(*tids));
+  CHECK(tids);
+  CHECK(pthread_barrier_init(&start, NULL, parents + 1) == 0);
+  for (int i = 0; i < parents; ++i) {
+    CHECK(pthread_create(&tids[i], NULL, parent_main, NULL) == 0);
+  }
+  pthread_barrier_wait(&start);
+  double t0 = now();
+  for (int i = 0; i < parents; ++i) {
+    CHECK(pthread_join(tids[i], NULL) == 0);
+  }
+  double elapsed = now() - t0;
+  printf("parents=%d threads=%d elapsed=%.3fs rate=%.0f/s\n", parents, parents * threads,
+         elapsed, parents * threads / elapsed);
+  return 0;
+}
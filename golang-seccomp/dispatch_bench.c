@@ -0,0 +1,149 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../common/sysdispatch.h"
+
+// Cost of picking a syscall's handler by number, without making the syscall:
+// an if-chain like the one seccomp.c had, a switch, and a table from
+// ../common/sysdispatch.h. The handlers just count, so what's left is the
+// dispatch.
+//
+// Usage: dispatch_bench [-n calls] [-h handled]
+//
+// The stream of syscall numbers is a shuffled mix, mostly of numbers nobody
+// handles, with `handled` percent (default 10) of ones that have handlers.
+// Prints one JSON object per mode, and the cost of a real getpid for scale.
+
+static long counts[SYSDISPATCH_NR + 1];
+
+__attribute__((noinline)) static long on_default(void *ctx, long n, long a[6]) {
+  return ++counts[SYSDISPATCH_NR];
+}
+
+__attribute__((noinline)) static long on_sigaction(void *ctx, int sig, const void *act,
+                                                   void *oldact, size_t size) {
+  return ++counts[SYS_rt_sigaction] + sig;
+}
+
+__attribute__((noinline)) static long on_sigprocmask(void *ctx, int how, const uint64_t *set,
+                                                     uint64_t *oldset, size_t size) {
+  return ++counts[SYS_rt_sigprocmask] + how;
+}
+
+__attribute__((noinline)) static long on_clone(void *ctx, long n, long a[6]) {
+  return ++counts[n];
+}
+
+#define BENCH_SYSCALLS(TYPED, RAW, p) \
+  TYPED(p, rt_sigaction) \
+  TYPED(p, rt_sigprocmask) \
+  RAW(p, clone, on_clone) \
+  RAW(p, clone3, on_clone) \
+  RAW(p, vfork, on_clone)
+
+static long bench_rt_sigaction(void *ctx, int sig, const void *act, void *oldact, size_t size) {
+  return on_sigaction(ctx, sig, act, oldact, size);
+}
+
+static long bench_rt_sigprocmask(void *ctx, int how, const uint64_t *set, uint64_t *oldset,
+                                 size_t size) {
+  return on_sigprocmask(ctx, how, set, oldset, size);
+}
+
+SYSDISPATCH_TABLE(bench, BENCH_SYSCALLS, on_default)
+
+__attribute__((noinline)) static long by_ifs(long n, long a[6]) {
+  if (n == SYS_rt_sigaction) {
+    return on_sigaction(NULL, a[0], (const void*)a[1], (void*)a[2], a[3]);
+  }
+  if (n == SYS_rt_sigprocmask) {
+    return on_sigprocmask(NULL, a[0], (const uint64_t*)a[1], (uint64_t*)a[2], a[3]);
+  }
+  if (n == SYS_clone || n == SYS_clone3 || n == SYS_vfork) {
+    return on_clone(NULL, n, a);
+  }
+  return on_default(NULL, n, a);
+}
+
+__attribute__((noinline)) static long by_switch(long n, long a[6]) {
+  switch (n) {
+    case SYS_rt_sigaction:
+      return on_sigaction(NULL, a[0], (const void*)a[1], (void*)a[2], a[3]);
+    case SYS_rt_sigprocmask:
+      return on_sigprocmask(NULL, a[0], (const uint64_t*)a[1], (uint64_t*)a[2], a[3]);
+    case SYS_clone:
+    case SYS_clone3:
+    case SYS_vfork:
+      return on_clone(NULL, n, a);
+    default:
+      return on_default(NULL, n, a);
+  }
+}
+
+__attribute__((noinline)) static long by_table(long n, long a[6]) {
+  return sysdispatch(bench_table, NULL, n, a);
+}
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+  long calls = 10 * 1000 * 1000;
+  int handled = 10;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:h:")) != -1) {
+    switch (opt) {
+      case 'n': calls = atol(optarg); break;
+      case 'h': handled = atoi(optarg); break;
+      default:
+        fprintf(stderr, "Usage: %s [-n calls] [-h handled]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  // A stream long enough that the branch predictor can't learn it.
+  const long hot[] = {SYS_rt_sigaction, SYS_rt_sigprocmask, SYS_clone, SYS_clone3, SYS_vfork};
+  const long cold[] = {SYS_read, SYS_write, SYS_futex, SYS_epoll_pwait, SYS_nanosleep,
+                       SYS_mmap, SYS_openat, SYS_close, SYS_getpid, SYS_newfstatat};
+  enum { STREAM = 1 << 16 };
+  static long stream[STREAM];
+  srand(1);
+  for (int i = 0; i < STREAM; ++i) {
+    stream[i] = rand() % 100 < handled ? hot[rand() % 5] : cold[rand() % 10];
+  }
+
+  struct {
+    const char *name;
+    long (*fn)(long n, long a[6]);
+  } modes[] = {{"ifs", by_ifs}, {"switch", by_switch}, {"table", by_table}};
+  long a[6] = {0};
+  for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+    memset(counts, 0, sizeof(counts));
+    double start = now();
+    for (long i = 0; i < calls; ++i) {
+      modes[m].fn(stream[i % STREAM], a);
+    }
+    double elapsed = now() - start;
+    printf("{\"mode\":\"%s\",\"calls\":%ld,\"handled_pct\":%d,\"ns_per_call\":%.2f,"
+           "\"defaulted\":%ld}\n",
+           modes[m].name, calls, handled, elapsed * 1e9 / calls, counts[SYSDISPATCH_NR]);
+  }
+
+  long getpids = calls / 10;
+  double start = now();
+  for (long i = 0; i < getpids; ++i) {
+    syscall(SYS_getpid);
+  }
+  printf("{\"mode\":\"getpid\",\"calls\":%ld,\"ns_per_call\":%.2f}\n", getpids,
+         (now() - start) * 1e9 / getpids);
+  return 0;
+}
@@ -0,0 +1,75 @@
+package main
+
+// Workload for gobench.sh: the scheduler and GC churn of test_goroutines and
+// test_gc, with knobs, reporting what it cost as one line of JSON.
+//
+// Starts -goroutines goroutines, each of which runs -iters iterations of:
+// allocate -alloc KiB of garbage, then sleep for -sleep. GOMAXPROCS comes from
+// the environment as usual.
+
+import (
+    "encoding/json"
+    "flag"
+    "os"
+    "runtime"
+    "sync"
+    "syscall"
+    "time"
+)
+
+var sink []byte
+
+func worker(wg *sync.WaitGroup, iters int, alloc int, sleep time.Duration) {
+    defer wg.Done()
+    for i := 0; i < iters; i++ {
+        if alloc > 0 {
+            garbage := make([]byte, alloc<<10)
+            // Touch every page, so that the heap's actually backed.
+            for j := 0; j < len(garbage); j += 4096 {
+                garbage[j] = byte(i)
+            }
+            sink = garbage
+        }
+        if sleep > 0 {
+            time.Sleep(sleep)
+        } else {
+            runtime.Gosched()
+        }
+    }
+}
+
+func main() {
+    goroutines := flag.Int("goroutines", 10, "goroutines to run")
+    iters := flag.Int("iters", 100, "iterations per goroutine")
+    alloc := flag.Int("alloc", 0, "KiB allocated per iteration")
+    sleep := flag.Duration("sleep", 10*time.Millisecond, "sleep per iteration (0 yields instead)")
+    flag.Parse()
+
+    start := time.Now()
+    var wg sync.WaitGroup
+    for i := 0; i < *goroutines; i++ {
+        wg.Add(1)
+        go worker(&wg, *iters, *alloc, *sleep)
+    }
+    wg.Wait()
+    wall := time.Since(start)
+
+    var ru syscall.Rusage
+    syscall.Getrusage(syscall.RUSAGE_SELF, &ru)
+    var ms runtime.MemStats
+    runtime.ReadMemStats(&ms)
+    json.NewEncoder(os.Stdout).Encode(map[string]interface{}{
+        "gomaxprocs": runtime.GOMAXPROCS(0),
+        "goroutines": *goroutines,
+        "iters":      *iters,
+        "alloc_kb":   *alloc,
+        "sleep_ns":   sleep.Nanoseconds(),
+        "wall_ns":    wall.Nanoseconds(),
+        "user_ns":    ru.Utime.Nano(),
+        "sys_ns":     ru.Stime.Nano(),
+        "maxrss_kb":  ru.Maxrss,
+        "num_gc":     ms.NumGC,
+        "vol_csw":    ru.Nvcsw,
+        "invol_csw":  ru.Nivcsw,
+    })
+}
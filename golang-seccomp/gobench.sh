@@ -0,0 +1,83 @@
+#!/bin/bash
+#
+# Sweeps gobench over GOMAXPROCS, goroutine count, allocation rate and sleep
+# granularity, natively and under seccomp.so, and prints one JSON object per
+# run. Runs under the shim have SHIM_STATS=1, and add the trapped syscalls by
+# name, and totals for the ones the Go runtime leans on:
+#
+#   mode, gomaxprocs, goroutines, iters, alloc_kb, sleep_ns   the point
+#   wall_ns, user_ns, sys_ns, maxrss_kb, num_gc, vol_csw, invol_csw
+#   trapped     syscalls that went through the handler (shim only)
+#   futex, nanosleep, epoll_pwait
+#   mm          mmap, munmap, mprotect and madvise
+#   syscalls    {name: count}
+#
+# Keep the output of a run and compare against it after changing the shim,
+# e.g. wall time relative to native at each point:
+#
+#   jq -rs 'group_by([.gomaxprocs, .goroutines, .alloc_kb, .sleep_ns])[]
+#          | (map(select(.mode == "native"))[0].wall_ns) as $n
+#          | .[] | select(.mode == "shim") | [.gomaxprocs, .goroutines, .alloc_kb,
+#                  .sleep_ns, .wall_ns / $n] | @tsv' < results.jsonl
+#
+# Knobs (environment):
+#   PROCS       GOMAXPROCS values, default "1 2 4"
+#   GOROUTINES  default "10 100 1000"
+#   ALLOC       KiB allocated per iteration, default "0 64"
+#   SLEEP       per iteration, as a Go duration; 0 yields instead. Default
+#               "0 100us 1ms 10ms"
+#   ITERS       iterations per goroutine, default 50
+#   SHIM_ENV    extra environment for shim runs, e.g. "SHIM_PATCH=1"
+
+set -u
+
+cd "$(dirname "$0")"
+
+PROCS=${PROCS:-"1 2 4"}
+GOROUTINES=${GOROUTINES:-"10 100 1000"}
+ALLOC=${ALLOC:-"0 64"}
+SLEEP=${SLEEP:-"0 100us 1ms 10ms"}
+ITERS=${ITERS:-50}
+SHIM_ENV=${SHIM_ENV:-}
+
+stats=$(mktemp)
+trap 'rm -f "$stats"' EXIT
+
+# Turns the shim's exit-time stats table into JSON fields.
+stats_json() {
+  awk '
+    $1 ~ /^[0-9]+$/ && NF >= 3 {
+      syscalls = syscalls (n++ ? "," : "") sprintf("\"%s\":%d", $2, $3)
+      total += $3
+      if ($2 ~ /^(futex|nanosleep|epoll_pwait)$/) by[$2] += $3
+      if ($2 ~ /^(mmap|munmap|mprotect|madvise)$/) mm += $3
+    }
+    END {
+      printf "\"trapped\":%d,\"futex\":%d,\"nanosleep\":%d,\"epoll_pwait\":%d,\"mm\":%d,\"syscalls\":{%s}",
+             total, by["futex"], by["nanosleep"], by["epoll_pwait"], mm, syscalls
+    }' "$1"
+}
+
+for p in $PROCS; do
+  for g in $GOROUTINES; do
+    for a in $ALLOC; do
+      for s in $SLEEP; do
+        args="-goroutines $g -iters $ITERS -alloc $a -sleep $s"
+        for mode in native shim; do
+          if [ $mode = native ]; then
+            line=$(GOMAXPROCS=$p ./gobench $args)
+            extra=""
+          else
+            line=$(env GOMAXPROCS=$p LD_PRELOAD=$PWD/seccomp.so SHIM_STATS=1 $SHIM_ENV ./gobench $args 2>"$stats")
+            extra=",$(stats_json "$stats")"
+          fi
+          if [ -z "$line" ]; then
+            echo "gobench failed: mode=$mode GOMAXPROCS=$p $args" >&2
+            continue
+          fi
+          echo "{\"mode\":\"$mode\",${line#\{}" | sed "s/}\$/$extra}/"
+        done
+      done
+    done
+  done
+done
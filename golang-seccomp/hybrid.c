@@ -0,0 +1,189 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+
+#include "../common/shmchan.h"
+#include "shim.h"
+
+// Per-call routing, for policy action `hybrid`. The syscall traps, and we look
+// at its arguments to decide whether it needs the controller (see channel.c).
+// Most don't, and go straight to the kernel, at the cost of a trap rather than
+// a round trip to another process. What does go over the channel:
+//
+// * open and openat of absolute paths under SHIM_HYBRID (default /shim/),
+//   which the controller serves;
+// * anything on an fd that the controller handed out for one of those. They're
+//   numbered from SHMCHAN_VFD_BASE, above anything the kernel hands out, so
+//   telling them apart is one comparison.
+//
+// We keep track of which of the controller's fds are open, and how, so that
+// some things about them don't need asking: fcntl F_GETFD, F_SETFD and
+// F_GETFL, and EBADF for ones that aren't open. close goes over without
+// waiting for the answer. dup and fcntl F_DUPFD make more of them.
+//
+// Path arguments are read with shim_progmem_string, so that a bad pointer gets
+// EFAULT rather than crashing the handler.
+//
+// Identities are left to the cache (SHIM_IDCACHE=1), which answers them
+// wherever they're routed. Routing shows up in the stats' `local` and
+// `remote` columns.
+//
+// The controller's fds belong to the process that opened them: a forked
+// child has a channel of its own, and starts with none.
+
+static const char *_prefix = "/shim/";
+static size_t _prefix_len;
+
+// Open flags, plus FD_CLOEXEC in the high bits, of each of the controller's
+// fds; 0 if it isn't open. Updated with atomics, since threads share them.
+#define VFD_OPEN (1u << 31)
+#define VFD_CLOEXEC (1u << 30)
+static uint32_t _vfds[SHMCHAN_VFDS];
+
+static void _hybrid_atfork_child() {
+  memset(_vfds, 0, sizeof(_vfds));
+}
+
+void shim_hybrid_init() {
+  const char *env = getenv("SHIM_HYBRID");
+  if (env && env[0]) {
+    _prefix = env;
+  }
+  _prefix_len = strlen(_prefix);
+  pthread_atfork(NULL, NULL, _hybrid_atfork_child);
+}
+
+static bool _is_vfd(long fd) {
+  return fd >= SHMCHAN_VFD_BASE && fd < SHMCHAN_VFD_BASE + SHMCHAN_VFDS;
+}
+
+static uint32_t *_vfd(long fd) {
+  return &_vfds[fd - SHMCHAN_VFD_BASE];
+}
+
+// Whether the first argument of syscall `n` is an fd, and one of the calls
+// the controller serves on its fds (or we answer for it). Anything else on one
+// of its fds goes to the kernel, which knows nothing of them: EBADF.
+static bool _takes_fd(long n) {
+  switch (n) {
+    case SYS_read:
+    case SYS_write:
+    case SYS_pread64:
+    case SYS_pwrite64:
+    case SYS_lseek:
+    case SYS_fstat:
+    case SYS_close:
+    case SYS_fcntl:
+    case SYS_fsync:
+    case SYS_fdatasync:
+    case SYS_ftruncate:
+    case SYS_dup:
+    case SYS_newfstatat:
+    case SYS_openat:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Status flags that F_SETFL can change.
+#define SETFL_MASK (O_APPEND | O_ASYNC | O_DIRECT | O_NOATIME | O_NONBLOCK)
+
+bool shim_hybrid_local(long n, const long args[6], long *rv) {
+  if (!shim_policy_hybrid(n) || !_takes_fd(n) || !_is_vfd(args[0])) {
+    return false;
+  }
+  if (n == SYS_openat || n == SYS_newfstatat) {
+    char c = '\0';
+    if (!(n == SYS_newfstatat && args[1] == 0 && (args[3] & AT_EMPTY_PATH)) &&
+        shim_progmem_read(&c, (const char*)args[1], 1) != 0) {
+      *rv = -EFAULT;
+      return true;
+    }
+    // An absolute path doesn't care what the dirfd is.
+    if (c == '/') {
+      return false;
+    }
+  }
+  uint32_t *vfd = _vfd(args[0]);
+  uint32_t state = __atomic_load_n(vfd, __ATOMIC_ACQUIRE);
+  if (!(state & VFD_OPEN)) {
+    *rv = -EBADF;
+    return true;
+  }
+  if (n != SYS_fcntl) {
+    return false;
+  }
+  switch (args[1]) {
+    case F_GETFD:
+      *rv = state & VFD_CLOEXEC ? FD_CLOEXEC : 0;
+      return true;
+    case F_SETFD:
+      if (args[2] & FD_CLOEXEC) {
+        __atomic_fetch_or(vfd, VFD_CLOEXEC, __ATOMIC_RELEASE);
+      } else {
+        __atomic_fetch_and(vfd, ~VFD_CLOEXEC, __ATOMIC_RELEASE);
+      }
+      *rv = 0;
+      return true;
+    case F_GETFL:
+      *rv = state & ~(VFD_OPEN | VFD_CLOEXEC);
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool shim_hybrid_remote(long n, const long args[6], bool *async) {
+  if (!shim_policy_hybrid(n)) {
+    return false;
+  }
+  *async = false;
+  if (n == SYS_open || n == SYS_openat) {
+    // The kernel gets bad paths, and fails them itself.
+    char path[PATH_MAX];
+    if (shim_progmem_string(path, (const char*)args[n == SYS_open ? 0 : 1], sizeof(path)) < 0) {
+      return false;
+    }
+    if (path[0] == '/') {
+      return strncmp(path, _prefix, _prefix_len) == 0;
+    }
+    // Relative to one of the controller's directories.
+    return n == SYS_openat && _is_vfd(args[0]);
+  }
+  if (!_takes_fd(n) || !_is_vfd(args[0])) {
+    return false;
+  }
+  // Nobody looks at what close returns.
+  *async = n == SYS_close;
+  return true;
+}
+
+void shim_hybrid_update(long n, const long args[6], long rv) {
+  if ((n == SYS_open || n == SYS_openat) && _is_vfd(rv)) {
+    int flags = args[n == SYS_open ? 1 : 2];
+    uint32_t state = VFD_OPEN | (flags & O_CLOEXEC ? VFD_CLOEXEC : 0) |
+                     (flags & ~(O_CREAT | O_EXCL | O_NOCTTY | O_TRUNC | O_CLOEXEC));
+    __atomic_store_n(_vfd(rv), state, __ATOMIC_RELEASE);
+  } else if (n == SYS_close && _is_vfd(args[0])) {
+    __atomic_store_n(_vfd(args[0]), 0, __ATOMIC_RELEASE);
+  } else if ((n == SYS_dup || (n == SYS_fcntl && (args[1] == F_DUPFD || args[1] == F_DUPFD_CLOEXEC))) &&
+             _is_vfd(args[0]) && _is_vfd(rv)) {
+    // Same file and status flags; FD_CLOEXEC is per fd.
+    uint32_t state = __atomic_load_n(_vfd(args[0]), __ATOMIC_ACQUIRE) & ~VFD_CLOEXEC;
+    if (n == SYS_fcntl && args[1] == F_DUPFD_CLOEXEC) {
+      state |= VFD_CLOEXEC;
+    }
+    __atomic_store_n(_vfd(rv), state, __ATOMIC_RELEASE);
+  } else if (n == SYS_fcntl && args[1] == F_SETFL && rv == 0 && _is_vfd(args[0])) {
+    uint32_t state = __atomic_load_n(_vfd(args[0]), __ATOMIC_ACQUIRE);
+    state = (state & ~SETFL_MASK) | (args[2] & SETFL_MASK);
+    __atomic_store_n(_vfd(args[0]), state, __ATOMIC_RELEASE);
+  }
+}
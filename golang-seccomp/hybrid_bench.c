@@ -0,0 +1,95 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// A mix of syscalls for comparing ways of routing them between seccomp.so,
+// the kernel and shimchan (see hybrid_bench.sh). Each iteration does:
+//
+// * `ids` getpids;
+// * `local` rounds of openat, fstat, read and close of a small file in /tmp,
+//   which only the kernel needs to know about;
+// * `remote` preads from `vpath`, opened once at the start, which is meant to
+//   be a file that the controller serves (e.g. /shim/data under
+//   `shimchan -m /shim/=dir`).
+//
+// Usage: hybrid_bench [-n iters] [-i ids] [-l local] [-r remote] [-f vpath]
+//
+// Prints one JSON object. Makes the syscalls directly, so that libc doesn't
+// swap in others (e.g. newfstatat for fstat) behind our back.
+
+#define CHECK(x) { \
+  if (!(x)) {\
+    perror(#x);\
+    exit(EXIT_FAILURE);\
+  }\
+}
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+  int iters = 10000, ids = 4, local = 1, remote = 1;
+  const char *vpath = "/shim/data";
+  int opt;
+  while ((opt = getopt(argc, argv, "n:i:l:r:f:")) != -1) {
+    switch (opt) {
+      case 'n': iters = atoi(optarg); break;
+      case 'i': ids = atoi(optarg); break;
+      case 'l': local = atoi(optarg); break;
+      case 'r': remote = atoi(optarg); break;
+      case 'f': vpath = optarg; break;
+      default:
+        fprintf(stderr, "Usage: %s [-n iters] [-i ids] [-l local] [-r remote] [-f vpath]\n",
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  char path[] = "/tmp/hybrid_bench.XXXXXX";
+  int fd = mkstemp(path);
+  CHECK(fd >= 0);
+  CHECK(write(fd, "local\n", 6) == 6);
+  close(fd);
+  long vfd = -1;
+  if (remote) {
+    vfd = syscall(SYS_openat, AT_FDCWD, vpath, O_RDONLY);
+    CHECK(vfd >= 0);
+  }
+
+  char buf[64];
+  struct stat st;
+  double start = now();
+  for (int n = 0; n < iters; ++n) {
+    for (int i = 0; i < ids; ++i) {
+      syscall(SYS_getpid);
+    }
+    for (int i = 0; i < local; ++i) {
+      long f = syscall(SYS_openat, AT_FDCWD, path, O_RDONLY | O_CLOEXEC);
+      CHECK(f >= 0);
+      CHECK(syscall(SYS_fstat, f, &st) == 0);
+      CHECK(syscall(SYS_read, f, buf, sizeof(buf)) == st.st_size);
+      syscall(SYS_close, f);
+    }
+    for (int i = 0; i < remote; ++i) {
+      CHECK(syscall(SYS_pread64, vfd, buf, sizeof(buf), 0) > 0);
+    }
+  }
+  double elapsed = now() - start;
+
+  if (vfd >= 0) {
+    syscall(SYS_close, vfd);
+  }
+  unlink(path);
+  printf("{\"iters\":%d,\"ids\":%d,\"local\":%d,\"remote\":%d,\"ns_per_iter\":%.1f}\n", iters, ids,
+         local, remote, elapsed * 1e9 / iters);
+  return 0;
+}
@@ -0,0 +1,85 @@
+#!/bin/bash
+#
+# Runs hybrid_bench under each way of routing its syscalls, and prints one
+# JSON object per run:
+#
+#   native  no shim; the "controller's" file is a plain file
+#   trap    everything traps and the shim passes it on (identities from
+#           SHIM_IDCACHE). As fast as the shim gets, but nothing can be served
+#           by the controller: a plain file again
+#   remote  everything goes to shimchan
+#   static  what a per-syscall policy can do: identities trap, and anything
+#           that might touch the controller's file goes to shimchan, whatever
+#           it's called on
+#   hybrid  identities trap, and file syscalls trap and go to shimchan only if
+#           they're about its file (see hybrid.c)
+#
+# Fields are hybrid_bench's, plus `mode`, and for shim runs `trapped`,
+# `shim_local` and `shim_remote`: syscalls through the handler, answered by
+# the shim itself, and sent to the controller.
+#
+# Knobs (environment):
+#   ITERS   default 20000
+#   IDS     getpids per iteration, default 4
+#   LOCAL   open/fstat/read/close rounds on a plain file, default 1
+#   REMOTE  preads of the controller's file, default 1
+
+set -u
+
+cd "$(dirname "$0")"
+
+ITERS=${ITERS:-20000}
+IDS=${IDS:-4}
+LOCAL=${LOCAL:-1}
+REMOTE=${REMOTE:-1}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+mkdir "$tmp/served"
+echo "served by the controller" > "$tmp/served/data"
+
+# SHIM_IDCACHE needs the process-creating syscalls trapped.
+FILE="openat fstat read pread64 write close"
+policy() {
+  echo "default allow"
+  for s in clone clone3 fork vfork; do echo "$s trap"; done
+  echo "getpid $1"
+  for s in $FILE; do echo "$s $2"; done
+}
+policy trap trap > "$tmp/trap.pol"
+policy remote remote > "$tmp/remote.pol"
+policy trap remote > "$tmp/static.pol"
+policy trap hybrid > "$tmp/hybrid.pol"
+
+# Totals from the shim's exit-time stats table.
+stats_json() {
+  awk '
+    $1 ~ /^[0-9]+$/ && NF >= 5 { count += $3; local += $5; remote += $6 }
+    END { printf "\"trapped\":%d,\"shim_local\":%d,\"shim_remote\":%d", count, local, remote }' "$1"
+}
+
+args="-n $ITERS -i $IDS -l $LOCAL -r $REMOTE"
+for mode in native trap remote static hybrid; do
+  case $mode in
+    native)
+      line=$(./hybrid_bench $args -f "$tmp/served/data")
+      extra=""
+      ;;
+    trap)
+      line=$(env LD_PRELOAD=$PWD/seccomp.so SHIM_POLICY="$tmp/trap.pol" SHIM_IDCACHE=1 \
+             SHIM_STATS=1 ./hybrid_bench $args -f "$tmp/served/data" 2>"$tmp/stats")
+      extra=",$(stats_json "$tmp/stats")"
+      ;;
+    *)
+      line=$(./shimchan -m /shim/="$tmp/served" env LD_PRELOAD=$PWD/seccomp.so \
+             SHIM_POLICY="$tmp/$mode.pol" SHIM_IDCACHE=1 SHIM_STATS=1 \
+             ./hybrid_bench $args -f /shim/data 2>"$tmp/stats")
+      extra=",$(stats_json "$tmp/stats")"
+      ;;
+  esac
+  if [ -z "$line" ]; then
+    echo "hybrid_bench failed: mode=$mode" >&2
+    continue
+  fi
+  echo "{\"mode\":\"$mode\",${line#\{}" | sed "s/}\$/$extra}/"
+done
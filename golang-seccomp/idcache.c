@@ -0,0 +1,251 @@
+#define _GNU_SOURCE
+
+#include <linux/sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+
+#include "shim.h"
+
+// Identity cache, enabled by SHIM_IDCACHE=1. Answers getpid, gettid, getuid,
+// geteuid, getgid, getegid and uname from what the kernel told us last time,
+// without making the syscall. Combined with SHIM_PATCH, a patched site gets
+// its answer without even trapping.
+//
+// The pid is per process. gettid and the credentials are per thread, as the
+// kernel has them. We drop what we know when it may have changed:
+//
+// * fork: the child forgets its pid and tid, whether it returns through the
+//   handler or (a clone with a stack of its own) resumes the program directly
+//   (see clone.c).
+// * clone: threads start with zeroed TLS, so they know nothing. Clones that
+//   share our memory or TLS with a different pid or tid would see our cached
+//   values, so the first one of those turns the cache off for good. vfork
+//   children are the common case, and the parent's suspended until they exec
+//   or exit, so we just bypass the cache while one's running.
+// * setuid and friends: that thread forgets its credentials. glibc applies
+//   them to every thread by having each one make the syscall.
+// * exec: the new image starts with an empty cache.
+// * sethostname, setdomainname, unshare and setns: forget uname. unshare and
+//   setns also make that thread forget its credentials, which look different
+//   from a new user namespace.
+//
+// Nothing catches fork or clone that the filter lets straight through, so the
+// cache only turns on if all of them trap. It also misses hostname changes by
+// other processes. getppid isn't cached at all: our parent can exit and leave
+// us reparented without us making a syscall.
+//
+// Hits show up in the stats' `local` column.
+
+static bool _enabled = false;
+// vfork children running. While there are any, the cache is shared with a
+// process that isn't us.
+static int _vforking = 0;
+
+static int32_t _pid = 0;
+static __thread int32_t _tid = 0;
+
+// Credentials, indexed by _cred_index.
+#define NCREDS 4
+static __thread uint32_t _creds[NCREDS];
+static __thread uint8_t _creds_valid = 0;
+
+// uname, under a seqlock. _uts_seq is odd while someone's writing, and 0 if
+// there's nothing cached. _uts_gen counts invalidations, so that a uname that
+// was in flight across one doesn't fill the cache with the old name.
+static struct utsname _uts;
+static uint32_t _uts_seq = 0;
+static uint32_t _uts_gen = 0;
+static uint32_t _uts_writer = 0;
+static __thread uint32_t _uts_miss_gen;
+
+static int _cred_index(long n) {
+  switch (n) {
+    case SYS_getuid: return 0;
+    case SYS_geteuid: return 1;
+    case SYS_getgid: return 2;
+    case SYS_getegid: return 3;
+    default: return -1;
+  }
+}
+
+static bool _uts_read(struct utsname *to) {
+  uint32_t seq;
+  do {
+    seq = __atomic_load_n(&_uts_seq, __ATOMIC_ACQUIRE);
+    if (seq == 0 || (seq & 1)) {
+      return false;
+    }
+    memcpy(to, &_uts, sizeof(_uts));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while (__atomic_load_n(&_uts_seq, __ATOMIC_RELAXED) != seq);
+  return true;
+}
+
+static void _uts_lock() {
+  while (__atomic_exchange_n(&_uts_writer, 1, __ATOMIC_ACQUIRE)) {
+    _syscall(SYS_sched_yield);
+  }
+}
+
+static void _uts_unlock() {
+  __atomic_store_n(&_uts_writer, 0, __ATOMIC_RELEASE);
+}
+
+// Caches `from`, if nothing's been invalidated since our miss.
+static void _uts_fill(const struct utsname *from) {
+  _uts_lock();
+  if (_uts_gen == _uts_miss_gen) {
+    uint32_t seq = _uts_seq | 1;
+    __atomic_store_n(&_uts_seq, seq, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&_uts, from, sizeof(_uts));
+    // Skip 0, which means empty.
+    __atomic_store_n(&_uts_seq, seq + 1 ? seq + 1 : 2, __ATOMIC_RELEASE);
+  }
+  _uts_unlock();
+}
+
+static void _uts_invalidate() {
+  _uts_lock();
+  ++_uts_gen;
+  __atomic_store_n(&_uts_seq, 0, __ATOMIC_RELEASE);
+  _uts_unlock();
+}
+
+void shim_idcache_init() {
+  const char *env = getenv("SHIM_IDCACHE");
+  if (env == NULL || strcmp(env, "0") == 0) {
+    return;
+  }
+  if (!shim_policy_traps(SYS_clone) || !shim_policy_traps(SYS_clone3) ||
+      !shim_policy_traps(SYS_fork) || !shim_policy_traps(SYS_vfork)) {
+    fprintf(stderr, "seccomp.so: SHIM_IDCACHE needs the policy to trap clone, clone3, fork "
+                    "and vfork; not caching\n");
+    return;
+  }
+  _enabled = true;
+}
+
+bool shim_idcache_lookup(long n, const long args[6], long *rv) {
+  if (!__atomic_load_n(&_enabled, __ATOMIC_RELAXED)) {
+    return false;
+  }
+  uint64_t flags;
+  long stack;
+  if (shim_clone_flags(n, args, &flags, &stack) && (flags & CLONE_VM)) {
+    if (flags & CLONE_VFORK) {
+      __atomic_fetch_add(&_vforking, 1, __ATOMIC_ACQUIRE);
+    } else if (!(flags & CLONE_THREAD) || !(flags & CLONE_SETTLS)) {
+      __atomic_store_n(&_enabled, false, __ATOMIC_RELAXED);
+    }
+    return false;
+  }
+  if (__atomic_load_n(&_vforking, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+
+  int i;
+  switch (n) {
+    case SYS_getpid: {
+      int32_t pid = __atomic_load_n(&_pid, __ATOMIC_RELAXED);
+      *rv = pid;
+      return pid != 0;
+    }
+    case SYS_gettid:
+      *rv = _tid;
+      return _tid != 0;
+    case SYS_getuid:
+    case SYS_geteuid:
+    case SYS_getgid:
+    case SYS_getegid:
+      i = _cred_index(n);
+      *rv = _creds[i];
+      return _creds_valid & (1 << i);
+    case SYS_uname: {
+      _uts_miss_gen = __atomic_load_n(&_uts_gen, __ATOMIC_RELAXED);
+      struct utsname uts;
+      if (!_uts_read(&uts)) {
+        return false;
+      }
+      *rv = shim_progmem_write((void*)args[0], &uts, sizeof(uts));
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+void shim_idcache_forked() {
+  _pid = 0;
+  _tid = 0;
+}
+
+void shim_idcache_update(long n, const long args[6], long rv) {
+  if (!__atomic_load_n(&_enabled, __ATOMIC_RELAXED)) {
+    return;
+  }
+  uint64_t flags = 0;
+  long stack;
+  if (shim_clone_flags(n, args, &flags, &stack) || n == SYS_fork) {
+    if ((flags & CLONE_VM) && (flags & CLONE_VFORK)) {
+      // Only the parent gets here.
+      __atomic_fetch_sub(&_vforking, 1, __ATOMIC_RELEASE);
+    } else if (rv == 0) {
+      // The child of a fork.
+      shim_idcache_forked();
+    }
+    return;
+  }
+  switch (n) {
+    case SYS_setuid:
+    case SYS_setgid:
+    case SYS_setreuid:
+    case SYS_setregid:
+    case SYS_setresuid:
+    case SYS_setresgid:
+    case SYS_setfsuid:
+    case SYS_setfsgid:
+      _creds_valid = 0;
+      return;
+    case SYS_unshare:
+    case SYS_setns:
+      _creds_valid = 0;
+      _uts_invalidate();
+      return;
+    case SYS_sethostname:
+    case SYS_setdomainname:
+      _uts_invalidate();
+      return;
+  }
+  if (__atomic_load_n(&_vforking, __ATOMIC_ACQUIRE)) {
+    // This might be the child, whose pid isn't ours.
+    return;
+  }
+
+  if (rv < 0) {
+    return;
+  }
+  int i;
+  switch (n) {
+    case SYS_getpid:
+      __atomic_store_n(&_pid, rv, __ATOMIC_RELAXED);
+      break;
+    case SYS_gettid:
+      _tid = rv;
+      break;
+    case SYS_getuid:
+    case SYS_geteuid:
+    case SYS_getgid:
+    case SYS_getegid:
+      i = _cred_index(n);
+      _creds[i] = rv;
+      _creds_valid |= 1 << i;
+      break;
+    case SYS_uname:
+      _uts_fill((const struct utsname*)args[0]);
+      break;
+  }
+}
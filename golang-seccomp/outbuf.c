@@ -0,0 +1,60 @@
+#define _GNU_SOURCE
+
+#include <sys/syscall.h>
+
+#include "shim.h"
+
+// Minimal async-signal-safe output formatting, for use inside the SIGSYS
+// handler where we can't use stdio.
+
+void shim_out_flush(struct shim_outbuf *out) {
+  size_t off = 0;
+  while (off < out->len) {
+    long rv = _syscall(SYS_write, out->fd, out->buf + off, out->len - off);
+    if (rv <= 0) {
+      break;
+    }
+    off += rv;
+  }
+  out->len = 0;
+}
+
+void shim_out_char(struct shim_outbuf *out, char c) {
+  if (out->len == sizeof(out->buf)) {
+    shim_out_flush(out);
+  }
+  out->buf[out->len++] = c;
+}
+
+void shim_out_str(struct shim_outbuf *out, const char *s) {
+  while (*s) {
+    shim_out_char(out, *s++);
+  }
+}
+
+// Right-aligns `v` in a field of `width` characters.
+void shim_out_u64(struct shim_outbuf *out, uint64_t v, int width) {
+  char digits[20];
+  int n = 0;
+  do {
+    digits[n++] = '0' + v % 10;
+    v /= 10;
+  } while (v);
+  for (int i = n; i < width; ++i) {
+    shim_out_char(out, ' ');
+  }
+  while (n) {
+    shim_out_char(out, digits[--n]);
+  }
+}
+
+// Left-aligns `s` in a field of `width` characters.
+void shim_out_str_padded(struct shim_outbuf *out, const char *s, int width) {
+  int n = 0;
+  for (; s[n]; ++n) {
+    shim_out_char(out, s[n]);
+  }
+  for (; n < width; ++n) {
+    shim_out_char(out, ' ');
+  }
+}
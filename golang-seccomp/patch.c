@@ -0,0 +1,348 @@
+#define _GNU_SOURCE
+
+#include <cpuid.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "shim.h"
+
+// Lazy rewriting of syscall sites, enabled by SHIM_PATCH=1.
+//
+// The first time a `syscall` instruction traps, if it's preceded by the usual
+// `mov $nr,%eax` (436 of 526 sites in glibc 2.36, and all of the Go runtime's
+// raw syscalls), we overwrite that mov with a jmp to a trampoline:
+//
+//   site:  b8 nr            mov  $nr,%eax      ->   jmp  tramp
+//          0f 05            syscall                 (syscall; not reached)
+//
+//   tramp: mov  $nr,%eax
+//          lea  -128(%rsp),%rsp                     skip the red zone
+//          movabs $shim_patch_entry,%r11; call *%r11
+//          lea  128(%rsp),%rsp
+//          jmp  site+7
+//
+// and from then on that site calls shim_patch_dispatch directly, without
+// entering the kernel for a SIGSYS. The syscall instruction itself stays put,
+// so anything that jumps straight to it still works (and still traps).
+//
+// We only patch when it's safe to do so while other threads may be running
+// the same code: the mov's 5 bytes have to lie within one aligned 8-byte word,
+// so that they change with a single atomic store, and its immediate has to
+// match the syscall number that trapped. Syscalls that switch stacks or don't
+// return to their caller in the usual way (clone, fork, rt_sigreturn...) are
+// never patched. Sites we can't patch keep trapping, and each site is only
+// considered once.
+
+// Per-thread stack for shim_patch_dispatch, so that we don't run C code on
+// what might be a small goroutine stack. It's reserved alongside the thread's
+// signal stack (see altstack.c), so only threads that have trapped have one,
+// and only when SHIM_PATCH is on; this is just a pointer to its top. A thread
+// without one (a new thread that reaches an already-patched site) makes the
+// syscall from shim_patch_entry instead, and its trap sets the stack up.
+#define PATCH_STACK_SIZE (32 << 10)
+SHIM_HIDDEN __thread char *_shim_patch_stack
+    __attribute__((tls_model("initial-exec"))) = NULL;
+
+// Bytes of XSAVE area for the features the kernel has enabled, from CPUID leaf
+// 0xD, plus slack for aligning it to 64 bytes.
+SHIM_HIDDEN uint64_t _shim_patch_xsave_size = 0;
+// The whole of that stack, XSAVE areas included.
+SHIM_HIDDEN uint64_t _shim_patch_stack_size = 0;
+
+// Called from trampolines, with the syscall number in %rax and its arguments
+// in the usual registers. Preserves everything the kernel would (all but
+// %rax, %rcx and %r11): flags, and with XSAVE, all the extended state that the
+// C code in between may touch (x87, MXCSR, the full ymm/zmm registers,
+// zmm16-31, opmask registers), as the kernel's signal frame does.
+__asm__(
+    ".text\n"
+    ".globl shim_patch_entry\n"
+    ".hidden shim_patch_entry\n"
+    ".type shim_patch_entry, @function\n"
+    "shim_patch_entry:\n"
+    "  pushfq\n"
+    "  movq _shim_patch_stack@gottpoff(%rip), %r11\n"
+    "  movq %fs:(%r11), %r11\n"
+    "  testq %r11, %r11\n"
+    "  jz 3f\n"
+    // Switch to our stack, unless we're already on it (a signal handler that
+    // interrupted a dispatch made a syscall of its own).
+    "  movq %r11, %rcx\n"
+    "  subq %rsp, %rcx\n"
+    "  cmpq _shim_patch_stack_size(%rip), %rcx\n"
+    "  jae 2f\n"
+    "  movq %rsp, %r11\n"
+    "2:\n"
+    "  movq %rsp, %rcx\n"
+    "  movq %r11, %rsp\n"
+    "  subq _shim_patch_xsave_size(%rip), %rsp\n"
+    "  andq $-64, %rsp\n"
+    // XRSTOR faults unless the rest of the XSAVE header after XSTATE_BV
+    // (XCOMP_BV and a reserved word) is zero; XSAVE only writes XSTATE_BV.
+    "  movq $0, 520(%rsp)\n"
+    "  movq $0, 528(%rsp)\n"
+    "  pushq %rcx\n"
+    "  pushq %rcx\n"
+    // long args[6], in order.
+    "  pushq %r9\n"
+    "  pushq %r8\n"
+    "  pushq %r10\n"
+    "  pushq %rdx\n"
+    "  pushq %rsi\n"
+    "  pushq %rdi\n"
+    "  movq %rax, %r11\n"
+    "  movl $-1, %eax\n"
+    "  movl $-1, %edx\n"
+    "  xsave64 64(%rsp)\n"
+    "  movq %r11, %rdi\n"
+    "  movq %rsp, %rsi\n"
+    "  call shim_patch_dispatch\n"
+    "  movq %rax, %r11\n"
+    "  movl $-1, %eax\n"
+    "  movl $-1, %edx\n"
+    "  xrstor64 64(%rsp)\n"
+    "  movq %r11, %rax\n"
+    "  popq %rdi\n"
+    "  popq %rsi\n"
+    "  popq %rdx\n"
+    "  popq %r10\n"
+    "  popq %r8\n"
+    "  popq %r9\n"
+    "  addq $8, %rsp\n"
+    "  popq %rsp\n"
+    "  popfq\n"
+    "  ret\n"
+    // No stack yet: trap like an unpatched site would.
+    "3:\n"
+    "  popfq\n"
+    "  syscall\n"
+    ".globl _shim_patch_trap\n"
+    ".hidden _shim_patch_trap\n"
+    "_shim_patch_trap:\n"
+    "  ret\n"
+    ".size shim_patch_entry, .-shim_patch_entry\n");
+SHIM_HIDDEN void shim_patch_entry();
+// Just after the syscall instruction in shim_patch_entry; never patched.
+SHIM_HIDDEN extern char _shim_patch_trap[];
+
+#define TRAMP_SIZE 64
+#define POOL_SIZE 4096
+#define MAX_POOLS 256
+#define MAX_SITES 4096
+
+// Pages of trampolines. They're RWX, since other threads may be running
+// earlier trampolines on a page while we write a new one.
+struct pool {
+  char *base;
+  int used;
+};
+static struct pool _pools[MAX_POOLS];
+static int _npools = 0;
+
+enum site_state {
+  SITE_NEW,
+  SITE_BUSY,
+  SITE_PATCHED,
+  SITE_TRAPPING,
+};
+
+// Open-addressed set of sites we've seen, keyed by the address just after the
+// syscall instruction.
+struct site {
+  uintptr_t rip;
+  int state;
+};
+static struct site _sites[MAX_SITES];
+
+static bool _enabled = false;
+// Held while writing trampolines and code. Only ever tried, never waited on:
+// we might be a nested trap on the thread that holds it.
+static int _lock = 0;
+
+void shim_patch_init() {
+  const char *env = getenv("SHIM_PATCH");
+  _enabled = env && strcmp(env, "0") != 0;
+  if (!_enabled) {
+    return;
+  }
+  // Without OSXSAVE we can't preserve the program's registers; don't patch.
+  unsigned a, b, c, d;
+  if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_OSXSAVE)) {
+    _enabled = false;
+    return;
+  }
+  __cpuid_count(0xd, 0, a, b, c, d);
+  _shim_patch_xsave_size = b + 64;
+  _shim_patch_stack_size = PATCH_STACK_SIZE + _shim_patch_xsave_size;
+  shim_altstack_reserve(_shim_patch_stack_size);
+}
+
+void shim_patch_thread_init(void *top) {
+  _shim_patch_stack = top;
+}
+
+static struct site* _get_site(uintptr_t rip) {
+  unsigned i = (rip * UINT64_C(0x9E3779B97F4A7C15)) >> 52;
+  for (int probe = 0; probe < MAX_SITES; ++probe, i = (i + 1) % MAX_SITES) {
+    uintptr_t expected = 0;
+    if (__atomic_compare_exchange_n(&_sites[i].rip, &expected, rip, false, __ATOMIC_ACQ_REL,
+                                    __ATOMIC_ACQUIRE) ||
+        expected == rip) {
+      return &_sites[i];
+    }
+  }
+  return NULL;
+}
+
+static bool _near(uintptr_t a, uintptr_t b) {
+  // Leave some slack under the 2 GiB reach of a rel32.
+  return (a > b ? a - b : b - a) < (UINT64_C(1) << 31) - (UINT64_C(1) << 20);
+}
+
+// A free trampoline slot within rel32 reach of `near`, or NULL.
+static char* _alloc_tramp(uintptr_t near) {
+  for (int i = 0; i < _npools; ++i) {
+    struct pool *p = &_pools[i];
+    if (p->used < POOL_SIZE / TRAMP_SIZE && _near((uintptr_t)p->base, near)) {
+      return p->base + TRAMP_SIZE * p->used++;
+    }
+  }
+  if (_npools == MAX_POOLS) {
+    return NULL;
+  }
+  // Look for free space a megabyte or more away, below and then above.
+  uintptr_t page = near & ~(uintptr_t)(POOL_SIZE - 1);
+  for (int i = 1; i < 2000; ++i) {
+    uintptr_t hint = i <= 1000 ? page - (uintptr_t)i * (1 << 20) : page + (uintptr_t)(i - 1000) * (1 << 20);
+    void *p = (void*)_syscall(SYS_mmap, hint, POOL_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if ((unsigned long)p > -4096UL) {
+      continue;
+    }
+    if ((uintptr_t)p != hint) {
+      // Old kernel that doesn't know MAP_FIXED_NOREPLACE, and took it as a hint.
+      _syscall(SYS_munmap, p, POOL_SIZE);
+      continue;
+    }
+    _pools[_npools] = (struct pool){.base = p, .used = 1};
+    return _pools[_npools++].base;
+  }
+  return NULL;
+}
+
+char* shim_patch_tramp(uintptr_t near) {
+  if (__atomic_exchange_n(&_lock, 1, __ATOMIC_ACQUIRE)) {
+    return NULL;
+  }
+  char *t = _alloc_tramp(near);
+  __atomic_store_n(&_lock, 0, __ATOMIC_RELEASE);
+  return t;
+}
+
+static void _put32(char *p, uint32_t v) {
+  memcpy(p, &v, 4);
+}
+
+static char* _write_tramp(char *t, const unsigned char *mov, uintptr_t resume) {
+  char *p = t;
+  memcpy(p, mov, 5);
+  p += 5;
+  memcpy(p, "\x48\x8d\x64\x24\x80", 5); // lea -0x80(%rsp),%rsp
+  p += 5;
+  memcpy(p, "\x49\xbb", 2); // movabs $shim_patch_entry,%r11
+  uint64_t entry = (uintptr_t)shim_patch_entry;
+  memcpy(p + 2, &entry, 8);
+  p += 10;
+  memcpy(p, "\x41\xff\xd3", 3); // call *%r11
+  p += 3;
+  memcpy(p, "\x48\x8d\xa4\x24\x80\x00\x00\x00", 8); // lea 0x80(%rsp),%rsp
+  p += 8;
+  *p = 0xe9; // jmp resume
+  _put32(p + 1, resume - (uintptr_t)(p + 5));
+  return t;
+}
+
+static bool _patchable_nr(long n) {
+  switch (n) {
+    case SYS_clone:
+    case SYS_clone3:
+    case SYS_fork:
+    case SYS_vfork:
+    case SYS_rt_sigreturn:
+      return false;
+    default:
+      return true;
+  }
+}
+
+// Tries to patch; returns whether it did.
+static bool _patch(long n, uintptr_t rip) {
+  const unsigned char *mov = (const unsigned char*)rip - 7;
+  uintptr_t word = (uintptr_t)mov & ~(uintptr_t)7;
+  if (!_patchable_nr(n) || (uintptr_t)mov - word > 3 ||
+      mov[5] != 0x0f || mov[6] != 0x05 || mov[0] != 0xb8) {
+    return false;
+  }
+  uint32_t imm;
+  memcpy(&imm, mov + 1, 4);
+  if (imm != n) {
+    return false;
+  }
+  // A prefix byte just before the b8 would mean it isn't an instruction by
+  // itself (e.g. 41 b8 is mov $imm,%r8d).
+  unsigned char before = mov[-1];
+  if ((before >= 0x40 && before <= 0x4f) || before == 0x66 || before == 0x67 ||
+      before == 0xf0 || before == 0xf2 || before == 0xf3 || before == 0x0f) {
+    return false;
+  }
+
+  char *t = _alloc_tramp(rip);
+  if (!t) {
+    return false;
+  }
+  _write_tramp(t, mov, rip);
+
+  // Text is normally r-x; we assume that's what it was, and put it back.
+  uintptr_t page = word & ~(uintptr_t)4095;
+  if (_syscall(SYS_mprotect, page, 4096, PROT_READ | PROT_WRITE | PROT_EXEC) != 0) {
+    return false;
+  }
+  uint64_t old = __atomic_load_n((uint64_t*)word, __ATOMIC_RELAXED), new;
+  unsigned char jmp[5] = {0xe9};
+  uint32_t rel = (uintptr_t)t - ((uintptr_t)mov + 5);
+  memcpy(jmp + 1, &rel, 4);
+  do {
+    new = old;
+    memcpy((char*)&new + ((uintptr_t)mov - word), jmp, 5);
+  } while (!__atomic_compare_exchange_n((uint64_t*)word, &old, new, false, __ATOMIC_SEQ_CST,
+                                        __ATOMIC_RELAXED));
+  _syscall(SYS_mprotect, page, 4096, PROT_READ | PROT_EXEC);
+  return true;
+}
+
+void shim_patch_site(long n, uintptr_t rip) {
+  if (!_enabled || rip == (uintptr_t)_shim_patch_trap) {
+    return;
+  }
+  struct site *site = _get_site(rip);
+  if (!site) {
+    return;
+  }
+  int expected = SITE_NEW;
+  if (!__atomic_compare_exchange_n(&site->state, &expected, SITE_BUSY, false, __ATOMIC_ACQ_REL,
+                                   __ATOMIC_RELAXED)) {
+    return;
+  }
+  if (__atomic_exchange_n(&_lock, 1, __ATOMIC_ACQUIRE)) {
+    // Someone's patching; try again next time.
+    __atomic_store_n(&site->state, SITE_NEW, __ATOMIC_RELEASE);
+    return;
+  }
+  bool patched = _patch(n, rip);
+  __atomic_store_n(&_lock, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&site->state, patched ? SITE_PATCHED : SITE_TRAPPING, __ATOMIC_RELEASE);
+  shim_stats_site(patched);
+}
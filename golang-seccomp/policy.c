@@ -0,0 +1,433 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../common/bpftree.h"
+#include "shim.h"
+#include "syscallnames.h"
+
+// Decides which syscalls the seccomp filter sends to our SIGSYS handler, and
+// compiles that into the filter.
+//
+// SHIM_POLICY=<path> reads a policy file, with one rule per line:
+//
+//   <syscall> <action>
+//   default <action>
+//
+// <syscall> is a name from syscallnames.h or a number, and # starts a comment.
+// <action> is one of:
+//
+//   allow      run natively; the shim never sees it
+//   trap       SIGSYS to our handler (the default)
+//   errno <E>  fail with E, by name (EPERM) or number
+//   notif      seccomp user notification. The listener fd is sent to the unix
+//              socket at SHIM_NOTIF_SOCK, which is required.
+//   remote     trap, and forward to the controller at SHIM_CHANNEL (see
+//              channel.c), which is required
+//   remote-async
+//              like remote, but don't wait for the answer; the program gets
+//              the byte count it asked for. Only for write and pwrite64.
+//   hybrid     trap, and decide from the arguments whether to forward it, answer
+//              it ourselves, or pass it through (see hybrid.c). Needs
+//              SHIM_CHANNEL too
+//
+// Without a policy everything traps. Regardless of policy, rt_sigreturn and
+// sigaltstack are always allowed (our handler needs them), and rt_sigaction,
+// rt_sigprocmask, exit and exit_group always trap (so that SIGSYS can't be
+// replaced or blocked, and so that we get to flush stats at exit).
+//
+// SHIM_LEARN=<path> traps everything and, when the process exits, writes a
+// policy to <path> that allows every syscall our handler passed through
+// unchanged and traps the ones it had to change, plus anything never seen. If
+// <path> already exists it's merged in, so repeated runs of a workload, and
+// forked children, accumulate into one policy.
+
+#define POLICY_NR 512
+
+// SECCOMP_RET_* for each syscall number below POLICY_NR, or UNSET to use the
+// default.
+#define UNSET UINT32_MAX
+// Traps, marked (in SECCOMP_RET_DATA, which the handler gets as si_errno) for
+// forwarding.
+#define REMOTE (SECCOMP_RET_TRAP | 1)
+#define REMOTE_ASYNC (SECCOMP_RET_TRAP | 2)
+#define HYBRID (SECCOMP_RET_TRAP | 3)
+static uint32_t _actions[POLICY_NR];
+static uint32_t _default_action = SECCOMP_RET_TRAP;
+
+// SHIM_LEARN state. Shared with forked children, so that their syscalls count.
+struct learned {
+  uint64_t passed[POLICY_NR];
+  uint64_t emulated[POLICY_NR];
+};
+static struct learned *_learned = NULL;
+static const char *_learn_path = NULL;
+static pid_t _learn_pid = 0;
+
+static char _text[1 << 16];
+
+// Bounds of the section holding `_syscall`, courtesy of the linker.
+extern char __start_shim_syscall[] SHIM_HIDDEN;
+extern char __stop_shim_syscall[] SHIM_HIDDEN;
+
+static long _syscall_nr(const char *s) {
+  char *end;
+  long nr = strtol(s, &end, 0);
+  if (*s && *end == '\0') {
+    return nr >= 0 ? nr : -1;
+  }
+  for (long i = 0; i < SYSCALL_NAMES_LEN; ++i) {
+    if (syscall_names[i] && strcmp(syscall_names[i], s) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static long _errno_value(const char *s) {
+  char *end;
+  long e = strtol(s, &end, 0);
+  if (*s && *end == '\0') {
+    return e > 0 && e <= SECCOMP_RET_DATA ? e : -1;
+  }
+  for (int i = 1; i < 4096; ++i) {
+    const char *name = strerrorname_np(i);
+    if (name && strcmp(name, s) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static char* _next_word(char **p) {
+  while (**p == ' ' || **p == '\t') {
+    ++*p;
+  }
+  if (**p == '\0') {
+    return NULL;
+  }
+  char *word = *p;
+  while (**p && **p != ' ' && **p != '\t') {
+    ++*p;
+  }
+  if (**p) {
+    *(*p)++ = '\0';
+  }
+  return word;
+}
+
+// Parses policy `text` in place, calling `rule` for each rule, with nr -1 for
+// `default`. Safe to use inside the handler. Returns 0, or the number of the
+// first line that didn't parse.
+static int _parse(char *text, void (*rule)(long nr, uint32_t action)) {
+  int lineno = 0;
+  char *line = text;
+  while (line) {
+    ++lineno;
+    char *next = strchr(line, '\n');
+    if (next) {
+      *next++ = '\0';
+    }
+    char *comment = strchr(line, '#');
+    if (comment) {
+      *comment = '\0';
+    }
+
+    char *p = line;
+    char *syscall = _next_word(&p);
+    char *action = _next_word(&p);
+    char *arg = _next_word(&p);
+    line = next;
+    if (syscall == NULL) {
+      continue;
+    }
+    if (action == NULL) {
+      return lineno;
+    }
+
+    long nr = strcmp(syscall, "default") == 0 ? -1 : _syscall_nr(syscall);
+    uint32_t a;
+    long e;
+    if (strcmp(action, "allow") == 0 && !arg) {
+      a = SECCOMP_RET_ALLOW;
+    } else if (strcmp(action, "trap") == 0 && !arg) {
+      a = SECCOMP_RET_TRAP;
+    } else if (strcmp(action, "notif") == 0 && !arg) {
+      a = SECCOMP_RET_USER_NOTIF;
+    } else if (strcmp(action, "remote") == 0 && !arg) {
+      a = REMOTE;
+    } else if (strcmp(action, "remote-async") == 0 && !arg &&
+               (nr == SYS_write || nr == SYS_pwrite64)) {
+      // Nothing else has a result we can guess without the controller.
+      a = REMOTE_ASYNC;
+    } else if (strcmp(action, "hybrid") == 0 && !arg) {
+      a = HYBRID;
+    } else if (strcmp(action, "errno") == 0 && arg && (e = _errno_value(arg)) > 0) {
+      a = SECCOMP_RET_ERRNO | e;
+    } else {
+      return lineno;
+    }
+    if (nr == -1 && strcmp(syscall, "default") != 0) {
+      return lineno;
+    }
+    if (_next_word(&p)) {
+      return lineno;
+    }
+    rule(nr, a);
+  }
+  return 0;
+}
+
+// Reads `path` into _text with raw syscalls. Returns false if it doesn't exist
+// or can't be read.
+static bool _read_text(const char *path) {
+  int fd = _syscall(SYS_openat, AT_FDCWD, path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  size_t len = 0;
+  long rv = 0;
+  while (len < sizeof(_text) - 1 &&
+         (rv = _syscall(SYS_read, fd, _text + len, sizeof(_text) - 1 - len)) > 0) {
+    len += rv;
+  }
+  _syscall(SYS_close, fd);
+  _text[len] = '\0';
+  return rv >= 0;
+}
+
+static void _policy_rule(long nr, uint32_t action) {
+  if (nr < 0) {
+    _default_action = action;
+  } else if (nr < POLICY_NR) {
+    _actions[nr] = action;
+  }
+}
+
+static void _load_policy(const char *path) {
+  if (!_read_text(path)) {
+    fprintf(stderr, "seccomp.so: couldn't read policy %s\n", path);
+    abort();
+  }
+  int bad = _parse(_text, _policy_rule);
+  if (bad) {
+    fprintf(stderr, "seccomp.so: %s:%d: bad rule\n", path, bad);
+    abort();
+  }
+}
+
+// Sends the notification listener to whoever's listening at SHIM_NOTIF_SOCK.
+static void _send_listener(int sock, int listener) {
+  char buf[CMSG_SPACE(sizeof(int))] = {0}, c = 'c';
+  struct iovec io = {.iov_base = &c, .iov_len = 1};
+  struct msghdr msg = {
+    .msg_iov = &io,
+    .msg_iovlen = 1,
+    .msg_control = buf,
+    .msg_controllen = sizeof(buf),
+  };
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &listener, sizeof(int));
+  // We're filtered by now, so don't go through libc.
+  if (_syscall(SYS_sendmsg, sock, &msg, 0) < 0) {
+    abort();
+  }
+}
+
+static int _connect_notif_sock() {
+  const char *path = getenv("SHIM_NOTIF_SOCK");
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (path == NULL || strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "seccomp.so: policy uses notif, but SHIM_NOTIF_SOCK isn't set\n");
+    abort();
+  }
+  strcpy(addr.sun_path, path);
+  int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (sock < 0 || connect(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    perror("seccomp.so: SHIM_NOTIF_SOCK");
+    abort();
+  }
+  return sock;
+}
+
+void shim_policy_load() {
+  const char *policy = getenv("SHIM_POLICY");
+  _learn_path = getenv("SHIM_LEARN");
+  for (int i = 0; i < POLICY_NR; ++i) {
+    _actions[i] = UNSET;
+  }
+  if (_learn_path && _learn_path[0]) {
+    // Learn from everything.
+    _learned = mmap(NULL, sizeof(*_learned), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                    -1, 0);
+    if (_learned == MAP_FAILED) {
+      abort();
+    }
+    _learn_pid = getpid();
+  } else if (policy && policy[0]) {
+    _load_policy(policy);
+  }
+  for (int i = 0; i < POLICY_NR; ++i) {
+    if (_actions[i] == UNSET) {
+      _actions[i] = _default_action;
+    }
+  }
+
+  _actions[SYS_rt_sigreturn] = SECCOMP_RET_ALLOW;
+  _actions[SYS_sigaltstack] = SECCOMP_RET_ALLOW;
+  _actions[SYS_rt_sigaction] = SECCOMP_RET_TRAP;
+  _actions[SYS_rt_sigprocmask] = SECCOMP_RET_TRAP;
+  _actions[SYS_exit] = SECCOMP_RET_TRAP;
+  _actions[SYS_exit_group] = SECCOMP_RET_TRAP;
+}
+
+void shim_policy_install() {
+
+  bool notif = _default_action == SECCOMP_RET_USER_NOTIF;
+  for (int i = 0; i < POLICY_NR; ++i) {
+    notif |= _actions[i] == SECCOMP_RET_USER_NOTIF;
+  }
+  int sock = notif ? _connect_notif_sock() : -1;
+
+  // Our handler makes its real syscalls through `_syscall`, which the linker
+  // places in a section of its own; syscalls from there never trap.
+  static struct bpftree tree;
+  tree.exempt_lo = (uintptr_t)__start_shim_syscall;
+  tree.exempt_hi = (uintptr_t)__stop_shim_syscall;
+  static struct bpftree_run runs[POLICY_NR + 1];
+  int nruns = bpftree_runs(_actions, POLICY_NR, _default_action, runs);
+  if (bpftree_compile(&tree, runs, nruns) != 0) {
+    fprintf(stderr, "seccomp.so: couldn't compile the seccomp filter\n");
+    abort();
+  }
+  struct sock_fprog prog = {
+    .len = (unsigned short)tree.len,
+    .filter = tree.insns,
+  };
+
+  // Install the seccomp filter.
+  unsigned flags = SECCOMP_FILTER_FLAG_SPEC_ALLOW | (notif ? SECCOMP_FILTER_FLAG_NEW_LISTENER : 0);
+  long rv = syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER, flags, &prog);
+  if (rv < 0) {
+    abort();
+  }
+  if (notif) {
+    _send_listener(sock, rv);
+    _syscall(SYS_close, rv);
+    _syscall(SYS_close, sock);
+  }
+}
+
+void shim_policy_learn(long n, bool emulated) {
+  if (!_learned || n < 0 || n >= POLICY_NR) {
+    return;
+  }
+  __atomic_fetch_add(emulated ? &_learned->emulated[n] : &_learned->passed[n], 1,
+                     __ATOMIC_RELAXED);
+}
+
+bool shim_policy_traps(long n) {
+  return n >= 0 && n < POLICY_NR && (_actions[n] & SECCOMP_RET_ACTION_FULL) == SECCOMP_RET_TRAP;
+}
+
+bool shim_policy_remote(long n, bool *async) {
+  if (n < 0 || n >= POLICY_NR || (_actions[n] != REMOTE && _actions[n] != REMOTE_ASYNC)) {
+    return false;
+  }
+  *async = _actions[n] == REMOTE_ASYNC;
+  return true;
+}
+
+bool shim_policy_hybrid(long n) {
+  return n >= 0 && n < POLICY_NR && _actions[n] == HYBRID;
+}
+
+bool shim_policy_remote_used() {
+  for (int i = 0; i < POLICY_NR; ++i) {
+    if (_actions[i] == REMOTE || _actions[i] == REMOTE_ASYNC || _actions[i] == HYBRID) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// What the existing learned policy says, while merging.
+static uint8_t _prior[POLICY_NR];
+
+static void _prior_rule(long nr, uint32_t action) {
+  if (nr >= 0 && nr < POLICY_NR) {
+    _prior[nr] = action == SECCOMP_RET_ALLOW ? 1 : 2;
+  }
+}
+
+void shim_policy_exit() {
+  // Forked children share _learned; leave the writing to the process that
+  // made it.
+  if (!_learned || _syscall(SYS_getpid) != _learn_pid) {
+    return;
+  }
+  if (_read_text(_learn_path)) {
+    _parse(_text, _prior_rule);
+  }
+
+  // Write it next to the destination and rename into place, so that a
+  // concurrent reader never sees half a policy.
+  struct shim_outbuf out = {.fd = -1};
+  shim_out_str(&out, _learn_path);
+  shim_out_str(&out, ".tmp.");
+  shim_out_u64(&out, _learn_pid, 0);
+  char tmp[256];
+  if (out.len >= sizeof(tmp)) {
+    return;
+  }
+  memcpy(tmp, out.buf, out.len);
+  tmp[out.len] = '\0';
+  int fd = _syscall(SYS_openat, AT_FDCWD, tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return;
+  }
+
+  out = (struct shim_outbuf){.fd = fd};
+  shim_out_str(&out, "# Written by seccomp.so with SHIM_LEARN. Counts are from the last run.\n");
+  shim_out_str(&out, "default trap\n");
+  for (int n = 0; n < POLICY_NR; ++n) {
+    uint64_t passed = _learned->passed[n], emulated = _learned->emulated[n];
+    if (!passed && !emulated && !_prior[n]) {
+      continue;
+    }
+    const char *name = n < SYSCALL_NAMES_LEN ? syscall_names[n] : NULL;
+    if (name) {
+      shim_out_str_padded(&out, name, 24);
+    } else {
+      shim_out_u64(&out, n, 0);
+      shim_out_char(&out, ' ');
+    }
+    shim_out_str(&out, emulated || _prior[n] == 2 ? "trap " : "allow");
+    shim_out_str(&out, "  #");
+    shim_out_u64(&out, passed + emulated, 10);
+    if (emulated) {
+      shim_out_str(&out, " (");
+      shim_out_u64(&out, emulated, 0);
+      shim_out_str(&out, " emulated)");
+    }
+    shim_out_char(&out, '\n');
+  }
+  shim_out_flush(&out);
+  _syscall(SYS_close, fd);
+  _syscall(SYS_rename, tmp, _learn_path);
+}
@@ -0,0 +1,56 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include "shim.h"
+
+// Reads and writes of the program's memory, for syscall arguments that point
+// into it. The kernel fails a bad pointer with EFAULT; if we dereferenced it
+// ourselves in the handler, we'd take the whole process down with SIGSEGV.
+// process_vm_readv and process_vm_writev on ourselves do the copy with the
+// kernel's checks, at the cost of a syscall.
+
+#define PAGE 4096
+
+static long _vm(long n, void *local, const void *remote, size_t len) {
+  struct iovec l = {.iov_base = local, .iov_len = len};
+  struct iovec r = {.iov_base = (void*)remote, .iov_len = len};
+  return _syscall(n, _syscall(SYS_getpid), &l, 1, &r, 1, 0);
+}
+
+long shim_progmem_read(void *to, const void *from, size_t len) {
+  if (len == 0) {
+    return 0;
+  }
+  return _vm(SYS_process_vm_readv, to, from, len) == (long)len ? 0 : -EFAULT;
+}
+
+long shim_progmem_write(void *to, const void *from, size_t len) {
+  if (len == 0) {
+    return 0;
+  }
+  return _vm(SYS_process_vm_writev, (void*)from, to, len) == (long)len ? 0 : -EFAULT;
+}
+
+long shim_progmem_string(char *to, const char *from, size_t max) {
+  size_t len = 0;
+  while (len < max) {
+    // A page at a time, so that a string that ends just before an unmapped
+    // page doesn't fail.
+    size_t chunk = PAGE - ((uintptr_t)(from + len) % PAGE);
+    if (chunk > max - len) {
+      chunk = max - len;
+    }
+    if (_vm(SYS_process_vm_readv, to + len, from + len, chunk) != (long)chunk) {
+      return -EFAULT;
+    }
+    for (size_t end = len + chunk; len < end; ++len) {
+      if (to[len] == '\0') {
+        return len;
+      }
+    }
+  }
+  return -ENAMETOOLONG;
+}
@@ -1,6 +1,5 @@
 #define _GNU_SOURCE
 
-#include <assert.h>
 #include <dlfcn.h>
 #include <linux/filter.h>
 #include <linux/seccomp.h>
@@ -18,18 +17,17 @@
 #include <sys/ucontext.h>
 #include <unistd.h>
 
-#ifndef SS_AUTODISARM
-#define SS_AUTODISARM (1U << 31)
-#endif
+#include "../common/sysdispatch.h"
+#include "shim.h"
 
 static void _handle_sigsys(int signo, siginfo_t* info, void* voidUcontext);
 
-static void *_clone_rip = NULL;
-
-// Same API as libc's syscall(2), but our seccomp filter below ignores syscalls
+// Same API as libc's syscall(2), but our seccomp filter ignores syscalls
 // made from this function. e.g. our our seccomp signal handler uses this to
-// make syscalls without recursively trapping.
-static long _syscall(long n, ...) {
+// make syscalls without recursively trapping. The filter finds it by the
+// bounds of its section (see policy.c), so nothing else goes in there.
+__attribute__((section("shim_syscall"), noinline))
+long _syscall(long n, ...) {
     va_list args;
     va_start(args, n);
     long arg1 = va_arg(args, long);
@@ -41,54 +39,34 @@ static long _syscall(long n, ...) {
     va_end(args);
 
     long rv;
-    if (n == SYS_clone) {
-      // Grab original instruction pointer of the clone syscall
-      void* clone_rip = _clone_rip;
-      _clone_rip = NULL;
-      assert(clone_rip);
-
-      // Make the syscall, but in the child we can't return, since we're running on a new stack.
-      // Instead, *jump*.
-      register long r10 __asm__("r10") = arg4;
-      register long r8 __asm__("r8") = arg5;
-      // Put clone_rip in a callee-saved register
-      register long r9 __asm__("r9") = (long)clone_rip;
-      __asm__ __volatile__("syscall\n"
-                           "cmp $0, %%rax\n"
-                           "jne shim_native_syscallv_out\n"
-                           "jmp *%%r9\n"
-                           "shim_native_syscallv_out:\n"
-                           : "=a"(rv)
-                           : "a"(n), "D"(arg1), "S"(arg2), "d"(arg3), "r"(r10), "r"(r8),
-                             "r"(r9)
-                           : "rcx", "r11", "memory");
-    } else {
-      register long r10 __asm__("r10") = arg4;
-      register long r8 __asm__("r8") = arg5;
-      register long r9 __asm__("r9") = arg6;
-      __asm__ __volatile__("syscall"
-                           : "=a"(rv)
-                           : "a"(n), "D"(arg1), "S"(arg2), "d"(arg3), "r"(r10), "r"(r8), "r"(r9)
-                           : "rcx", "r11", "memory");
-    }
+    register long r10 __asm__("r10") = arg4;
+    register long r8 __asm__("r8") = arg5;
+    register long r9 __asm__("r9") = arg6;
+    __asm__ __volatile__("syscall"
+                         : "=a"(rv)
+                         : "a"(n), "D"(arg1), "S"(arg2), "d"(arg3), "r"(r10), "r"(r8), "r"(r9)
+                         : "rcx", "r11", "memory");
     return rv;
 }
 
 // One-time initialization per thread.
 static void _init_thread() {
-  static __thread char stack_buf[8 * 1<<20];
-  stack_t stack = {
-    .ss_sp = stack_buf,
-    .ss_size = sizeof(stack_buf),
-    .ss_flags = SS_AUTODISARM,
-  };
-  if (sigaltstack(&stack, NULL) != 0) {
-    abort();
-  }
+  shim_patch_thread_init(shim_altstack_thread_init());
 }
 
+// The process whose exit dumps stats, writes the learned policy and so on.
+// vfork children share our memory, and must leave all that to us.
+static pid_t _owner_pid;
+
 // One-time initialization per process.
 static void _init_process() {
+  _owner_pid = _syscall(SYS_getpid);
+  shim_stats_init();
+  shim_trace_init();
+  shim_patch_init();
+  shim_clock_init();
+  shim_altstack_init();
+
   // Install a signal handler for SIGSYS. This will get invoked via our seccomp
   // filter, which we install below.
   if (sigaction(SIGSYS,
@@ -105,52 +83,14 @@ static void _init_process() {
       abort();
   }
 
-  // Seccomp filter we're going to install.
-  struct sock_filter filter[] = {
-        /* accumulator := syscall number */
-        BPF_STMT(BPF_LD + BPF_W + BPF_ABS, offsetof(struct seccomp_data, nr)),
-
-        /* Always allow sigreturn; otherwise we'd crash returning from our signal handler. */
-        BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, SYS_rt_sigreturn, /*true-skip=*/0, /*false-skip=*/1),
-        BPF_STMT(BPF_RET + BPF_K, SECCOMP_RET_ALLOW),
-
-        /* Always allow sigaltstack; we can't call it from the signal handler */
-        BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, SYS_sigaltstack, /*true-skip=*/0, /*false-skip=*/1),
-        BPF_STMT(BPF_RET + BPF_K, SECCOMP_RET_ALLOW),
-
-        /* XXX allow clone. we'll need to handle it specially, but skip for now. */
-        //BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, SYS_clone, /*true-skip=*/0, /*false-skip=*/1),
-        //BPF_STMT(BPF_RET + BPF_K, SECCOMP_RET_ALLOW),
-
-        /* See if instruction pointer is within the _syscall fn. */
-        /* accumulator := instruction_pointer */
-        BPF_STMT(BPF_LD + BPF_W + BPF_ABS, offsetof(struct seccomp_data, instruction_pointer)),
-        /* If it's in `_syscall`, allow. We don't know the end address, but it
-         * should be safe-ish to check if it's within a kilobyte or so. We know there are no
-         * other syscall instructions within this library, so the only problem would be if
-         * shim_native_syscallv ended up at the very end of the library object, and a syscall
-         * ended up being made from the very beginning of another library object, loaded just
-         * after ours.
-         *
-         * TODO: Consider using the actual bounds of this object file, from /proc/self/maps. */
-        BPF_JUMP(BPF_JMP + BPF_JGT + BPF_K, ((long)_syscall) + 2000,
-                 /*true-skip=*/2, /*false-skip=*/0),
-        BPF_JUMP(BPF_JMP + BPF_JGE + BPF_K, (long)_syscall, /*true-skip=*/0,
-                 /*false-skip=*/1),
-        BPF_STMT(BPF_RET + BPF_K, SECCOMP_RET_ALLOW),
-
-        /* Trap to our syscall handler */
-        BPF_STMT(BPF_RET + BPF_K, SECCOMP_RET_TRAP),
-      };
-        struct sock_fprog prog = {
-        .len = (unsigned short)(sizeof(filter) / sizeof(filter[0])),
-        .filter = filter,
-    };
-
-    // Install the seccomp filter.
-    if (syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER, SECCOMP_FILTER_FLAG_SPEC_ALLOW, &prog)) {
-        abort();
-    }
+  // Compile our policy into a seccomp filter, and install it. Whatever depends
+  // on the policy sets itself up in between.
+  shim_policy_load();
+  shim_idcache_init();
+  shim_hybrid_init();
+  shim_channel_init();
+  shim_signals_init();
+  shim_policy_install();
 }
 
 // Ensure that our initialization has been done in the current process and thread.
@@ -162,8 +102,132 @@ static void _ensure_initd() {
   pthread_once(&init_thread_once, _init_thread);
 }
 
+// How we make syscalls that go to the kernel, by number (see
+// ../common/sysdispatch.h). `ctx` is the program's registers, or NULL at a
+// patched site.
+static long _kernel_default(void *ctx, long n, long a[6]) {
+  return _syscall(n, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+// Don't allow overwriting the SIGSYS handler.
+static long _kernel_rt_sigaction(void *ctx, int sig, const void *act, void *oldact, size_t size) {
+  return _syscall(SYS_rt_sigaction, sig, sig == SIGSYS ? NULL : act, oldact, size);
+}
+
+// Don't allow masking SIGSYS.
+static long _kernel_rt_sigprocmask(void *ctx, int how, const uint64_t *set, uint64_t *oldset,
+                                   size_t size) {
+  uint64_t alt_set;
+  if (set != NULL && (how == SIG_BLOCK || how == SIG_SETMASK)) {
+    alt_set = *set & ~(UINT64_C(1) << (SIGSYS - 1));
+    set = &alt_set;
+  }
+  return _syscall(SYS_rt_sigprocmask, how, set, oldset, size);
+}
+
+// May return in the child in the program's context, not here.
+static long _kernel_clone(void *ctx, long n, long a[6]) {
+  return ctx ? shim_clone_syscall(n, a, ctx) : _kernel_default(ctx, n, a);
+}
+
+#define KERNEL_SYSCALLS(TYPED, RAW, p) \
+  TYPED(p, rt_sigaction) \
+  TYPED(p, rt_sigprocmask) \
+  RAW(p, clone, _kernel_clone) \
+  RAW(p, clone3, _kernel_clone) \
+  RAW(p, vfork, _kernel_clone)
+
+SYSDISPATCH_TABLE(_kernel, KERNEL_SYSCALLS, _kernel_default)
+
+// Does the syscall `n` for the program, by way of either a trap (with the
+// program's context in `uc`) or a patched site. `start` is when we got
+// control, for stats.
+static long _dispatch(long n, long args[6], uint64_t start, ucontext_t *uc) {
+  bool patched = uc == NULL;
+  const greg_t *gregs = uc ? uc->uc_mcontext.gregs : NULL;
+
+  // What the program asked for, before we alter anything below.
+  long orig_args[6];
+  memcpy(orig_args, args, sizeof(orig_args));
+
+  // Syscalls that we answer ourselves, without the kernel.
+  long cached;
+  bool hit = shim_idcache_lookup(n, args, &cached) || shim_hybrid_local(n, args, &cached);
+  bool signals = !hit && shim_signals_emulates(n, args);
+  bool local = hit || signals || shim_clock_emulates(n, args);
+  // Or that the controller answers.
+  bool async;
+  bool remote = !local && (shim_policy_remote(n, &async) || shim_hybrid_remote(n, args, &async));
+
+  shim_policy_learn(n, local || memcmp(args, orig_args, sizeof(orig_args)) != 0);
+
+  if (n == SYS_exit || n == SYS_exit_group) {
+    // These don't return, so account for them now.
+    shim_trace_record_entry(n, orig_args, start);
+    shim_stats_record(n, shim_rdtsc() - start, 0, patched, SHIM_ROUTE_KERNEL);
+    if (n == SYS_exit) {
+      shim_channel_thread_exit();
+      shim_trace_thread_exit();
+      shim_stats_thread_exit();
+      shim_signals_thread_exit();
+    } else if (_syscall(SYS_getpid) == _owner_pid) {
+      shim_signals_exit();
+      shim_channel_exit();
+      shim_trace_exit();
+      shim_stats_exit();
+      shim_policy_exit();
+    }
+  } else if (n == SYS_execve || n == SYS_execveat) {
+    // Only returns on failure, in which case we'll record it again below.
+    shim_trace_record_entry(n, orig_args, start);
+  }
+
+  // Make the syscall (possibly with altered parameters), using our own syscall
+  // function that won't trap again.
+  uint64_t syscall_start = shim_rdtsc();
+  long rv;
+  if (hit) {
+    rv = cached;
+  } else if (signals) {
+    rv = shim_signals_syscall(n, args, uc);
+  } else if (local) {
+    rv = shim_clock_syscall(n, args);
+  } else {
+    // Signals can interrupt whatever blocks in here.
+    shim_signals_enter(n, args, uc);
+    if (remote) {
+      rv = shim_channel_syscall(n, args, async);
+    } else {
+      rv = sysdispatch(_kernel_table, (void*)gregs, n, args);
+    }
+    shim_signals_leave(n, args, rv);
+  }
+  uint64_t syscall_end = shim_rdtsc();
+  if (!hit) {
+    shim_idcache_update(n, args, rv);
+  }
+  if (remote) {
+    shim_hybrid_update(n, args, rv);
+  }
+  if (rv == 0 && (n == SYS_fork || shim_clone_is_clone(n))) {
+    // Only the child of a fork gets back here with 0.
+    _owner_pid = _syscall(SYS_getpid);
+  }
+  shim_trace_record(n, orig_args, rv, start, syscall_end);
+  shim_stats_record(n, (syscall_start - start) + (shim_rdtsc() - syscall_end),
+                    syscall_end - syscall_start, patched,
+                    local ? SHIM_ROUTE_LOCAL : remote ? SHIM_ROUTE_REMOTE : SHIM_ROUTE_KERNEL);
+  return rv;
+}
+
+void shim_forked() {
+  _owner_pid = _syscall(SYS_getpid);
+  shim_idcache_forked();
+}
+
 // Handle traps from our seccomp filter.
 static void _handle_sigsys(int signo, siginfo_t* info, void* voidUcontext) {
+  uint64_t start = shim_rdtsc();
   _ensure_initd();
 
   ucontext_t* ctx = (ucontext_t*)(voidUcontext);
@@ -173,41 +237,26 @@ static void _handle_sigsys(int signo, siginfo_t* info, void* voidUcontext) {
   // char use_stack[100000];
   // (void)use_stack;
 
-  char buf[100];
-  // XXX not really signal-safe. (Thanks, locales).
-  sprintf(buf, "Trapped syscall %lld\n", regs[REG_RAX]);
-  _syscall(SYS_write, 2, buf, strlen(buf));
-
   long n = regs[REG_RAX];
   long args[6] = {regs[REG_RDI], regs[REG_RSI], regs[REG_RDX], regs[REG_R10], regs[REG_R8], regs[REG_R9]};
 
-  // Don't allow overwriting the SIGSYS handler.
-  if (n == SYS_rt_sigaction && args[0] == SIGSYS) {
-    args[1] = 0;
-  }
+  // With SHIM_PATCH, make this site skip the trap next time.
+  shim_patch_site(n, regs[REG_RIP]);
 
-  // Don't allow masking SIGSYS.
-  // Using implementation details of the kernel's definition of sigset (as a 64 bit bitfield) here.
-  // Careful not to mutate the passed in pointer, which would break const correctness.
-  uint64_t alt_sigset;
-  if (n == SYS_rt_sigprocmask) {
-    int how = args[0];
-    const uint64_t *set = (const uint64_t*)args[1];
-    if (set != NULL && (how == SIG_BLOCK || how == SIG_SETMASK)) {
-      alt_sigset = *set & ~(UINT64_C(1)<<(SIGSYS-1));
-      args[1] = (long)&alt_sigset;
-    }
-  }
-
-  if (n == SYS_clone) {
-    // Save instruction pointer so we can jump back to it after making the real syscall.
-    assert(_clone_rip == NULL);
-    _clone_rip = (void*)regs[REG_RIP];
-  }
+  regs[REG_RAX] = _dispatch(n, args, start, ctx);
+  // Signals that came up meanwhile, or that the syscall unblocked.
+  shim_signals_deliver(ctx);
+}
 
-  // Make the syscall that trapped (possibly with altered parameters), using
-  // our own syscall function that won't trap again.
-  regs[REG_RAX] = _syscall(n, args[0], args[1], args[2], args[3], args[4], args[5]);
+// Called from syscall sites patched by patch.c.
+long shim_patch_dispatch(long n, long args[6]) {
+  uint64_t start = shim_rdtsc();
+  _ensure_initd();
+  long a[6];
+  memcpy(a, args, sizeof(a));
+  long rv = _dispatch(n, a, start, NULL);
+  shim_signals_deliver(NULL);
+  return rv;
 }
 
 // Use a global constructor to initialize ourselves near the beginning of process start.
@@ -0,0 +1,212 @@
+// Internal interfaces shared between the pieces of seccomp.so.
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <sys/ucontext.h>
+#include <time.h>
+#include <x86intrin.h>
+
+#define SHIM_HIDDEN __attribute__((visibility("hidden")))
+
+#define SHIM_STR_(x) #x
+#define SHIM_STR(x) SHIM_STR_(x)
+
+// Same API as libc's syscall(2), except that it returns -errno instead of
+// setting errno, and our seccomp filter allows syscalls made from it. Anything
+// running inside the SIGSYS handler must use this instead of libc to avoid
+// recursively trapping.
+SHIM_HIDDEN long _syscall(long n, ...);
+
+// Timestamp for measuring intervals. Cheap, and doesn't make a syscall.
+static inline uint64_t shim_rdtsc() {
+  return __rdtsc();
+}
+
+// CLOCK_MONOTONIC, read with a real syscall.
+static inline uint64_t shim_monotonic_ns() {
+  struct timespec ts;
+  _syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+// outbuf.c: minimal async-signal-safe output buffering, flushed with _syscall.
+struct shim_outbuf {
+  int fd;
+  size_t len;
+  char buf[512];
+};
+SHIM_HIDDEN void shim_out_flush(struct shim_outbuf *out);
+SHIM_HIDDEN void shim_out_char(struct shim_outbuf *out, char c);
+SHIM_HIDDEN void shim_out_str(struct shim_outbuf *out, const char *s);
+// Right-aligns `v` in a field of `width` characters.
+SHIM_HIDDEN void shim_out_u64(struct shim_outbuf *out, uint64_t v, int width);
+// Left-aligns `s` in a field of `width` characters.
+SHIM_HIDDEN void shim_out_str_padded(struct shim_outbuf *out, const char *s, int width);
+
+// progmem.c: copies to and from the program's memory that fail with -EFAULT
+// on bad pointers, rather than faulting in the handler. Return 0 or -EFAULT.
+SHIM_HIDDEN long shim_progmem_read(void *to, const void *from, size_t len);
+SHIM_HIDDEN long shim_progmem_write(void *to, const void *from, size_t len);
+// Copies a NUL-terminated string of at most `max` bytes, NUL included.
+// Returns its length, -EFAULT, or -ENAMETOOLONG.
+SHIM_HIDDEN long shim_progmem_string(char *to, const char *from, size_t max);
+
+// Where a syscall we handled was answered.
+enum shim_route {
+  SHIM_ROUTE_KERNEL,
+  // By us, without the kernel.
+  SHIM_ROUTE_LOCAL,
+  // By the controller, over the channel.
+  SHIM_ROUTE_REMOTE,
+};
+
+// stats.c
+SHIM_HIDDEN void shim_stats_init();
+// Account for one trapped syscall, or one from a patched site.
+SHIM_HIDDEN void shim_stats_record(long n, uint64_t handler_cycles, uint64_t syscall_cycles,
+                                   bool patched, enum shim_route route);
+// Account for a syscall site that we patched, or gave up on patching.
+SHIM_HIDDEN void shim_stats_site(bool patched);
+// Call just before the current thread exits.
+SHIM_HIDDEN void shim_stats_thread_exit();
+// Call just before the process exits. Dumps the stats to stderr.
+SHIM_HIDDEN void shim_stats_exit();
+
+// trace.c
+SHIM_HIDDEN void shim_trace_init();
+// Record one trapped syscall that returned `ret`.
+SHIM_HIDDEN void shim_trace_record(long n, const long args[6], long ret, uint64_t start_tsc,
+                                   uint64_t end_tsc);
+// Record a syscall that won't return, or might not.
+SHIM_HIDDEN void shim_trace_record_entry(long n, const long args[6], uint64_t start_tsc);
+// Call just before the current thread exits.
+SHIM_HIDDEN void shim_trace_thread_exit();
+// Call just before the process exits.
+SHIM_HIDDEN void shim_trace_exit();
+
+// policy.c
+// Reads our policy (see SHIM_POLICY).
+SHIM_HIDDEN void shim_policy_load();
+// Compiles the policy into a seccomp filter and installs it. From here on, the
+// thread making the call can't use libc for syscalls.
+SHIM_HIDDEN void shim_policy_install();
+// With SHIM_LEARN, note that syscall `n` trapped, and whether we had to change
+// it.
+SHIM_HIDDEN void shim_policy_learn(long n, bool emulated);
+// Call just before the process exits. Writes the learned policy.
+SHIM_HIDDEN void shim_policy_exit();
+// Whether the installed filter traps syscall `n` (rather than allowing it,
+// failing it, or passing it to a supervisor).
+SHIM_HIDDEN bool shim_policy_traps(long n);
+// Whether the policy forwards syscall `n` to the controller, and if so,
+// whether without waiting for the answer.
+SHIM_HIDDEN bool shim_policy_remote(long n, bool *async);
+// Whether syscall `n` is routed per call by hybrid.c.
+SHIM_HIDDEN bool shim_policy_hybrid(long n);
+// Whether anything might be forwarded to the controller.
+SHIM_HIDDEN bool shim_policy_remote_used();
+
+// patch.c
+SHIM_HIDDEN void shim_patch_init();
+// With SHIM_PATCH, try to rewrite the syscall instruction that just trapped
+// with syscall `n`, so that it calls shim_patch_dispatch directly from now on.
+SHIM_HIDDEN void shim_patch_site(long n, uintptr_t rip);
+// Gives the current thread the stack with top `top` to run patched sites on.
+// With NULL, they trap instead.
+SHIM_HIDDEN void shim_patch_thread_init(void *top);
+// A 64-byte slot of RWX memory within rel32 reach of `near`, or NULL.
+SHIM_HIDDEN char* shim_patch_tramp(uintptr_t near);
+// seccomp.c: entry point for patched sites.
+SHIM_HIDDEN long shim_patch_dispatch(long n, long args[6]);
+
+// clock.c
+SHIM_HIDDEN void shim_clock_init();
+// With SHIM_CLOCK, whether we answer syscall `n` from the simulated clock.
+SHIM_HIDDEN bool shim_clock_emulates(long n, const long args[6]);
+// Answers a syscall that shim_clock_emulates said we would.
+SHIM_HIDDEN long shim_clock_syscall(long n, const long args[6]);
+
+// altstack.c
+SHIM_HIDDEN void shim_altstack_init();
+// Call before shim_altstack_init to give every thread a second stack of
+// `size` bytes alongside its signal stack.
+SHIM_HIDDEN void shim_altstack_reserve(size_t size);
+// Gives the current thread a stack for the SIGSYS handler. Returns the top of
+// its reserved stack, or NULL if there isn't one.
+SHIM_HIDDEN void* shim_altstack_thread_init();
+
+// seccomp.c: call in the child of a clone that made a new process with its
+// own memory but didn't return through the handler.
+SHIM_HIDDEN void shim_forked();
+
+// clone.c
+// Whether syscall `n` makes a new thread or process that shim_clone_syscall
+// has to start.
+SHIM_HIDDEN bool shim_clone_is_clone(long n);
+// The flags and child stack pointer (0 if none) of clone-like syscall `n`.
+// False if it isn't one, or its arguments are too short or unreadable to say.
+SHIM_HIDDEN bool shim_clone_flags(long n, const long args[6], uint64_t *flags, long *stack);
+// Makes clone-like syscall `n` that trapped with registers `gregs`. Children
+// with a stack of their own, or that share our memory, resume the program
+// directly rather than returning.
+SHIM_HIDDEN long shim_clone_syscall(long n, const long args[6], const greg_t *gregs);
+
+// idcache.c
+// Call between shim_policy_load and shim_policy_install.
+SHIM_HIDDEN void shim_idcache_init();
+// With SHIM_IDCACHE, answers syscall `n` from the cache if we can, into *rv.
+// Call before every syscall we make for the program.
+SHIM_HIDDEN bool shim_idcache_lookup(long n, const long args[6], long *rv);
+// Call after every syscall we made for the program (but not ones that
+// shim_idcache_lookup answered), with its result.
+SHIM_HIDDEN void shim_idcache_update(long n, const long args[6], long rv);
+// Call in a new process that shares nothing with us, before it runs any more
+// of the program.
+SHIM_HIDDEN void shim_idcache_forked();
+
+// channel.c
+// Call between shim_policy_load and shim_policy_install.
+SHIM_HIDDEN void shim_channel_init();
+// Forwards syscall `n` to the controller, and returns its answer (or, if
+// `async`, what the answer will presumably be).
+SHIM_HIDDEN long shim_channel_syscall(long n, const long args[6], bool async);
+// Call just before the current thread exits.
+SHIM_HIDDEN void shim_channel_thread_exit();
+// Call just before the process exits. Waits for queued syscalls.
+SHIM_HIDDEN void shim_channel_exit();
+
+// hybrid.c
+// Call between shim_policy_load and shim_policy_install.
+SHIM_HIDDEN void shim_hybrid_init();
+// For syscalls that the policy routes per call: whether we can answer `n`
+// ourselves, into *rv, without the kernel or the controller.
+SHIM_HIDDEN bool shim_hybrid_local(long n, const long args[6], long *rv);
+// Or whether it needs the controller, and if so, whether we need to wait for
+// the answer.
+SHIM_HIDDEN bool shim_hybrid_remote(long n, const long args[6], bool *async);
+// Call after forwarding a syscall that shim_hybrid_remote said to, with its
+// result.
+SHIM_HIDDEN void shim_hybrid_update(long n, const long args[6], long rv);
+
+// signal.c
+// Call between shim_policy_load and shim_policy_install.
+SHIM_HIDDEN void shim_signals_init();
+// With SHIM_SIGNALS, whether we handle syscall `n` ourselves.
+SHIM_HIDDEN bool shim_signals_emulates(long n, const long args[6]);
+// Does a syscall that shim_signals_emulates said we would. `uc` is the
+// program's context, or NULL at a patched site.
+SHIM_HIDDEN long shim_signals_syscall(long n, const long args[6], void *uc);
+// Call just before every other syscall we make for the program, and just
+// after, if it returns.
+SHIM_HIDDEN void shim_signals_enter(long n, const long args[6], void *uc);
+SHIM_HIDDEN void shim_signals_leave(long n, const long args[6], long rv);
+// Runs the handlers of signals that the current thread can take. Call on the
+// way back to the program.
+SHIM_HIDDEN void shim_signals_deliver(void *uc);
+// Call just before the current thread exits.
+SHIM_HIDDEN void shim_signals_thread_exit();
+// Call just before the process exits.
+SHIM_HIDDEN void shim_signals_exit();
@@ -0,0 +1,411 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysinfo.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../common/shmchan.h"
+
+// Controller for syscalls that seccomp.so forwards over shared memory (policy
+// actions `remote`, `remote-async` and `hybrid`; see channel.c). Runs a
+// command with SHIM_CHANNEL pointing at us, and answers its forwarded syscalls
+// until it and everything it forked are gone.
+//
+// Usage: shimchan [-o log] [-s spin] [-m prefix=dir] <cmd> [args...]
+//   -o  where writes to fds other than 1 and 2 go (default: nowhere)
+//   -s  times to poll an idle channel before sleeping (default 0 on a single
+//       CPU, else 1000)
+//   -m  serve paths under `prefix` from `dir`, and tell the command's `hybrid`
+//       syscalls to come to us for them (SHIM_HYBRID; see hybrid.c)
+//
+// This is a toy: it answers getpid and gettid from what it knows about the
+// process. It opens files for the process, on its behalf: paths under the -m
+// prefix from the -m dir, and anything else as the process would have, which
+// is only useful for measuring. Those fds live here, and the process gets
+// numbers from SHMCHAN_VFD_BASE for them; we answer read, pread64, write,
+// pwrite64, lseek, fstat, fsync, fdatasync, ftruncate, dup, fcntl (F_DUPFD,
+// F_DUPFD_CLOEXEC and F_SETFL) and close on them. Writes to its own fds 1 and
+// 2 go to our own; to others, to the log. Everything else fails with ENOSYS.
+// The command needs LD_PRELOAD=seccomp.so and a SHIM_POLICY that forwards
+// something, e.g.:
+//
+//   shimchan env LD_PRELOAD=$PWD/seccomp.so SHIM_POLICY=remote.pol ./prog
+
+#define CHECK(x) { \
+  if (!(x)) {\
+    perror(#x);\
+    exit(EXIT_FAILURE);\
+  }\
+}
+
+static int log_fd = -1;
+static unsigned spin;
+static const char *map_prefix, *map_dir;
+
+struct conn {
+  int sock;
+  struct shmchan_segment *seg;
+  // Our fds for the process's SHMCHAN_VFD_BASE + i, or -1. Only the conn's
+  // own server thread touches them.
+  int fds[SHMCHAN_VFDS];
+};
+
+static int recv_fd(int sock) {
+  char buf[CMSG_SPACE(sizeof(int))] = {0}, c;
+  struct iovec io = {.iov_base = &c, .iov_len = 1};
+  struct msghdr msg = {
+    .msg_iov = &io,
+    .msg_iovlen = 1,
+    .msg_control = buf,
+    .msg_controllen = sizeof(buf),
+  };
+  if (recvmsg(sock, &msg, 0) <= 0 || !CMSG_FIRSTHDR(&msg)) {
+    return -1;
+  }
+  int fd;
+  memcpy(&fd, CMSG_DATA(CMSG_FIRSTHDR(&msg)), sizeof(fd));
+  return fd;
+}
+
+static bool is_vfd(int64_t fd) {
+  return fd >= SHMCHAN_VFD_BASE && fd < SHMCHAN_VFD_BASE + SHMCHAN_VFDS;
+}
+
+// Our fd for the process's `fd`, or -1.
+static int real_fd(const struct conn *c, int64_t fd) {
+  return is_vfd(fd) ? c->fds[fd - SHMCHAN_VFD_BASE] : -1;
+}
+
+// openat(dirfd, path, ...) for the process.
+static int64_t do_open(struct conn *c, int64_t dirfd, const char *path, int flags, mode_t mode) {
+  char buf[PATH_MAX];
+  int at = AT_FDCWD;
+  size_t plen = map_prefix ? strlen(map_prefix) : 0;
+  if (plen && strncmp(path, map_prefix, plen) == 0) {
+    snprintf(buf, sizeof(buf), "%s/%s", map_dir, path + plen);
+  } else if (path[0] == '/') {
+    snprintf(buf, sizeof(buf), "%s", path);
+  } else if (is_vfd(dirfd)) {
+    if ((at = real_fd(c, dirfd)) < 0) {
+      return -EBADF;
+    }
+    snprintf(buf, sizeof(buf), "%s", path);
+  } else if (dirfd == AT_FDCWD) {
+    snprintf(buf, sizeof(buf), "/proc/%d/cwd/%s", c->seg->pid, path);
+  } else {
+    snprintf(buf, sizeof(buf), "/proc/%d/fd/%d/%s", c->seg->pid, (int)dirfd, path);
+  }
+  int i = 0;
+  while (i < SHMCHAN_VFDS && c->fds[i] >= 0) {
+    ++i;
+  }
+  if (i == SHMCHAN_VFDS) {
+    return -EMFILE;
+  }
+  int fd = openat(at, buf, flags | O_CLOEXEC, mode);
+  if (fd < 0) {
+    return -errno;
+  }
+  c->fds[i] = fd;
+  return SHMCHAN_VFD_BASE + i;
+}
+
+// dup(fd) for the process, onto its lowest free number of ours. FD_CLOEXEC is
+// the shim's business.
+static int64_t do_dup(struct conn *c, int fd) {
+  int i = 0;
+  while (i < SHMCHAN_VFDS && c->fds[i] >= 0) {
+    ++i;
+  }
+  if (i == SHMCHAN_VFDS) {
+    return -EMFILE;
+  }
+  int new = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  if (new < 0) {
+    return -errno;
+  }
+  c->fds[i] = new;
+  return SHMCHAN_VFD_BASE + i;
+}
+
+static int64_t handle(struct conn *c, const struct shmchan_thread *t, const struct shmchan_entry *e,
+                      char *data) {
+  const int64_t *a = e->args;
+  int fd = real_fd(c, a[0]);
+  ssize_t rv;
+  switch (e->nr) {
+    case SYS_getpid:
+      return c->seg->pid;
+    case SYS_gettid:
+      return __atomic_load_n(&t->tid, __ATOMIC_RELAXED);
+    case SYS_open:
+      return do_open(c, AT_FDCWD, data, a[1], a[2]);
+    case SYS_openat:
+      return do_open(c, a[0], data, a[2], a[3]);
+    case SYS_write:
+    case SYS_pwrite64:
+      if (is_vfd(a[0])) {
+        if (fd < 0) {
+          return -EBADF;
+        }
+        rv = e->nr == SYS_write ? write(fd, data, e->len) : pwrite(fd, data, e->len, a[3]);
+        return rv < 0 ? -errno : rv;
+      }
+      fd = a[0] == 1 || a[0] == 2 ? a[0] : log_fd;
+      if (fd < 0) {
+        return e->len;
+      }
+      rv = write(fd, data, e->len);
+      return rv < 0 ? -errno : rv;
+    case SYS_read:
+    case SYS_pread64:
+    case SYS_lseek:
+    case SYS_fstat:
+    case SYS_fsync:
+    case SYS_fdatasync:
+    case SYS_ftruncate:
+    case SYS_dup:
+    case SYS_fcntl:
+    case SYS_close:
+      if (!is_vfd(a[0])) {
+        return -ENOSYS;
+      }
+      if (fd < 0) {
+        return -EBADF;
+      }
+      break;
+    default:
+      return -ENOSYS;
+  }
+
+  switch (e->nr) {
+    case SYS_read:
+      rv = read(fd, data, e->len);
+      break;
+    case SYS_pread64:
+      rv = pread(fd, data, e->len, a[3]);
+      break;
+    case SYS_lseek:
+      rv = lseek(fd, a[1], a[2]);
+      break;
+    case SYS_fstat: {
+      struct stat st;
+      rv = fstat(fd, &st);
+      memcpy(data, &st, sizeof(st));
+      break;
+    }
+    case SYS_fsync:
+      rv = fsync(fd);
+      break;
+    case SYS_fdatasync:
+      rv = fdatasync(fd);
+      break;
+    case SYS_ftruncate:
+      rv = ftruncate(fd, a[1]);
+      break;
+    case SYS_dup:
+      return do_dup(c, fd);
+    case SYS_fcntl:
+      // The shim answers F_GETFD, F_SETFD and F_GETFL itself.
+      switch (a[1]) {
+        case F_DUPFD:
+        case F_DUPFD_CLOEXEC:
+          return do_dup(c, fd);
+        case F_SETFL:
+          rv = fcntl(fd, F_SETFL, (int)a[2]);
+          break;
+        default:
+          return -EINVAL;
+      }
+      break;
+    default:
+      c->fds[a[0] - SHMCHAN_VFD_BASE] = -1;
+      rv = close(fd);
+      break;
+  }
+  return rv < 0 ? -errno : rv;
+}
+
+// Answers everything pending in `t`. Returns how many.
+static int serve_thread(struct conn *c, struct shmchan_thread *t) {
+  uint32_t done = t->done;
+  uint32_t head = __atomic_load_n(&t->head, __ATOMIC_ACQUIRE);
+  for (uint32_t n = done; n != head; ++n) {
+    uint32_t i = n % SHMCHAN_RING;
+    struct shmchan_entry *e = &t->ring[i];
+    e->ret = handle(c, t, e, t->data[i]);
+    __atomic_store_n(&t->done, n + 1, __ATOMIC_RELEASE);
+  }
+  if (head != done) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&t->waiting, __ATOMIC_RELAXED)) {
+      shmchan_futex_wake((long (*)(long, ...))syscall, &t->done);
+    }
+  }
+  return head - done;
+}
+
+static int serve_all(struct conn *c) {
+  struct shmchan_segment *seg = c->seg;
+  int n = 0;
+  for (int i = 0; i < SHMCHAN_THREADS; ++i) {
+    // Slots are handed out in order, and rarely given back, so most of them
+    // are untouched: skip those without faulting them in.
+    struct shmchan_thread *t = &seg->threads[i];
+    if (__atomic_load_n(&t->head, __ATOMIC_ACQUIRE) != t->done) {
+      n += serve_thread(c, t);
+    }
+  }
+  return n;
+}
+
+static void *serve(void *arg) {
+  struct conn *c = arg;
+  struct shmchan_segment *seg = c->seg;
+  const struct timespec timeout = {.tv_nsec = 50 * 1000 * 1000};
+  unsigned idle = 0;
+  while (1) {
+    if (serve_all(c)) {
+      idle = 0;
+      continue;
+    }
+    if (idle++ < spin) {
+      __builtin_ia32_pause();
+      continue;
+    }
+    uint32_t bell = __atomic_load_n(&seg->doorbell, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&seg->sleeping, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (serve_all(c) == 0) {
+      // The process drains its rings before it exits, so once it hangs up
+      // we're done.
+      struct pollfd p = {.fd = c->sock, .events = POLLIN};
+      if (poll(&p, 1, 0) == 1 && (p.revents & (POLLHUP | POLLERR))) {
+        break;
+      }
+      shmchan_futex_wait((long (*)(long, ...))syscall, &seg->doorbell, bell, &timeout);
+    }
+    __atomic_store_n(&seg->sleeping, 0, __ATOMIC_RELAXED);
+    idle = 0;
+  }
+  for (int i = 0; i < SHMCHAN_VFDS; ++i) {
+    if (c->fds[i] >= 0) {
+      close(c->fds[i]);
+    }
+  }
+  munmap(seg, sizeof(*seg));
+  close(c->sock);
+  free(c);
+  return NULL;
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr, "Usage: %s [-o log] [-s spin] [-m prefix=dir] <cmd> [args...]\n", argv0);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+  spin = get_nprocs() > 1 ? 1000 : 0;
+  int opt;
+  char *eq;
+  while ((opt = getopt(argc, argv, "+o:s:m:")) != -1) {
+    switch (opt) {
+      case 'm':
+        if (!(eq = strchr(optarg, '=')) || eq == optarg) {
+          usage(argv[0]);
+        }
+        *eq = '\0';
+        map_prefix = optarg;
+        map_dir = eq + 1;
+        break;
+      case 'o': CHECK((log_fd = open(optarg, O_WRONLY | O_CREAT | O_APPEND, 0644)) >= 0); break;
+      case 's': spin = strtoul(optarg, NULL, 0); break;
+      default: usage(argv[0]);
+    }
+  }
+  if (optind >= argc) {
+    usage(argv[0]);
+  }
+
+  char dir[] = "/tmp/shimchan.XXXXXX";
+  CHECK(mkdtemp(dir));
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/sock", dir);
+  int listener;
+  CHECK((listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) >= 0);
+  CHECK(bind(listener, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+  CHECK(listen(listener, 64) == 0);
+
+  pid_t child = fork();
+  CHECK(child >= 0);
+  if (child == 0) {
+    setenv("SHIM_CHANNEL", addr.sun_path, 1);
+    if (map_prefix) {
+      setenv("SHIM_HYBRID", map_prefix, 1);
+    }
+    execvp(argv[optind], &argv[optind]);
+    perror("execvp");
+    exit(EXIT_FAILURE);
+  }
+
+  // Serve whoever connects, until the command has exited and nobody's
+  // connected.
+  int status = 0, active = 0, exited = 0;
+  pthread_t *threads = NULL;
+  while (!exited || active) {
+    struct pollfd p = {.fd = listener, .events = POLLIN};
+    if (poll(&p, 1, 50) == 1) {
+      int sock = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+      int fd = sock >= 0 ? recv_fd(sock) : -1;
+      struct shmchan_segment *seg = fd >= 0 ? mmap(NULL, sizeof(*seg), PROT_READ | PROT_WRITE,
+                                                   MAP_SHARED, fd, 0) : MAP_FAILED;
+      if (fd >= 0) {
+        close(fd);
+      }
+      if (seg == MAP_FAILED || seg->magic != SHMCHAN_MAGIC || seg->version != SHMCHAN_VERSION) {
+        fprintf(stderr, "shimchan: bad connection\n");
+        if (sock >= 0) {
+          close(sock);
+        }
+        continue;
+      }
+      struct conn *c = malloc(sizeof(*c));
+      CHECK(c);
+      c->sock = sock;
+      c->seg = seg;
+      memset(c->fds, -1, sizeof(c->fds));
+      CHECK((threads = realloc(threads, (active + 1) * sizeof(*threads))));
+      CHECK(pthread_create(&threads[active], NULL, serve, c) == 0);
+      ++active;
+    }
+    if (!exited && waitpid(child, &status, WNOHANG) == child) {
+      exited = 1;
+    }
+    // Reap finished servers.
+    for (int i = 0; i < active;) {
+      if (pthread_tryjoin_np(threads[i], NULL) == 0) {
+        threads[i] = threads[--active];
+      } else {
+        ++i;
+      }
+    }
+  }
+
+  unlink(addr.sun_path);
+  rmdir(dir);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+}
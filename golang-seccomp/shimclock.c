@@ -0,0 +1,124 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#include "../common/simclock.h"
+
+// Controls a simulated clock page, for processes running under seccomp.so with
+// SHIM_CLOCK=<path>.
+//
+// Usage: shimclock <path> <command>
+//   init            create the page, running at real speed from the real time
+//   show            print the simulated time
+//   set <secs>      set simulated CLOCK_MONOTONIC
+//   advance <secs>  jump forward (or back, if negative)
+//   rate <r>        run at r times real speed; 0 stops the clock
+//   realtime <secs> set simulated CLOCK_REALTIME, as seconds since the epoch
+
+#define CHECK(x) { \
+  if (!(x)) {\
+    perror(#x);\
+    exit(EXIT_FAILURE);\
+  }\
+}
+
+static uint64_t clock_ns(clockid_t clk) {
+  struct timespec ts;
+  clock_gettime(clk, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Real ns per TSC cycle, << 32.
+static uint64_t measure_tsc_mult() {
+  uint64_t ns0 = clock_ns(CLOCK_MONOTONIC), tsc0 = __rdtsc();
+  usleep(100 * 1000);
+  uint64_t ns1 = clock_ns(CLOCK_MONOTONIC), tsc1 = __rdtsc();
+  return ((unsigned __int128)(ns1 - ns0) << 32) / (tsc1 - tsc0);
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr, "Usage: %s <path> init|show|set <secs>|advance <secs>|rate <r>|realtime <secs>\n",
+          argv0);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    usage(argv[0]);
+  }
+  const char *path = argv[1], *cmd = argv[2];
+  const char *arg = argc > 3 ? argv[3] : NULL;
+  int init = strcmp(cmd, "init") == 0;
+
+  int fd;
+  CHECK((fd = open(path, O_RDWR | (init ? O_CREAT : 0), 0644)) >= 0);
+  if (init) {
+    CHECK(ftruncate(fd, sizeof(struct simclock)) == 0);
+  }
+  struct simclock *c;
+  CHECK((c = mmap(NULL, sizeof(*c), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) != MAP_FAILED);
+  close(fd);
+
+  if (init) {
+    uint64_t tsc_mult = measure_tsc_mult();
+    simclock_write_begin(c);
+    c->version = SIMCLOCK_VERSION;
+    c->tsc_mult = tsc_mult;
+    c->mult = tsc_mult;
+    c->base_tsc = __rdtsc();
+    c->base_ns = clock_ns(CLOCK_MONOTONIC);
+    c->realtime_offset_ns = clock_ns(CLOCK_REALTIME) - c->base_ns;
+    simclock_write_end(c);
+    __atomic_store_n(&c->magic, SIMCLOCK_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+  }
+  if (c->magic != SIMCLOCK_MAGIC || c->version != SIMCLOCK_VERSION) {
+    fprintf(stderr, "%s: not a clock page; run `%s %s init` first\n", path, argv[0], path);
+    return EXIT_FAILURE;
+  }
+
+  if (strcmp(cmd, "show") == 0) {
+    int64_t offset;
+    uint64_t ns = simclock_read(c, &offset);
+    printf("monotonic %lu.%09lu\nrealtime  %ld.%09lu\nrate      %.3f\n",
+           (unsigned long)(ns / 1000000000), (unsigned long)(ns % 1000000000),
+           (long)((ns + offset) / 1000000000), (unsigned long)((ns + offset) % 1000000000),
+           (double)c->mult / c->tsc_mult);
+    return 0;
+  }
+  if (!arg) {
+    usage(argv[0]);
+  }
+  double v = atof(arg);
+
+  // Re-base at the current simulated time, so that changing the rate doesn't
+  // make the clock jump.
+  int64_t offset;
+  uint64_t tsc = __rdtsc();
+  uint64_t now = simclock_read(c, &offset);
+  simclock_write_begin(c);
+  c->base_tsc = tsc;
+  c->base_ns = now;
+  if (strcmp(cmd, "set") == 0) {
+    c->base_ns = v * 1e9;
+    c->realtime_offset_ns = offset + now - c->base_ns;
+  } else if (strcmp(cmd, "advance") == 0) {
+    c->base_ns = now + (int64_t)(v * 1e9);
+  } else if (strcmp(cmd, "rate") == 0 && v >= 0) {
+    c->mult = c->tsc_mult * v;
+  } else if (strcmp(cmd, "realtime") == 0) {
+    c->realtime_offset_ns = (int64_t)(v * 1e9) - now;
+  } else {
+    simclock_write_end(c);
+    usage(argv[0]);
+  }
+  simclock_write_end(c);
+  return 0;
+}
@@ -0,0 +1,141 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#include "stats.h"
+#include "syscallnames.h"
+
+// Prints the stats of a process running under seccomp.so with SHIM_STATS=1,
+// optionally refreshing every few seconds.
+//
+// Usage: shimstat [-t] [-i seconds] <pid>
+//   -t  break counts down by thread
+
+#define CHECK(x) { \
+  if (!(x)) {\
+    perror(#x);\
+    exit(EXIT_FAILURE);\
+  }\
+}
+
+static uint64_t monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static double ns_per_cycle;
+
+static double to_us(uint64_t cycles) {
+  return cycles * ns_per_cycle / 1000;
+}
+
+static void print_row(const char *label, int n, const struct shim_syscall_stats *s) {
+  const char *name = n < SYSCALL_NAMES_LEN && syscall_names[n] ? syscall_names[n] : "?";
+  printf("%-8s %3d %-20s %10lu %10lu %10lu %10lu  %8.2f %8.2f %8.2f  %8.2f %8.2f %8.2f\n",
+         label, n, name, (unsigned long)s->count, (unsigned long)s->patched,
+         (unsigned long)s->local, (unsigned long)s->remote,
+         to_us(s->handler_cycles / s->count),
+         to_us(shim_stats_quantile(s->handler_hist, 0.5)),
+         to_us(shim_stats_quantile(s->handler_hist, 0.99)),
+         to_us(s->syscall_cycles / s->count),
+         to_us(shim_stats_quantile(s->syscall_hist, 0.5)),
+         to_us(shim_stats_quantile(s->syscall_hist, 0.99)));
+}
+
+static void add(struct shim_syscall_stats *to, const struct shim_syscall_stats *from) {
+  to->count += from->count;
+  to->patched += from->patched;
+  to->local += from->local;
+  to->remote += from->remote;
+  to->handler_cycles += from->handler_cycles;
+  to->syscall_cycles += from->syscall_cycles;
+  for (int b = 0; b < SHIM_STATS_BUCKETS; ++b) {
+    to->handler_hist[b] += from->handler_hist[b];
+    to->syscall_hist[b] += from->syscall_hist[b];
+  }
+}
+
+static void print_stats(const struct shim_stats_segment *seg, int per_thread) {
+  ns_per_cycle = (double)(monotonic_ns() - seg->start_ns) / (__rdtsc() - seg->start_tsc);
+
+  if (seg->sites_patched || seg->sites_trapping) {
+    printf("syscall sites patched: %lu, still trapping: %lu\n",
+           (unsigned long)seg->sites_patched, (unsigned long)seg->sites_trapping);
+  }
+  printf("%-8s %3s %-20s %10s %10s %10s %10s  %-26s  %-26s\n", "thread", "nr", "name", "count",
+         "patched", "local", "remote", "handler avg/p50/p99 (us)", "syscall avg/p50/p99 (us)");
+  for (int n = 0; n < SHIM_STATS_MAX_SYSCALL; ++n) {
+    struct shim_syscall_stats sum = {0};
+    for (int t = 0; t < SHIM_STATS_MAX_THREADS; ++t) {
+      // The process is still writing; take a snapshot so that each row is at
+      // least self-consistent.
+      struct shim_syscall_stats s;
+      memcpy(&s, &seg->threads[t].syscalls[n], sizeof(s));
+      if (s.count == 0) {
+        continue;
+      }
+      if (per_thread) {
+        char label[16];
+        int tid = __atomic_load_n(&seg->threads[t].tid, __ATOMIC_RELAXED);
+        if (t == 0) {
+          snprintf(label, sizeof(label), "exited");
+        } else {
+          snprintf(label, sizeof(label), "%d", tid);
+        }
+        print_row(label, n, &s);
+      }
+      add(&sum, &s);
+    }
+    if (sum.count && !per_thread) {
+      print_row("all", n, &sum);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  int per_thread = 0, interval = 0, opt;
+  while ((opt = getopt(argc, argv, "ti:")) != -1) {
+    switch (opt) {
+      case 't': per_thread = 1; break;
+      case 'i': interval = atoi(optarg); break;
+      default:
+        fprintf(stderr, "Usage: %s [-t] [-i seconds] <pid>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if (optind != argc - 1) {
+    fprintf(stderr, "Usage: %s [-t] [-i seconds] <pid>\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  char path[64];
+  snprintf(path, sizeof(path), "/dev/shm/seccomp-shim.%s.stats", argv[optind]);
+  int fd;
+  CHECK((fd = open(path, O_RDONLY)) >= 0);
+  const struct shim_stats_segment *seg;
+  CHECK((seg = mmap(NULL, sizeof(*seg), PROT_READ, MAP_SHARED, fd, 0)) != MAP_FAILED);
+  close(fd);
+  if (__atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) != SHIM_STATS_MAGIC ||
+      seg->version != SHIM_STATS_VERSION) {
+    fprintf(stderr, "%s: not a stats segment, or from a different version of seccomp.so\n", path);
+    return EXIT_FAILURE;
+  }
+
+  while (1) {
+    print_stats(seg, per_thread);
+    if (!interval) {
+      break;
+    }
+    sleep(interval);
+    printf("\n");
+  }
+  return 0;
+}
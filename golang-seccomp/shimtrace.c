@@ -0,0 +1,134 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#include "syscallnames.h"
+#include "trace.h"
+
+// Decodes a trace written by seccomp.so with SHIM_TRACE set, printing the
+// events of all threads merged in time order, strace-style.
+//
+// Usage: shimtrace <file>
+
+#define CHECK(x) { \
+  if (!(x)) {\
+    perror(#x);\
+    exit(EXIT_FAILURE);\
+  }\
+}
+
+static int cmp_start(const void *a, const void *b) {
+  const struct shim_trace_event *x = a, *y = b;
+  return x->start_tsc < y->start_tsc ? -1 : x->start_tsc > y->start_tsc;
+}
+
+static void print_arg(int64_t v) {
+  // Small values are probably fds, sizes or flags; big ones pointers.
+  if (v > -4096 && v < 65536) {
+    printf("%ld", (long)v);
+  } else {
+    printf("%#lx", (unsigned long)v);
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s <file>\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  int fd;
+  CHECK((fd = open(argv[1], O_RDONLY)) >= 0);
+  struct stat st;
+  CHECK(fstat(fd, &st) == 0);
+  if ((size_t)st.st_size < sizeof(struct shim_trace_header)) {
+    fprintf(stderr, "%s: too short to be a trace\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  const struct shim_trace_header *hdr;
+  CHECK((hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) != MAP_FAILED);
+  close(fd);
+  if (hdr->magic != SHIM_TRACE_MAGIC || hdr->version != SHIM_TRACE_VERSION ||
+      sizeof(*hdr) + hdr->nrings * shim_trace_ring_size(hdr->ring_events) > (uint64_t)st.st_size) {
+    fprintf(stderr, "%s: not a trace, or from a different version of seccomp.so\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+
+  // Convert TSC to ns with the calibration the process left us at exit, or
+  // failing that (it's still running, or died) with our own clock.
+  uint64_t end_tsc = hdr->end_tsc, end_ns = hdr->end_ns;
+  if (!end_tsc) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    end_tsc = __rdtsc();
+    end_ns = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  }
+  double ns_per_cycle = (double)(end_ns - hdr->start_ns) / (end_tsc - hdr->start_tsc);
+
+  // Collect the still-valid events of each ring.
+  size_t cap = 1024, n = 0;
+  struct shim_trace_event *events = malloc(cap * sizeof(*events));
+  CHECK(events != NULL);
+  uint64_t dropped = 0;
+  for (uint32_t r = 0; r < hdr->nrings; ++r) {
+    const struct shim_trace_ring *ring = shim_trace_get_ring(hdr, r);
+    uint64_t head = ring->head;
+    uint64_t first = head > hdr->ring_events ? head - hdr->ring_events : 0;
+    dropped += first;
+    for (uint64_t i = first; i < head; ++i) {
+      const struct shim_trace_event *ev = &ring->events[i & (hdr->ring_events - 1)];
+      if (ev->seq != i + 1) {
+        continue;
+      }
+      if (n == cap) {
+        cap *= 2;
+        CHECK((events = realloc(events, cap * sizeof(*events))) != NULL);
+      }
+      events[n++] = *ev;
+    }
+  }
+  qsort(events, n, sizeof(*events), cmp_start);
+
+  printf("# pid %d: %zu events", hdr->pid, n);
+  if (dropped) {
+    printf(" (%lu older events overwritten)", (unsigned long)dropped);
+  }
+  printf("\n");
+  for (size_t i = 0; i < n; ++i) {
+    const struct shim_trace_event *ev = &events[i];
+    const char *name = ev->nr >= 0 && ev->nr < SYSCALL_NAMES_LEN && syscall_names[ev->nr]
+                           ? syscall_names[ev->nr] : NULL;
+    printf("%12.6f %6d ", (ev->start_tsc - hdr->start_tsc) * ns_per_cycle / 1e9, ev->tid);
+    if (name) {
+      printf("%s(", name);
+    } else {
+      printf("syscall_%d(", ev->nr);
+    }
+    for (int a = 0; a < 6; ++a) {
+      if (a) {
+        printf(", ");
+      }
+      print_arg(ev->args[a]);
+    }
+    if (!ev->end_tsc) {
+      printf(") = ?\n");
+      continue;
+    }
+    printf(") = ");
+    if (ev->ret < 0 && ev->ret > -4096) {
+      printf("-1 %s", strerrorname_np(-ev->ret) ? strerrorname_np(-ev->ret) : "?");
+    } else {
+      print_arg(ev->ret);
+    }
+    printf(" <%.3fus>\n", (ev->end_tsc - ev->start_tsc) * ns_per_cycle / 1000);
+  }
+  return 0;
+}
@@ -0,0 +1,968 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/ucontext.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shim.h"
+
+// Signals in user space, enabled by SHIM_SIGNALS=1. kill, tgkill and tkill
+// between processes under the shim, signal masks, and waiting for signals are
+// all handled here without the kernel. Signals are delivered at trap
+// boundaries: just before a syscall that we pass on, and just after any
+// syscall that trapped (or came from a patched site). So signals between the
+// threads and processes of a simulation show up at the same points in their
+// programs every run.
+//
+// Each process has a shared-memory segment at
+// /dev/shm/seccomp-shim.<pid>.signals, holding its process-wide pending set
+// and a slot per thread with that thread's mask and pending set. A pending set
+// is a bitset, plus the siginfo of each signal in it. To send a signal, a
+// sender in another process maps the target's segment and posts to it. At
+// each boundary, the target's threads look for pending signals that they
+// don't block, and run the handlers right there.
+//
+// A thread that's blocked in a syscall never gets to a boundary. So if a
+// sender sees that nobody who could take its signal is running, it kicks one
+// of them with a real signal to interrupt the syscall. The kick goes by
+// rt_tgsigqueueinfo and is tagged, so that we know it's only a kick.
+//
+// The kernel sees the program's handlers only through ours (_on_signal), and
+// its masks stay empty. Signals from outside arrive there: from processes
+// without the shim, timers, SIGCHLD and faults. They go through the same
+// pending sets and masks, except that an unblocked one runs right away, as it
+// would have without us.
+//
+// Left to the kernel:
+//
+// * SIGKILL, SIGSTOP, SIGCONT and SIGSYS, and glibc's internal signals (32 and
+//   33).
+// * Signals whose action is the default, once there's a thread that would
+//   take them. Until then (everybody it could go to blocks it, or somebody's
+//   waiting for it in rt_sigtimedwait) it's pending with us, like any other,
+//   and goes to the kernel when a thread takes it. From outside, they go
+//   straight to the kernel, which does the default thing right away, blocked
+//   or not.
+// * Process groups (pid <= 0), rt_sigqueueinfo and rt_tgsigqueueinfo, which
+//   come back in through _on_signal.
+// * Targets that aren't running under the shim with SHIM_SIGNALS, and threads
+//   that haven't trapped yet (or found no free slot).
+// * vfork children, which share our memory but not our signals.
+//
+// Differences from the kernel:
+//
+// * A thread only sees a signal at a boundary. One that runs without making
+//   syscalls doesn't, and neither does one blocked in a syscall that the
+//   policy lets through. That includes Go's preemption signals.
+// * Real-time signals don't queue. Like standard ones, a second one that
+//   arrives while one is pending is dropped.
+// * Handlers that we run at a boundary run on the SIGSYS handler's stack (see
+//   SHIM_ALTSTACK_SIZE), whatever SA_ONSTACK says. They get its ucontext, or
+//   an empty one at a patched site.
+// * signalfd, and the masks that ppoll, pselect6 and epoll_pwait take, only
+//   apply to signals that the kernel holds. With the kernel's masks empty,
+//   that's none of them.
+// * Pending signals are lost across exec, though the mask isn't.
+// * A process that crashes leaves its segment behind. Signals to a later
+//   process with the same pid vanish, if that process isn't under the shim.
+//
+// Needs the policy to trap clone, clone3, fork, vfork, execve, execveat,
+// rt_sigsuspend, rt_sigtimedwait and pause. kill, tgkill and tkill work either
+// way, but only go through shared memory if they trap.
+
+#ifndef SA_RESTORER
+#define SA_RESTORER 0x04000000
+#endif
+
+#define SIGNALS_MAGIC UINT64_C(0x6c616e6769736d31) /* "1msignal" */
+#define SIGNALS_VERSION 1
+#define MAX_THREADS 256
+
+#define BIT(sig) (UINT64_C(1) << ((sig) - 1))
+// Signals that are never ours to send, hold or handle.
+#define NOT_OURS (BIT(SIGKILL) | BIT(SIGSTOP) | BIT(SIGSYS) | BIT(32) | BIT(33))
+
+// si_value of a kick.
+#define KICK ((void*)UINT64_C(0x6b63696b6d696873))
+
+// Static TLS, so that a thread can set it for a thread it's creating (see
+// shim_signals_enter).
+#define TLS __thread __attribute__((tls_model("initial-exec")))
+
+struct pending {
+  uint64_t set;
+  // Signals pending, or being posted or taken. One that's already here is
+  // dropped.
+  uint64_t busy;
+  siginfo_t info[64];
+};
+
+struct thread_slot {
+  // Owner; -1 while it's being claimed, and 0 if it's free.
+  int32_t tid;
+  // Whether a kick would interrupt the syscall it's making.
+  int32_t in_syscall;
+  uint64_t mask;
+  // What it's waiting for in rt_sigtimedwait, blocked or not.
+  uint64_t waiting;
+  struct pending pending;
+} __attribute__((aligned(64)));
+
+struct segment {
+  uint64_t magic;
+  uint32_t version;
+  int32_t pid;
+  // Signals with a handler, and ignored ones. The rest have the default
+  // action, which senders leave to the kernel.
+  uint64_t caught;
+  uint64_t ignored;
+  // One past the highest slot ever claimed.
+  uint32_t nthreads;
+  struct pending pending;
+  struct thread_slot threads[MAX_THREADS];
+};
+
+// The kernel's struct sigaction.
+struct kernel_sigaction {
+  void *handler;
+  unsigned long flags;
+  void *restorer;
+  uint64_t mask;
+};
+
+static void _on_signal(int sig, siginfo_t *info, void *uc);
+static void _wake(struct segment *seg, pid_t pid, struct thread_slot *target, int sig);
+
+static struct segment *_seg = NULL;
+static char _path[64];
+static int32_t _pid;
+static uint32_t _uid;
+// vfork children running. They share our memory, including this thread's
+// TLS, so while there are any we check who we are.
+static int _vforking = 0;
+
+static TLS struct thread_slot *_slot;
+static TLS bool _no_slot;
+// The mask to start with, set by whoever started the thread.
+static TLS uint64_t _inherited_mask;
+static TLS bool _inherited;
+
+// The program's actions, under a seqlock each. Writers also take
+// _actions_writer, with the kernel's mask full so that nothing interrupts
+// them.
+static struct {
+  uint32_t seq;
+  struct kernel_sigaction act;
+} _actions[65];
+static uint32_t _actions_writer = 0;
+
+static bool _ours(long sig) {
+  return sig >= 1 && sig <= 64 && !(BIT(sig) & NOT_OURS);
+}
+
+static bool _is_handler(const struct kernel_sigaction *act) {
+  return act->handler != SIG_DFL && act->handler != SIG_IGN;
+}
+
+static bool _is_kick(const siginfo_t *info) {
+  return info->si_code == SI_QUEUE && info->si_value.sival_ptr == KICK;
+}
+
+static void _make_path(char *path, pid_t pid) {
+  struct shim_outbuf out = {.fd = -1};
+  shim_out_str(&out, "/dev/shm/seccomp-shim.");
+  shim_out_u64(&out, pid, 0);
+  shim_out_str(&out, ".signals");
+  memcpy(path, out.buf, out.len);
+  path[out.len] = '\0';
+}
+
+static void _get_action(int sig, struct kernel_sigaction *act) {
+  uint32_t seq;
+  do {
+    seq = __atomic_load_n(&_actions[sig].seq, __ATOMIC_ACQUIRE);
+    memcpy(act, &_actions[sig].act, sizeof(*act));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((seq & 1) || __atomic_load_n(&_actions[sig].seq, __ATOMIC_RELAXED) != seq);
+}
+
+static void _put_action(int sig, const struct kernel_sigaction *act) {
+  uint32_t seq = _actions[sig].seq;
+  __atomic_store_n(&_actions[sig].seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(&_actions[sig].act, act, sizeof(*act));
+  __atomic_store_n(&_actions[sig].seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+// Records `sig` in `p`, unless it's already there.
+static void _post(struct pending *p, int sig, const siginfo_t *info) {
+  uint64_t bit = BIT(sig);
+  if (__atomic_fetch_or(&p->busy, bit, __ATOMIC_ACQUIRE) & bit) {
+    return;
+  }
+  memcpy(&p->info[sig - 1], info, sizeof(*info));
+  __atomic_fetch_or(&p->set, bit, __ATOMIC_SEQ_CST);
+}
+
+// Takes `sig` out of `p`, if nobody beat us to it.
+static bool _take(struct pending *p, int sig, siginfo_t *info) {
+  uint64_t bit = BIT(sig);
+  if (!(__atomic_fetch_and(&p->set, ~bit, __ATOMIC_SEQ_CST) & bit)) {
+    return false;
+  }
+  memcpy(info, &p->info[sig - 1], sizeof(*info));
+  __atomic_fetch_and(&p->busy, ~bit, __ATOMIC_RELEASE);
+  return true;
+}
+
+static void _publish_action(struct segment *seg, int sig, const struct kernel_sigaction *act) {
+  uint64_t bit = BIT(sig);
+  if (act->handler == SIG_IGN) {
+    __atomic_fetch_or(&seg->ignored, bit, __ATOMIC_RELEASE);
+  } else {
+    __atomic_fetch_and(&seg->ignored, ~bit, __ATOMIC_RELEASE);
+  }
+  if (_is_handler(act)) {
+    __atomic_fetch_or(&seg->caught, bit, __ATOMIC_RELEASE);
+  } else {
+    __atomic_fetch_and(&seg->caught, ~bit, __ATOMIC_RELEASE);
+  }
+}
+
+static struct segment *_create() {
+  _make_path(_path, _pid);
+  int fd = _syscall(SYS_openat, AT_FDCWD, _path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    return NULL;
+  }
+  // Sparse, like the stats segment: slots that no thread claims are never
+  // touched.
+  long rv = _syscall(SYS_ftruncate, fd, sizeof(struct segment));
+  void *p = (void*)_syscall(SYS_mmap, NULL, sizeof(struct segment), PROT_READ | PROT_WRITE,
+                            MAP_SHARED, fd, 0);
+  _syscall(SYS_close, fd);
+  if (rv != 0 || (unsigned long)p > -4096UL) {
+    _syscall(SYS_unlink, _path);
+    return NULL;
+  }
+  struct segment *seg = p;
+  seg->version = SIGNALS_VERSION;
+  seg->pid = _pid;
+  for (int sig = 1; sig <= 64; ++sig) {
+    if (_ours(sig)) {
+      struct kernel_sigaction act;
+      _get_action(sig, &act);
+      _publish_action(seg, sig, &act);
+    }
+  }
+  __atomic_store_n(&seg->magic, SIGNALS_MAGIC, __ATOMIC_RELEASE);
+  return seg;
+}
+
+// Maps another process's segment, if it has one.
+static struct segment *_map(pid_t pid) {
+  char path[64];
+  _make_path(path, pid);
+  int fd = _syscall(SYS_openat, AT_FDCWD, path, O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    return NULL;
+  }
+  void *p = (void*)_syscall(SYS_mmap, NULL, sizeof(struct segment), PROT_READ | PROT_WRITE,
+                            MAP_SHARED, fd, 0);
+  _syscall(SYS_close, fd);
+  if ((unsigned long)p > -4096UL) {
+    return NULL;
+  }
+  struct segment *seg = p;
+  if (__atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) != SIGNALS_MAGIC ||
+      seg->version != SIGNALS_VERSION || seg->pid != pid) {
+    _syscall(SYS_munmap, seg, sizeof(*seg));
+    return NULL;
+  }
+  return seg;
+}
+
+// Whether we're doing signals, and not a vfork child.
+static bool _active() {
+  return _seg && (!__atomic_load_n(&_vforking, __ATOMIC_ACQUIRE) || _syscall(SYS_getpid) == _pid);
+}
+
+// This thread's slot, claimed on first use. NULL if there are none left, in
+// which case the kernel does this thread's signals as it always did.
+static struct thread_slot *_self() {
+  if (_slot || _no_slot) {
+    return _slot;
+  }
+  int32_t tid = _syscall(SYS_gettid);
+  for (int i = 0; i < MAX_THREADS; ++i) {
+    struct thread_slot *t = &_seg->threads[i];
+    int32_t expected = 0;
+    if (!__atomic_compare_exchange_n(&t->tid, &expected, -1, false, __ATOMIC_ACQUIRE,
+                                     __ATOMIC_RELAXED)) {
+      continue;
+    }
+    t->mask = _inherited ? _inherited_mask : 0;
+    t->in_syscall = 0;
+    t->waiting = 0;
+    __atomic_store_n(&t->tid, tid, __ATOMIC_RELEASE);
+    uint32_t n = __atomic_load_n(&_seg->nthreads, __ATOMIC_RELAXED);
+    while (n < (uint32_t)i + 1 &&
+           !__atomic_compare_exchange_n(&_seg->nthreads, &n, i + 1, false, __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED)) {
+    }
+    _slot = t;
+    return t;
+  }
+  _no_slot = true;
+  return NULL;
+}
+
+static struct thread_slot *_find(struct segment *seg, int32_t tid) {
+  uint32_t n = __atomic_load_n(&seg->nthreads, __ATOMIC_ACQUIRE);
+  for (uint32_t i = 0; i < n && i < MAX_THREADS; ++i) {
+    if (__atomic_load_n(&seg->threads[i].tid, __ATOMIC_ACQUIRE) == tid) {
+      return &seg->threads[i];
+    }
+  }
+  return NULL;
+}
+
+// Signals that `t` could take now.
+static uint64_t _ready(struct thread_slot *t) {
+  uint64_t pending = __atomic_load_n(&t->pending.set, __ATOMIC_SEQ_CST) |
+                     __atomic_load_n(&_seg->pending.set, __ATOMIC_SEQ_CST);
+  return pending & ~__atomic_load_n(&t->mask, __ATOMIC_SEQ_CST);
+}
+
+static long _install(int sig, const struct kernel_sigaction *act) {
+  struct kernel_sigaction k = *act;
+  if (_is_handler(act)) {
+    // Masks are ours to apply, so let every signal through to _on_signal.
+    k.handler = (void*)_on_signal;
+    k.flags = (act->flags & ~(SA_RESETHAND | SA_NODEFER)) | SA_SIGINFO | SA_NODEFER;
+    k.mask = 0;
+  }
+  return _syscall(SYS_rt_sigaction, sig, &k, NULL, 8);
+}
+
+// Sets the program's action for `sig` to `act`, if it isn't NULL, and returns
+// the old one in `old`, if that isn't NULL.
+static long _set_action(int sig, const struct kernel_sigaction *act, struct kernel_sigaction *old) {
+  uint64_t all = ~BIT(SIGSYS), kmask;
+  _syscall(SYS_rt_sigprocmask, SIG_SETMASK, &all, &kmask, 8);
+  while (__atomic_exchange_n(&_actions_writer, 1, __ATOMIC_ACQUIRE)) {
+    _syscall(SYS_sched_yield);
+  }
+  struct kernel_sigaction prev = _actions[sig].act;
+  long rv = 0;
+  if (act) {
+    // Ours first: until the kernel has _on_signal, it only sends what it's
+    // already been told how to handle.
+    _put_action(sig, act);
+    rv = _install(sig, act);
+    if (rv != 0) {
+      _put_action(sig, &prev);
+    } else if (_seg) {
+      _publish_action(_seg, sig, act);
+      if (act->handler == SIG_IGN) {
+        // Ignoring a signal discards it.
+        siginfo_t info;
+        _take(&_seg->pending, sig, &info);
+        uint32_t n = __atomic_load_n(&_seg->nthreads, __ATOMIC_ACQUIRE);
+        for (uint32_t i = 0; i < n && i < MAX_THREADS; ++i) {
+          _take(&_seg->threads[i].pending, sig, &info);
+        }
+      }
+    }
+  }
+  __atomic_store_n(&_actions_writer, 0, __ATOMIC_RELEASE);
+  _syscall(SYS_rt_sigprocmask, SIG_SETMASK, &kmask, NULL, 8);
+  if (old && rv == 0) {
+    *old = prev;
+  }
+  return rv;
+}
+
+// Runs the program's action for a signal we've taken.
+static void _run(struct thread_slot *t, int sig, siginfo_t *info, void *uc) {
+  struct kernel_sigaction act;
+  _get_action(sig, &act);
+  if (act.handler == SIG_IGN) {
+    return;
+  }
+  if (act.handler == SIG_DFL) {
+    // The kernel knows what that is.
+    _syscall(SYS_tgkill, _pid, t->tid, sig);
+    return;
+  }
+  uint64_t old = __atomic_load_n(&t->mask, __ATOMIC_RELAXED);
+  uint64_t mask = old | act.mask | (act.flags & SA_NODEFER ? 0 : BIT(sig));
+  __atomic_store_n(&t->mask, mask & ~NOT_OURS, __ATOMIC_SEQ_CST);
+  if (act.flags & SA_RESETHAND) {
+    struct kernel_sigaction dfl = {.handler = SIG_DFL};
+    _set_action(sig, &dfl, NULL);
+  }
+  ucontext_t empty;
+  if (!uc) {
+    memset(&empty, 0, sizeof(empty));
+    uc = &empty;
+  }
+  if (act.flags & SA_SIGINFO) {
+    ((void (*)(int, siginfo_t*, void*))act.handler)(sig, info, uc);
+  } else {
+    ((void (*)(int))act.handler)(sig);
+  }
+  __atomic_store_n(&t->mask, old, __ATOMIC_SEQ_CST);
+}
+
+// Runs whatever `t` can take, lowest signal first and the thread's own before
+// the process's, like the kernel.
+static void _deliver(struct thread_slot *t, void *uc) {
+  uint64_t ready;
+  while ((ready = _ready(t))) {
+    int sig = __builtin_ctzll(ready) + 1;
+    bool mine = __atomic_load_n(&t->pending.set, __ATOMIC_RELAXED) & BIT(sig);
+    siginfo_t info;
+    if (_take(mine ? &t->pending : &_seg->pending, sig, &info)) {
+      _run(t, sig, &info, uc);
+    }
+  }
+}
+
+// The kernel's handler for every signal that the program has one for.
+static void _on_signal(int sig, siginfo_t *info, void *uc) {
+  struct thread_slot *t = _active() ? _self() : NULL;
+  struct kernel_sigaction act;
+  if (!t) {
+    // The kernel applied this thread's mask, so it's the program's now.
+    _get_action(sig, &act);
+    if (_is_handler(&act) && !_is_kick(info)) {
+      if (act.flags & SA_SIGINFO) {
+        ((void (*)(int, siginfo_t*, void*))act.handler)(sig, info, uc);
+      } else {
+        ((void (*)(int))act.handler)(sig);
+      }
+    }
+    return;
+  }
+  if (_is_kick(info)) {
+    _deliver(t, uc);
+    return;
+  }
+  bool fault = info->si_code > 0 && (sig == SIGSEGV || sig == SIGBUS || sig == SIGILL ||
+                                     sig == SIGFPE || sig == SIGTRAP);
+  if (fault) {
+    // The faulting instruction runs again when we return, so it can't wait.
+    _get_action(sig, &act);
+    if (!_is_handler(&act) || (__atomic_load_n(&t->mask, __ATOMIC_RELAXED) & BIT(sig))) {
+      // Blocked, or not handled, kills it; let the kernel do that.
+      struct kernel_sigaction dfl = {.handler = SIG_DFL};
+      _syscall(SYS_rt_sigaction, sig, &dfl, NULL, 8);
+      return;
+    }
+    _run(t, sig, info, uc);
+    return;
+  }
+  // If we block it, somebody else may not, or may be waiting for it.
+  struct thread_slot *target = info->si_code == SI_TKILL ? t : NULL;
+  _post(target ? &t->pending : &_seg->pending, sig, info);
+  _wake(_seg, _pid, target, sig);
+  _deliver(t, uc);
+}
+
+static void _kick(pid_t pid, int32_t tid, int sig) {
+  siginfo_t info;
+  memset(&info, 0, sizeof(info));
+  info.si_signo = sig;
+  info.si_code = SI_QUEUE;
+  info.si_pid = _pid;
+  info.si_uid = _uid;
+  info.si_value.sival_ptr = KICK;
+  _syscall(SYS_rt_tgsigqueueinfo, pid, tid, sig, &info);
+}
+
+// Whether `t` is stuck in a syscall, where it would take `sig` if it weren't.
+static bool _asleep_for(struct thread_slot *t, uint64_t bit) {
+  return __atomic_load_n(&t->in_syscall, __ATOMIC_SEQ_CST) &&
+         (!(__atomic_load_n(&t->mask, __ATOMIC_RELAXED) & bit) ||
+          (__atomic_load_n(&t->waiting, __ATOMIC_RELAXED) & bit));
+}
+
+// After posting `sig` to `target` (or the process, if NULL) in `seg`, wakes
+// somebody up to take it, if need be.
+static void _wake(struct segment *seg, pid_t pid, struct thread_slot *target, int sig) {
+  uint64_t bit = BIT(sig);
+  struct thread_slot *me = seg == _seg ? _slot : NULL;
+  if (target) {
+    if (target != me && _asleep_for(target, bit)) {
+      _kick(pid, target->tid, sig);
+    }
+    return;
+  }
+  // We're at a boundary ourselves.
+  if (me && !(__atomic_load_n(&me->mask, __ATOMIC_RELAXED) & bit)) {
+    return;
+  }
+  struct thread_slot *sleeper = NULL;
+  uint32_t n = __atomic_load_n(&seg->nthreads, __ATOMIC_ACQUIRE);
+  for (uint32_t i = 0; i < n && i < MAX_THREADS; ++i) {
+    struct thread_slot *t = &seg->threads[i];
+    if (__atomic_load_n(&t->tid, __ATOMIC_ACQUIRE) <= 0) {
+      continue;
+    }
+    if (!__atomic_load_n(&t->in_syscall, __ATOMIC_SEQ_CST) &&
+        !(__atomic_load_n(&t->mask, __ATOMIC_RELAXED) & bit)) {
+      // Will see it at its next boundary.
+      return;
+    }
+    if (!sleeper && _asleep_for(t, bit)) {
+      sleeper = t;
+    }
+  }
+  if (sleeper) {
+    _kick(pid, sleeper->tid, sig);
+  }
+}
+
+// Whether `sig`, with the default action, has to wait for `target` (or the
+// process, if NULL) of `seg`, rather than go to the kernel: because it's
+// blocked everywhere it could go, or somebody's waiting for it.
+static bool _held(struct segment *seg, struct thread_slot *target, uint64_t bit) {
+  if (target) {
+    return (__atomic_load_n(&target->mask, __ATOMIC_SEQ_CST) |
+            __atomic_load_n(&target->waiting, __ATOMIC_SEQ_CST)) & bit;
+  }
+  bool any = false;
+  uint32_t n = __atomic_load_n(&seg->nthreads, __ATOMIC_ACQUIRE);
+  for (uint32_t i = 0; i < n && i < MAX_THREADS; ++i) {
+    struct thread_slot *t = &seg->threads[i];
+    if (__atomic_load_n(&t->tid, __ATOMIC_ACQUIRE) <= 0) {
+      continue;
+    }
+    if (__atomic_load_n(&t->waiting, __ATOMIC_SEQ_CST) & bit) {
+      return true;
+    }
+    if (!(__atomic_load_n(&t->mask, __ATOMIC_SEQ_CST) & bit)) {
+      return false;
+    }
+    any = true;
+  }
+  return any;
+}
+
+// Sends `sig` to thread `tid` of `pid`, or to the process if `tid` is 0, by
+// way of its segment. False if it has to go to the kernel instead.
+static bool _send(pid_t pid, int32_t tid, int sig, int code) {
+  struct segment *seg = pid == _pid ? _seg : _map(pid);
+  if (!seg) {
+    return false;
+  }
+  bool sent = false;
+  uint64_t bit = BIT(sig);
+  struct thread_slot *target = tid ? _find(seg, tid) : NULL;
+  if (tid && !target) {
+    // Not one of its threads that we know of.
+  } else if (__atomic_load_n(&seg->ignored, __ATOMIC_ACQUIRE) & bit) {
+    sent = true;
+  } else if ((__atomic_load_n(&seg->caught, __ATOMIC_ACQUIRE) & bit) ||
+             _held(seg, target, bit)) {
+    // A held one with the default action goes to the kernel from _run, when
+    // somebody takes it.
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    info.si_signo = sig;
+    info.si_code = code;
+    info.si_pid = _pid;
+    info.si_uid = _uid;
+    _post(target ? &target->pending : &seg->pending, sig, &info);
+    _wake(seg, pid, target, sig);
+    sent = true;
+  }
+  if (seg != _seg) {
+    _syscall(SYS_munmap, seg, sizeof(*seg));
+  }
+  return sent;
+}
+
+// The program's pointers are read and written through shim_progmem_*, so that
+// a bad one fails with EFAULT. Like the kernel, we only find out that the one
+// for the old value is bad after making the change.
+
+static long _sigaction(int sig, const struct kernel_sigaction *act, struct kernel_sigaction *oldact) {
+  struct kernel_sigaction new, old;
+  // It may be the same memory as oldact.
+  if (act && shim_progmem_read(&new, act, sizeof(new)) != 0) {
+    return -EFAULT;
+  }
+  long rv = _set_action(sig, act ? &new : NULL, &old);
+  if (rv == 0 && oldact) {
+    rv = shim_progmem_write(oldact, &old, sizeof(old));
+  }
+  return rv;
+}
+
+static long _sigprocmask(struct thread_slot *t, int how, const uint64_t *set, uint64_t *oldset) {
+  uint64_t old = __atomic_load_n(&t->mask, __ATOMIC_RELAXED);
+  if (set) {
+    uint64_t mask;
+    if (shim_progmem_read(&mask, set, sizeof(mask)) != 0) {
+      return -EFAULT;
+    }
+    switch (how) {
+      case SIG_BLOCK: mask |= old; break;
+      case SIG_UNBLOCK: mask = old & ~mask; break;
+      case SIG_SETMASK: break;
+      default: return -EINVAL;
+    }
+    // Anything this unblocks is delivered on the way out.
+    __atomic_store_n(&t->mask, mask & ~NOT_OURS, __ATOMIC_SEQ_CST);
+  }
+  if (oldset) {
+    return shim_progmem_write(oldset, &old, sizeof(old));
+  }
+  return 0;
+}
+
+// rt_sigsuspend, and pause with the mask we have.
+static long _suspend(struct thread_slot *t, uint64_t mask, void *uc) {
+  uint64_t old = __atomic_load_n(&t->mask, __ATOMIC_RELAXED);
+  mask &= ~NOT_OURS;
+  __atomic_store_n(&t->mask, mask, __ATOMIC_SEQ_CST);
+  // Hold kicks in the kernel until we're asleep, so that one that comes just
+  // before can't get lost.
+  uint64_t all = ~BIT(SIGSYS), none = 0;
+  _syscall(SYS_rt_sigprocmask, SIG_SETMASK, &all, NULL, 8);
+  __atomic_store_n(&t->in_syscall, 1, __ATOMIC_SEQ_CST);
+  if (!_ready(t)) {
+    // Whatever gets through runs in _on_signal, under `mask`.
+    _syscall(SYS_rt_sigsuspend, &mask, 8);
+  }
+  __atomic_store_n(&t->in_syscall, 0, __ATOMIC_SEQ_CST);
+  _syscall(SYS_rt_sigprocmask, SIG_SETMASK, &none, NULL, 8);
+  _deliver(t, uc);
+  __atomic_store_n(&t->mask, old, __ATOMIC_SEQ_CST);
+  return -EINTR;
+}
+
+static long _timedwait(struct thread_slot *t, uint64_t want, siginfo_t *info,
+                       const struct timespec *timeout) {
+  want &= ~NOT_OURS;
+  uint64_t deadline = 0;
+  if (timeout) {
+    deadline = shim_monotonic_ns() + timeout->tv_sec * UINT64_C(1000000000) + timeout->tv_nsec;
+  }
+  // Kicks for what we want wait in the kernel, for its rt_sigtimedwait.
+  uint64_t kmask;
+  _syscall(SYS_rt_sigprocmask, SIG_BLOCK, &want, &kmask, 8);
+  __atomic_store_n(&t->waiting, want, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&t->in_syscall, 1, __ATOMIC_SEQ_CST);
+  long rv;
+  while (1) {
+    siginfo_t got;
+    uint64_t mine = __atomic_load_n(&t->pending.set, __ATOMIC_SEQ_CST) & want;
+    uint64_t ours = __atomic_load_n(&_seg->pending.set, __ATOMIC_SEQ_CST) & want;
+    if (mine | ours) {
+      int sig = __builtin_ctzll(mine | ours) + 1;
+      if (_take(mine & BIT(sig) ? &t->pending : &_seg->pending, sig, &got)) {
+        memcpy(info, &got, sizeof(got));
+        rv = sig;
+        break;
+      }
+      continue;
+    }
+    struct timespec left, *tp = NULL;
+    if (timeout) {
+      uint64_t now = shim_monotonic_ns();
+      uint64_t ns = now < deadline ? deadline - now : 0;
+      left.tv_sec = ns / 1000000000;
+      left.tv_nsec = ns % 1000000000;
+      tp = &left;
+    }
+    rv = _syscall(SYS_rt_sigtimedwait, &want, &got, tp, 8);
+    if (rv > 0 && _is_kick(&got)) {
+      continue;
+    }
+    // Or one from outside, that never went through _on_signal.
+    if (rv > 0) {
+      memcpy(info, &got, sizeof(got));
+    }
+    break;
+  }
+  __atomic_store_n(&t->in_syscall, 0, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&t->waiting, 0, __ATOMIC_SEQ_CST);
+  _syscall(SYS_rt_sigprocmask, SIG_SETMASK, &kmask, NULL, 8);
+  return rv;
+}
+
+void shim_signals_init() {
+  const char *env = getenv("SHIM_SIGNALS");
+  if (env == NULL || strcmp(env, "0") == 0) {
+    return;
+  }
+  static const long needed[] = {SYS_clone, SYS_clone3, SYS_fork, SYS_vfork, SYS_execve,
+                                SYS_execveat, SYS_rt_sigsuspend, SYS_rt_sigtimedwait, SYS_pause};
+  for (size_t i = 0; i < sizeof(needed) / sizeof(needed[0]); ++i) {
+    if (!shim_policy_traps(needed[i])) {
+      fprintf(stderr, "seccomp.so: SHIM_SIGNALS needs the policy to trap clone, clone3, fork, "
+                      "vfork, execve, execveat, rt_sigsuspend, rt_sigtimedwait and pause; "
+                      "leaving signals to the kernel\n");
+      return;
+    }
+  }
+  _pid = getpid();
+  _uid = getuid();
+  for (int sig = 1; sig <= 64; ++sig) {
+    if (_ours(sig)) {
+      _syscall(SYS_rt_sigaction, sig, NULL, &_actions[sig].act, 8);
+    }
+  }
+  _seg = _create();
+  if (!_seg) {
+    fprintf(stderr, "seccomp.so: couldn't create %s; leaving signals to the kernel\n", _path);
+    return;
+  }
+  // Handlers from before we got here.
+  for (int sig = 1; sig <= 64; ++sig) {
+    if (_ours(sig) && _is_handler(&_actions[sig].act)) {
+      _install(sig, &_actions[sig].act);
+    }
+  }
+  // The mask we started with (e.g. from before an exec) is ours now, and the
+  // kernel's is empty from here on.
+  uint64_t mask, none = 0;
+  _syscall(SYS_rt_sigprocmask, SIG_SETMASK, &none, &mask, 8);
+  _inherited_mask = mask & ~NOT_OURS;
+  _inherited = true;
+  _self();
+}
+
+bool shim_signals_emulates(long n, const long args[6]) {
+  if (!_active()) {
+    return false;
+  }
+  // Actions are per process, so every thread's go through us.
+  if (n == SYS_rt_sigaction) {
+    return _ours(args[0]) && args[3] == 8;
+  }
+  if (!_self()) {
+    return false;
+  }
+  switch (n) {
+    case SYS_rt_sigprocmask:
+      return args[3] == 8;
+    case SYS_rt_sigpending:
+    case SYS_rt_sigsuspend:
+      return args[1] == 8;
+    case SYS_rt_sigtimedwait: {
+      // A bad set is the kernel's to fail.
+      uint64_t want;
+      return args[3] == 8 && shim_progmem_read(&want, (const void*)args[0], sizeof(want)) == 0 &&
+             (want & ~NOT_OURS);
+    }
+    case SYS_pause:
+      return true;
+    case SYS_kill:
+      return args[0] > 0 && _ours(args[1]) && args[1] != SIGCONT;
+    case SYS_tgkill:
+      return args[0] > 0 && args[1] > 0 && _ours(args[2]) && args[2] != SIGCONT;
+    case SYS_tkill:
+      return args[0] > 0 && _ours(args[1]) && args[1] != SIGCONT;
+    default:
+      return false;
+  }
+}
+
+long shim_signals_syscall(long n, const long args[6], void *uc) {
+  struct thread_slot *t = _slot;
+  switch (n) {
+    case SYS_rt_sigaction:
+      return _sigaction(args[0], (const struct kernel_sigaction*)args[1],
+                        (struct kernel_sigaction*)args[2]);
+    case SYS_rt_sigprocmask:
+      return _sigprocmask(t, args[0], (const uint64_t*)args[1], (uint64_t*)args[2]);
+    case SYS_rt_sigpending: {
+      uint64_t pending = __atomic_load_n(&t->pending.set, __ATOMIC_ACQUIRE) |
+                         __atomic_load_n(&_seg->pending.set, __ATOMIC_ACQUIRE);
+      pending &= __atomic_load_n(&t->mask, __ATOMIC_RELAXED);
+      return shim_progmem_write((void*)args[0], &pending, sizeof(pending));
+    }
+    case SYS_rt_sigsuspend: {
+      uint64_t mask;
+      if (shim_progmem_read(&mask, (const void*)args[0], sizeof(mask)) != 0) {
+        return -EFAULT;
+      }
+      return _suspend(t, mask, uc);
+    }
+    case SYS_pause:
+      return _suspend(t, __atomic_load_n(&t->mask, __ATOMIC_RELAXED), uc);
+    case SYS_rt_sigtimedwait: {
+      uint64_t want;
+      struct timespec timeout;
+      if (shim_progmem_read(&want, (const void*)args[0], sizeof(want)) != 0 ||
+          (args[2] && shim_progmem_read(&timeout, (const void*)args[2], sizeof(timeout)) != 0)) {
+        return -EFAULT;
+      }
+      if (args[2] && (timeout.tv_sec < 0 || timeout.tv_nsec < 0 || timeout.tv_nsec >= 1000000000)) {
+        return -EINVAL;
+      }
+      siginfo_t info;
+      long rv = _timedwait(t, want, &info, args[2] ? &timeout : NULL);
+      if (rv > 0 && args[1] && shim_progmem_write((void*)args[1], &info, sizeof(info)) != 0) {
+        return -EFAULT;
+      }
+      return rv;
+    }
+    case SYS_kill:
+      if (_send(args[0], 0, args[1], SI_USER)) {
+        return 0;
+      }
+      break;
+    case SYS_tgkill:
+      if (_send(args[0], args[1], args[2], SI_TKILL)) {
+        return 0;
+      }
+      break;
+    case SYS_tkill:
+      // Only our own threads; we can't tell whose anyone else's are.
+      if (_find(_seg, args[0]) && _send(_pid, args[0], args[1], SI_TKILL)) {
+        return 0;
+      }
+      break;
+  }
+  return _syscall(n, args[0], args[1], args[2], args[3], args[4], args[5]);
+}
+
+void shim_signals_enter(long n, const long args[6], void *uc) {
+  if (!_seg) {
+    return;
+  }
+  uint64_t flags;
+  long stack;
+  bool clone = shim_clone_flags(n, args, &flags, &stack);
+  if (clone && (flags & CLONE_VM) && (flags & CLONE_VFORK)) {
+    __atomic_fetch_add(&_vforking, 1, __ATOMIC_ACQUIRE);
+  }
+  struct thread_slot *t = _active() ? _self() : NULL;
+  if (!t) {
+    return;
+  }
+  // Anything we can take goes first, and then we're in the syscall. Kicks
+  // from then on interrupt it.
+  while (1) {
+    __atomic_store_n(&t->in_syscall, 1, __ATOMIC_SEQ_CST);
+    if (!_ready(t)) {
+      break;
+    }
+    __atomic_store_n(&t->in_syscall, 0, __ATOMIC_SEQ_CST);
+    _deliver(t, uc);
+  }
+  uint64_t mask = __atomic_load_n(&t->mask, __ATOMIC_RELAXED);
+  if (clone && (flags & CLONE_THREAD) && (flags & CLONE_SETTLS)) {
+    // A new thread starts with our mask. Its TLS is set up already (glibc
+    // does it before the clone), and if its thread pointer points at itself,
+    // as the x86-64 TLS ABI has it, our static TLS is at the same offset from
+    // it as from ours. All of that is the program's memory, so bad pointers
+    // are left for the kernel (or the new thread) to trip over.
+    char *tp = (char*)args[4];
+    struct clone_args ca;
+    if (n == SYS_clone3) {
+      tp = shim_progmem_read(&ca, (const void*)args[0], CLONE_ARGS_SIZE_VER0) == 0
+               ? (char*)ca.tls : NULL;
+    }
+    char *ours = __builtin_thread_pointer();
+    char *self;
+    bool inherited = true;
+    if (tp && shim_progmem_read(&self, tp, sizeof(self)) == 0 && self == tp) {
+      shim_progmem_write(tp + ((char*)&_inherited_mask - ours), &mask, sizeof(mask));
+      shim_progmem_write(tp + ((char*)&_inherited - ours), &inherited, sizeof(inherited));
+    }
+  } else if ((clone && (flags & CLONE_VFORK)) || n == SYS_execve || n == SYS_execveat) {
+    // These inherit the kernel's mask.
+    _syscall(SYS_rt_sigprocmask, SIG_SETMASK, &mask, NULL, 8);
+  } else if ((clone && !(flags & CLONE_VM)) || n == SYS_fork) {
+    // Until the child has a segment of its own, anything from the kernel
+    // would end up in ours.
+    uint64_t all = ~BIT(SIGSYS);
+    _syscall(SYS_rt_sigprocmask, SIG_SETMASK, &all, NULL, 8);
+  }
+}
+
+void shim_signals_leave(long n, const long args[6], long rv) {
+  if (!_seg) {
+    return;
+  }
+  uint64_t flags = 0;
+  long stack;
+  bool clone = shim_clone_flags(n, args, &flags, &stack) || n == SYS_fork;
+  uint64_t none = 0;
+  if (clone && rv == 0) {
+    // The child of a fork, which has signals of its own. Threads and vfork
+    // children never come back this way.
+    struct segment *parent = _seg;
+    uint64_t mask = _slot ? _slot->mask : 0;
+    _slot = NULL;
+    _no_slot = false;
+    _pid = _syscall(SYS_getpid);
+    _seg = _create();
+    _syscall(SYS_munmap, parent, sizeof(*parent));
+    if (!_seg) {
+      // Let the kernel hold what we were holding.
+      _syscall(SYS_rt_sigprocmask, SIG_SETMASK, &mask, NULL, 8);
+      return;
+    }
+    _inherited_mask = mask;
+    _inherited = true;
+    _self();
+    _syscall(SYS_rt_sigprocmask, SIG_SETMASK, &none, NULL, 8);
+    return;
+  }
+  if (clone && (flags & CLONE_VM) && (flags & CLONE_VFORK)) {
+    _syscall(SYS_rt_sigprocmask, SIG_SETMASK, &none, NULL, 8);
+    __atomic_fetch_sub(&_vforking, 1, __ATOMIC_RELEASE);
+  } else if (((clone && !(flags & CLONE_VM)) || n == SYS_execve || n == SYS_execveat) &&
+             _active()) {
+    // The parent of a fork, or an exec that failed.
+    _syscall(SYS_rt_sigprocmask, SIG_SETMASK, &none, NULL, 8);
+  }
+  if (_slot && _active()) {
+    __atomic_store_n(&_slot->in_syscall, 0, __ATOMIC_SEQ_CST);
+  }
+}
+
+void shim_signals_deliver(void *uc) {
+  struct thread_slot *t = _active() ? _self() : NULL;
+  if (t && _ready(t)) {
+    _deliver(t, uc);
+  }
+}
+
+void shim_signals_thread_exit() {
+  struct thread_slot *t = _slot;
+  if (!t || !_active()) {
+    return;
+  }
+  _slot = NULL;
+  // Its pending signals die with it.
+  __atomic_store_n(&t->pending.set, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&t->pending.busy, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&t->in_syscall, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&t->waiting, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&t->tid, 0, __ATOMIC_RELEASE);
+}
+
+void shim_signals_exit() {
+  if (_seg) {
+    _syscall(SYS_unlink, _path);
+  }
+}
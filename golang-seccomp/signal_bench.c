@@ -0,0 +1,182 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Signals per second, for comparing the kernel's signals with seccomp.so's
+// SHIM_SIGNALS (see signal_bench.sh). Modes:
+//
+//   self      kill(getpid(), SIGUSR1), handled before kill returns
+//   thread    tgkill to ourselves
+//   masked    block SIGUSR1, kill ourselves, unblock: delivered on unblock
+//   pingpong  two threads taking turns to tgkill the other and sigsuspend
+//   procs     the same between a parent and child process, with kill
+//
+// Usage: signal_bench [-m mode] [-n signals] [-l label]
+//
+// Prints one JSON object. Fails if a signal goes missing or arrives twice.
+
+#define CHECK(x) { \
+  if (!(x)) {\
+    perror(#x);\
+    exit(EXIT_FAILURE);\
+  }\
+}
+
+#define CHECK_EQ0(x) CHECK((x) == 0)
+
+static volatile sig_atomic_t _count;
+
+static void _handler(int sig) {
+  ++_count;
+}
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static sigset_t _usr1;
+static sigset_t _none;
+
+// For pingpong: each side's tid, and how many signals it's had.
+struct side {
+  pid_t tid;
+  long n;
+};
+static struct side _sides[2];
+static __thread long _got;
+
+static void _count_handler(int sig) {
+  ++_got;
+}
+
+// Both sides go `n` times around: wait for a signal, send one back.
+static void _volley(int me, long n, void (*send)(int other)) {
+  for (long i = 0; i < n; ++i) {
+    if (me == 0) {
+      send(1);
+    }
+    while (_got <= i) {
+      sigsuspend(&_none);
+    }
+    if (me == 1) {
+      send(0);
+    }
+  }
+  _sides[me].n = _got;
+}
+
+static void _tgkill(int other) {
+  CHECK_EQ0(syscall(SYS_tgkill, getpid(), _sides[other].tid, SIGUSR1));
+}
+
+static void *_pong(void *arg) {
+  long n = (long)arg;
+  _sides[1].tid = gettid();
+  __atomic_store_n(&_count, 1, __ATOMIC_RELEASE);
+  _volley(1, n, _tgkill);
+  return NULL;
+}
+
+static pid_t _peer;
+
+static void _kill(int other) {
+  CHECK_EQ0(kill(_peer, SIGUSR1));
+}
+
+int main(int argc, char **argv) {
+  const char *mode = "self";
+  long n = 100000;
+  const char *label = "";
+  int opt;
+  while ((opt = getopt(argc, argv, "m:n:l:")) != -1) {
+    switch (opt) {
+      case 'm': mode = optarg; break;
+      case 'n': n = atol(optarg); break;
+      case 'l': label = optarg; break;
+      default:
+        fprintf(stderr, "Usage: %s [-m mode] [-n signals] [-l label]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+  CHECK(n > 0);
+  sigemptyset(&_none);
+  sigemptyset(&_usr1);
+  sigaddset(&_usr1, SIGUSR1);
+
+  double start = now();
+  long signals = n;
+  if (strcmp(mode, "self") == 0 || strcmp(mode, "thread") == 0 || strcmp(mode, "masked") == 0) {
+    CHECK_EQ0(sigaction(SIGUSR1, &(struct sigaction){.sa_handler = _handler}, NULL));
+    pid_t pid = getpid(), tid = gettid();
+    bool masked = strcmp(mode, "masked") == 0;
+    bool thread = strcmp(mode, "thread") == 0;
+    start = now();
+    for (long i = 0; i < n; ++i) {
+      if (masked) {
+        CHECK_EQ0(sigprocmask(SIG_BLOCK, &_usr1, NULL));
+      }
+      if (thread) {
+        CHECK_EQ0(syscall(SYS_tgkill, pid, tid, SIGUSR1));
+      } else {
+        CHECK_EQ0(kill(pid, SIGUSR1));
+      }
+      if (masked) {
+        CHECK(_count == i);
+        CHECK_EQ0(sigprocmask(SIG_UNBLOCK, &_usr1, NULL));
+      }
+    }
+    CHECK(_count == n);
+  } else if (strcmp(mode, "pingpong") == 0) {
+    // Blocked except in sigsuspend, so none can slip by between checking
+    // _got and waiting. The new thread inherits the mask.
+    CHECK_EQ0(sigaction(SIGUSR1, &(struct sigaction){.sa_handler = _count_handler}, NULL));
+    CHECK_EQ0(sigprocmask(SIG_BLOCK, &_usr1, NULL));
+    _sides[0].tid = gettid();
+    pthread_t thread;
+    CHECK_EQ0(pthread_create(&thread, NULL, _pong, (void*)n));
+    while (!__atomic_load_n(&_count, __ATOMIC_ACQUIRE)) {
+      sched_yield();
+    }
+    start = now();
+    _volley(0, n, _tgkill);
+    CHECK_EQ0(pthread_join(thread, NULL));
+    CHECK(_sides[0].n == n && _sides[1].n == n);
+    signals = 2 * n;
+  } else if (strcmp(mode, "procs") == 0) {
+    CHECK_EQ0(sigaction(SIGUSR1, &(struct sigaction){.sa_handler = _count_handler}, NULL));
+    CHECK_EQ0(sigprocmask(SIG_BLOCK, &_usr1, NULL));
+    pid_t parent = getpid();
+    pid_t child = fork();
+    CHECK(child >= 0);
+    if (child == 0) {
+      _peer = parent;
+      _volley(1, n, _kill);
+      _exit(_sides[1].n == n ? 0 : 1);
+    }
+    _peer = child;
+    _volley(0, n, _kill);
+    int status;
+    CHECK(waitpid(child, &status, 0) == child);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0 && _sides[0].n == n);
+    signals = 2 * n;
+  } else {
+    fprintf(stderr, "unknown mode %s\n", mode);
+    exit(EXIT_FAILURE);
+  }
+  double secs = now() - start;
+  printf("{\"label\":\"%s\",\"mode\":\"%s\",\"signals\":%ld,\"secs\":%.3f,"
+         "\"signals_per_sec\":%.0f}\n",
+         label, mode, signals, secs, signals / secs);
+  return 0;
+}
@@ -0,0 +1,41 @@
+#!/bin/bash
+#
+# Runs each of signal_bench's modes natively, under seccomp.so, and under
+# seccomp.so with SHIM_SIGNALS, and prints one JSON object per run (with
+# `shim` set to one of those). A mode that fails prints {"failed":true}
+# instead: without SHIM_SIGNALS, the shim's mask changes don't outlast the
+# SIGSYS handler (rt_sigreturn puts the old mask back), so `masked` loses
+# count and the sigsuspend modes can hang.
+#
+# Knobs (environment):
+#   MODES  default "self thread masked pingpong procs"
+#   N      signals per run (per side, for the two-sided modes), default 100000
+#   LIMIT  seconds before giving up on a run, default 30
+
+set -u
+
+cd "$(dirname "$0")"
+
+MODES=${MODES:-"self thread masked pingpong procs"}
+N=${N:-100000}
+LIMIT=${LIMIT:-30}
+
+# Not timeout(1): it would run under the shim too.
+run() {
+  local shim=$1 mode=$2
+  shift 2
+  env "$@" ./signal_bench -m "$mode" -n "$N" -l "$shim" 2>/dev/null &
+  local pid=$!
+  # procs leaves a child behind.
+  ( sleep "$LIMIT"; pkill -KILL -P $pid; kill -KILL $pid ) 2>/dev/null &
+  local watchdog=$!
+  { wait $pid; } 2>/dev/null || echo "{\"label\":\"$shim\",\"mode\":\"$mode\",\"failed\":true}"
+  kill $watchdog 2>/dev/null
+  wait $watchdog 2>/dev/null
+}
+
+for mode in $MODES; do
+  run native "$mode"
+  run shim "$mode" LD_PRELOAD=$PWD/seccomp.so
+  run signals "$mode" LD_PRELOAD=$PWD/seccomp.so SHIM_SIGNALS=1
+done | sed 's/"label"/"shim"/'
@@ -0,0 +1,32 @@
+#!/bin/bash
+#
+# Checks SHIM_SIGNALS against the kernel: runs ../process-thread-signals/main
+# natively and with SHIM_SIGNALS, and fails if they disagree. main checks for
+# itself that a signal pending for both the process and the thread is
+# delivered twice, once the thread unblocks it.
+
+set -u
+
+cd "$(dirname "$0")"
+
+make -s -C ../process-thread-signals main || exit 1
+
+status=0
+check() {
+  local name=$1
+  shift
+  local got
+  got=$(env "$@" ../process-thread-signals/main 2>&1)
+  local rv=$?
+  if [ $rv -ne 0 ] || [ "$got" != "Final count 2" ]; then
+    echo "FAIL $name (exit $rv): $got"
+    status=1
+  else
+    echo "ok   $name"
+  fi
+}
+
+check native
+check signals LD_PRELOAD=$PWD/seccomp.so SHIM_SIGNALS=1
+check signals+patch LD_PRELOAD=$PWD/seccomp.so SHIM_SIGNALS=1 SHIM_PATCH=1
+exit $status
@@ -0,0 +1,235 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shim.h"
+#include "stats.h"
+#include "syscallnames.h"
+
+// Per-syscall counters and latency histograms, kept in a shared-memory segment
+// at /dev/shm/seccomp-shim.<pid>.stats so that shimstat can watch them while
+// the process runs. Enabled by setting SHIM_STATS=1 in the environment.
+//
+// Everything here can run inside the SIGSYS handler, so: no libc calls that
+// might make syscalls (we'd trap on them) or take locks (we might have
+// interrupted the holder), and no assumptions that we weren't interrupted by
+// another instance of ourselves. Each thread gets its own slot in the segment,
+// but counters are still updated with atomic adds since a nested trap on the
+// same thread can interleave with an update.
+
+static struct shim_stats_segment *_stats = NULL;
+static char _stats_path[64];
+static __thread struct shim_thread_stats *_thread_stats = NULL;
+
+static void _make_path(char *path, pid_t pid) {
+  struct shim_outbuf out = {.fd = -1};
+  shim_out_str(&out, "/dev/shm/seccomp-shim.");
+  shim_out_u64(&out, pid, 0);
+  shim_out_str(&out, ".stats");
+  memcpy(path, out.buf, out.len);
+  path[out.len] = '\0';
+}
+
+static struct shim_stats_segment* _create_segment() {
+  pid_t pid = _syscall(SYS_getpid);
+  _make_path(_stats_path, pid);
+  int fd = _syscall(SYS_openat, AT_FDCWD, _stats_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    return NULL;
+  }
+  // The segment is big, but sparse: pages for syscalls and threads that never
+  // show up are never touched.
+  long rv = _syscall(SYS_ftruncate, fd, sizeof(struct shim_stats_segment));
+  void *seg = (void*)_syscall(SYS_mmap, NULL, sizeof(struct shim_stats_segment),
+                              PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  _syscall(SYS_close, fd);
+  if (rv != 0 || (unsigned long)seg > -4096UL) {
+    _syscall(SYS_unlink, _stats_path);
+    return NULL;
+  }
+
+  struct shim_stats_segment *stats = seg;
+  stats->version = SHIM_STATS_VERSION;
+  stats->pid = pid;
+  stats->start_tsc = shim_rdtsc();
+  stats->start_ns = shim_monotonic_ns();
+  // Publish last, so that readers never see a half-initialized header.
+  __atomic_store_n(&stats->magic, SHIM_STATS_MAGIC, __ATOMIC_RELEASE);
+  return stats;
+}
+
+// After fork the child shares our MAP_SHARED segment; give it its own.
+static void _stats_atfork_child() {
+  struct shim_stats_segment *parent = _stats;
+  _stats = NULL;
+  _thread_stats = NULL;
+  _syscall(SYS_munmap, parent, sizeof(*parent));
+  _stats = _create_segment();
+}
+
+void shim_stats_init() {
+  const char *env = getenv("SHIM_STATS");
+  if (env == NULL || strcmp(env, "0") == 0) {
+    return;
+  }
+  _stats = _create_segment();
+  if (_stats) {
+    pthread_atfork(NULL, NULL, _stats_atfork_child);
+  }
+}
+
+static struct shim_thread_stats* _get_thread_stats() {
+  if (_thread_stats) {
+    return _thread_stats;
+  }
+  int32_t tid = _syscall(SYS_gettid);
+  for (int i = 1; i < SHIM_STATS_MAX_THREADS; ++i) {
+    int32_t expected = 0;
+    if (__atomic_compare_exchange_n(&_stats->threads[i].tid, &expected, tid, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      _thread_stats = &_stats->threads[i];
+      return _thread_stats;
+    }
+  }
+  // Out of slots; share slot 0. Don't cache that, so that we can pick up a
+  // slot of our own once another thread exits.
+  return &_stats->threads[0];
+}
+
+static void _add(uint64_t *counter, uint64_t v) {
+  __atomic_fetch_add(counter, v, __ATOMIC_RELAXED);
+}
+
+void shim_stats_record(long n, uint64_t handler_cycles, uint64_t syscall_cycles, bool patched,
+                       enum shim_route route) {
+  if (!_stats) {
+    return;
+  }
+  if (n < 0 || n >= SHIM_STATS_MAX_SYSCALL) {
+    n = SHIM_STATS_MAX_SYSCALL - 1;
+  }
+  struct shim_syscall_stats *s = &_get_thread_stats()->syscalls[n];
+  _add(&s->count, 1);
+  _add(&s->patched, patched);
+  _add(&s->local, route == SHIM_ROUTE_LOCAL);
+  _add(&s->remote, route == SHIM_ROUTE_REMOTE);
+  _add(&s->handler_cycles, handler_cycles);
+  _add(&s->handler_hist[shim_stats_bucket(handler_cycles)], 1);
+  _add(&s->syscall_cycles, syscall_cycles);
+  _add(&s->syscall_hist[shim_stats_bucket(syscall_cycles)], 1);
+}
+
+void shim_stats_site(bool patched) {
+  if (_stats) {
+    _add(patched ? &_stats->sites_patched : &_stats->sites_trapping, 1);
+  }
+}
+
+void shim_stats_thread_exit() {
+  if (!_stats || !_thread_stats) {
+    return;
+  }
+  // Fold our counts into the shared slot and give ours up.
+  struct shim_thread_stats *mine = _thread_stats;
+  _thread_stats = NULL;
+  for (int n = 0; n < SHIM_STATS_MAX_SYSCALL; ++n) {
+    struct shim_syscall_stats *from = &mine->syscalls[n];
+    if (from->count == 0) {
+      continue;
+    }
+    struct shim_syscall_stats *to = &_stats->threads[0].syscalls[n];
+    _add(&to->count, from->count);
+    _add(&to->patched, from->patched);
+    _add(&to->local, from->local);
+    _add(&to->remote, from->remote);
+    _add(&to->handler_cycles, from->handler_cycles);
+    _add(&to->syscall_cycles, from->syscall_cycles);
+    for (int b = 0; b < SHIM_STATS_BUCKETS; ++b) {
+      _add(&to->handler_hist[b], from->handler_hist[b]);
+      _add(&to->syscall_hist[b], from->syscall_hist[b]);
+    }
+    memset(from, 0, sizeof(*from));
+  }
+  __atomic_store_n(&mine->tid, 0, __ATOMIC_RELEASE);
+}
+
+static uint64_t _cycles_to_ns(uint64_t cycles, uint64_t elapsed_cycles, uint64_t elapsed_ns) {
+  if (elapsed_cycles == 0) {
+    return 0;
+  }
+  return (unsigned __int128)cycles * elapsed_ns / elapsed_cycles;
+}
+
+void shim_stats_exit() {
+  if (!_stats) {
+    return;
+  }
+  struct shim_stats_segment *stats = _stats;
+  _stats = NULL;
+
+  uint64_t elapsed_cycles = shim_rdtsc() - stats->start_tsc;
+  uint64_t elapsed_ns = shim_monotonic_ns() - stats->start_ns;
+
+  struct shim_outbuf out = {.fd = STDERR_FILENO};
+  shim_out_str(&out, "seccomp shim stats for pid ");
+  shim_out_u64(&out, stats->pid, 0);
+  shim_out_str(&out, " (ns; p50/p99 are histogram bucket upper bounds)\n");
+  if (stats->sites_patched || stats->sites_trapping) {
+    shim_out_str(&out, "syscall sites patched: ");
+    shim_out_u64(&out, stats->sites_patched, 0);
+    shim_out_str(&out, ", still trapping: ");
+    shim_out_u64(&out, stats->sites_trapping, 0);
+    shim_out_char(&out, '\n');
+  }
+  shim_out_str(&out, " nr name                      count    patched      local     remote   handler avg/p50/p99     syscall avg/p50/p99\n");
+  for (int n = 0; n < SHIM_STATS_MAX_SYSCALL; ++n) {
+    struct shim_syscall_stats sum = {0};
+    for (int t = 0; t < SHIM_STATS_MAX_THREADS; ++t) {
+      const struct shim_syscall_stats *s = &stats->threads[t].syscalls[n];
+      if (s->count == 0) {
+        continue;
+      }
+      sum.count += s->count;
+      sum.patched += s->patched;
+      sum.local += s->local;
+      sum.remote += s->remote;
+      sum.handler_cycles += s->handler_cycles;
+      sum.syscall_cycles += s->syscall_cycles;
+      for (int b = 0; b < SHIM_STATS_BUCKETS; ++b) {
+        sum.handler_hist[b] += s->handler_hist[b];
+        sum.syscall_hist[b] += s->syscall_hist[b];
+      }
+    }
+    if (sum.count == 0) {
+      continue;
+    }
+    const char *name = n < SYSCALL_NAMES_LEN && syscall_names[n] ? syscall_names[n] : "?";
+    shim_out_u64(&out, n, 3);
+    shim_out_char(&out, ' ');
+    shim_out_str_padded(&out, name, 20);
+    shim_out_u64(&out, sum.count, 11);
+    shim_out_u64(&out, sum.patched, 11);
+    shim_out_u64(&out, sum.local, 11);
+    shim_out_u64(&out, sum.remote, 11);
+    const uint64_t *hists[] = {sum.handler_hist, sum.syscall_hist};
+    const uint64_t totals[] = {sum.handler_cycles, sum.syscall_cycles};
+    for (int i = 0; i < 2; ++i) {
+      shim_out_str(&out, "  ");
+      shim_out_u64(&out, _cycles_to_ns(totals[i] / sum.count, elapsed_cycles, elapsed_ns), 7);
+      shim_out_u64(&out, _cycles_to_ns(shim_stats_quantile(hists[i], 0.5), elapsed_cycles, elapsed_ns), 7);
+      shim_out_u64(&out, _cycles_to_ns(shim_stats_quantile(hists[i], 0.99), elapsed_cycles, elapsed_ns), 8);
+    }
+    shim_out_char(&out, '\n');
+  }
+  shim_out_flush(&out);
+
+  _syscall(SYS_unlink, _stats_path);
+}
@@ -0,0 +1,83 @@
+// Layout of the shim's shared-memory stats segment. Written by seccomp.so
+// (stats.c) and read, possibly while the process is still running, by
+// shimstat.c.
+#pragma once
+
+#include <stdint.h>
+
+#define SHIM_STATS_MAGIC UINT64_C(0x7374617473686d31) /* "1mhstats" */
+#define SHIM_STATS_VERSION 4
+
+// Syscalls numbered at or above this are counted under the last entry.
+#define SHIM_STATS_MAX_SYSCALL 512
+// Histogram bucket i counts intervals of [2^i, 2^(i+1)) TSC cycles; the last
+// bucket also gets everything longer.
+#define SHIM_STATS_BUCKETS 32
+// Thread slot 0 is shared: it absorbs the counts of threads that have exited,
+// and of threads that started when every other slot was taken.
+#define SHIM_STATS_MAX_THREADS 128
+
+struct shim_syscall_stats {
+  uint64_t count;
+  // How many of `count` came from patched sites, rather than traps.
+  uint64_t patched;
+  // How many of `count` we answered ourselves, without the kernel (e.g. from
+  // the identity cache, or the simulated clock).
+  uint64_t local;
+  // How many of `count` went to the controller (see channel.c). The rest went
+  // to the kernel.
+  uint64_t remote;
+  // Cycles spent in our handler, not counting the real syscall.
+  uint64_t handler_cycles;
+  // Cycles spent in the real syscall.
+  uint64_t syscall_cycles;
+  uint64_t handler_hist[SHIM_STATS_BUCKETS];
+  uint64_t syscall_hist[SHIM_STATS_BUCKETS];
+};
+
+struct shim_thread_stats {
+  // Owning thread, or 0 if the slot is free. Written with atomics.
+  int32_t tid;
+  int32_t _pad;
+  struct shim_syscall_stats syscalls[SHIM_STATS_MAX_SYSCALL];
+};
+
+struct shim_stats_segment {
+  uint64_t magic;
+  uint32_t version;
+  int32_t pid;
+  // A (TSC, CLOCK_MONOTONIC) pair taken when the segment was created. Readers
+  // take their own pair to estimate the TSC frequency, so that the hot path
+  // only ever has to record raw cycle counts.
+  uint64_t start_tsc;
+  uint64_t start_ns;
+  // Syscall sites that SHIM_PATCH rewrote, and that it couldn't.
+  uint64_t sites_patched;
+  uint64_t sites_trapping;
+  struct shim_thread_stats threads[SHIM_STATS_MAX_THREADS];
+};
+
+static inline int shim_stats_bucket(uint64_t cycles) {
+  int b = cycles ? 63 - __builtin_clzll(cycles) : 0;
+  return b < SHIM_STATS_BUCKETS ? b : SHIM_STATS_BUCKETS - 1;
+}
+
+// Upper bound, in cycles, of the bucket that the `p`th quantile (0 < p < 1)
+// of `hist` falls in. 0 if the histogram is empty.
+static inline uint64_t shim_stats_quantile(const uint64_t *hist, double p) {
+  uint64_t total = 0;
+  for (int i = 0; i < SHIM_STATS_BUCKETS; ++i) {
+    total += hist[i];
+  }
+  if (total == 0) {
+    return 0;
+  }
+  uint64_t target = (uint64_t)(p * total), seen = 0;
+  for (int i = 0; i < SHIM_STATS_BUCKETS; ++i) {
+    seen += hist[i];
+    if (seen > target) {
+      return UINT64_C(2) << i;
+    }
+  }
+  return UINT64_C(2) << (SHIM_STATS_BUCKETS - 1);
+}
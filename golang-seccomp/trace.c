@@ -0,0 +1,230 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "shim.h"
+#include "trace.h"
+
+// Binary trace of every trapped syscall. Set SHIM_TRACE=<prefix> to write
+// <prefix>.<pid>, and decode it with shimtrace.
+//
+// The file itself is the buffer: it's mmap'd, and each thread appends
+// fixed-size events to its own ring in it, so recording an event is a couple
+// of stores and an atomic increment, with no syscalls and no locks. Each ring
+// keeps the most recent SHIM_TRACE_EVENTS events (default 65536, at most 2^24)
+// of its thread, for up to SHIM_TRACE_THREADS threads (default 64, at most
+// 4096), and fewer threads if that many rings would make the file bigger than
+// 4 GiB. The kernel writes the pages back on its own schedule; at exit we just
+// record a final clock calibration and truncate off rings that were never
+// used.
+
+#define DEFAULT_RING_EVENTS (1 << 16)
+#define DEFAULT_RINGS 64
+// Caps on the knobs, so that a typo doesn't overflow the ring arithmetic, and
+// on the file, so that it doesn't ask for terabytes (if sparse). A single
+// ring of MAX_RING_EVENTS fits under MAX_TRACE_SIZE.
+#define MAX_RING_EVENTS (1 << 24)
+#define MAX_RINGS 4096
+#define MAX_TRACE_SIZE (UINT64_C(4) << 30)
+
+static struct shim_trace_header *_trace = NULL;
+static uint64_t _trace_size = 0;
+static int _trace_fd = -1;
+static const char *_trace_prefix = NULL;
+static __thread struct shim_trace_ring *_thread_ring = NULL;
+
+static uint32_t _ring_events = DEFAULT_RING_EVENTS;
+static uint32_t _nrings = DEFAULT_RINGS;
+
+static int _open_trace_file(pid_t pid) {
+  // An exec'd image keeps our pid; don't clobber the previous image's trace.
+  for (int attempt = 0; attempt < 100; ++attempt) {
+    char path[256];
+    struct shim_outbuf out = {.fd = -1};
+    shim_out_str(&out, _trace_prefix);
+    shim_out_char(&out, '.');
+    shim_out_u64(&out, pid, 0);
+    if (attempt) {
+      shim_out_char(&out, '.');
+      shim_out_u64(&out, attempt, 0);
+    }
+    if (out.len >= sizeof(path)) {
+      return -ENAMETOOLONG;
+    }
+    memcpy(path, out.buf, out.len);
+    path[out.len] = '\0';
+    int fd = _syscall(SYS_openat, AT_FDCWD, path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd != -EEXIST) {
+      return fd;
+    }
+  }
+  return -EEXIST;
+}
+
+static void _create_trace() {
+  pid_t pid = _syscall(SYS_getpid);
+  int fd = _open_trace_file(pid);
+  if (fd < 0) {
+    return;
+  }
+  uint64_t size = sizeof(struct shim_trace_header) + _nrings * shim_trace_ring_size(_ring_events);
+  // Sparse until written.
+  long rv = _syscall(SYS_ftruncate, fd, size);
+  void *p = (void*)_syscall(SYS_mmap, NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (rv != 0 || (unsigned long)p > -4096UL) {
+    _syscall(SYS_close, fd);
+    return;
+  }
+  struct shim_trace_header *hdr = p;
+  hdr->version = SHIM_TRACE_VERSION;
+  hdr->pid = pid;
+  hdr->nrings = _nrings;
+  hdr->ring_events = _ring_events;
+  hdr->start_tsc = shim_rdtsc();
+  hdr->start_ns = shim_monotonic_ns();
+  __atomic_store_n(&hdr->magic, SHIM_TRACE_MAGIC, __ATOMIC_RELEASE);
+
+  _trace_fd = fd;
+  _trace_size = size;
+  _trace = hdr;
+}
+
+static void _trace_atfork_child() {
+  struct shim_trace_header *parent = _trace;
+  _trace = NULL;
+  _thread_ring = NULL;
+  _syscall(SYS_munmap, parent, _trace_size);
+  _syscall(SYS_close, _trace_fd);
+  _create_trace();
+}
+
+void shim_trace_init() {
+  _trace_prefix = getenv("SHIM_TRACE");
+  if (_trace_prefix == NULL || _trace_prefix[0] == '\0') {
+    return;
+  }
+  const char *events = getenv("SHIM_TRACE_EVENTS");
+  if (events) {
+    // Round down to a power of 2, so that ring indexing is a mask.
+    unsigned long n = strtoul(events, NULL, 0);
+    if (n > MAX_RING_EVENTS) {
+      n = MAX_RING_EVENTS;
+    }
+    _ring_events = n ? UINT32_C(1) << (63 - __builtin_clzl(n)) : DEFAULT_RING_EVENTS;
+  }
+  const char *rings = getenv("SHIM_TRACE_THREADS");
+  if (rings && strtoul(rings, NULL, 0) > 0) {
+    unsigned long n = strtoul(rings, NULL, 0);
+    _nrings = n > MAX_RINGS ? MAX_RINGS : n;
+  }
+  uint64_t fit = (MAX_TRACE_SIZE - sizeof(struct shim_trace_header)) /
+                 shim_trace_ring_size(_ring_events);
+  if (_nrings > fit) {
+    _nrings = fit;
+  }
+  _create_trace();
+  if (_trace) {
+    pthread_atfork(NULL, NULL, _trace_atfork_child);
+  }
+}
+
+static struct shim_trace_ring* _get_ring(struct shim_trace_header *hdr) {
+  if (_thread_ring) {
+    return _thread_ring;
+  }
+  int32_t tid = _syscall(SYS_gettid);
+  for (uint32_t i = 0; i < _nrings; ++i) {
+    struct shim_trace_ring *ring = shim_trace_get_ring(hdr, i);
+    int32_t expected = 0;
+    if (__atomic_compare_exchange_n(&ring->tid, &expected, tid, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      _thread_ring = ring;
+      return ring;
+    }
+  }
+  // Out of rings. Drop this thread's events rather than interleave them into
+  // someone else's ring.
+  return NULL;
+}
+
+static void _record(struct shim_trace_header *hdr, long n, const long args[6], long ret,
+                    uint64_t start_tsc, uint64_t end_tsc) {
+  struct shim_trace_ring *ring = _get_ring(hdr);
+  if (!ring) {
+    return;
+  }
+  // Reserve a slot atomically: a nested trap on this thread may append to the
+  // same ring before we're done here.
+  uint64_t idx = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+  struct shim_trace_event *ev = &ring->events[idx & (_ring_events - 1)];
+  // Invalidate the slot while we overwrite it.
+  __atomic_store_n(&ev->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  ev->start_tsc = start_tsc;
+  ev->end_tsc = end_tsc;
+  ev->nr = n;
+  ev->tid = ring->tid;
+  for (int i = 0; i < 6; ++i) {
+    ev->args[i] = args[i];
+  }
+  ev->ret = ret;
+  __atomic_store_n(&ev->seq, idx + 1, __ATOMIC_RELEASE);
+}
+
+void shim_trace_record(long n, const long args[6], long ret, uint64_t start_tsc, uint64_t end_tsc) {
+  struct shim_trace_header *hdr = _trace;
+  if (hdr) {
+    _record(hdr, n, args, ret, start_tsc, end_tsc);
+  }
+}
+
+void shim_trace_record_entry(long n, const long args[6], uint64_t start_tsc) {
+  struct shim_trace_header *hdr = _trace;
+  if (hdr) {
+    _record(hdr, n, args, 0, start_tsc, 0);
+  }
+}
+
+void shim_trace_thread_exit() {
+  if (_trace && _thread_ring) {
+    // The next thread to take this ring overwrites our events oldest-first;
+    // each event carries its tid, so nothing gets misattributed.
+    __atomic_store_n(&_thread_ring->tid, 0, __ATOMIC_RELEASE);
+    _thread_ring = NULL;
+  }
+}
+
+void shim_trace_exit() {
+  if (!_trace) {
+    return;
+  }
+  struct shim_trace_header *hdr = _trace;
+  _trace = NULL;
+  hdr->end_tsc = shim_rdtsc();
+  hdr->end_ns = shim_monotonic_ns();
+
+  // Rings are claimed lowest-first, so everything after the last one that was
+  // ever claimed is unused. Other threads are still running until the kernel
+  // gets around to killing them, so count rings that are owned but still
+  // empty as used too; truncating under a thread that's writing its first
+  // event would get it a SIGBUS.
+  uint32_t used = 0;
+  for (uint32_t i = 0; i < hdr->nrings; ++i) {
+    struct shim_trace_ring *ring = shim_trace_get_ring(hdr, i);
+    if (__atomic_load_n(&ring->tid, __ATOMIC_ACQUIRE) ||
+        __atomic_load_n(&ring->head, __ATOMIC_RELAXED)) {
+      used = i + 1;
+    }
+  }
+  hdr->nrings = used;
+  _syscall(SYS_ftruncate, _trace_fd,
+           sizeof(struct shim_trace_header) + used * shim_trace_ring_size(hdr->ring_events));
+}
@@ -0,0 +1,61 @@
+// Layout of the shim's binary trace file. Written by seccomp.so (trace.c) and
+// decoded by shimtrace.c.
+#pragma once
+
+#include <stdint.h>
+
+#define SHIM_TRACE_MAGIC UINT64_C(0x6563617274686d31) /* "1mhtrace" */
+#define SHIM_TRACE_VERSION 1
+
+// One trapped syscall.
+struct shim_trace_event {
+  // Index of this event in its ring plus one. Written last; a mismatch means
+  // the slot was never written, or was being overwritten when we looked.
+  uint64_t seq;
+  uint64_t start_tsc;
+  // 0 if the syscall never returned (exit, a successful execve), in which
+  // case `ret` is meaningless.
+  uint64_t end_tsc;
+  int32_t nr;
+  int32_t tid;
+  int64_t args[6];
+  int64_t ret;
+};
+
+// Per-thread ring. Only the most recent `ring_events` events of each ring are
+// kept.
+struct shim_trace_ring {
+  // Owning thread, or 0 if the ring is free. Written with atomics.
+  int32_t tid;
+  int32_t _pad;
+  // Number of events ever written to this ring.
+  uint64_t head;
+  uint64_t _pad2[6];
+  struct shim_trace_event events[];
+};
+
+struct shim_trace_header {
+  uint64_t magic;
+  uint32_t version;
+  int32_t pid;
+  uint32_t nrings;
+  // Events per ring. Always a power of 2.
+  uint32_t ring_events;
+  // (TSC, CLOCK_MONOTONIC) pairs taken when the file was created and when the
+  // process exited, for converting TSC timestamps. end_tsc is 0 if the process
+  // didn't exit cleanly.
+  uint64_t start_tsc;
+  uint64_t start_ns;
+  uint64_t end_tsc;
+  uint64_t end_ns;
+  uint64_t _pad[2];
+  // Followed by `nrings` rings.
+};
+
+static inline uint64_t shim_trace_ring_size(uint32_t ring_events) {
+  return sizeof(struct shim_trace_ring) + (uint64_t)ring_events * sizeof(struct shim_trace_event);
+}
+
+static inline struct shim_trace_ring* shim_trace_get_ring(const struct shim_trace_header *hdr, uint32_t i) {
+  return (struct shim_trace_ring*)((char*)(hdr + 1) + i * shim_trace_ring_size(hdr->ring_events));
+}
@@ -0,0 +1,199 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../common/capture.h"
+
+// Turns capture files (see ../common/capture.h) back into text: what went to
+// fd 1 goes to stdout, and fd 2 to stderr. Several files (a process and its
+// forked children, say) are merged in timestamp order.
+//
+// Usage: capcat [-f] [-t] file.cap...
+//   -f  follow: keep reading until each writer has exited
+//   -t  prefix each write with "[seconds.nanoseconds pid fd] "
+//
+// If a writer got more than a ring ahead, what it overwrote is reported to
+// stderr as lost.
+
+#define CHECK(x) { \
+    if (!(x)) {\
+        perror(#x);\
+        exit(EXIT_FAILURE);\
+    }\
+}
+
+struct cap {
+    const char* path;
+    struct capture_header* h;
+    const char* ring;
+    // Offset of the next record to read.
+    uint64_t tail;
+    // The next record, once it's been copied out.
+    int ready;
+    uint64_t ns;
+    uint32_t len;
+    int fd;
+    char data[CAPTURE_MAX_RECORD];
+};
+
+static void cap_open(struct cap* c, const char* path) {
+    c->path = path;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    CHECK(fd >= 0);
+    struct stat st;
+    CHECK(fstat(fd, &st) == 0);
+    CHECK(st.st_size >= CAPTURE_HEADER);
+    c->h = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    CHECK(c->h != MAP_FAILED);
+    close(fd);
+    if (__atomic_load_n(&c->h->magic, __ATOMIC_ACQUIRE) != CAPTURE_MAGIC ||
+        c->h->version != CAPTURE_VERSION ||
+        CAPTURE_HEADER + c->h->size > (uint64_t)st.st_size) {
+        fprintf(stderr, "%s: not a capture\n", path);
+        exit(EXIT_FAILURE);
+    }
+    c->ring = (const char*)c->h + CAPTURE_HEADER;
+    c->tail = 0;
+    c->ready = 0;
+}
+
+// Copies out the next record, if there's one. Returns whether there is.
+static int cap_peek(struct cap* c) {
+    uint64_t size = c->h->size;
+    while (!c->ready) {
+        uint64_t head = __atomic_load_n(&c->h->head, __ATOMIC_ACQUIRE);
+        if (head - c->tail > size) {
+            // Overwritten. Lap boundaries are the only record boundaries we
+            // can find without walking from the last one, so pick up from the
+            // oldest that's still there. That skips some records that
+            // weren't overwritten yet, too.
+            uint64_t from = (head - size + size - 1) & ~(size - 1);
+            fprintf(stderr, "%s: lost %lu bytes\n", c->path, from - c->tail);
+            c->tail = from;
+            continue;
+        }
+        if (c->tail == head) {
+            return 0;
+        }
+        uint64_t off = c->tail & (size - 1);
+        if (size - off < sizeof(struct capture_record)) {
+            c->tail += size - off;
+            continue;
+        }
+        const struct capture_record* r = (const void*)(c->ring + off);
+        if (__atomic_load_n(&r->pos, __ATOMIC_ACQUIRE) != c->tail) {
+            // Claimed, but still being written.
+            return 0;
+        }
+        c->ns = r->ns;
+        c->len = r->len;
+        c->fd = r->fd;
+        if (c->fd >= 0 && c->len <= CAPTURE_MAX_RECORD) {
+            memcpy(c->data, r + 1, c->len);
+        }
+        // If nobody's claimed as far as a ring past it in the meantime, what
+        // we copied is what was committed.
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&c->h->head, __ATOMIC_RELAXED) - c->tail > size) {
+            continue;
+        }
+        if (c->fd < 0 || c->len > CAPTURE_MAX_RECORD) {
+            c->tail += capture_record_size(c->len);
+            continue;
+        }
+        c->ready = 1;
+    }
+    return 1;
+}
+
+static int cap_writer_alive(struct cap* c) {
+    return kill(c->h->pid, 0) == 0 || errno != ESRCH;
+}
+
+int main(int argc, char** argv) {
+    int follow = 0;
+    int stamps = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "ft")) != -1) {
+        switch (opt) {
+            case 'f': follow = 1; break;
+            case 't': stamps = 1; break;
+            default:
+                fprintf(stderr, "Usage: %s [-f] [-t] file.cap...\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    int n = argc - optind;
+    if (n < 1) {
+        fprintf(stderr, "Usage: %s [-f] [-t] file.cap...\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    struct cap* caps = calloc(n, sizeof(*caps));
+    CHECK(caps);
+    for (int i = 0; i < n; ++i) {
+        cap_open(&caps[i], argv[optind + i]);
+    }
+
+    while (1) {
+        struct cap* next = NULL;
+        for (int i = 0; i < n; ++i) {
+            if (cap_peek(&caps[i]) && (!next || caps[i].ns < next->ns)) {
+                next = &caps[i];
+            }
+        }
+        if (next) {
+            FILE* out = stdout;
+            if (next->fd == STDERR_FILENO) {
+                // In order with stdout, when they're the same place.
+                fflush(stdout);
+                out = stderr;
+            }
+            if (stamps) {
+                fprintf(out, "[%lu.%09lu %d %d] ", next->ns / 1000000000, next->ns % 1000000000,
+                        next->h->pid, next->fd);
+            }
+            fwrite(next->data, 1, next->len, out);
+            next->tail += capture_record_size(next->len);
+            next->ready = 0;
+            continue;
+        }
+        fflush(stdout);
+        if (!follow) {
+            break;
+        }
+        // Done once every writer is gone and we've read everything it wrote
+        // since. A writer that died mid-record leaves one we never finish.
+        int alive = 0;
+        for (int i = 0; i < n; ++i) {
+            alive |= cap_writer_alive(&caps[i]);
+        }
+        if (!alive) {
+            int more = 0;
+            for (int i = 0; i < n; ++i) {
+                more |= cap_peek(&caps[i]);
+            }
+            if (!more) {
+                break;
+            }
+            continue;
+        }
+        usleep(10000);
+    }
+
+    for (int i = 0; i < n; ++i) {
+        uint64_t head = __atomic_load_n(&caps[i].h->head, __ATOMIC_ACQUIRE);
+        if (caps[i].tail != head) {
+            fprintf(stderr, "%s: %lu bytes unfinished at the end\n", caps[i].path,
+                    head - caps[i].tail);
+        }
+    }
+    return 0;
+}
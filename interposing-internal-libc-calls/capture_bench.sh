@@ -0,0 +1,83 @@
+#!/bin/bash
+#
+# Log collection through pipes, against capture files. Runs log_bench with
+# its stdout and stderr going through a pipe each to a file (as a collector
+# would have it), and again with them captured (see ../common/capture.h) and
+# turned back into text by capcat afterwards. The write syscalls are counted
+# under ../golang-seccomp/seccomp.so with SHIM_STATS=1. Prints one
+# tab-separated line per run (elapsed is from a run without seccomp.so):
+#
+#   workload  mode  writes  elapsed  capcat elapsed  lines out
+#
+# Modes: pipe; interpose_write.so, which sees calls to write(2) through the
+# PLT; and ../patching-libc-to-interpose-syscalls/libinterpose.so, which sees
+# calls to syscall(2) (log_bench -s).
+#
+# Knobs (environment):
+#   THREADS  log_bench threads, default "1 4"
+#   LINES    per thread, default 100000
+#   SIZE     CAPTURE_SIZE, default 64M, enough that nothing's overwritten
+
+set -u
+
+cd "$(dirname "$0")"
+
+THREADS=${THREADS:-"1 4"}
+LINES=${LINES:-100000}
+SIZE=${SIZE:-64M}
+
+SECCOMP_SO=$PWD/../golang-seccomp/seccomp.so
+PATCHING=$PWD/../patching-libc-to-interpose-syscalls
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+printf 'default allow\nwrite trap\n' > "$tmp/writes.pol"
+
+count_writes() {
+  awk '$1 ~ /^[0-9]+$/ && $2 == "write" { writes = $3 } END { print writes + 0 }' "$@"
+}
+
+elapsed() {
+  awk '/elapsed=/ { for (i = 1; i <= NF; ++i) if ($i ~ /^elapsed=/) print substr($i, 9) }' "$@"
+}
+
+# run <workload> <mode> <capture preload, or empty for pipes> <command...>
+run() {
+  local workload=$1 mode=$2 so=$3
+  shift 3
+  local writes took capcat_took=- lines
+  if [ -z "$so" ]; then
+    # log_bench's summary goes to stderr too, so it comes through the pipe.
+    # Once to count, once to time, since the counting slows each write down.
+    env LD_PRELOAD="$SECCOMP_SO" SHIM_POLICY="$tmp/writes.pol" SHIM_STATS=1 "$@" \
+        > >(cat > /dev/null) 2> >(cat > "$tmp/err")
+    wait
+    writes=$(count_writes "$tmp/err")
+    "$@" > >(cat > "$tmp/out") 2> >(cat > "$tmp/err")
+    wait
+    took=$(elapsed "$tmp/err")
+  else
+    # Its summary goes through stdio, which the interposers don't see without
+    # the patched libc, so it isn't captured.
+    rm -rf "$tmp/cap" && mkdir "$tmp/cap"
+    env LD_PRELOAD="$SECCOMP_SO:$so" SHIM_POLICY="$tmp/writes.pol" SHIM_STATS=1 \
+        CAPTURE_DIR="$tmp/cap" CAPTURE_SIZE="$SIZE" "$@" 2> "$tmp/stderr"
+    writes=$(count_writes "$tmp/stderr")
+    rm -rf "$tmp/cap" && mkdir "$tmp/cap"
+    env LD_PRELOAD="$so" CAPTURE_DIR="$tmp/cap" CAPTURE_SIZE="$SIZE" "$@" 2> "$tmp/stderr"
+    took=$(elapsed "$tmp/stderr")
+    local TIMEFORMAT=%3Rs
+    capcat_took=$( { time ./capcat "$tmp"/cap/*.cap > "$tmp/out" 2> "$tmp/err"; } 2>&1 )
+  fi
+  lines=$(cat "$tmp/out" "$tmp/err" | grep -c '^x*$')
+  printf '%s\t%s\t%s\t%s\t%s\t%s\n' "$workload" "$mode" "$writes" "$took" "$capcat_took" \
+      "$lines"
+}
+
+for t in $THREADS; do
+  args="-t $t -n $LINES"
+  run "log_bench $args" pipe "" ./log_bench $args
+  run "log_bench $args" interpose_write "$PWD/interpose_write.so" ./log_bench $args
+  run "log_bench -s $args" pipe "" ./log_bench -s $args
+  run "log_bench -s $args" libinterpose "$PATCHING/libinterpose.so" ./log_bench -s $args
+done
@@ -0,0 +1,60 @@
+#!/bin/bash
+#
+# Counts the write and writev syscalls that call_write and log_bench make,
+# natively and with their writes to stdout and stderr coalesced, by running
+# them under ../golang-seccomp/seccomp.so with SHIM_STATS=1 and a policy that
+# traps just those two. Prints one tab-separated line per run:
+#
+#   workload  mode  writes  writevs  elapsed (log_bench only)
+#
+# Modes: native; coalesce_write.so, which sees calls to write(2) through the
+# PLT; and ../patching-libc-to-interpose-syscalls/libcoalesce.so, which sees
+# calls to syscall(2) (log_bench -s). With the patched libc that would be all
+# of them; without it, call_write's stdio output doesn't come through either.
+#
+# Knobs (environment):
+#   THREADS  log_bench threads, default "1 4"
+#   LINES    per thread, default 100000
+#   EVERY    every EVERY'th line goes to stderr, default "16 0" (0 for never)
+
+set -u
+
+cd "$(dirname "$0")"
+
+THREADS=${THREADS:-"1 4"}
+LINES=${LINES:-100000}
+EVERY=${EVERY:-"16 0"}
+
+SECCOMP_SO=$PWD/../golang-seccomp/seccomp.so
+PATCHING=$PWD/../patching-libc-to-interpose-syscalls
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+printf 'default allow\nwrite trap\nwritev trap\n' > "$tmp/writes.pol"
+
+# run <workload> <mode> <extra preload> <command...>
+run() {
+  local workload=$1 mode=$2 so=$3
+  shift 3
+  env LD_PRELOAD="$SECCOMP_SO${so:+:$so}" SHIM_POLICY="$tmp/writes.pol" SHIM_STATS=1 \
+      COALESCE_FDS=1,2 "$@" > /dev/null 2> "$tmp/stderr"
+  awk -v w="$workload" -v m="$mode" '
+    $1 ~ /^[0-9]+$/ && $2 == "write" { writes = $3 }
+    $1 ~ /^[0-9]+$/ && $2 == "writev" { writevs = $3 }
+    /elapsed=/ { for (i = 1; i <= NF; ++i) if ($i ~ /^elapsed=/) elapsed = substr($i, 9) }
+    END { printf "%s\t%s\t%d\t%d\t%s\n", w, m, writes, writevs, elapsed }' "$tmp/stderr"
+}
+
+run call_write native "" "$PATCHING/call_write"
+run call_write coalesce_write "$PWD/coalesce_write.so" "$PATCHING/call_write"
+run call_write libcoalesce "$PATCHING/libcoalesce.so" "$PATCHING/call_write"
+
+for t in $THREADS; do
+  for e in $EVERY; do
+    args="-t $t -n $LINES -e $e"
+    run "log_bench $args" native "" ./log_bench $args
+    run "log_bench $args" coalesce_write "$PWD/coalesce_write.so" ./log_bench $args
+    run "log_bench -s $args" native "" ./log_bench -s $args
+    run "log_bench -s $args" libcoalesce "$PATCHING/libcoalesce.so" ./log_bench -s $args
+  done
+done
@@ -0,0 +1,235 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../common/libcnext.h"
+#include "../common/coalesce.h"
+
+// Coalesces small writes to the fds in COALESCE_FDS (see
+// ../common/coalesce.h), e.g.:
+//
+//   COALESCE_FDS=1,2 LD_PRELOAD=$PWD/coalesce_write.so ./call_write
+//
+// Only calls that come through the PLT get here, which, as the README
+// explains, leaves out stdio's own writes. They do still go out in order with
+// ours: we flush before the calls that stdio makes a point of flushing
+// before, if they're made through the PLT too, and at exit before stdio does.
+
+static ssize_t next_writev(int fd, const struct iovec* iov, int iovcnt) {
+    return LIBCNEXT(writev)(fd, iov, iovcnt);
+}
+
+__attribute__((constructor)) static void load() {
+    coalesce_init(next_writev);
+}
+
+// Shared libraries' destructors run before stdio's final flush.
+__attribute__((destructor)) static void unload() {
+    coalesce_flush_all();
+}
+
+ssize_t write(int fd, const void* buf, size_t count) {
+    if (coalesce_wants(fd)) {
+        return coalesce_write(fd, buf, count);
+    }
+    return LIBCNEXT(write)(fd, buf, count);
+}
+
+ssize_t __write(int fd, const void* buf, size_t count) {
+    return write(fd, buf, count);
+}
+
+// Other ways of writing to a coalesced fd go out after what's buffered.
+
+ssize_t writev(int fd, const struct iovec* iov, int iovcnt) {
+    coalesce_before_write(fd);
+    return LIBCNEXT(writev)(fd, iov, iovcnt);
+}
+
+ssize_t pwrite(int fd, const void* buf, size_t count, off_t offset) {
+    coalesce_before_write(fd);
+    return LIBCNEXT(pwrite)(fd, buf, count, offset);
+}
+
+ssize_t pwrite64(int fd, const void* buf, size_t count, off_t offset) {
+    return pwrite(fd, buf, count, offset);
+}
+
+ssize_t pwritev(int fd, const struct iovec* iov, int iovcnt, off_t offset) {
+    coalesce_before_write(fd);
+    return LIBCNEXT(pwritev)(fd, iov, iovcnt, offset);
+}
+
+ssize_t pwritev2(int fd, const struct iovec* iov, int iovcnt, off_t offset, int flags) {
+    coalesce_before_write(fd);
+    return LIBCNEXT(pwritev2)(fd, iov, iovcnt, offset, flags);
+}
+
+ssize_t send(int fd, const void* buf, size_t len, int flags) {
+    coalesce_before_write(fd);
+    return LIBCNEXT(send)(fd, buf, len, flags);
+}
+
+ssize_t sendto(int fd, const void* buf, size_t len, int flags, const struct sockaddr* to,
+               socklen_t tolen) {
+    coalesce_before_write(fd);
+    return LIBCNEXT(sendto)(fd, buf, len, flags, to, tolen);
+}
+
+ssize_t sendmsg(int fd, const struct msghdr* msg, int flags) {
+    coalesce_before_write(fd);
+    return LIBCNEXT(sendmsg)(fd, msg, flags);
+}
+
+ssize_t splice(int fd_in, loff_t* off_in, int fd_out, loff_t* off_out, size_t len,
+               unsigned flags) {
+    coalesce_before_write(fd_out);
+    return LIBCNEXT(splice)(fd_in, off_in, fd_out, off_out, len, flags);
+}
+
+ssize_t sendfile(int out_fd, int in_fd, off_t* offset, size_t count) {
+    coalesce_before_write(out_fd);
+    return LIBCNEXT(sendfile)(out_fd, in_fd, offset, count);
+}
+
+// And so does anything that changes what a coalesced fd refers to, or makes
+// another fd refer to the same thing.
+
+int dup(int fd) {
+    coalesce_before_dup(fd);
+    return LIBCNEXT(dup)(fd);
+}
+
+int dup2(int oldfd, int newfd) {
+    coalesce_before_dup(oldfd);
+    coalesce_before_dup(newfd);
+    return LIBCNEXT(dup2)(oldfd, newfd);
+}
+
+int dup3(int oldfd, int newfd, int flags) {
+    coalesce_before_dup(oldfd);
+    coalesce_before_dup(newfd);
+    return LIBCNEXT(dup3)(oldfd, newfd, flags);
+}
+
+int close(int fd) {
+    coalesce_before_dup(fd);
+    return LIBCNEXT(close)(fd);
+}
+
+int close_range(unsigned first, unsigned last, int flags) {
+    for (unsigned fd = first; fd <= last && fd < 64; ++fd) {
+        if (coalesce_wants(fd)) {
+            coalesce_flush_all();
+            break;
+        }
+    }
+    return LIBCNEXT(close_range)(first, last, flags);
+}
+
+int fcntl(int fd, int cmd, ...) {
+    va_list args;
+    va_start(args, cmd);
+    long arg = va_arg(args, long);
+    va_end(args);
+    if (cmd == F_DUPFD || cmd == F_DUPFD_CLOEXEC) {
+        coalesce_before_dup(fd);
+    }
+    return LIBCNEXT(fcntl)(fd, cmd, arg);
+}
+
+// Flush before anything that waits, or that wants the output to be out.
+
+ssize_t read(int fd, void* buf, size_t count) {
+    coalesce_flush();
+    return LIBCNEXT(read)(fd, buf, count);
+}
+
+ssize_t readv(int fd, const struct iovec* iov, int iovcnt) {
+    coalesce_flush();
+    return LIBCNEXT(readv)(fd, iov, iovcnt);
+}
+
+ssize_t pread(int fd, void* buf, size_t count, off_t offset) {
+    coalesce_flush();
+    return LIBCNEXT(pread)(fd, buf, count, offset);
+}
+
+int fsync(int fd) {
+    coalesce_flush_all();
+    return LIBCNEXT(fsync)(fd);
+}
+
+int fdatasync(int fd) {
+    coalesce_flush_all();
+    return LIBCNEXT(fdatasync)(fd);
+}
+
+int nanosleep(const struct timespec* req, struct timespec* rem) {
+    coalesce_flush();
+    return LIBCNEXT(nanosleep)(req, rem);
+}
+
+unsigned sleep(unsigned seconds) {
+    coalesce_flush();
+    return LIBCNEXT(sleep)(seconds);
+}
+
+int usleep(useconds_t usec) {
+    coalesce_flush();
+    return LIBCNEXT(usleep)(usec);
+}
+
+int execve(const char* path, char* const argv[], char* const envp[]) {
+    coalesce_flush_all();
+    return LIBCNEXT(execve)(path, argv, envp);
+}
+
+// fork needs nothing: coalesce.h flushes in a pthread_atfork handler. The
+// other ways of starting a process don't run those.
+
+int posix_spawn(pid_t* pid, const char* path, const posix_spawn_file_actions_t* actions,
+                const posix_spawnattr_t* attr, char* const argv[], char* const envp[]) {
+    coalesce_flush_all();
+    return LIBCNEXT(posix_spawn)(pid, path, actions, attr, argv, envp);
+}
+
+int posix_spawnp(pid_t* pid, const char* file, const posix_spawn_file_actions_t* actions,
+                 const posix_spawnattr_t* attr, char* const argv[], char* const envp[]) {
+    coalesce_flush_all();
+    return LIBCNEXT(posix_spawnp)(pid, file, actions, attr, argv, envp);
+}
+
+int system(const char* command) {
+    coalesce_flush_all();
+    return LIBCNEXT(system)(command);
+}
+
+// vfork's child returns into its caller's frame, so vfork can't be wrapped by
+// a C function that calls the real one: the child would return from ours and
+// overwrite the frame that the parent then returns through. Instead we flush,
+// get the real one, and jump to it with our caller's return address still on
+// the stack.
+__attribute__((used, noinline)) static void* vfork_next(void) {
+    coalesce_flush_all();
+    return (void*)LIBCNEXT(vfork);
+}
+
+__asm__(".text\n"
+        ".globl vfork\n"
+        ".type vfork, @function\n"
+        "vfork:\n"
+        "    sub $8, %rsp\n"
+        "    call vfork_next\n"
+        "    add $8, %rsp\n"
+        "    jmp *%rax\n"
+        ".size vfork, .-vfork\n");
+
+void _exit(int status) {
+    coalesce_flush_all();
+    LIBCNEXT(_exit)(status);
+    __builtin_unreachable();
+}
@@ -3,7 +3,17 @@
 #include <dlfcn.h>
 #include <unistd.h>
 
+#include "../common/capture.h"
+
+// With CAPTURE_DIR set, stdout and stderr go to a capture file instead.
+__attribute__((constructor)) static void init(void) {
+    capture_init();
+}
+
 ssize_t __write(int fd, const void *buf, size_t count) {
+    if (capture_wants(fd)) {
+        return capture_write(fd, buf, count);
+    }
     // Look up the next `__write` symbol, which will be glibc's
     ssize_t (*orig_write)(int fd, const void *buf, size_t count) = 
         dlsym(RTLD_NEXT, "__write");
@@ -1,12 +1,24 @@
 #define _GNU_SOURCE
 
-#include <dlfcn.h>
 #include <unistd.h>
 
+#include "../common/capture.h"
+#include "../common/libcnext.h"
+
+// With CAPTURE_DIR set, stdout and stderr go to a capture file instead; see
+// ../common/capture.h, and capcat.c to read it back.
+__attribute__((constructor)) static void init(void) {
+    capture_init();
+}
+
 ssize_t write(int fd, const void *buf, size_t count) {
-    // Look up the next `write` symbol, which will be glibc's
-    ssize_t (*orig_write)(int fd, const void *buf, size_t count) = 
-        dlsym(RTLD_NEXT, "write");
+    if (capture_wants(fd)) {
+        return capture_write(fd, buf, count);
+    }
+    // The next `write` symbol, which will be glibc's. libcnext.h looks it up
+    // once, the first time we need it.
+    ssize_t (*orig_write)(int fd, const void *buf, size_t count) =
+        LIBCNEXT(write);
     if (STDOUT_FILENO) {
         // If we're writing to stdout, call the original function an extra time.
         orig_write(fd, buf, count);
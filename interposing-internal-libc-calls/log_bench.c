@@ -0,0 +1,85 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// A chatty logger: threads each writing lines to stdout with one write per
+// line, and every so often one to stderr. For coalesce_write.so and
+// ../patching-libc-to-interpose-syscalls/libcoalesce.so; see coalesce_bench.sh.
+//
+// Usage: log_bench [-s] [-t threads] [-n lines per thread] [-l line length]
+//                  [-e every]
+//   -s  write with syscall(2) instead of write(2)
+//   -e  send every e'th line to stderr instead (default 16; 0 for never)
+//
+// Prints how long it took to stderr.
+
+#define CHECK(x) { \
+    if (!(x)) {\
+        perror(#x);\
+        exit(EXIT_FAILURE);\
+    }\
+}
+
+static int use_syscall = 0;
+static long lines = 100000;
+static int len = 64;
+static int every = 16;
+
+static void* thread_main(void* arg) {
+    char line[len];
+    memset(line, 'x', len - 1);
+    line[len - 1] = '\n';
+    for (long i = 0; i < lines; ++i) {
+        int fd = every && i % every == every - 1 ? STDERR_FILENO : STDOUT_FILENO;
+        if (use_syscall) {
+            syscall(SYS_write, fd, line, len);
+        } else {
+            write(fd, line, len);
+        }
+    }
+    return NULL;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+    int threads = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "st:n:l:e:")) != -1) {
+        switch (opt) {
+            case 's': use_syscall = 1; break;
+            case 't': threads = atoi(optarg); break;
+            case 'n': lines = atol(optarg); break;
+            case 'l': len = atoi(optarg); break;
+            case 'e': every = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-s] [-t threads] [-n lines per thread] "
+                        "[-l line length] [-e every]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    CHECK(len > 0);
+
+    pthread_t tids[threads];
+    double start = now();
+    for (int i = 0; i < threads; ++i) {
+        CHECK(pthread_create(&tids[i], NULL, thread_main, NULL) == 0);
+    }
+    for (int i = 0; i < threads; ++i) {
+        pthread_join(tids[i], NULL);
+    }
+    double elapsed = now() - start;
+    fprintf(stderr, "threads=%d lines=%ld elapsed=%.3fs rate=%.0f/s\n", threads,
+            lines * threads, elapsed, lines * threads / elapsed);
+    return 0;
+}
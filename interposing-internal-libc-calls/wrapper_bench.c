@@ -0,0 +1,79 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Calls per second through an LD_PRELOAD'd `write` or `fwrite` wrapper, e.g.
+// interpose_write.so, which finds libc's with ../common/libcnext.h, against
+// interpose_write_dlsym.so, which is the same code doing a dlsym per call.
+//
+// Usage: wrapper_bench [-f] [-t threads] [-n calls per thread]
+//   -f  fwrite instead of write
+//
+// Everything goes to /dev/null. See wrapper_bench.sh.
+
+#define CHECK(x) { \
+    if (!(x)) {\
+        perror(#x);\
+        exit(EXIT_FAILURE);\
+    }\
+}
+
+static long calls = 1000000;
+static int use_fwrite = 0;
+
+static void* thread_main(void* arg) {
+    int fd = open("/dev/null", O_WRONLY);
+    CHECK(fd >= 0);
+    FILE* f = fdopen(fd, "w");
+    CHECK(f);
+    for (long i = 0; i < calls; ++i) {
+        if (use_fwrite) {
+            fwrite("x", 1, 1, f);
+        } else {
+            write(fd, "x", 1);
+        }
+    }
+    fclose(f);
+    return NULL;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+    int threads = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "ft:n:")) != -1) {
+        switch (opt) {
+            case 'f': use_fwrite = 1; break;
+            case 't': threads = atoi(optarg); break;
+            case 'n': calls = atol(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-f] [-t threads] [-n calls per thread]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    pthread_t tids[threads];
+    double start = now();
+    for (int i = 0; i < threads; ++i) {
+        CHECK(pthread_create(&tids[i], NULL, thread_main, NULL) == 0);
+    }
+    for (int i = 0; i < threads; ++i) {
+        pthread_join(tids[i], NULL);
+    }
+    double elapsed = now() - start;
+    printf("func=%s threads=%d calls=%ld elapsed=%.3fs rate=%.0f/s\n",
+           use_fwrite ? "fwrite" : "write", threads, calls * threads, elapsed,
+           calls * threads / elapsed);
+    return 0;
+}
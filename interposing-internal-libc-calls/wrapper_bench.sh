@@ -0,0 +1,32 @@
+#!/bin/bash
+#
+# Runs wrapper_bench natively, and under the write and fwrite wrappers built
+# both ways: looking libc's function up with a dlsym on every call (before),
+# and from libcnext.h's table (after).
+#
+# Knobs (environment):
+#   THREADS  default "1 4"
+#   CALLS    per thread, default 1000000
+
+set -u
+
+cd "$(dirname "$0")"
+
+THREADS=${THREADS:-"1 4"}
+CALLS=${CALLS:-1000000}
+
+MECHANISMS=(
+  "native||"
+  "dlsym|$PWD/interpose_write_dlsym.so|"
+  "table|$PWD/interpose_write.so|"
+  "native||-f"
+  "dlsym|$PWD/interpose_fwrite_dlsym.so|-f"
+  "table|$PWD/interpose_fwrite.so|-f"
+)
+
+for m in "${MECHANISMS[@]}"; do
+  IFS='|' read -r name so args <<< "$m"
+  for t in $THREADS; do
+    env LD_PRELOAD="$so" ./wrapper_bench -t "$t" -n "$CALLS" $args | sed "s/^/$name\t/"
+  done
+done
@@ -122,4 +122,34 @@ Even though we still didn't explicitly add a v3 symbol, it now works with v3:
 
 `show_cmd "LD_LIBRARY_PATH=. LD_PRELOAD=./libinterposer_v1v2_default.so ./user_v3"`
 
+## Binding each version straight to an implementation
+
+The wrappers for old versions, and the default, are an extra call on the way
+to the implementation. With GNU IFUNC, a symbol instead has a resolver
+function, which the dynamic linker calls once, at load time, to get the
+address to bind the symbol to. Each version can then bind straight to an
+implementation of its API, and the resolver can pick one for the running
+CPU. \`interposer_ifunc.h\` has some helpers:
+
+`show_cmd "cat ./interposer_ifunc.h"`
+
+`show_cmd "cat ./interposer_v1v2_ifunc.c"`
+
+The versions are all IFUNCs now:
+
+`show_cmd "readelf -s libinterposer_v1v2_ifunc.so | grep 'target[@ ]\\|target$'"`
+
+`show_cmd "LD_LIBRARY_PATH=. LD_PRELOAD=./libinterposer_v1v2_ifunc.so ./user_v1"`
+
+`show_cmd "LD_LIBRARY_PATH=. LD_PRELOAD=./libinterposer_v1v2_ifunc.so ./user_v2"`
+
+`show_cmd "LD_LIBRARY_PATH=. LD_PRELOAD=./libinterposer_v1v2_ifunc.so ./user_v3"`
+
+\`ifunc_bench.sh\` compares the two interposers, timing each user program
+whole, and a loop of calls to \`target\`. Here the implementations just
+\`printf\`, which swamps the wrapper's extra call either way. Resolving the
+IFUNCs at load time isn't free either:
+
+`show_cmd "RUNS=50 ./ifunc_bench.sh"`
+
 EOF
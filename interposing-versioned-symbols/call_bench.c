@@ -0,0 +1,33 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Calls `target` in a loop, like user_v1 (or user_v2, with -DTARGET_INT)
+// calls it once, for ifunc_bench.sh. Send stdout to /dev/null.
+//
+// Usage: bench_vN [calls]
+//
+// Prints nanoseconds per call to stderr.
+
+#ifdef TARGET_INT
+int target();
+#else
+void target();
+#endif
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+  long calls = argc > 1 ? atol(argv[1]) : 1000000;
+  double start = now();
+  for (long i = 0; i < calls; ++i) {
+    target();
+  }
+  double elapsed = now() - start;
+  fprintf(stderr, "%.2f\n", elapsed * 1e9 / calls);
+  return 0;
+}
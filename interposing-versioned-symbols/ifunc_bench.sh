@@ -0,0 +1,40 @@
+#!/bin/bash
+#
+# Runs the user programs against the interposer with a wrapper per old
+# version (libinterposer_v1v2_default.so) and the one that binds each version
+# straight to a CPU-specific implementation (libinterposer_v1v2_ifunc.so).
+# Prints one tab-separated line per program and interposer:
+#
+#   program  interposer  output  us/run  ns/call
+#
+# us/run is the whole of user_vN, loading and IFUNC resolution included,
+# averaged over RUNS runs. ns/call is bench_vN, the same call in a loop,
+# with stdout to /dev/null.
+#
+# Knobs (environment):
+#   RUNS   runs of each user_vN, default 200
+#   CALLS  calls in each bench_vN, default 10000000
+
+set -u
+
+cd "$(dirname "$0")"
+
+RUNS=${RUNS:-200}
+CALLS=${CALLS:-10000000}
+
+export LD_LIBRARY_PATH=.
+
+for v in 0 1 2 3; do
+  for interposer in none libinterposer_v1v2_default.so libinterposer_v1v2_ifunc.so; do
+    preload=
+    [ "$interposer" != none ] && preload=./$interposer
+    output=$(LD_PRELOAD=$preload ./user_v$v | head -1)
+    start=$(date +%s%N)
+    for ((i = 0; i < RUNS; ++i)); do
+      LD_PRELOAD=$preload ./user_v$v > /dev/null
+    done
+    us=$(( ($(date +%s%N) - start) / RUNS / 1000 ))
+    ns=$(LD_PRELOAD=$preload ./bench_v$v "$CALLS" 2>&1 > /dev/null)
+    printf 'user_v%s\t%s\t%s\t%s\t%s\n' "$v" "$interposer" "$output" "$us" "$ns"
+  done
+done
@@ -0,0 +1,41 @@
+// Helpers for interposers that bind each version of a symbol, once at load
+// time, straight to an implementation picked for the running CPU. With GNU
+// IFUNC, the dynamic linker calls a resolver to get the address that the
+// symbol binds to; there's no wrapper left in between at call time.
+#pragma once
+
+// Defines `static ret (*name##_pick(void))params`, which returns
+// name##_avx2, name##_sse42 or name##_generic, the first the CPU supports.
+// IFUNC resolvers run before relocations are done, so they can't call much;
+// the __builtin_cpu_* functions are fine.
+#define IFUNC_CPU_PICKER(name) \
+  static __typeof__(&name##_generic) name##_pick(void) { \
+    __builtin_cpu_init(); \
+    if (__builtin_cpu_supports("avx2")) { \
+      return name##_avx2; \
+    } \
+    if (__builtin_cpu_supports("sse4.2")) { \
+      return name##_sse42; \
+    } \
+    return name##_generic; \
+  }
+
+// Exports `name`, unversioned, as an IFUNC that binds to whatever
+// impl##_pick() returns.
+//
+// Each gets a resolver of its own, even where they share an implementation:
+// the linker mixes up symbols at the same address, and drops an unversioned
+// one that's at the same address as a versioned one. no_icf keeps GCC from
+// merging the resolvers back together.
+#define IFUNC_DEFAULT(ret, name, params, impl) \
+  __attribute__((no_icf)) static __typeof__(&impl##_generic) name##_resolve(void) { \
+    return impl##_pick(); \
+  } \
+  ret name params __attribute__((ifunc(#name "_resolve")))
+
+// Exports `symbol` (e.g. "target@TARGET_1_0_0") the same way. `alias` is just
+// a unique local name for it, like the ones the wrappers in
+// interposer_v1v2_default.c have.
+#define IFUNC_VERSIONED(ret, alias, params, impl, symbol) \
+  IFUNC_DEFAULT(ret, alias, params, impl); \
+  __asm__(".symver " #alias "," symbol)
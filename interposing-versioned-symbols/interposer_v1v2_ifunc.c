@@ -0,0 +1,46 @@
+#include <stdio.h>
+
+#include "interposer_ifunc.h"
+
+// Implementations of each API, one per CPU feature level. These only print,
+// so they're all the same code, but a wrapper that copies buffers would have
+// AVX2 and SSE kernels here.
+static void target_v1_generic() {
+  printf("Called interposer v1 fn (generic)\n");
+}
+
+__attribute__((target("sse4.2"))) static void target_v1_sse42() {
+  printf("Called interposer v1 fn (sse4.2)\n");
+}
+
+__attribute__((target("avx2"))) static void target_v1_avx2() {
+  printf("Called interposer v1 fn (avx2)\n");
+}
+
+static int target_v2_generic() {
+  printf("Called interposer v2 fn (generic)\n");
+  return 42;
+}
+
+__attribute__((target("sse4.2"))) static int target_v2_sse42() {
+  printf("Called interposer v2 fn (sse4.2)\n");
+  return 42;
+}
+
+__attribute__((target("avx2"))) static int target_v2_avx2() {
+  printf("Called interposer v2 fn (avx2)\n");
+  return 42;
+}
+
+IFUNC_CPU_PICKER(target_v1)
+IFUNC_CPU_PICKER(target_v2)
+
+// Every version binds directly to an implementation of its API. Unlike
+// interposer_v1v2_default.c, v0 doesn't go through a wrapper that calls v1's,
+// nor does the default through one that calls v2's.
+IFUNC_VERSIONED(void, target_v0, (), target_v1, "target@TARGET_0_0_0");
+IFUNC_VERSIONED(void, target_v1, (), target_v1, "target@TARGET_1_0_0");
+IFUNC_VERSIONED(int, target_v2, (), target_v2, "target@TARGET_2_0_0");
+
+// The default, for versions we don't know about, implements the new API.
+IFUNC_DEFAULT(int, target, (), target_v2);
@@ -0,0 +1,252 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// Runs a syscall-heavy workload and reports what each syscall cost. Meant to
+// be run natively and then again under each interposition mechanism (see
+// run.sh), so that the difference is the cost of the mechanism.
+//
+// Output is a single tab-separated line:
+//   workload threads iters syscalls_per_iter ns_per_syscall p50_ns p99_ns syscalls_per_sec
+
+#define CHECK(x) { \
+  if (!(x)) {\
+    perror(#x);\
+    exit(EXIT_FAILURE);\
+  }\
+}
+
+// When set, make every syscall via syscall(2) instead of the libc wrapper.
+// libc's wrappers make inlined syscalls, so this is the only way to exercise
+// an interposed `syscall` function without also using a patched libc.
+static int via_syscall = 0;
+
+static long do_getpid() {
+    return via_syscall ? syscall(SYS_getpid) : getpid();
+}
+
+static long do_write(int fd, const void *buf, size_t n) {
+    return via_syscall ? syscall(SYS_write, fd, buf, n) : write(fd, buf, n);
+}
+
+static long do_nanosleep(const struct timespec *ts) {
+    return via_syscall ? syscall(SYS_nanosleep, ts, NULL) : nanosleep(ts, NULL);
+}
+
+static long do_openat(const char *path, int flags, mode_t mode) {
+    return via_syscall ? syscall(SYS_openat, AT_FDCWD, path, flags, mode)
+                       : openat(AT_FDCWD, path, flags, mode);
+}
+
+static long do_pwrite(int fd, const void *buf, size_t n, off_t off) {
+    return via_syscall ? syscall(SYS_pwrite64, fd, buf, n, off) : pwrite(fd, buf, n, off);
+}
+
+static long do_pread(int fd, void *buf, size_t n, off_t off) {
+    return via_syscall ? syscall(SYS_pread64, fd, buf, n, off) : pread(fd, buf, n, off);
+}
+
+static long do_fstat(int fd, struct stat *st) {
+    return via_syscall ? syscall(SYS_fstat, fd, st) : fstat(fd, st);
+}
+
+static long do_close(int fd) {
+    return via_syscall ? syscall(SYS_close, fd) : close(fd);
+}
+
+struct workload {
+    const char *name;
+    // Number of syscalls made by one call to `iter`.
+    int syscalls_per_iter;
+    void (*setup)(int thread_idx);
+    void (*iter)(void);
+    void (*teardown)(void);
+};
+
+static __thread int thread_fd = -1;
+static __thread char thread_path[64];
+static char io_buf[4096];
+
+static void devnull_setup(int thread_idx) {
+    CHECK((thread_fd = open("/dev/null", O_WRONLY)) >= 0);
+}
+
+static void fd_teardown() {
+    close(thread_fd);
+    if (thread_path[0]) {
+        unlink(thread_path);
+    }
+}
+
+static void getpid_iter() {
+    do_getpid();
+}
+
+static void write_iter() {
+    do_write(thread_fd, io_buf, 1);
+}
+
+static void nanosleep_iter() {
+    static const struct timespec zero = {0, 0};
+    do_nanosleep(&zero);
+}
+
+static void fileio_setup(int thread_idx) {
+    const char *dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    snprintf(thread_path, sizeof(thread_path), "%s/bench.%d.%d", dir, getpid(), thread_idx);
+    CHECK((thread_fd = open(thread_path, O_RDWR | O_CREAT | O_TRUNC, 0600)) >= 0);
+}
+
+// Roughly what a program doing small-block file I/O looks like: open, a
+// write and read-back, a stat, close.
+static void fileio_iter() {
+    int fd = do_openat(thread_path, O_RDWR, 0);
+    do_pwrite(fd, io_buf, sizeof(io_buf), 0);
+    do_pread(fd, io_buf, sizeof(io_buf), 0);
+    struct stat st;
+    do_fstat(fd, &st);
+    do_close(fd);
+}
+
+static const struct workload workloads[] = {
+    {"getpid", 1, NULL, getpid_iter, NULL},
+    {"write", 1, devnull_setup, write_iter, fd_teardown},
+    {"nanosleep", 1, NULL, nanosleep_iter, NULL},
+    {"fileio", 5, fileio_setup, fileio_iter, fd_teardown},
+};
+
+static const struct workload *workload;
+static long iters = 100000;
+static pthread_barrier_t start_barrier;
+
+struct thread_result {
+    int idx;
+    // Latency of each iteration, in ns.
+    uint64_t *samples;
+    uint64_t total_ns;
+};
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void* run_thread(void *arg) {
+    struct thread_result *res = arg;
+
+    if (workload->setup) {
+        workload->setup(res->idx);
+    }
+    CHECK((res->samples = malloc(iters * sizeof(*res->samples))) != NULL);
+    // Fault the sample buffer in before we start timing.
+    memset(res->samples, 0, iters * sizeof(*res->samples));
+
+    pthread_barrier_wait(&start_barrier);
+    uint64_t start = now_ns();
+    uint64_t prev = start;
+    for (long i = 0; i < iters; ++i) {
+        workload->iter();
+        uint64_t t = now_ns();
+        res->samples[i] = t - prev;
+        prev = t;
+    }
+    res->total_ns = prev - start;
+
+    if (workload->teardown) {
+        workload->teardown();
+    }
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-s] [-t threads] [-n iters] <workload>\n", prog);
+    fprintf(stderr, "  -s  make syscalls via syscall(2) instead of libc wrappers\n");
+    fprintf(stderr, "workloads:");
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); ++i) {
+        fprintf(stderr, " %s", workloads[i].name);
+    }
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+    int nthreads = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "st:n:")) != -1) {
+        switch (opt) {
+            case 's': via_syscall = 1; break;
+            case 't': nthreads = atoi(optarg); break;
+            case 'n': iters = atol(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || nthreads < 1 || iters < 1) {
+        usage(argv[0]);
+    }
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); ++i) {
+        if (strcmp(workloads[i].name, argv[optind]) == 0) {
+            workload = &workloads[i];
+        }
+    }
+    if (!workload) {
+        usage(argv[0]);
+    }
+
+    CHECK(pthread_barrier_init(&start_barrier, NULL, nthreads) == 0);
+    struct thread_result *results = calloc(nthreads, sizeof(*results));
+    pthread_t *threads = calloc(nthreads, sizeof(*threads));
+    CHECK(results && threads);
+
+    for (int i = 0; i < nthreads; ++i) {
+        results[i].idx = i;
+    }
+    for (int i = 1; i < nthreads; ++i) {
+        CHECK(pthread_create(&threads[i], NULL, run_thread, &results[i]) == 0);
+    }
+    // Use the main thread as thread 0, so that the single-threaded case
+    // doesn't involve creating threads at all.
+    run_thread(&results[0]);
+    for (int i = 1; i < nthreads; ++i) {
+        CHECK(pthread_join(threads[i], NULL) == 0);
+    }
+
+    // Merge samples from all threads to get latency percentiles, and use the
+    // slowest thread to get aggregate throughput.
+    uint64_t *all = malloc(nthreads * iters * sizeof(*all));
+    CHECK(all != NULL);
+    uint64_t total_ns = 0, slowest_ns = 0;
+    for (int i = 0; i < nthreads; ++i) {
+        memcpy(&all[i * iters], results[i].samples, iters * sizeof(*all));
+        total_ns += results[i].total_ns;
+        if (results[i].total_ns > slowest_ns) {
+            slowest_ns = results[i].total_ns;
+        }
+    }
+    long n = nthreads * iters;
+    qsort(all, n, sizeof(*all), cmp_u64);
+
+    int per_iter = workload->syscalls_per_iter;
+    double ns_per_syscall = (double)total_ns / n / per_iter;
+    double syscalls_per_sec = (double)n * per_iter / (slowest_ns / 1e9);
+    printf("%s\t%d\t%ld\t%d\t%.1f\t%lu\t%lu\t%.0f\n",
+           workload->name, nthreads, iters, per_iter, ns_per_syscall,
+           (unsigned long)all[n / 2], (unsigned long)all[n * 99 / 100],
+           syscalls_per_sec);
+    return 0;
+}
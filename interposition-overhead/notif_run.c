@@ -0,0 +1,193 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Runs a command with the syscalls used by bench.c routed through seccomp
+// user notification (see ../user-trap/user-trap.c). The supervisor just tells
+// the kernel to continue each syscall, so what we measure is the round trip
+// through the notifier.
+//
+// With -e the supervisor answers getpid and write itself instead, reading
+// write's buffer out of the child with process_vm_readv, as an emulating
+// supervisor would have to, and then throwing it away. (Writes to stdout and
+// stderr still go through.) That's the apples-to-apples comparison with
+// golang-seccomp's shared-memory channel (shm_channel in run.sh).
+//
+// Usage: notif_run [-e] <cmd> [args...]
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
+
+#define CHECK(x) { \
+  if (!(x)) {\
+    perror(#x);\
+    exit(EXIT_FAILURE);\
+  }\
+}
+
+static const int trapped[] = {
+    SYS_getpid, SYS_write, SYS_nanosleep, SYS_openat, SYS_pwrite64,
+    SYS_pread64, SYS_fstat, SYS_newfstatat, SYS_close,
+};
+
+static int install_filter() {
+    // Load the syscall number, then one compare-and-notify per trapped
+    // syscall. Everything else is allowed.
+    struct sock_filter filter[1 + 2 * ARRAY_SIZE(trapped) + 1];
+    int i = 0;
+    filter[i++] = (struct sock_filter)BPF_STMT(BPF_LD+BPF_W+BPF_ABS,
+                                               offsetof(struct seccomp_data, nr));
+    for (size_t j = 0; j < ARRAY_SIZE(trapped); ++j) {
+        filter[i++] = (struct sock_filter)BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, trapped[j], 0, 1);
+        filter[i++] = (struct sock_filter)BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_USER_NOTIF);
+    }
+    filter[i++] = (struct sock_filter)BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW);
+
+    struct sock_fprog prog = {
+        .len = (unsigned short)i,
+        .filter = filter,
+    };
+    return syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER,
+                   SECCOMP_FILTER_FLAG_NEW_LISTENER, &prog);
+}
+
+static void send_fd(int sock, int fd) {
+    char buf[CMSG_SPACE(sizeof(int))] = {0}, c = 'c';
+    struct iovec io = {.iov_base = &c, .iov_len = 1};
+    struct msghdr msg = {
+        .msg_iov = &io,
+        .msg_iovlen = 1,
+        .msg_control = buf,
+        .msg_controllen = sizeof(buf),
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    *((int *)CMSG_DATA(cmsg)) = fd;
+    CHECK(sendmsg(sock, &msg, 0) >= 0);
+}
+
+static int recv_fd(int sock) {
+    char buf[CMSG_SPACE(sizeof(int))] = {0}, c;
+    struct iovec io = {.iov_base = &c, .iov_len = 1};
+    struct msghdr msg = {
+        .msg_iov = &io,
+        .msg_iovlen = 1,
+        .msg_control = buf,
+        .msg_controllen = sizeof(buf),
+    };
+    CHECK(recvmsg(sock, &msg, 0) >= 0);
+    return *((int *)CMSG_DATA(CMSG_FIRSTHDR(&msg)));
+}
+
+// Fills in `resp` for `req`. Returns false to let the kernel run the syscall.
+static int emulate(const struct seccomp_notif *req, struct seccomp_notif_resp *resp) {
+    static char buf[1 << 16];
+    switch (req->data.nr) {
+        case SYS_getpid:
+            resp->val = req->pid;
+            return 1;
+        case SYS_write: {
+            if (req->data.args[0] == 1 || req->data.args[0] == 2) {
+                return 0;
+            }
+            size_t len = req->data.args[2] < sizeof(buf) ? req->data.args[2] : sizeof(buf);
+            struct iovec local = {.iov_base = buf, .iov_len = len};
+            struct iovec remote = {.iov_base = (void *)req->data.args[1], .iov_len = len};
+            ssize_t n = process_vm_readv(req->pid, &local, 1, &remote, 1, 0);
+            if (n < 0) {
+                resp->error = -errno;
+            } else {
+                resp->val = n;
+            }
+            return 1;
+        }
+        default:
+            return 0;
+    }
+}
+
+int main(int argc, char **argv) {
+    int emulating = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "+e")) != -1) {
+        switch (opt) {
+            case 'e': emulating = 1; break;
+            default: optind = argc;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-e] <cmd> [args...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int sk_pair[2];
+    CHECK(socketpair(PF_LOCAL, SOCK_SEQPACKET, 0, sk_pair) == 0);
+
+    pid_t child = fork();
+    CHECK(child >= 0);
+    if (child == 0) {
+        CHECK(prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == 0);
+        int listener;
+        CHECK((listener = install_filter()) >= 0);
+        send_fd(sk_pair[1], listener);
+        close(listener);
+        close(sk_pair[0]);
+        close(sk_pair[1]);
+        execvp(argv[optind], &argv[optind]);
+        perror("execvp");
+        exit(EXIT_FAILURE);
+    }
+
+    int listener = recv_fd(sk_pair[0]);
+    close(sk_pair[0]);
+    close(sk_pair[1]);
+
+    struct seccomp_notif_sizes sizes;
+    CHECK(syscall(SYS_seccomp, SECCOMP_GET_NOTIF_SIZES, 0, &sizes) == 0);
+    struct seccomp_notif *req = malloc(sizes.seccomp_notif);
+    struct seccomp_notif_resp *resp = malloc(sizes.seccomp_notif_resp);
+    CHECK(req && resp);
+    memset(resp, 0, sizes.seccomp_notif_resp);
+
+    while (1) {
+        memset(req, 0, sizes.seccomp_notif);
+        if (ioctl(listener, SECCOMP_IOCTL_NOTIF_RECV, req) != 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // ENOENT once the child and all its descendants are gone.
+            break;
+        }
+        resp->id = req->id;
+        resp->error = 0;
+        resp->val = 0;
+        resp->flags = 0;
+        if (!emulating || !emulate(req, resp)) {
+            resp->flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+        }
+        // ENOENT here means the tracee was interrupted by a signal; nothing to
+        // do but move on.
+        if (ioctl(listener, SECCOMP_IOCTL_NOTIF_SEND, resp) != 0 && errno != ENOENT) {
+            perror("ioctl send");
+            break;
+        }
+    }
+
+    int status;
+    CHECK(waitpid(child, &status, 0) == child);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+}
@@ -0,0 +1,51 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../common/libcnext.h"
+
+// LD_PRELOAD wrappers for the libc functions used by bench.c, in the style of
+// ../interposing-internal-libc-calls/interpose_write.c, but forwarding each call
+// unchanged. Next symbols come from libcnext.h's table, looked up once up
+// front, so that what we measure is the cost of the extra hop through the PLT
+// and wrapper, not of dlsym.
+
+pid_t getpid(void) {
+    return LIBCNEXT(getpid)();
+}
+
+ssize_t write(int fd, const void *buf, size_t count) {
+    return LIBCNEXT(write)(fd, buf, count);
+}
+
+int nanosleep(const struct timespec *req, struct timespec *rem) {
+    return LIBCNEXT(nanosleep)(req, rem);
+}
+
+int openat(int dirfd, const char *path, int flags, ...) {
+    va_list args;
+    va_start(args, flags);
+    mode_t mode = va_arg(args, mode_t);
+    va_end(args);
+    return LIBCNEXT(openat)(dirfd, path, flags, mode);
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset) {
+    return LIBCNEXT(pwrite)(fd, buf, count, offset);
+}
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset) {
+    return LIBCNEXT(pread)(fd, buf, count, offset);
+}
+
+int fstat(int fd, struct stat *st) {
+    return LIBCNEXT(fstat)(fd, st);
+}
+
+int close(int fd) {
+    return LIBCNEXT(close)(fd);
+}
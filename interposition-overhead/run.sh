@@ -0,0 +1,72 @@
+#!/bin/bash
+#
+# Runs each bench.c workload natively and under each interposition mechanism,
+# and prints one tab-separated line per (mechanism, workload, threads) with the
+# per-syscall overhead relative to native.
+#
+# Knobs (environment):
+#   WORKLOADS  default "getpid write nanosleep fileio"
+#   THREADS    default "1 2 4 8"
+#   ITERS      iterations per thread, default 20000
+#   TIMEOUT    seconds before a single run counts as FAILED, default 60
+
+set -u
+
+cd "$(dirname "$0")"
+
+WORKLOADS=${WORKLOADS:-"getpid write nanosleep fileio"}
+THREADS=${THREADS:-"1 2 4 8"}
+ITERS=${ITERS:-20000}
+TIMEOUT=${TIMEOUT:-60}
+
+SECCOMP_SO=$PWD/../golang-seccomp/seccomp.so
+SHIMCHAN=$PWD/../golang-seccomp/shimchan
+PATCHED_LIBC=$PWD/../patching-libc-to-interpose-syscalls/glibc-build/libc.so
+
+# name and command prefix for each mechanism. Commands are eval'd with the
+# bench arguments appended.
+MECHANISMS=(
+  "native|./bench"
+  "ld_preload|env LD_PRELOAD=$PWD/preload_passthrough.so ./bench"
+  "syscall_fn|env LD_PRELOAD=$PWD/syscall_passthrough.so ./bench -s"
+  "sigsys|env LD_PRELOAD=$SECCOMP_SO ./bench"
+  "sigsys_patched|env LD_PRELOAD=$SECCOMP_SO SHIM_PATCH=1 ./bench"
+  "user_notif|./notif_run ./bench"
+  "user_notif_emul|./notif_run -e ./bench"
+  "shm_channel|$SHIMCHAN env LD_PRELOAD=$SECCOMP_SO SHIM_POLICY=$PWD/channel.pol ./bench"
+  "shm_channel_async|$SHIMCHAN env LD_PRELOAD=$SECCOMP_SO SHIM_POLICY=$PWD/channel_async.pol ./bench"
+)
+if [ -e "$PATCHED_LIBC" ]; then
+  MECHANISMS+=("patched_libc|env LD_PRELOAD=$PWD/syscall_passthrough.so:$PATCHED_LIBC ./bench")
+fi
+
+results=$(mktemp)
+trap 'rm -f "$results"' EXIT
+
+for m in "${MECHANISMS[@]}"; do
+  name=${m%%|*}
+  cmd=${m#*|}
+  for w in $WORKLOADS; do
+    for t in $THREADS; do
+      if line=$(eval "timeout $TIMEOUT $cmd -t $t -n $ITERS $w" 2>/dev/null) && [ -n "$line" ]; then
+        echo -e "$name\t$line" >> "$results"
+      else
+        echo -e "$name\t$w\t$t\tFAILED" >> "$results"
+      fi
+    done
+  done
+done
+
+# Input columns: mechanism workload threads iters per_iter ns p50 p99 tput
+awk -F'\t' '
+  BEGIN { OFS = "\t"; print "mechanism", "workload", "threads", "ns/syscall", "overhead_ns", "p50_ns", "p99_ns", "syscalls/s" }
+  $1 == "native" && $4 != "FAILED" { native[$2, $3] = $6 }
+  { rows[NR] = $0 }
+  END {
+    for (i = 1; i <= NR; ++i) {
+      split(rows[i], f, "\t")
+      if (f[4] == "FAILED") { print f[1], f[2], f[3], "FAILED"; continue }
+      base = native[f[2], f[3]]
+      print f[1], f[2], f[3], f[6], (base == "" ? "-" : sprintf("%.1f", f[6] - base)), f[7], f[8], f[9]
+    }
+  }' "$results"
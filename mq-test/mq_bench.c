@@ -0,0 +1,272 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <mqueue.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Throughput and latency of a POSIX message queue, with producer and consumer
+// processes. Uses whatever mq_* it's linked against, so an interposed queue
+// can be compared against the kernel's:
+//
+//   ./mq_bench -p 2 -c 2
+//   LD_PRELOAD=$PWD/libshmmq.so ./mq_bench -p 2 -c 2
+//
+// Usage: mq_bench [-p producers] [-c consumers] [-n messages per producer]
+//                 [-s size] [-d maxmsg] [-m prio:weight,...] [-N] [-l label]
+//   -s  message size, at least 16 (default 64)
+//   -d  the queue's mq_maxmsg (default 10). The kernel's queues can't go past
+//       /proc/sys/fs/mqueue/msg_max without CAP_SYS_RESOURCE.
+//   -m  priorities to send, and how often relative to each other (default
+//       "0:1")
+//   -N  O_NONBLOCK, spinning on EAGAIN, instead of blocking
+//   -l  label for the output, e.g. which implementation it is
+//
+// Prints a JSON object for the whole run, then one per priority with the
+// latency percentiles, from send to receive, in microseconds.
+
+#define CHECK(x) { \
+  if (!(x)) {\
+    perror(#x);\
+    exit(EXIT_FAILURE);\
+  }\
+}
+
+#define CHECK_GTE0(x) CHECK((x) >= 0)
+#define CHECK_EQ0(x) CHECK((x) == 0)
+
+#define MAX_PRIOS 64
+
+// What a message starts with; the rest is filler.
+struct header {
+  uint64_t sent_ns;
+  // Stop, rather than a message to measure.
+  uint32_t stop;
+  uint32_t pad;
+};
+
+struct sample {
+  uint32_t prio;
+  uint64_t ns;
+};
+
+// Shared between the processes.
+struct results {
+  uint64_t received;
+  uint64_t eagain;
+  struct sample samples[];
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static int nprios;
+static unsigned prios[MAX_PRIOS];
+static unsigned weights[MAX_PRIOS];
+static unsigned total_weight;
+
+static void parse_mix(const char *mix) {
+  char *copy = strdup(mix);
+  CHECK(copy);
+  for (char *tok = strtok(copy, ","); tok; tok = strtok(NULL, ",")) {
+    CHECK(nprios < MAX_PRIOS);
+    char *colon = strchr(tok, ':');
+    prios[nprios] = atoi(tok);
+    weights[nprios] = colon ? atoi(colon + 1) : 1;
+    total_weight += weights[nprios];
+    ++nprios;
+  }
+  free(copy);
+  CHECK(nprios > 0 && total_weight > 0);
+}
+
+static unsigned pick_prio(unsigned *seed) {
+  unsigned r = rand_r(seed) % total_weight;
+  int i = 0;
+  while (r >= weights[i]) {
+    r -= weights[i++];
+  }
+  return prios[i];
+}
+
+// Sends, spinning on EAGAIN if nonblocking.
+static void send_msg(mqd_t q, char *buf, size_t size, unsigned prio, struct results *res) {
+  while (mq_send(q, buf, size, prio) < 0) {
+    CHECK(errno == EAGAIN);
+    __atomic_fetch_add(&res->eagain, 1, __ATOMIC_RELAXED);
+    sched_yield();
+  }
+}
+
+static void producer(const char *name, int oflag, long n, size_t size, int id,
+                     struct results *res) {
+  mqd_t q;
+  CHECK_GTE0(q = mq_open(name, O_WRONLY | oflag));
+  char *buf = calloc(1, size);
+  CHECK(buf);
+  struct header *h = (struct header*)buf;
+  unsigned seed = id + 1;
+  for (long i = 0; i < n; ++i) {
+    unsigned prio = pick_prio(&seed);
+    h->sent_ns = now_ns();
+    send_msg(q, buf, size, prio, res);
+  }
+}
+
+static void consumer(const char *name, int oflag, size_t size, struct results *res) {
+  mqd_t q;
+  CHECK_GTE0(q = mq_open(name, O_RDONLY | oflag));
+  char *buf = malloc(size);
+  CHECK(buf);
+  while (1) {
+    unsigned prio;
+    ssize_t n = mq_receive(q, buf, size, &prio);
+    uint64_t at = now_ns();
+    if (n < 0) {
+      CHECK(errno == EAGAIN);
+      __atomic_fetch_add(&res->eagain, 1, __ATOMIC_RELAXED);
+      sched_yield();
+      continue;
+    }
+    struct header *h = (struct header*)buf;
+    if (h->stop) {
+      return;
+    }
+    uint64_t i = __atomic_fetch_add(&res->received, 1, __ATOMIC_RELAXED);
+    res->samples[i].prio = prio;
+    res->samples[i].ns = at - h->sent_ns;
+  }
+}
+
+static int by_ns(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+static double percentile(uint64_t *sorted, long n, double p) {
+  long i = (long)(p * n);
+  return sorted[i < n ? i : n - 1] / 1e3;
+}
+
+int main(int argc, char **argv) {
+  int producers = 1;
+  int consumers = 1;
+  long n = 100000;
+  size_t size = 64;
+  long maxmsg = 10;
+  const char *mix = "0:1";
+  int nonblock = 0;
+  const char *label = "";
+  int opt;
+  while ((opt = getopt(argc, argv, "p:c:n:s:d:m:Nl:")) != -1) {
+    switch (opt) {
+      case 'p': producers = atoi(optarg); break;
+      case 'c': consumers = atoi(optarg); break;
+      case 'n': n = atol(optarg); break;
+      case 's': size = atol(optarg); break;
+      case 'd': maxmsg = atol(optarg); break;
+      case 'm': mix = optarg; break;
+      case 'N': nonblock = 1; break;
+      case 'l': label = optarg; break;
+      default:
+        fprintf(stderr, "Usage: %s [-p producers] [-c consumers] [-n messages per producer] "
+                "[-s size] [-d maxmsg] [-m prio:weight,...] [-N] [-l label]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+  CHECK(producers > 0 && consumers > 0 && n > 0);
+  CHECK(size >= sizeof(struct header));
+  parse_mix(mix);
+
+  char name[64];
+  snprintf(name, sizeof(name), "/mq_bench.%d", getpid());
+  struct mq_attr attr = {.mq_maxmsg = maxmsg, .mq_msgsize = size};
+  mqd_t q;
+  CHECK_GTE0(q = mq_open(name, O_CREAT | O_EXCL | O_WRONLY, 0600, &attr));
+  int oflag = nonblock ? O_NONBLOCK : 0;
+
+  long total = producers * n;
+  size_t res_size = sizeof(struct results) + total * sizeof(struct sample);
+  struct results *res =
+      mmap(NULL, res_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  CHECK(res != MAP_FAILED);
+
+  // Everybody starts when this pipe closes.
+  int go[2];
+  CHECK_EQ0(pipe(go));
+  pid_t pids[producers + consumers];
+  for (int i = 0; i < producers + consumers; ++i) {
+    CHECK_GTE0(pids[i] = fork());
+    if (pids[i] == 0) {
+      close(go[1]);
+      char c;
+      CHECK(read(go[0], &c, 1) == 0);
+      if (i < producers) {
+        producer(name, oflag, n, size, i, res);
+      } else {
+        consumer(name, oflag, size, res);
+      }
+      _exit(0);
+    }
+  }
+  close(go[0]);
+  uint64_t start = now_ns();
+  close(go[1]);
+  for (int i = 0; i < producers; ++i) {
+    CHECK(waitpid(pids[i], NULL, 0) == pids[i]);
+  }
+  // Stops go at the lowest priority, so they come after every message.
+  unsigned lowest = prios[0];
+  for (int i = 1; i < nprios; ++i) {
+    lowest = prios[i] < lowest ? prios[i] : lowest;
+  }
+  char *stop = calloc(1, size);
+  CHECK(stop);
+  ((struct header*)stop)->stop = 1;
+  for (int i = 0; i < consumers; ++i) {
+    send_msg(q, stop, size, lowest, res);
+  }
+  for (int i = producers; i < producers + consumers; ++i) {
+    CHECK(waitpid(pids[i], NULL, 0) == pids[i]);
+  }
+  double secs = (now_ns() - start) / 1e9;
+  CHECK(res->received == (uint64_t)total);
+  CHECK_EQ0(mq_unlink(name));
+
+  printf("{\"label\":\"%s\",\"producers\":%d,\"consumers\":%d,\"size\":%zu,\"maxmsg\":%ld,"
+         "\"mix\":\"%s\",\"nonblock\":%d,\"messages\":%ld,\"secs\":%.3f,\"msgs_per_sec\":%.0f,"
+         "\"eagain\":%lu}\n",
+         label, producers, consumers, size, maxmsg, mix, nonblock, total, secs, total / secs,
+         res->eagain);
+  uint64_t *lat = malloc(total * sizeof(*lat));
+  CHECK(lat);
+  for (int p = 0; p < nprios; ++p) {
+    long count = 0;
+    for (long i = 0; i < total; ++i) {
+      if (res->samples[i].prio == prios[p]) {
+        lat[count++] = res->samples[i].ns;
+      }
+    }
+    if (count == 0) {
+      continue;
+    }
+    qsort(lat, count, sizeof(*lat), by_ns);
+    printf("{\"label\":\"%s\",\"prio\":%u,\"messages\":%ld,\"p50_us\":%.1f,\"p99_us\":%.1f,"
+           "\"p999_us\":%.1f}\n",
+           label, prios[p], count, percentile(lat, count, 0.5), percentile(lat, count, 0.99),
+           percentile(lat, count, 0.999));
+  }
+  return 0;
+}
@@ -0,0 +1,121 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <mqueue.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+// mq_recv for consumers of many queues: opens them all, waits for any to have
+// messages with epoll (a Linux mqd_t is a pollable fd), and drains the ready
+// ones, without blocking, into one buffer that's reused throughout. Messages
+// are streamed to stdout, or appended to a file, as they arrive.
+//
+// Usage: mq_drain [-o file] [-b batch] [-l] [-e] /queue...
+//   -o  append to file instead of writing to stdout
+//   -b  messages to take from a queue before moving on to the next ready one,
+//       so a busy queue can't starve the rest (default 64)
+//   -l  label each message with a line "<queue> <priority> <length>" first,
+//       instead of just writing out its contents like mq_recv does
+//   -e  exit once every queue is empty, instead of waiting for more
+//
+// Only for queues whose descriptors are fds the kernel can poll; libshmmq.so's
+// aren't.
+
+#define CHECK(x) { \
+  if (!(x)) {\
+    perror(#x);\
+    exit(EXIT_FAILURE);\
+  }\
+}
+
+#define CHECK_GTE0(x) CHECK((x) >= 0)
+#define CHECK_EQ0(x) CHECK((x) == 0)
+
+#define MAX_EVENTS 64
+
+static void usage(const char *argv0) {
+  fprintf(stderr, "Usage: %s [-o file] [-b batch] [-l] [-e] /queue...\n", argv0);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+  const char *path = NULL;
+  long batch = 64;
+  int labels = 0;
+  int exit_when_empty = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "o:b:le")) != -1) {
+    switch (opt) {
+      case 'o': path = optarg; break;
+      case 'b': batch = atol(optarg); break;
+      case 'l': labels = 1; break;
+      case 'e': exit_when_empty = 1; break;
+      default: usage(argv[0]);
+    }
+  }
+  int nqueues = argc - optind;
+  if (nqueues < 1 || batch < 1) {
+    usage(argv[0]);
+  }
+  char **names = &argv[optind];
+
+  FILE *out = stdout;
+  if (path) {
+    CHECK(out = fopen(path, "a"));
+  }
+  // Flushed after each round of draining, rather than per message.
+  CHECK_EQ0(setvbuf(out, NULL, _IOFBF, 1 << 16));
+
+  int ep;
+  CHECK_GTE0(ep = epoll_create1(EPOLL_CLOEXEC));
+  long bufsize = 0;
+  for (int i = 0; i < nqueues; ++i) {
+    mqd_t q;
+    CHECK_GTE0(q = mq_open(names[i], O_RDONLY | O_NONBLOCK));
+    struct mq_attr attr;
+    CHECK_EQ0(mq_getattr(q, &attr));
+    bufsize = attr.mq_msgsize > bufsize ? attr.mq_msgsize : bufsize;
+    struct epoll_event ev = {.events = EPOLLIN, .data.u64 = ((uint64_t)q << 32) | i};
+    if (epoll_ctl(ep, EPOLL_CTL_ADD, q, &ev) != 0) {
+      fprintf(stderr, "%s: can't poll it: %m\n", names[i]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  char *buf = malloc(bufsize);
+  CHECK(buf);
+
+  struct epoll_event events[MAX_EVENTS];
+  while (1) {
+    int n;
+    // Level-triggered, so a queue we left messages in comes back next time.
+    while ((n = epoll_wait(ep, events, MAX_EVENTS, exit_when_empty ? 0 : -1)) < 0) {
+      CHECK(errno == EINTR);
+    }
+    if (n == 0) {
+      break;
+    }
+    for (int i = 0; i < n; ++i) {
+      mqd_t q = events[i].data.u64 >> 32;
+      const char *name = names[(uint32_t)events[i].data.u64];
+      for (long taken = 0; taken < batch; ++taken) {
+        unsigned prio;
+        ssize_t len = mq_receive(q, buf, bufsize, &prio);
+        if (len < 0) {
+          CHECK(errno == EAGAIN);
+          break;
+        }
+        if (labels) {
+          fprintf(out, "%s %u %zd\n", name, prio, len);
+        }
+        CHECK(fwrite(buf, 1, len, out) == (size_t)len);
+      }
+    }
+    CHECK_EQ0(fflush(out));
+  }
+  CHECK_EQ0(fflush(out));
+  return 0;
+}
@@ -0,0 +1,820 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <mqueue.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// POSIX message queues in shared memory instead of the kernel, for
+// LD_PRELOAD: mq_open, mq_close, mq_unlink, mq_send, mq_timedsend,
+// mq_receive, mq_timedreceive, mq_getattr, mq_setattr and mq_notify.
+//
+//   LD_PRELOAD=$PWD/libshmmq.so ./mq_send /q 0 < msg
+//
+// Queue /name lives in SHMMQ_DIR/shmmq.name (default /dev/shm), so these
+// queues and the kernel's don't see each other. An mqd_t is the fd of that
+// file; it isn't pollable like the kernel's. An empty file there is a queue
+// with the default attributes, as soon as somebody opens it.
+//
+// The segment holds maxmsg message slots, a ring of free slot indices, and
+// a ring of slot indices per priority. The rings are bounded multi-producer
+// multi-consumer queues (Dmitry Vyukov's), so senders and receivers only ever
+// CAS. There are two counters: `space`, the slots that a sender may still
+// claim, and `avail`, the messages that a receiver may claim. A sender takes
+// one from `space`, fills a free slot and appends it to its priority's ring,
+// then adds one to `avail`. A receiver takes one from `avail`, takes a slot
+// from the highest priority ring that has one, copies it out, and gives the
+// slot and a unit of `space` back. Somebody who finds their counter at 0
+// either fails with EAGAIN (O_NONBLOCK) or waits on it with a futex; the
+// other side only makes the futex wake syscall when there are waiters.
+//
+// Differences from the kernel's:
+// * a queue can have up to SHMMQ_PRIOS different priorities over its life.
+//   A send with another one fails with EINVAL;
+// * maxmsg and msgsize are only limited to 65536 and 16 MiB, not by
+//   /proc/sys/fs/mqueue (which we do take the defaults from);
+// * an mq_notify signal has si_code SI_QUEUE, not SI_MESGQ;
+// * a process that dies in the middle of an operation can leave the queue
+//   stuck.
+
+#define SHMMQ_MAGIC UINT64_C(0x31716d6d68730000) /* "\0\0shmmq1" */
+#define SHMMQ_PRIOS 32
+#define SHMMQ_MAXMSG 65536
+#define SHMMQ_MSGSIZE (16 << 20)
+#define SHMMQ_FDS 4096
+
+// Positions count up forever; cell i of a ring is ready for the enqueue at
+// position p when its seq is p, and for the dequeue at p when it's p + 1.
+// Stored less i, so that a zero-filled ring is an empty one without touching
+// its pages.
+struct shmmq_cell {
+  uint64_t seq;
+  uint64_t slot;
+};
+
+struct shmmq_ring {
+  uint64_t enq __attribute__((aligned(64)));
+  uint64_t deq __attribute__((aligned(64)));
+};
+
+struct shmmq_slot {
+  uint64_t len;
+  uint64_t prio;
+  char data[];
+};
+
+struct shmmq_notify {
+  // Registered process, or 0. Briefly -pid while registering.
+  int32_t pid;
+  int32_t how;
+  int32_t signo;
+  // Registration count, so a SIGEV_THREAD helper knows whether it's its own
+  // that's done, and whether it fired.
+  uint32_t reg;
+  uint32_t done;
+  uint32_t fired;
+  union sigval value;
+};
+
+struct shmmq {
+  uint64_t magic;
+  int64_t maxmsg;
+  int64_t msgsize;
+  // Cells per ring, a power of 2 >= maxmsg.
+  uint64_t cells;
+  uint64_t slot_size;
+  uint64_t slots_off;
+  uint32_t space __attribute__((aligned(64)));
+  uint32_t send_waiters;
+  uint32_t avail __attribute__((aligned(64)));
+  uint32_t recv_waiters;
+  struct shmmq_notify notify __attribute__((aligned(64)));
+  // Priority + 1 of each ring in prio_rings, or 0 if it's unclaimed. Claimed
+  // in order, and never given back.
+  uint32_t prios[SHMMQ_PRIOS] __attribute__((aligned(64)));
+  struct shmmq_ring free_ring;
+  struct shmmq_ring prio_rings[SHMMQ_PRIOS];
+  // Then the cells of free_ring and each of prio_rings, and the slots.
+};
+
+// An open queue. It's referenced by descs[] until mq_close, and by every call
+// that's using it, including a SIGEV_THREAD helper that's waiting on it; the
+// last one to let go unmaps it.
+struct shmmq_desc {
+  struct shmmq *q;
+  size_t size;
+  int flags;
+  uint32_t refs;
+};
+
+static struct shmmq_desc *descs[SHMMQ_FDS];
+// Held while looking up or taking away an entry of descs.
+static pthread_mutex_t descs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static long futex(uint32_t *word, int op, uint32_t val, const struct timespec *timeout) {
+  return syscall(SYS_futex, word, op, val, timeout, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+static struct shmmq_cell *ring_cells(struct shmmq *q, struct shmmq_ring *r) {
+  char *cells = (char*)q + sizeof(*q);
+  return (struct shmmq_cell*)cells + (r - &q->free_ring) * q->cells;
+}
+
+static struct shmmq_slot *slot_at(struct shmmq *q, uint64_t i) {
+  return (struct shmmq_slot*)((char*)q + q->slots_off + i * q->slot_size);
+}
+
+// Never full for our uses: there are only maxmsg slots to go around.
+static void ring_push(struct shmmq *q, struct shmmq_ring *r, uint64_t slot) {
+  struct shmmq_cell *cells = ring_cells(q, r);
+  uint64_t pos = __atomic_load_n(&r->enq, __ATOMIC_RELAXED);
+  while (1) {
+    uint64_t i = pos & (q->cells - 1);
+    uint64_t seq = __atomic_load_n(&cells[i].seq, __ATOMIC_ACQUIRE) + i;
+    if (seq == pos) {
+      if (__atomic_compare_exchange_n(&r->enq, &pos, pos + 1, 1, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED)) {
+        cells[i].slot = slot;
+        __atomic_store_n(&cells[i].seq, pos + 1 - i, __ATOMIC_RELEASE);
+        return;
+      }
+    } else if ((int64_t)(seq - pos) < 0) {
+      // Not dequeued yet: somebody's mid-way.
+      sched_yield();
+      pos = __atomic_load_n(&r->enq, __ATOMIC_RELAXED);
+    } else {
+      pos = __atomic_load_n(&r->enq, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+// Returns whether there was one.
+static int ring_pop(struct shmmq *q, struct shmmq_ring *r, uint64_t *slot) {
+  struct shmmq_cell *cells = ring_cells(q, r);
+  uint64_t pos = __atomic_load_n(&r->deq, __ATOMIC_RELAXED);
+  while (1) {
+    uint64_t i = pos & (q->cells - 1);
+    uint64_t seq = __atomic_load_n(&cells[i].seq, __ATOMIC_ACQUIRE) + i;
+    if (seq == pos + 1) {
+      if (__atomic_compare_exchange_n(&r->deq, &pos, pos + 1, 1, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED)) {
+        *slot = cells[i].slot;
+        __atomic_store_n(&cells[i].seq, pos + q->cells - i, __ATOMIC_RELEASE);
+        return 1;
+      }
+    } else if ((int64_t)(seq - (pos + 1)) < 0) {
+      return 0;
+    } else {
+      pos = __atomic_load_n(&r->deq, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+static int ring_empty(struct shmmq *q, struct shmmq_ring *r) {
+  uint64_t pos = __atomic_load_n(&r->deq, __ATOMIC_RELAXED);
+  uint64_t i = pos & (q->cells - 1);
+  return __atomic_load_n(&ring_cells(q, r)[i].seq, __ATOMIC_ACQUIRE) + i != pos + 1;
+}
+
+// Like the kernel's, a bad timeout fails even when it wouldn't have been
+// needed.
+static int bad_timeout(const struct timespec *abs_timeout) {
+  return abs_timeout && (abs_timeout->tv_sec < 0 || abs_timeout->tv_nsec < 0 ||
+                         abs_timeout->tv_nsec >= 1000000000);
+}
+
+// Takes one from *count, waiting for there to be one unless nonblocking.
+// Returns 0 or an errno.
+static int take(uint32_t *count, uint32_t *waiters, int nonblock,
+                const struct timespec *abs_timeout) {
+  while (1) {
+    uint32_t n = __atomic_load_n(count, __ATOMIC_RELAXED);
+    if (n > 0) {
+      if (__atomic_compare_exchange_n(count, &n, n - 1, 1, __ATOMIC_ACQUIRE,
+                                      __ATOMIC_RELAXED)) {
+        return 0;
+      }
+      continue;
+    }
+    if (nonblock) {
+      return EAGAIN;
+    }
+    // Paired with give(): either it sees us waiting, or we see its count.
+    __atomic_fetch_add(waiters, 1, __ATOMIC_SEQ_CST);
+    long rv = 0;
+    if (__atomic_load_n(count, __ATOMIC_SEQ_CST) == 0) {
+      rv = futex(count, FUTEX_WAIT_BITSET | FUTEX_CLOCK_REALTIME, 0, abs_timeout);
+    }
+    int err = errno;
+    __atomic_fetch_sub(waiters, 1, __ATOMIC_RELAXED);
+    if (rv < 0 && (err == ETIMEDOUT || err == EINTR)) {
+      return err;
+    }
+  }
+}
+
+// Gives one to *count. Returns its old value.
+static uint32_t give(uint32_t *count, uint32_t *waiters) {
+  uint32_t old = __atomic_fetch_add(count, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(waiters, __ATOMIC_SEQ_CST)) {
+    futex(count, FUTEX_WAKE, 1, NULL);
+  }
+  return old;
+}
+
+// Takes a reference to mqdes's queue, for desc_put to give back.
+static struct shmmq_desc *desc_get(mqd_t mqdes) {
+  struct shmmq_desc *d = NULL;
+  if (mqdes >= 0 && mqdes < SHMMQ_FDS) {
+    pthread_mutex_lock(&descs_lock);
+    d = descs[mqdes];
+    if (d) {
+      __atomic_fetch_add(&d->refs, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&descs_lock);
+  }
+  if (!d) {
+    errno = EBADF;
+  }
+  return d;
+}
+
+static void desc_put(struct shmmq_desc *d) {
+  if (__atomic_sub_fetch(&d->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    munmap(d->q, d->size);
+    free(d);
+  }
+}
+
+struct notify_thread {
+  struct shmmq_desc *d;
+  uint32_t reg;
+  void (*fn)(union sigval);
+  union sigval value;
+};
+
+// SIGEV_THREAD: waits in the registering process for the registration to be
+// done with, and if it was by a message, calls the function.
+static void *notify_main(void *arg) {
+  struct notify_thread t = *(struct notify_thread*)arg;
+  free(arg);
+  struct shmmq_notify *n = &t.d->q->notify;
+  uint32_t done;
+  while ((done = __atomic_load_n(&n->done, __ATOMIC_ACQUIRE)) != t.reg) {
+    futex(&n->done, FUTEX_WAIT, done, NULL);
+  }
+  int fired = __atomic_load_n(&n->fired, __ATOMIC_ACQUIRE) == t.reg;
+  desc_put(t.d);
+  if (fired) {
+    t.fn(t.value);
+  }
+  return NULL;
+}
+
+static void notify_done(struct shmmq_notify *n, uint32_t reg) {
+  __atomic_store_n(&n->done, reg, __ATOMIC_RELEASE);
+  futex(&n->done, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+// The kernel drops a process's registration when it exits; nothing tells us,
+// so we check whether the registered process (or one that died registering)
+// is still around whenever its registration is in the way. Clears `pid`'s
+// registration if it's gone, and returns whether it was. A pid that's been
+// reused by then looks alive.
+static int notify_reap(struct shmmq_notify *n, int32_t pid) {
+  if (pid == 0 || kill(pid < 0 ? -pid : pid, 0) == 0 || errno != ESRCH) {
+    return 0;
+  }
+  if (__atomic_compare_exchange_n(&n->pid, &pid, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+    notify_done(n, n->reg);
+  }
+  return 1;
+}
+
+// A message went into an empty queue that nobody was waiting on.
+static void notify_fire(struct shmmq *q) {
+  struct shmmq_notify *n = &q->notify;
+  int32_t pid = __atomic_load_n(&n->pid, __ATOMIC_ACQUIRE);
+  if (pid < 0) {
+    notify_reap(n, pid);
+  }
+  if (pid <= 0) {
+    return;
+  }
+  int how = n->how;
+  int signo = n->signo;
+  union sigval value = n->value;
+  uint32_t reg = n->reg;
+  // One-shot: whoever takes it away fires it.
+  if (!__atomic_compare_exchange_n(&n->pid, &pid, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+    return;
+  }
+  if (how == SIGEV_SIGNAL) {
+    sigqueue(pid, signo, value);
+  } else if (how == SIGEV_THREAD) {
+    __atomic_store_n(&n->fired, reg, __ATOMIC_RELEASE);
+  }
+  notify_done(n, reg);
+}
+
+
+static long proc_default(const char *path, long dflt) {
+  FILE *f = fopen(path, "r");
+  long v = dflt;
+  if (f) {
+    if (fscanf(f, "%ld", &v) != 1) {
+      v = dflt;
+    }
+    fclose(f);
+  }
+  return v;
+}
+
+static size_t shmmq_size(long maxmsg, long msgsize, uint64_t *cells, uint64_t *slot_size,
+                         uint64_t *slots_off) {
+  *cells = 1;
+  while (*cells < (uint64_t)maxmsg) {
+    *cells <<= 1;
+  }
+  *slot_size = (sizeof(struct shmmq_slot) + msgsize + 63) & ~UINT64_C(63);
+  *slots_off = sizeof(struct shmmq) + (1 + SHMMQ_PRIOS) * *cells * sizeof(struct shmmq_cell);
+  *slots_off = (*slots_off + 4095) & ~UINT64_C(4095);
+  return *slots_off + maxmsg * *slot_size;
+}
+
+// SHMMQ_DIR/shmmq.name for /name.
+static int queue_path(const char *name, char *out, size_t size) {
+  if (name[0] != '/' || !name[1] || strchr(name + 1, '/')) {
+    errno = EINVAL;
+    return -1;
+  }
+  const char *dir = getenv("SHMMQ_DIR");
+  if (strlen(name) > NAME_MAX - 6 ||
+      snprintf(out, size, "%s/shmmq.%s", dir && dir[0] ? dir : "/dev/shm", name + 1) >=
+          (int)size) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  return 0;
+}
+
+// Makes the queue in an empty file.
+static int shmmq_create(int fd, const struct mq_attr *attr) {
+  long maxmsg = proc_default("/proc/sys/fs/mqueue/msg_default", 10);
+  long msgsize = proc_default("/proc/sys/fs/mqueue/msgsize_default", 8192);
+  if (attr) {
+    if (attr->mq_maxmsg <= 0 || attr->mq_maxmsg > SHMMQ_MAXMSG || attr->mq_msgsize <= 0 ||
+        attr->mq_msgsize > SHMMQ_MSGSIZE) {
+      errno = EINVAL;
+      return -1;
+    }
+    maxmsg = attr->mq_maxmsg;
+    msgsize = attr->mq_msgsize;
+  }
+  uint64_t cells, slot_size, slots_off;
+  size_t size = shmmq_size(maxmsg, msgsize, &cells, &slot_size, &slots_off);
+  if (ftruncate(fd, size) < 0) {
+    return -1;
+  }
+  // Just the header and the free ring; the rest starts out zero.
+  size_t init_size = sizeof(struct shmmq) + cells * sizeof(struct shmmq_cell);
+  struct shmmq *q = mmap(NULL, init_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (q == MAP_FAILED) {
+    return -1;
+  }
+  q->maxmsg = maxmsg;
+  q->msgsize = msgsize;
+  q->cells = cells;
+  q->slot_size = slot_size;
+  q->slots_off = slots_off;
+  q->space = maxmsg;
+  // Every slot starts out free.
+  struct shmmq_cell *free_cells = ring_cells(q, &q->free_ring);
+  for (long i = 0; i < maxmsg; ++i) {
+    free_cells[i].slot = i;
+    free_cells[i].seq = 1;
+  }
+  q->free_ring.enq = maxmsg;
+  // Last, so that shmmq_attach can tell a queue from some other file.
+  __atomic_store_n(&q->magic, SHMMQ_MAGIC, __ATOMIC_RELEASE);
+  munmap(q, init_size);
+  return 0;
+}
+
+// An empty file is a queue with the default attributes, so that touching
+// one makes one, like with the kernel's in /dev/mqueue.
+static struct shmmq *shmmq_attach(int fd, size_t *size) {
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    return NULL;
+  }
+  if (st.st_size == 0) {
+    flock(fd, LOCK_EX);
+    int rv = fstat(fd, &st);
+    if (rv == 0 && st.st_size == 0) {
+      rv = shmmq_create(fd, NULL);
+    }
+    flock(fd, LOCK_UN);
+    if (rv < 0 || fstat(fd, &st) < 0) {
+      return NULL;
+    }
+  }
+  struct shmmq *q = MAP_FAILED;
+  if (st.st_size >= (off_t)sizeof(struct shmmq)) {
+    q = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  if (q == MAP_FAILED || __atomic_load_n(&q->magic, __ATOMIC_ACQUIRE) != SHMMQ_MAGIC) {
+    if (q != MAP_FAILED) {
+      munmap(q, st.st_size);
+    }
+    errno = EINVAL;
+    return NULL;
+  }
+  *size = st.st_size;
+  return q;
+}
+
+// Makes the queue in a file of its own, then links it into place, so that
+// nobody sees it half-made. Returns the fd, or -1 with errno EEXIST if
+// somebody beat us to it.
+static int shmmq_create_at(const char *path, mode_t mode, const struct mq_attr *attr) {
+  char tmp[PATH_MAX];
+  snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+  int fd = mkostemp(tmp, O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  mode_t mask = umask(0);
+  umask(mask);
+  int rv = fchmod(fd, mode & ~mask);
+  if (rv == 0) {
+    rv = shmmq_create(fd, attr);
+  }
+  if (rv == 0) {
+    rv = link(tmp, path);
+  }
+  int err = errno;
+  unlink(tmp);
+  if (rv < 0) {
+    close(fd);
+    errno = err;
+    return -1;
+  }
+  return fd;
+}
+
+mqd_t mq_open(const char *name, int oflag, ...) {
+  mode_t mode = 0;
+  struct mq_attr *attr = NULL;
+  if (oflag & O_CREAT) {
+    va_list args;
+    va_start(args, oflag);
+    mode = va_arg(args, mode_t);
+    attr = va_arg(args, struct mq_attr*);
+    va_end(args);
+  }
+  char path[PATH_MAX];
+  if (queue_path(name, path, sizeof(path)) < 0) {
+    return -1;
+  }
+  if ((oflag & O_ACCMODE) == O_ACCMODE) {
+    errno = EINVAL;
+    return -1;
+  }
+  int fd = -1;
+  if (oflag & O_CREAT) {
+    fd = shmmq_create_at(path, mode, attr);
+    if (fd < 0 && (errno != EEXIST || (oflag & O_EXCL))) {
+      return -1;
+    }
+  }
+  // We need to write to the segment even to receive.
+  if (fd < 0) {
+    fd = open(path, O_RDWR | O_CLOEXEC);
+  }
+  if (fd < 0) {
+    return -1;
+  }
+  if (fd >= SHMMQ_FDS) {
+    close(fd);
+    errno = EMFILE;
+    return -1;
+  }
+  struct shmmq_desc *d = malloc(sizeof(*d));
+  if (!d) {
+    close(fd);
+    return -1;
+  }
+  d->q = shmmq_attach(fd, &d->size);
+  if (!d->q) {
+    int err = errno;
+    free(d);
+    close(fd);
+    errno = err;
+    return -1;
+  }
+  d->flags = oflag & (O_ACCMODE | O_NONBLOCK);
+  d->refs = 1;
+  pthread_mutex_lock(&descs_lock);
+  descs[fd] = d;
+  pthread_mutex_unlock(&descs_lock);
+  return fd;
+}
+
+static int desc_notify(struct shmmq_desc *d, const struct sigevent *sevp);
+
+int mq_close(mqd_t mqdes) {
+  struct shmmq_desc *d = NULL;
+  if (mqdes >= 0 && mqdes < SHMMQ_FDS) {
+    pthread_mutex_lock(&descs_lock);
+    d = descs[mqdes];
+    descs[mqdes] = NULL;
+    pthread_mutex_unlock(&descs_lock);
+  }
+  if (!d) {
+    errno = EBADF;
+    return -1;
+  }
+  desc_notify(d, NULL);
+  // Calls still using it keep it mapped.
+  desc_put(d);
+  return close(mqdes);
+}
+
+int mq_unlink(const char *name) {
+  char path[PATH_MAX];
+  if (queue_path(name, path, sizeof(path)) < 0) {
+    return -1;
+  }
+  return unlink(path);
+}
+
+// mqueue.h has mq_timedsend's and mq_timedreceive's abs_timeout nonnull, so
+// these are separate, rather than mq_send calling mq_timedsend with NULL.
+static int desc_send(struct shmmq_desc *d, const char *msg_ptr, size_t msg_len,
+                     unsigned int msg_prio, const struct timespec *abs_timeout) {
+  struct shmmq *q = d->q;
+  if ((d->flags & O_ACCMODE) == O_RDONLY) {
+    errno = EBADF;
+    return -1;
+  }
+  if (msg_len > (size_t)q->msgsize) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+  if (msg_prio >= MQ_PRIO_MAX) {
+    errno = EINVAL;
+    return -1;
+  }
+  // Find the priority's ring, or claim one for it.
+  uint32_t want = msg_prio + 1;
+  int ring = -1;
+  for (int i = 0; i < SHMMQ_PRIOS && ring < 0; ++i) {
+    uint32_t p = __atomic_load_n(&q->prios[i], __ATOMIC_ACQUIRE);
+    // If we lose the race for an unclaimed one, p is the winner's, which may
+    // be ours.
+    if ((p == 0 && __atomic_compare_exchange_n(&q->prios[i], &p, want, 0, __ATOMIC_ACQ_REL,
+                                               __ATOMIC_ACQUIRE)) ||
+        p == want) {
+      ring = i;
+    }
+  }
+  if (ring < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  int err = take(&q->space, &q->send_waiters, d->flags & O_NONBLOCK, abs_timeout);
+  if (err) {
+    errno = err;
+    return -1;
+  }
+  uint64_t i;
+  while (!ring_pop(q, &q->free_ring, &i)) {
+    // Its receiver has given back `space`, but not the slot yet.
+    sched_yield();
+  }
+  struct shmmq_slot *slot = slot_at(q, i);
+  slot->len = msg_len;
+  slot->prio = msg_prio;
+  memcpy(slot->data, msg_ptr, msg_len);
+  ring_push(q, &q->prio_rings[ring], i);
+  uint32_t before = give(&q->avail, &q->recv_waiters);
+  if (before == 0 && __atomic_load_n(&q->recv_waiters, __ATOMIC_RELAXED) == 0) {
+    notify_fire(q);
+  }
+  return 0;
+}
+
+static int shmmq_send(mqd_t mqdes, const char *msg_ptr, size_t msg_len, unsigned int msg_prio,
+                      const struct timespec *abs_timeout) {
+  if (bad_timeout(abs_timeout)) {
+    errno = EINVAL;
+    return -1;
+  }
+  struct shmmq_desc *d = desc_get(mqdes);
+  if (!d) {
+    return -1;
+  }
+  int rv = desc_send(d, msg_ptr, msg_len, msg_prio, abs_timeout);
+  desc_put(d);
+  return rv;
+}
+
+int mq_timedsend(mqd_t mqdes, const char *msg_ptr, size_t msg_len, unsigned int msg_prio,
+                 const struct timespec *abs_timeout) {
+  return shmmq_send(mqdes, msg_ptr, msg_len, msg_prio, abs_timeout);
+}
+
+int mq_send(mqd_t mqdes, const char *msg_ptr, size_t msg_len, unsigned int msg_prio) {
+  return shmmq_send(mqdes, msg_ptr, msg_len, msg_prio, NULL);
+}
+
+static ssize_t desc_receive(struct shmmq_desc *d, char *msg_ptr, size_t msg_len,
+                            unsigned int *msg_prio, const struct timespec *abs_timeout) {
+  struct shmmq *q = d->q;
+  if ((d->flags & O_ACCMODE) == O_WRONLY) {
+    errno = EBADF;
+    return -1;
+  }
+  if (msg_len < (size_t)q->msgsize) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+  int err = take(&q->avail, &q->recv_waiters, d->flags & O_NONBLOCK, abs_timeout);
+  if (err) {
+    errno = err;
+    return -1;
+  }
+  // There's a message for us, but maybe not at the head of its ring yet, or
+  // taken by somebody who got theirs after we looked.
+  uint64_t i;
+  while (1) {
+    int best = -1;
+    uint32_t best_prio = 0;
+    for (int r = 0; r < SHMMQ_PRIOS; ++r) {
+      uint32_t p = __atomic_load_n(&q->prios[r], __ATOMIC_ACQUIRE);
+      if (p == 0) {
+        break;
+      }
+      if (p > best_prio && !ring_empty(q, &q->prio_rings[r])) {
+        best = r;
+        best_prio = p;
+      }
+    }
+    if (best >= 0 && ring_pop(q, &q->prio_rings[best], &i)) {
+      break;
+    }
+    if (best < 0) {
+      sched_yield();
+    }
+  }
+  struct shmmq_slot *slot = slot_at(q, i);
+  ssize_t n = slot->len;
+  memcpy(msg_ptr, slot->data, n);
+  if (msg_prio) {
+    *msg_prio = slot->prio;
+  }
+  ring_push(q, &q->free_ring, i);
+  give(&q->space, &q->send_waiters);
+  return n;
+}
+
+static ssize_t shmmq_receive(mqd_t mqdes, char *msg_ptr, size_t msg_len,
+                             unsigned int *msg_prio, const struct timespec *abs_timeout) {
+  if (bad_timeout(abs_timeout)) {
+    errno = EINVAL;
+    return -1;
+  }
+  struct shmmq_desc *d = desc_get(mqdes);
+  if (!d) {
+    return -1;
+  }
+  ssize_t rv = desc_receive(d, msg_ptr, msg_len, msg_prio, abs_timeout);
+  desc_put(d);
+  return rv;
+}
+
+ssize_t mq_timedreceive(mqd_t mqdes, char *msg_ptr, size_t msg_len, unsigned int *msg_prio,
+                        const struct timespec *abs_timeout) {
+  return shmmq_receive(mqdes, msg_ptr, msg_len, msg_prio, abs_timeout);
+}
+
+ssize_t mq_receive(mqd_t mqdes, char *msg_ptr, size_t msg_len, unsigned int *msg_prio) {
+  return shmmq_receive(mqdes, msg_ptr, msg_len, msg_prio, NULL);
+}
+
+static void desc_getattr(struct shmmq_desc *d, struct mq_attr *attr) {
+  memset(attr, 0, sizeof(*attr));
+  attr->mq_flags = d->flags & O_NONBLOCK;
+  attr->mq_maxmsg = d->q->maxmsg;
+  attr->mq_msgsize = d->q->msgsize;
+  attr->mq_curmsgs = __atomic_load_n(&d->q->avail, __ATOMIC_RELAXED);
+}
+
+int mq_getattr(mqd_t mqdes, struct mq_attr *attr) {
+  struct shmmq_desc *d = desc_get(mqdes);
+  if (!d) {
+    return -1;
+  }
+  desc_getattr(d, attr);
+  desc_put(d);
+  return 0;
+}
+
+int mq_setattr(mqd_t mqdes, const struct mq_attr *newattr, struct mq_attr *oldattr) {
+  struct shmmq_desc *d = desc_get(mqdes);
+  if (!d) {
+    return -1;
+  }
+  if (oldattr) {
+    desc_getattr(d, oldattr);
+  }
+  // Like the kernel's, only O_NONBLOCK can change.
+  d->flags = (d->flags & ~O_NONBLOCK) | (newattr->mq_flags & O_NONBLOCK);
+  desc_put(d);
+  return 0;
+}
+
+int mq_notify(mqd_t mqdes, const struct sigevent *sevp) {
+  struct shmmq_desc *d = desc_get(mqdes);
+  if (!d) {
+    return -1;
+  }
+  int rv = desc_notify(d, sevp);
+  desc_put(d);
+  return rv;
+}
+
+static int desc_notify(struct shmmq_desc *d, const struct sigevent *sevp) {
+  struct shmmq_notify *n = &d->q->notify;
+  int32_t me = getpid();
+  if (!sevp) {
+    // Only our own registration is ours to take away.
+    int32_t pid = me;
+    if (__atomic_compare_exchange_n(&n->pid, &pid, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+      notify_done(n, n->reg);
+    }
+    return 0;
+  }
+  if (sevp->sigev_notify != SIGEV_NONE && sevp->sigev_notify != SIGEV_SIGNAL &&
+      sevp->sigev_notify != SIGEV_THREAD) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (sevp->sigev_notify == SIGEV_SIGNAL && (sevp->sigev_signo <= 0 || sevp->sigev_signo >= NSIG)) {
+    errno = EINVAL;
+    return -1;
+  }
+  int32_t owner = 0;
+  while (!__atomic_compare_exchange_n(&n->pid, &owner, -me, 0, __ATOMIC_ACQ_REL,
+                                      __ATOMIC_RELAXED)) {
+    if (!notify_reap(n, owner)) {
+      errno = EBUSY;
+      return -1;
+    }
+    owner = 0;
+  }
+  n->how = sevp->sigev_notify;
+  n->signo = sevp->sigev_signo;
+  n->value = sevp->sigev_value;
+  uint32_t reg = ++n->reg;
+  if (sevp->sigev_notify == SIGEV_THREAD) {
+    struct notify_thread *t = malloc(sizeof(*t));
+    pthread_t thread;
+    int err = t ? 0 : ENOMEM;
+    if (t) {
+      // The helper's reference, which it gives back when it's done waiting.
+      __atomic_fetch_add(&d->refs, 1, __ATOMIC_RELAXED);
+      *t = (struct notify_thread){d, reg, sevp->sigev_notify_function, sevp->sigev_value};
+      err = pthread_create(&thread, sevp->sigev_notify_attributes, notify_main, t);
+    }
+    if (!err) {
+      pthread_detach(thread);
+    } else {
+      if (t) {
+        desc_put(d);
+      }
+      free(t);
+      __atomic_store_n(&n->pid, 0, __ATOMIC_RELEASE);
+      errno = err;
+      return -1;
+    }
+  }
+  __atomic_store_n(&n->pid, me, __ATOMIC_RELEASE);
+  return 0;
+}
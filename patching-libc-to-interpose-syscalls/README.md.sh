@@ -22,6 +22,10 @@ function directly.
 
 `show_cmd "cat ./interpose.c"`
 
+The syscalls it handles are listed in ``INTERPOSED``, from which
+[../common/sysdispatch.h](../common/sysdispatch.h) generates a table indexed
+by syscall number; everything else goes straight through to ``passthrough``.
+
 Unfortunately, it turns out that the libc implementations of these functions
 make *inlined* syscalls, so this only successfully interposes on and doubles
 the actual call to syscall:
@@ -0,0 +1,161 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "../common/coalesce.h"
+#include "../common/sysdispatch.h"
+
+// Like interpose.c, but rather than doubling writes to stdout, coalesces
+// small writes to the fds in COALESCE_FDS (see ../common/coalesce.h). With
+// the patched libc, that's all of them, stdio's included:
+//
+//   COALESCE_FDS=1,2 LD_PRELOAD=$PWD/libcoalesce.so:$PWD/glibc-build/libc.so ./call_write
+
+static long real_syscall(long n, long arg1, long arg2, long arg3, long arg4,
+                         long arg5, long arg6) {
+    long rv;
+    register long r10 __asm__("r10") = arg4;
+    register long r8 __asm__("r8") = arg5;
+    register long r9 __asm__("r9") = arg6;
+    asm volatile("syscall\n"
+                 : "=a"(rv)
+                 : "a"(n), "D"(arg1), "S"(arg2), "d"(arg3), "r"(r10), "r"(r8), "r"(r9)
+                 : "r11", "rcx", "memory");
+    return rv;
+}
+
+static ssize_t real_writev(int fd, const struct iovec* iov, int iovcnt) {
+    long rv = real_syscall(SYS_writev, fd, (long)iov, iovcnt, 0, 0, 0);
+    if (rv < 0) {
+        errno = -rv;
+        return -1;
+    }
+    return rv;
+}
+
+__attribute__((constructor)) static void load() {
+    coalesce_init(real_writev);
+}
+
+// Without the patched libc, exit_group doesn't come through syscall().
+__attribute__((destructor)) static void unload() {
+    coalesce_flush_all();
+}
+
+static long passthrough(void* ctx, long n, long a[6]) {
+    return real_syscall(n, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+static long sys_write(void* ctx, int fd, const void* buf, size_t count) {
+    if (!coalesce_wants(fd)) {
+        return real_syscall(SYS_write, fd, (long)buf, count, 0, 0, 0);
+    }
+    ssize_t rv = coalesce_write(fd, buf, count);
+    return rv < 0 ? -errno : rv;
+}
+
+// Syscalls that wait, or that want the output to be out, flush this thread's
+// buffer first; ones that other threads' output should beat, everyone's.
+static long flush_mine(void* ctx, long n, long a[6]) {
+    coalesce_flush();
+    return passthrough(ctx, n, a);
+}
+
+static long flush_all(void* ctx, long n, long a[6]) {
+    coalesce_flush_all();
+    return passthrough(ctx, n, a);
+}
+
+// Writes to a coalesced fd that don't come through sys_write go out after
+// what's buffered (the fd is the first argument, except for splice's).
+static long write_other(void* ctx, long n, long a[6]) {
+    coalesce_before_write(n == SYS_splice ? a[2] : a[0]);
+    return passthrough(ctx, n, a);
+}
+
+// As does anything that changes what a coalesced fd refers to, or makes
+// another fd refer to the same thing.
+static long dup_fds(void* ctx, long n, long a[6]) {
+    switch (n) {
+    case SYS_dup2:
+    case SYS_dup3:
+        coalesce_before_dup(a[1]);
+        break;
+    case SYS_close_range:
+        for (unsigned long fd = a[0]; fd <= (unsigned)a[1] && fd < 64; ++fd) {
+            if (coalesce_wants(fd)) {
+                coalesce_flush_all();
+                break;
+            }
+        }
+        return passthrough(ctx, n, a);
+    case SYS_fcntl:
+        if (a[1] != F_DUPFD && a[1] != F_DUPFD_CLOEXEC) {
+            return passthrough(ctx, n, a);
+        }
+        break;
+    }
+    coalesce_before_dup(a[0]);
+    return passthrough(ctx, n, a);
+}
+
+#define COALESCED(TYPED, RAW, p) \
+    TYPED(p, write) \
+    RAW(p, writev, write_other) \
+    RAW(p, pwrite64, write_other) \
+    RAW(p, pwritev, write_other) \
+    RAW(p, pwritev2, write_other) \
+    RAW(p, sendto, write_other) \
+    RAW(p, sendmsg, write_other) \
+    RAW(p, sendmmsg, write_other) \
+    RAW(p, sendfile, write_other) \
+    RAW(p, splice, write_other) \
+    RAW(p, dup, dup_fds) \
+    RAW(p, dup2, dup_fds) \
+    RAW(p, dup3, dup_fds) \
+    RAW(p, close, dup_fds) \
+    RAW(p, close_range, dup_fds) \
+    RAW(p, fcntl, dup_fds) \
+    RAW(p, read, flush_mine) \
+    RAW(p, readv, flush_mine) \
+    RAW(p, pread64, flush_mine) \
+    RAW(p, preadv, flush_mine) \
+    RAW(p, recvfrom, flush_mine) \
+    RAW(p, recvmsg, flush_mine) \
+    RAW(p, nanosleep, flush_mine) \
+    RAW(p, clock_nanosleep, flush_mine) \
+    RAW(p, poll, flush_mine) \
+    RAW(p, ppoll, flush_mine) \
+    RAW(p, select, flush_mine) \
+    RAW(p, pselect6, flush_mine) \
+    RAW(p, epoll_wait, flush_mine) \
+    RAW(p, epoll_pwait, flush_mine) \
+    RAW(p, wait4, flush_mine) \
+    RAW(p, waitid, flush_mine) \
+    RAW(p, exit, flush_mine) \
+    RAW(p, fsync, flush_all) \
+    RAW(p, fdatasync, flush_all) \
+    RAW(p, syncfs, flush_all) \
+    RAW(p, fork, flush_all) \
+    RAW(p, clone, flush_all) \
+    RAW(p, clone3, flush_all) \
+    RAW(p, execve, flush_all) \
+    RAW(p, execveat, flush_all) \
+    RAW(p, exit_group, flush_all)
+SYSDISPATCH_TABLE(sys, COALESCED, passthrough)
+
+long syscall(long n, ...) {
+    va_list args;
+    va_start(args, n);
+    long a[6];
+    for (int i = 0; i < 6; ++i) {
+        a[i] = va_arg(args, long);
+    }
+    va_end(args);
+
+    return sysdispatch(sys_table, NULL, n, a);
+}
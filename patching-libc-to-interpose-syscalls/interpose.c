@@ -5,53 +5,64 @@
 #include <sys/syscall.h>
 #include <stdio.h>
 
+#include "../common/capture.h"
+#include "../common/sysdispatch.h"
+
 static long real_syscall(long n, long arg1, long arg2, long arg3, long arg4,
                          long arg5, long arg6) {
     long rv;
+    register long r10 __asm__("r10") = arg4;
+    register long r8 __asm__("r8") = arg5;
+    register long r9 __asm__("r9") = arg6;
     asm volatile(
-        "movq %[n], %%rax\n"
-        "movq %[arg1], %%rdi\n"
-        "movq %[arg2], %%rsi\n"
-        "movq %[arg3], %%rdx\n"
-        "movq %[arg4], %%r10\n"
-        "movq %[arg5], %%r8\n"
-        "movq %[arg6], %%r9\n"
         "syscall\n"
-        "movq %%rax, %[rv]\n"
         : /* output parameters*/
-        [rv] "=rm"(rv)
+        "=a"(rv)
         : /* input parameters */
-        [n] "rm"(n), [arg1] "rm"(arg1), [arg2] "rm"(arg2), [arg3] "rm"(arg3),
-        [arg4] "rm"(arg4), [arg5] "rm"(arg5), [arg6] "rm"(arg6)
+        "a"(n), "D"(arg1), "S"(arg2), "d"(arg3), "r"(r10), "r"(r8), "r"(r9)
         : /* other clobbered regs */
-        "rdi",
         // "SYSCALL also saves RFLAGS into R11"
         "r11",
-        // "The SYSCALL instruction does not save the stack pointer (RSP)"
-        "rsp",
-        // Used to save rip; unclear whether it gets restored"
+        // Used to save rip
         "rcx",
-        // Flags
-        "cc",
         // Memory
         "memory");
     return rv;
 }
 
+static long passthrough(void* ctx, long n, long a[6]) {
+    return real_syscall(n, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+// With CAPTURE_DIR set, stdout and stderr go to a capture file instead of
+// being written; see ../common/capture.h. With the patched libc, that's
+// every write libc makes, internal ones included.
+__attribute__((constructor)) static void init(void) {
+    capture_init();
+}
+
+static long interpose_write(void* ctx, int fd, const void* buf, size_t count) {
+    if (capture_wants(fd)) {
+        return capture_write(fd, buf, count);
+    }
+    if (fd == STDOUT_FILENO) {
+        real_syscall(SYS_write, fd, (long)buf, count, 0, 0, 0);
+    }
+    return real_syscall(SYS_write, fd, (long)buf, count, 0, 0, 0);
+}
+
+// Everything else goes straight to passthrough.
+#define INTERPOSED(TYPED, RAW, p) TYPED(p, write)
+SYSDISPATCH_TABLE(interpose, INTERPOSED, passthrough)
+
 long syscall(long n, ...) {
     va_list args;
     va_start(args, n);
-    long arg1 = va_arg(args, long);
-    long arg2 = va_arg(args, long);
-    long arg3 = va_arg(args, long);
-    long arg4 = va_arg(args, long);
-    long arg5 = va_arg(args, long);
-    long arg6 = va_arg(args, long);
+    long a[6];
+    for (int i = 0; i < 6; ++i) {
+        a[i] = va_arg(args, long);
+    }
     va_end(args);
 
-    if (n == SYS_write && arg1 == STDOUT_FILENO) {
-        real_syscall(n, arg1, arg2, arg3, arg4, arg5, arg6);
-    }
-    return real_syscall(n, arg1, arg2, arg3, arg4, arg5, arg6);
+    return sysdispatch(interpose_table, NULL, n, a);
 }
-
@@ -0,0 +1,238 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "mem.h"
+
+static size_t page_size(void)
+{
+	static size_t size;
+
+	if (!size)
+		size = sysconf(_SC_PAGESIZE);
+	return size;
+}
+
+int mem_regions_add(struct mem_regions *regions, uintptr_t remote, size_t len,
+		    int fd, off_t offset)
+{
+	if (regions->n == MEM_REGIONS_MAX)
+		return -ENOSPC;
+	void *local = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+	if (local == MAP_FAILED)
+		return -errno;
+	regions->r[regions->n++] = (struct mem_region){
+		.remote = remote,
+		.len = len,
+		.local = local,
+	};
+	return 0;
+}
+
+void mem_regions_free(struct mem_regions *regions)
+{
+	for (int i = 0; i < regions->n; ++i)
+		munmap(regions->r[i].local, regions->r[i].len);
+	regions->n = 0;
+}
+
+/* The region holding remote, and how many bytes of it there are from there. */
+static const struct mem_region *find_region(const struct mem_regions *regions,
+					    uintptr_t remote, size_t *avail)
+{
+	if (!regions)
+		return NULL;
+	for (int i = 0; i < regions->n; ++i) {
+		const struct mem_region *r = &regions->r[i];
+		if (remote >= r->remote && remote - r->remote < r->len) {
+			*avail = r->len - (remote - r->remote);
+			return r;
+		}
+	}
+	return NULL;
+}
+
+void *mem_ptr(const struct mem_regions *regions, uintptr_t remote, size_t len)
+{
+	size_t avail;
+	const struct mem_region *r = find_region(regions, remote, &avail);
+
+	if (!r || avail < len)
+		return NULL;
+	return r->local + (remote - r->remote);
+}
+
+void mem_batch_init(struct mem_batch *b, pid_t pid, const struct mem_regions *regions)
+{
+	b->pid = pid;
+	b->regions = regions;
+	b->n = 0;
+	b->used = 0;
+}
+
+static int add(struct mem_batch *b, uintptr_t addr, size_t len, bool string)
+{
+	if (b->n == MEM_BATCH_MAX)
+		return -1;
+
+	struct mem_read *r = &b->reads[b->n];
+	*r = (struct mem_read){.addr = addr, .len = len, .string = string};
+
+	/* Mapped: nothing to read. Live data, though; copy what must hold still. */
+	size_t avail;
+	const struct mem_region *region = find_region(b->regions, addr, &avail);
+	const char *p = region ? region->local + (addr - region->remote) : NULL;
+	if (p && !string && avail >= len) {
+		r->data = p;
+		r->got = len;
+		return b->n++;
+	}
+	const char *nul = p && string ? memchr(p, '\0', avail < len ? avail : len) : NULL;
+	if (nul) {
+		r->data = p;
+		r->got = nul - p + 1;
+		return b->n++;
+	}
+
+	/* Strings get their whole max, so that they can grow in place. */
+	if (MEM_BATCH_BUF - b->used < len)
+		return -1;
+	r->data = b->buf + b->used;
+	b->used += len;
+	return b->n++;
+}
+
+int mem_batch_add(struct mem_batch *b, uintptr_t addr, size_t len)
+{
+	return add(b, addr, len, false);
+}
+
+int mem_batch_add_string(struct mem_batch *b, uintptr_t addr, size_t max)
+{
+	return add(b, addr, max, true);
+}
+
+/*
+ * How much more of r to read in the next round: the rest of a fixed-size
+ * read, or up to the end of the next page of a string.
+ */
+static size_t next_chunk(const struct mem_read *r)
+{
+	uintptr_t at = r->addr + r->got;
+	size_t chunk = r->len - r->got;
+
+	if (r->string) {
+		size_t to_page_end = page_size() - (at & (page_size() - 1));
+		if (chunk > to_page_end)
+			chunk = to_page_end;
+	}
+	return chunk;
+}
+
+/*
+ * One round: reads the next chunk of every read in idx[0..n) that still
+ * needs one, with as few process_vm_readv calls as faults allow.
+ */
+static void read_round(struct mem_batch *b, const int *idx, int n)
+{
+	struct iovec local[MEM_BATCH_MAX], remote[MEM_BATCH_MAX];
+
+	for (int i = 0; i < n; ++i) {
+		struct mem_read *r = &b->reads[idx[i]];
+		size_t chunk = next_chunk(r);
+		local[i] = (struct iovec){.iov_base = (char *)r->data + r->got, .iov_len = chunk};
+		remote[i] = (struct iovec){.iov_base = (void *)(r->addr + r->got), .iov_len = chunk};
+	}
+
+	int start = 0;
+	while (start < n) {
+		ssize_t got = process_vm_readv(b->pid, &local[start], n - start,
+					       &remote[start], n - start, 0);
+		if (got < 0) {
+			if (errno == EFAULT) {
+				/* The first one didn't read at all. */
+				b->reads[idx[start++]].error = EFAULT;
+				continue;
+			}
+			/* Gone, or not ours to read: the same for all of them. */
+			for (int i = start; i < n; ++i)
+				b->reads[idx[i]].error = errno;
+			return;
+		}
+		/* It stops at the first fault; restart after that one. */
+		while (start < n) {
+			struct mem_read *r = &b->reads[idx[start]];
+			size_t len = local[start].iov_len;
+			size_t part = (size_t)got < len ? (size_t)got : len;
+			r->got += part;
+			got -= part;
+			++start;
+			if (part < len) {
+				/*
+				 * A string might end before the fault; the
+				 * caller checks.
+				 */
+				if (!r->string)
+					r->error = EFAULT;
+				else if (!memchr(r->data, '\0', r->got))
+					r->error = EFAULT;
+				break;
+			}
+		}
+	}
+}
+
+int mem_batch_read(struct mem_batch *b)
+{
+	int idx[MEM_BATCH_MAX], n;
+
+	do {
+		n = 0;
+		for (int i = 0; i < b->n; ++i) {
+			struct mem_read *r = &b->reads[i];
+			if (r->error)
+				continue;
+			if (r->string && r->got) {
+				const char *nul = memchr(r->data, '\0', r->got);
+				if (nul) {
+					r->got = nul - (const char *)r->data + 1;
+					continue;
+				}
+			}
+			if (r->got < r->len)
+				idx[n++] = i;
+		}
+		if (n)
+			read_round(b, idx, n);
+	} while (n);
+
+	int err = 0;
+	for (int i = 0; i < b->n; ++i) {
+		struct mem_read *r = &b->reads[i];
+		if (!r->error && r->string && !memchr(r->data, '\0', r->got))
+			r->error = ENAMETOOLONG;
+		if (!err)
+			err = r->error;
+	}
+	return err;
+}
+
+int mem_write(pid_t pid, const struct mem_regions *regions, uintptr_t remote,
+	      const void *data, size_t len)
+{
+	void *p = mem_ptr(regions, remote, len);
+
+	if (p) {
+		memcpy(p, data, len);
+		return 0;
+	}
+	struct iovec local = {.iov_base = (void *)data, .iov_len = len};
+	struct iovec rem = {.iov_base = (void *)remote, .iov_len = len};
+	ssize_t n = process_vm_writev(pid, &local, 1, &rem, 1, 0);
+	if (n < 0)
+		return -errno;
+	return (size_t)n == len ? 0 : -EFAULT;
+}
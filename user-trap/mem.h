@@ -0,0 +1,94 @@
+#ifndef MEM_H
+#define MEM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*
+ * Reading a tracee's memory for a notification: collect every pointer
+ * argument into a mem_batch, then fetch them all with one process_vm_readv
+ * (more only if something faults, or a string runs off the end of a page).
+ *
+ * Strings are read up to the end of the page they start on, since that can't
+ * fault unless the string itself would. Nearly all of them end there, so
+ * they cost no more than a fixed-size read, and ride along in the same batch.
+ *
+ * If parts of the tracee's address space are backed by a memfd that we've
+ * mapped too (mem_regions_add), reads there don't copy anything: we hand back
+ * a pointer into our mapping. mem_ptr gives a pointer to write through the
+ * same way.
+ *
+ * None of this makes what we read safe to act on. Check
+ * SECCOMP_IOCTL_NOTIF_ID_VALID after mem_batch_read, as always.
+ */
+
+#define MEM_BATCH_MAX 16
+/* Scratch space for copies, per batch. */
+#define MEM_BATCH_BUF (64 << 10)
+#define MEM_REGIONS_MAX 8
+
+struct mem_region {
+	uintptr_t remote;
+	size_t len;
+	char *local;
+};
+
+/* Parts of one address space that we have mapped. */
+struct mem_regions {
+	int n;
+	struct mem_region r[MEM_REGIONS_MAX];
+};
+
+struct mem_read {
+	uintptr_t addr;
+	/* Bytes asked for; for a string, the most we'll read. */
+	size_t len;
+	bool string;
+	/* Results: the data, how much of it we got, and 0 or an errno. */
+	const void *data;
+	size_t got;
+	int error;
+};
+
+struct mem_batch {
+	pid_t pid;
+	const struct mem_regions *regions;
+	int n;
+	struct mem_read reads[MEM_BATCH_MAX];
+	size_t used;
+	char buf[MEM_BATCH_BUF];
+};
+
+/* Maps len bytes of fd at offset, which the tracee has mapped at remote. */
+int mem_regions_add(struct mem_regions *regions, uintptr_t remote, size_t len,
+		    int fd, off_t offset);
+void mem_regions_free(struct mem_regions *regions);
+
+/* Where remote..remote+len is in our mapping, or NULL if it isn't all there. */
+void *mem_ptr(const struct mem_regions *regions, uintptr_t remote, size_t len);
+
+/* Starts a batch of reads from pid. regions may be NULL. */
+void mem_batch_init(struct mem_batch *b, pid_t pid, const struct mem_regions *regions);
+
+/*
+ * Queues a read of len bytes, or of a NUL-terminated string of at most len
+ * bytes (including the NUL). Returns its index, or -1 if the batch is full.
+ */
+int mem_batch_add(struct mem_batch *b, uintptr_t addr, size_t len);
+int mem_batch_add_string(struct mem_batch *b, uintptr_t addr, size_t max);
+
+/*
+ * Does the queued reads. Returns 0, or the error of the first read that
+ * failed; reads[i].error says which. A string that doesn't end within its
+ * max fails with ENAMETOOLONG.
+ */
+int mem_batch_read(struct mem_batch *b);
+
+/* Writes len bytes to the tracee at remote. Returns 0 or -errno. */
+int mem_write(pid_t pid, const struct mem_regions *regions, uintptr_t remote,
+	      const void *data, size_t len);
+
+#endif
@@ -0,0 +1,193 @@
+#define _GNU_SOURCE
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#include "mem.h"
+
+/*
+ * Compares ways of reading a notification's pointer arguments out of another
+ * process:
+ *
+ *   per_arg  one process_vm_readv per pointer, as user-trap.c used to
+ *   batched  mem_batch: one process_vm_readv per round of dependent reads
+ *   mapped   mem_batch, with the memory also mapped here through a memfd
+ *
+ * for the arguments of three syscalls:
+ *
+ *   nanosleep  a timespec
+ *   newfstatat a path and a struct stat
+ *   writev     an array of -i iovecs, then the -s bytes each points to
+ *
+ * Usage: mem_bench [-i iovecs] [-s bytes per iovec] [-n iterations]
+ */
+
+#define CHECK(x) { \
+	if (!(x)) {\
+		perror(#x);\
+		exit(EXIT_FAILURE);\
+	}\
+}
+
+enum mode { PER_ARG, BATCHED, MAPPED };
+static const char *mode_names[] = {"per_arg", "batched", "mapped"};
+
+static pid_t child;
+static struct mem_regions regions;
+static struct mem_batch batch;
+static char scratch[MEM_BATCH_BUF];
+
+/* The "tracee's" arguments, in memory it shares with us. */
+static struct timespec *ts;
+static char *path;
+static struct stat *st;
+static struct iovec *iov;
+static int iovcnt = 8;
+static size_t iovsize = 1024;
+
+static double now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+static void read_one(const void *addr, void *to, size_t len)
+{
+	struct iovec local = {.iov_base = to, .iov_len = len};
+	struct iovec remote = {.iov_base = (void *)addr, .iov_len = len};
+
+	CHECK(process_vm_readv(child, &local, 1, &remote, 1, 0) == (ssize_t)len);
+}
+
+static void begin(enum mode mode)
+{
+	mem_batch_init(&batch, child, mode == MAPPED ? &regions : NULL);
+}
+
+static void do_nanosleep(enum mode mode)
+{
+	if (mode == PER_ARG) {
+		read_one(ts, scratch, sizeof(*ts));
+		return;
+	}
+	begin(mode);
+	mem_batch_add(&batch, (uintptr_t)ts, sizeof(*ts));
+	CHECK(mem_batch_read(&batch) == 0);
+}
+
+static void do_newfstatat(enum mode mode)
+{
+	if (mode == PER_ARG) {
+		/* Up to the end of the page, like mem.c. */
+		size_t len = 4096 - ((uintptr_t)path & 4095);
+		read_one(path, scratch, len);
+		CHECK(memchr(scratch, '\0', len));
+		read_one(st, scratch + 4096, sizeof(*st));
+		return;
+	}
+	begin(mode);
+	int p = mem_batch_add_string(&batch, (uintptr_t)path, 4096);
+	mem_batch_add(&batch, (uintptr_t)st, sizeof(*st));
+	CHECK(mem_batch_read(&batch) == 0);
+	CHECK(strcmp(batch.reads[p].data, path) == 0);
+}
+
+static void do_writev(enum mode mode)
+{
+	if (mode == PER_ARG) {
+		struct iovec v[MEM_BATCH_MAX];
+		read_one(iov, v, iovcnt * sizeof(*iov));
+		for (int i = 0; i < iovcnt; ++i)
+			read_one(v[i].iov_base, scratch + i * iovsize, v[i].iov_len);
+		return;
+	}
+	begin(mode);
+	int v = mem_batch_add(&batch, (uintptr_t)iov, iovcnt * sizeof(*iov));
+	CHECK(mem_batch_read(&batch) == 0);
+	const struct iovec *got = batch.reads[v].data;
+	for (int i = 0; i < iovcnt; ++i)
+		CHECK(mem_batch_add(&batch, (uintptr_t)got[i].iov_base, got[i].iov_len) >= 0);
+	CHECK(mem_batch_read(&batch) == 0);
+}
+
+int main(int argc, char **argv)
+{
+	int iters = 100000, opt;
+
+	while ((opt = getopt(argc, argv, "i:s:n:")) != -1) {
+		switch (opt) {
+		case 'i': iovcnt = atoi(optarg); break;
+		case 's': iovsize = atol(optarg); break;
+		case 'n': iters = atoi(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-i iovecs] [-s bytes per iovec] [-n iterations]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	/* The batch holds the iovec array too. */
+	CHECK(iovcnt > 0 && iovcnt < MEM_BATCH_MAX);
+	CHECK(iovcnt * iovsize + iovcnt * sizeof(struct iovec) <= MEM_BATCH_BUF);
+
+	/*
+	 * Everything the child "passes" us lives in a memfd, mapped before the
+	 * fork so that it's at the same address on both sides.
+	 */
+	size_t len = 4 * 4096 + iovcnt * iovsize;
+	int fd = memfd_create("mem_bench", 0);
+	CHECK(fd >= 0);
+	CHECK(ftruncate(fd, len) == 0);
+	char *shared = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	CHECK(shared != MAP_FAILED);
+	ts = (struct timespec *)shared;
+	st = (struct stat *)(shared + 64);
+	path = shared + 4096;
+	strcpy(path, "/usr/lib/x86_64-linux-gnu/libc.so.6");
+	iov = (struct iovec *)(shared + 2 * 4096);
+	for (int i = 0; i < iovcnt; ++i) {
+		iov[i].iov_base = shared + 4 * 4096 + i * iovsize;
+		iov[i].iov_len = iovsize;
+	}
+
+	child = fork();
+	CHECK(child >= 0);
+	if (child == 0) {
+		pause();
+		_exit(0);
+	}
+	CHECK(mem_regions_add(&regions, (uintptr_t)shared, len, fd, 0) == 0);
+
+	struct {
+		const char *name;
+		void (*fn)(enum mode);
+	} cases[] = {
+		{"nanosleep", do_nanosleep},
+		{"newfstatat", do_newfstatat},
+		{"writev", do_writev},
+	};
+	for (size_t c = 0; c < sizeof(cases) / sizeof(*cases); ++c) {
+		printf("case=%s", cases[c].name);
+		if (cases[c].fn == do_writev)
+			printf(" iovecs=%d bytes=%zu", iovcnt, iovsize);
+		for (enum mode m = PER_ARG; m <= MAPPED; ++m) {
+			double t0 = now();
+			for (int i = 0; i < iters; ++i)
+				cases[c].fn(m);
+			printf(" %s_ns=%.0f", mode_names[m], (now() - t0) / iters);
+		}
+		printf("\n");
+	}
+
+	kill(child, SIGKILL);
+	waitpid(child, NULL, 0);
+	return 0;
+}
@@ -0,0 +1,135 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+
+#include "supervisor.h"
+
+/*
+ * Load test for the supervisor: N tracees making trapped getpid calls as fast
+ * as they can, which the supervisor answers without letting them through.
+ * Reports notifications per second for 1, 2, 4, ... up to -w workers.
+ *
+ * Usage: notif_load [-n tracees] [-w max workers] [-d seconds]
+ */
+
+#define CHECK(x) { \
+	if (!(x)) {\
+		perror(#x);\
+		exit(EXIT_FAILURE);\
+	}\
+}
+
+static int trap_getpid(void *arg)
+{
+	struct sock_filter filter[] = {
+		BPF_STMT(BPF_LD+BPF_W+BPF_ABS,
+			offsetof(struct seccomp_data, nr)),
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, __NR_getpid, 0, 1),
+		BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_USER_NOTIF),
+		BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW),
+	};
+	struct sock_fprog prog = {
+		.len = sizeof(filter) / sizeof(*filter),
+		.filter = filter,
+	};
+
+	return syscall(__NR_seccomp, SECCOMP_SET_MODE_FILTER,
+		       SECCOMP_FILTER_FLAG_NEW_LISTENER, &prog);
+}
+
+static int handle_getpid(struct supervisor_worker *w, struct tracee *t,
+			 struct seccomp_notif *req,
+			 struct seccomp_notif_resp *resp)
+{
+	resp->val = t->pid;
+	return SUPERVISOR_RESPOND;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void tracee_main(int start_fd, double seconds)
+{
+	char c;
+	pid_t pid = getpid();
+
+	/* Wait for everyone, so that the whole run is under full load. */
+	while (read(start_fd, &c, 1) < 0 && errno == EINTR)
+		;
+	double end = now() + seconds;
+	while (now() < end) {
+		/* The vDSO clock isn't trapped; check it every so often. */
+		for (int i = 0; i < 100; ++i) {
+			if (syscall(__NR_getpid) != pid)
+				_exit(1);
+		}
+	}
+	_exit(0);
+}
+
+static void run(int workers, int tracees, double seconds)
+{
+	struct supervisor *sv = supervisor_new(workers, handle_getpid, NULL);
+	int start[2], status, failed = 0;
+
+	CHECK(sv);
+	CHECK(pipe(start) == 0);
+	for (int i = 0; i < tracees; ++i) {
+		pid_t pid = supervisor_fork(sv, trap_getpid, NULL);
+		CHECK(pid >= 0);
+		if (pid == 0) {
+			close(start[1]);
+			tracee_main(start[0], seconds);
+		}
+	}
+	close(start[0]);
+
+	uint64_t before = supervisor_handled(sv);
+	double t0 = now();
+	close(start[1]);
+	while (wait(&status) > 0)
+		failed += !WIFEXITED(status) || WEXITSTATUS(status);
+	double elapsed = now() - t0;
+	uint64_t handled = supervisor_handled(sv) - before;
+
+	supervisor_drain(sv);
+	supervisor_free(sv);
+	printf("workers=%d tracees=%d notifs=%lu elapsed=%.3fs rate=%.0f/s%s\n",
+	       workers, tracees, (unsigned long)handled, elapsed, handled / elapsed,
+	       failed ? " (some tracees FAILED)" : "");
+}
+
+int main(int argc, char **argv)
+{
+	int tracees = 64, max_workers = 8, opt;
+	double seconds = 1;
+
+	while ((opt = getopt(argc, argv, "n:w:d:")) != -1) {
+		switch (opt) {
+		case 'n': tracees = atoi(optarg); break;
+		case 'w': max_workers = atoi(optarg); break;
+		case 'd': seconds = atof(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-n tracees] [-w max workers] [-d seconds]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (int w = 1; w <= max_workers; w *= 2)
+		run(w, tracees, seconds);
+	return 0;
+}
@@ -0,0 +1,576 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
+
+#include "../common/bpftree.h"
+#include "policy.h"
+#include "syscallnames.h"
+
+/*
+ * A policy file has one rule per line:
+ *
+ *   <syscall> [under <prefix>...] <action>
+ *   default <action>
+ *
+ * <syscall> is a name from syscallnames.h or a number, and # starts a
+ * comment. <action> is one of:
+ *
+ *   allow      run it in the kernel
+ *   continue   trap it, then run it in the kernel anyway
+ *   errno <E>  fail with E, by name (EPERM) or number
+ *   emulate    answer it in the supervisor; only some syscalls can be
+ *   addfd      open(at) and creat only: open the file in the supervisor, and
+ *              give the tracee the fd
+ *   vtime      sleeps and timed waits only: wait in virtual time (vtime.h)
+ *
+ * A syscall's rules are tried in order, then the default ones (default allow,
+ * if there aren't any). `under` limits a rule to syscalls whose path argument
+ * is an absolute path under one of the prefixes, with no `..` in it. Relative
+ * paths never match.
+ *
+ * We do as little as we can per syscall. A syscall that's allowed or failed
+ * unconditionally is decided by the filter, and never gets to us at all.
+ * Otherwise we read tracee memory only if a rule needs it, and only once: the
+ * path, for `under` and `addfd`.
+ *
+ * The tracee can change the path after we've looked at it, and `under` only
+ * compares strings, so it's no way to keep the tracee out of places, unless
+ * the action is `addfd`. With `addfd` the supervisor opens the file itself,
+ * with its own credentials, and with `under` it resolves the rest of the path
+ * with openat2 from the prefix it matched, with RESOLVE_BENEATH: symlinks
+ * that lead out of the prefix (or any absolute ones) fail with EXDEV, and so
+ * do magic links. Without `under`, `addfd` opens whatever the tracee names,
+ * relative to its cwd or dirfd, even if the tracee couldn't open it itself.
+ * Files it creates get the tracee's umask, but are owned by the supervisor.
+ */
+
+/* An emulation fills in resp, given the request. */
+typedef void (*emulation)(struct tracee *t, struct seccomp_notif *req,
+			  struct seccomp_notif_resp *resp);
+
+static void emulate_gettid(struct tracee *t, struct seccomp_notif *req,
+			   struct seccomp_notif_resp *resp)
+{
+	/* As long as we're in the same pid namespace. */
+	resp->val = req->pid;
+}
+
+static void emulate_done(struct tracee *t, struct seccomp_notif *req,
+			 struct seccomp_notif_resp *resp)
+{
+	/* Sleeping and yielding: done as soon as we say so. */
+	resp->val = 0;
+}
+
+static const emulation emulations[POLICY_NR] = {
+	[__NR_gettid] = emulate_gettid,
+	[__NR_nanosleep] = emulate_done,
+	[__NR_clock_nanosleep] = emulate_done,
+	[__NR_sched_yield] = emulate_done,
+};
+
+/* Which argument is a path, or -1. */
+static int path_arg(int nr)
+{
+	switch (nr) {
+	case __NR_open:
+	case __NR_creat:
+	case __NR_stat:
+	case __NR_lstat:
+	case __NR_access:
+	case __NR_execve:
+	case __NR_mkdir:
+	case __NR_rmdir:
+	case __NR_unlink:
+	case __NR_readlink:
+	case __NR_chdir:
+	case __NR_truncate:
+	case __NR_chmod:
+	case __NR_chown:
+		return 0;
+	case __NR_openat:
+	case __NR_newfstatat:
+	case __NR_faccessat:
+	case __NR_faccessat2:
+	case __NR_execveat:
+	case __NR_mkdirat:
+	case __NR_unlinkat:
+	case __NR_readlinkat:
+	case __NR_statx:
+	case __NR_fchmodat:
+	case __NR_fchownat:
+	case __NR_openat2:
+		return 1;
+	default:
+		return -1;
+	}
+}
+
+static bool opens(int nr)
+{
+	return nr == __NR_open || nr == __NR_openat || nr == __NR_creat;
+}
+
+static long syscall_nr(const char *s)
+{
+	char *end;
+	long nr = strtol(s, &end, 0);
+
+	if (*s && *end == '\0')
+		return nr >= 0 && nr < POLICY_NR ? nr : -1;
+	for (long i = 0; i < SYSCALL_NAMES_LEN && i < POLICY_NR; ++i) {
+		if (syscall_names[i] && strcmp(syscall_names[i], s) == 0)
+			return i;
+	}
+	return -1;
+}
+
+static int errno_value(const char *s)
+{
+	char *end;
+	long e = strtol(s, &end, 0);
+
+	if (*s && *end == '\0')
+		return e > 0 && e < 4096 ? e : -1;
+	for (int i = 1; i < 4096; ++i) {
+		const char *name = strerrorname_np(i);
+		if (name && strcmp(name, s) == 0)
+			return i;
+	}
+	return -1;
+}
+
+static char *next_word(char **p)
+{
+	*p += strspn(*p, " \t");
+	if (**p == '\0')
+		return NULL;
+	char *word = *p;
+	*p += strcspn(*p, " \t");
+	if (**p)
+		*(*p)++ = '\0';
+	return word;
+}
+
+/* Parses one rule from the words in line. Returns NULL if it's no good. */
+static struct policy_rule *parse_rule(long nr, char *line)
+{
+	struct policy_rule *r = calloc(1, sizeof(*r));
+	char *word = next_word(&line);
+
+	if (!r)
+		return NULL;
+	if (word && strcmp(word, "under") == 0) {
+		if (nr < 0 || path_arg(nr) < 0)
+			goto bad;
+		while ((word = next_word(&line)) && word[0] == '/') {
+			if (r->nprefixes == POLICY_MAX_PREFIXES)
+				goto bad;
+			r->prefixes[r->nprefixes++] = strdup(word);
+		}
+		if (!r->nprefixes)
+			goto bad;
+	}
+	if (!word)
+		goto bad;
+
+	char *arg = next_word(&line);
+	if (strcmp(word, "allow") == 0 && !arg) {
+		r->action = POLICY_ALLOW;
+	} else if (strcmp(word, "continue") == 0 && !arg) {
+		r->action = POLICY_CONTINUE;
+	} else if (strcmp(word, "errno") == 0 && arg && (r->err = errno_value(arg)) > 0) {
+		r->action = POLICY_ERRNO;
+		arg = NULL;
+	} else if (strcmp(word, "emulate") == 0 && !arg && nr >= 0 && emulations[nr]) {
+		r->action = POLICY_EMULATE;
+	} else if (strcmp(word, "addfd") == 0 && !arg && nr >= 0 && opens(nr)) {
+		r->action = POLICY_ADDFD;
+	} else if (strcmp(word, "vtime") == 0 && !arg && nr >= 0 && vtime_covers(nr)) {
+		r->action = POLICY_VTIME;
+	} else {
+		goto bad;
+	}
+	if (arg || next_word(&line))
+		goto bad;
+	return r;
+
+bad:
+	for (int i = 0; i < r->nprefixes; ++i)
+		free(r->prefixes[i]);
+	free(r);
+	return NULL;
+}
+
+struct policy *policy_parse(const char *text)
+{
+	struct policy *policy = calloc(1, sizeof(*policy));
+	struct policy_rule **tails[POLICY_NR + 1];
+	char *copy = strdup(text), *line = copy;
+	int lineno = 0;
+
+	if (!policy || !copy)
+		goto fail;
+	for (int i = 0; i < POLICY_NR; ++i)
+		tails[i] = &policy->rules[i];
+	tails[POLICY_NR] = &policy->default_rules;
+
+	while (line) {
+		++lineno;
+		char *next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
+		char *comment = strchr(line, '#');
+		if (comment)
+			*comment = '\0';
+
+		char *p = line;
+		char *name = next_word(&p);
+		line = next;
+		if (!name)
+			continue;
+
+		long nr = strcmp(name, "default") == 0 ? -1 : syscall_nr(name);
+		struct policy_rule *r = nr == -1 && strcmp(name, "default") != 0 ?
+			NULL : parse_rule(nr, p);
+		if (!r) {
+			fprintf(stderr, "user-trap: bad policy rule on line %d\n", lineno);
+			goto fail;
+		}
+		int i = nr < 0 ? POLICY_NR : nr;
+		policy->uses_vtime |= r->action == POLICY_VTIME;
+		*tails[i] = r;
+		tails[i] = &r->next;
+	}
+	free(copy);
+	return policy;
+
+fail:
+	/* We're about to exit; leave the rules to that. */
+	free(copy);
+	free(policy);
+	return NULL;
+}
+
+struct policy *policy_load(const char *path)
+{
+	static char text[1 << 16];
+	FILE *f = fopen(path, "r");
+
+	if (!f) {
+		perror(path);
+		return NULL;
+	}
+	size_t len = fread(text, 1, sizeof(text) - 1, f);
+	fclose(f);
+	text[len] = '\0';
+	return policy_parse(text);
+}
+
+/* What the filter does with nr. */
+static uint32_t filter_action(const struct policy *policy, int nr)
+{
+	const struct policy_rule *r = nr < POLICY_NR && policy->rules[nr] ?
+		policy->rules[nr] : policy->default_rules;
+
+	if (!r)
+		return SECCOMP_RET_ALLOW;
+	if (r->nprefixes)
+		return SECCOMP_RET_USER_NOTIF;
+	switch (r->action) {
+	case POLICY_ALLOW:
+		return SECCOMP_RET_ALLOW;
+	case POLICY_ERRNO:
+		return SECCOMP_RET_ERRNO | r->err;
+	default:
+		return SECCOMP_RET_USER_NOTIF;
+	}
+}
+
+int policy_install(void *arg)
+{
+	const struct policy *policy = arg;
+	static uint32_t actions[POLICY_NR];
+	static struct bpftree_run runs[POLICY_NR + 1];
+	static struct bpftree tree;
+
+	for (int nr = 0; nr < POLICY_NR; ++nr)
+		actions[nr] = filter_action(policy, nr);
+	int nruns = bpftree_runs(actions, POLICY_NR, filter_action(policy, POLICY_NR), runs);
+	if (bpftree_compile(&tree, runs, nruns) != 0) {
+		errno = E2BIG;
+		return -1;
+	}
+
+	struct sock_fprog prog = {
+		.len = (unsigned short)tree.len,
+		.filter = tree.insns,
+	};
+	return syscall(__NR_seccomp, SECCOMP_SET_MODE_FILTER,
+		       SECCOMP_FILTER_FLAG_NEW_LISTENER, &prog);
+}
+
+/* The index of the prefix of r that path is under, or -1. */
+static int under(const char *path, const struct policy_rule *r)
+{
+	if (path[0] != '/' || strstr(path, "/../") ||
+	    (strlen(path) >= 3 && strcmp(path + strlen(path) - 3, "/..") == 0))
+		return -1;
+	for (int i = 0; i < r->nprefixes; ++i) {
+		const char *prefix = r->prefixes[i];
+		size_t len = strlen(prefix);
+		if (strncmp(path, prefix, len) == 0 &&
+		    (prefix[len - 1] == '/' || path[len] == '\0' || path[len] == '/'))
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * Reads the path argument. NULL, with resp's error set, if we can't, or the
+ * task has gone.
+ */
+static const char *read_path(struct supervisor_worker *w, struct tracee *t,
+			     struct seccomp_notif *req,
+			     struct seccomp_notif_resp *resp)
+{
+	struct mem_batch *mem = w->mem;
+
+	mem_batch_init(mem, req->pid, &t->regions);
+	int p = mem_batch_add_string(mem, req->data.args[path_arg(req->data.nr)], PATH_MAX);
+	int err = mem_batch_read(mem);
+	if (err) {
+		resp->error = -err;
+		return NULL;
+	}
+
+	/*
+	 * Now we avoid a TOCTOU: we referred to a pid by its pid, but since
+	 * the pid that made the syscall may have died, we need to confirm that
+	 * the pid is still valid after we read its memory. We can ask the
+	 * listener fd this as follows.
+	 *
+	 * Note that this check should occur *after* any task-specific
+	 * resources are opened, to make sure that the task has not died and
+	 * we're not wrongly reading someone else's state in order to make
+	 * decisions.
+	 */
+	if (ioctl(t->listener, SECCOMP_IOCTL_NOTIF_ID_VALID, &req->id) < 0) {
+		resp->error = -ESRCH;
+		return NULL;
+	}
+	return mem->reads[p].data;
+}
+
+/* The tracee's umask, from /proc, or -errno. */
+static int tracee_umask(pid_t pid)
+{
+	char proc[64], buf[1024];
+
+	snprintf(proc, sizeof(proc), "/proc/%d/status", pid);
+	int fd = open(proc, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	ssize_t len = read(fd, buf, sizeof(buf) - 1);
+	int err = errno;
+	close(fd);
+	if (len < 0)
+		return -err;
+	buf[len] = '\0';
+	/* Umask is the second line, well within buf. */
+	const char *line = strstr(buf, "\nUmask:");
+	if (!line)
+		return -ENOSYS;
+	return strtol(line + strlen("\nUmask:"), NULL, 8) & 0777;
+}
+
+/*
+ * Creates files with the tracee's umask rather than ours. The umask belongs to
+ * the fs_struct, which threads share, so each worker takes a copy of its own
+ * the first time.
+ */
+static int set_umask(pid_t pid)
+{
+	static __thread bool unshared;
+	int mask = tracee_umask(pid);
+
+	if (mask < 0)
+		return mask;
+	if (!unshared) {
+		if (unshare(CLONE_FS) != 0)
+			return -errno;
+		unshared = true;
+	}
+	umask(mask);
+	return 0;
+}
+
+/*
+ * For addfd: opens path as the tracee asked. If prefix is set (the `under`
+ * prefix that path matched), beneath it; otherwise relative to the tracee's
+ * cwd or dirfd.
+ */
+static int open_for(struct tracee *t, struct seccomp_notif *req, const char *path,
+		    const char *prefix)
+{
+	const __u64 *args = req->data.args;
+	int dirfd = AT_FDCWD, flags, mode, fd;
+	char proc[64];
+
+	switch (req->data.nr) {
+	case __NR_open:
+		flags = args[1];
+		mode = args[2];
+		break;
+	case __NR_creat:
+		flags = O_CREAT | O_WRONLY | O_TRUNC;
+		mode = args[1];
+		break;
+	default:
+		flags = args[2];
+		mode = args[3];
+		break;
+	}
+	if ((flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE) {
+		int err = set_umask(req->pid);
+		if (err)
+			return err;
+		/* That read /proc by pid; make sure it was still the tracee's. */
+		if (ioctl(t->listener, SECCOMP_IOCTL_NOTIF_ID_VALID, &req->id) < 0)
+			return -ESRCH;
+	} else {
+		/* The kernel rejects a mode without O_CREAT or O_TMPFILE. */
+		mode = 0;
+	}
+
+	if (prefix) {
+		const char *rel = path + strlen(prefix);
+		while (*rel == '/')
+			++rel;
+		dirfd = open(prefix, O_PATH | O_DIRECTORY | O_CLOEXEC);
+		if (dirfd < 0)
+			return -errno;
+		struct open_how how = {
+			.flags = (flags & ~O_CLOEXEC) | O_CLOEXEC,
+			.mode = mode,
+			.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS,
+		};
+		fd = syscall(__NR_openat2, dirfd, *rel ? rel : ".", &how, sizeof(how));
+	} else {
+		if (path[0] != '/') {
+			if (req->data.nr == __NR_openat && (int)args[0] != AT_FDCWD)
+				snprintf(proc, sizeof(proc), "/proc/%d/fd/%d", req->pid,
+					 (int)args[0]);
+			else
+				snprintf(proc, sizeof(proc), "/proc/%d/cwd", req->pid);
+			dirfd = open(proc, O_PATH | O_CLOEXEC);
+			if (dirfd < 0)
+				return -errno;
+		}
+		fd = openat(dirfd, path, flags | O_CLOEXEC, mode);
+	}
+	if (fd < 0)
+		fd = -errno;
+	if (dirfd != AT_FDCWD)
+		close(dirfd);
+	return fd;
+}
+
+static int addfd(struct tracee *t, struct seccomp_notif *req,
+		 struct seccomp_notif_resp *resp, const char *path, const char *prefix)
+{
+	int fd = open_for(t, req, path, prefix);
+	if (fd < 0) {
+		resp->error = fd;
+		return SUPERVISOR_RESPOND;
+	}
+
+	/* Installs the fd and answers the syscall with its number, in one go. */
+	const __u64 *args = req->data.args;
+	int flags = req->data.nr == __NR_open ? args[1] : req->data.nr == __NR_openat ? args[2] : 0;
+	struct seccomp_notif_addfd add = {
+		.id = req->id,
+		.flags = SECCOMP_ADDFD_FLAG_SEND,
+		.srcfd = fd,
+		.newfd_flags = flags & O_CLOEXEC,
+	};
+	int rv = ioctl(t->listener, SECCOMP_IOCTL_NOTIF_ADDFD, &add);
+	int err = errno;
+	close(fd);
+	if (rv >= 0 || err == ENOENT)
+		return SUPERVISOR_RESPONDED;
+	resp->error = -err;
+	return SUPERVISOR_RESPOND;
+}
+
+/* Applies r. prefix is the one of r's that path matched, if any. */
+static int apply(const struct policy *policy, const struct policy_rule *r,
+		 struct supervisor_worker *w, struct tracee *t,
+		 struct seccomp_notif *req, struct seccomp_notif_resp *resp,
+		 const char *path, const char *prefix)
+{
+	switch (r->action) {
+	case POLICY_ALLOW:
+	case POLICY_CONTINUE:
+		resp->flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+		return SUPERVISOR_RESPOND;
+	case POLICY_ERRNO:
+		resp->error = -r->err;
+		return SUPERVISOR_RESPOND;
+	case POLICY_EMULATE:
+		emulations[req->data.nr](t, req, resp);
+		return SUPERVISOR_RESPOND;
+	case POLICY_ADDFD:
+		return addfd(t, req, resp, path, prefix);
+	case POLICY_VTIME:
+		return vtime_handle(policy->vtime, w, t, req, resp);
+	}
+	return SUPERVISOR_RESPOND;
+}
+
+int policy_handle(struct supervisor_worker *w, struct tracee *t,
+		  struct seccomp_notif *req, struct seccomp_notif_resp *resp)
+{
+	const struct policy *policy = supervisor_data(w->sv);
+	int nr = req->data.nr;
+	const struct policy_rule *lists[] = {
+		nr >= 0 && nr < POLICY_NR ? policy->rules[nr] : NULL,
+		policy->default_rules,
+	};
+	const char *path = NULL;
+	bool read = false;
+
+	for (int i = 0; i < 2; ++i) {
+		for (const struct policy_rule *r = lists[i]; r; r = r->next) {
+			int match = -1;
+
+			if (r->nprefixes || r->action == POLICY_ADDFD) {
+				if (!read) {
+					path = read_path(w, t, req, resp);
+					read = true;
+				}
+				if (!path)
+					return SUPERVISOR_RESPOND;
+				if (r->nprefixes && (match = under(path, r)) < 0)
+					continue;
+			}
+			return apply(policy, r, w, t, req, resp, path,
+				     match >= 0 ? r->prefixes[match] : NULL);
+		}
+	}
+	/* Nothing applied. */
+	resp->flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+	return SUPERVISOR_RESPOND;
+}
@@ -0,0 +1,58 @@
+#ifndef POLICY_H
+#define POLICY_H
+
+#include "supervisor.h"
+#include "vtime.h"
+
+/*
+ * What user-trap does with each syscall, loaded from a file at startup. See
+ * policy.c for the format.
+ */
+
+#define POLICY_NR 512
+#define POLICY_MAX_PREFIXES 8
+
+enum policy_action {
+	/* Run it in the kernel. Not even trapped, unless a condition needs checking. */
+	POLICY_ALLOW,
+	/* Trap it, then let the kernel run it (SECCOMP_USER_NOTIF_FLAG_CONTINUE). */
+	POLICY_CONTINUE,
+	POLICY_ERRNO,
+	/* Answer it ourselves; see emulations in policy.c. */
+	POLICY_EMULATE,
+	/* Open the path ourselves and give the tracee the fd (SECCOMP_IOCTL_NOTIF_ADDFD). */
+	POLICY_ADDFD,
+	/* Sleep, or time out, in virtual time; see vtime.h. */
+	POLICY_VTIME,
+};
+
+struct policy_rule {
+	struct policy_rule *next;
+	enum policy_action action;
+	int err;
+	/* If any, the rule only applies to absolute paths under one of these. */
+	int nprefixes;
+	char *prefixes[POLICY_MAX_PREFIXES];
+};
+
+struct policy {
+	/* Tried in order; the first that applies wins. Then default_rules. */
+	struct policy_rule *rules[POLICY_NR];
+	struct policy_rule *default_rules;
+	/* Set if any rule is a vtime one, which needs this to be filled in. */
+	bool uses_vtime;
+	struct vtime *vtime;
+};
+
+/* Parses policy text. Prints what's wrong and returns NULL if it can't. */
+struct policy *policy_parse(const char *text);
+struct policy *policy_load(const char *path);
+
+/* For supervisor_fork: installs the policy's filter. arg is the policy. */
+int policy_install(void *arg);
+
+/* A supervisor_handler, for a supervisor whose data is the policy. */
+int policy_handle(struct supervisor_worker *w, struct tracee *t,
+		  struct seccomp_notif *req, struct seccomp_notif_resp *resp);
+
+#endif
@@ -0,0 +1,224 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+/*
+ * Threads that spend their time waiting, each a different way, for vtime.c to
+ * chew on. Each of the timer threads wakes every `period` * (its index + 1)
+ * ms, and says how late its wakeups were by its own clock. Natively that's
+ * scheduling noise, piling up over the iterations; in virtual time, nothing.
+ * Two more pairs check that a wait with a long timeout still ends early when
+ * it should: one waits on a condition variable (futex) and one polls a pipe,
+ * each for another thread that sleeps a bit and then wakes it.
+ *
+ * Usage: sleepers [-n iterations] [-p period ms]
+ *
+ * E.g., natively and then in virtual time:
+ *
+ *   time ./sleepers
+ *   time ./user-trap -p vtime.pol -c /dev/shm/vclock \
+ *       env LD_PRELOAD=../golang-seccomp/seccomp.so SHIM_POLICY=allow.pol ./sleepers
+ *
+ * where allow.pol says `default allow`, so that seccomp.so is only there to
+ * serve the clock.
+ */
+
+#define CHECK(x) { \
+	if (!(x)) {\
+		perror(#x);\
+		exit(EXIT_FAILURE);\
+	}\
+}
+
+enum kind { NANOSLEEP, CLOCK_NANOSLEEP_ABS, POLL, EPOLL_WAIT, COND_TIMEDWAIT, NKINDS };
+static const char *kind_names[] = {
+	"nanosleep", "clock_nanosleep_abs", "poll", "epoll_wait", "cond_timedwait",
+};
+
+static int iters = 10;
+static long period_ms = 10;
+static uint64_t start;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct timespec ns_timespec(uint64_t ns)
+{
+	return (struct timespec){.tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000};
+}
+
+struct timer {
+	enum kind kind;
+	uint64_t period;
+	uint64_t max_late;
+	pthread_t thread;
+};
+
+static void *timer_main(void *arg)
+{
+	struct timer *tm = arg;
+	int epfd = epoll_create1(0);
+	pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+	pthread_cond_t cond;
+	pthread_condattr_t attr;
+	struct epoll_event ev;
+
+	CHECK(epfd >= 0);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&cond, &attr);
+
+	for (int i = 1; i <= iters; ++i) {
+		uint64_t due = start + i * tm->period;
+		uint64_t left = due - now_ns();
+		struct timespec ts;
+
+		/* Relative ones from now, which is where the lateness piles up. */
+		if ((int64_t)left < 0)
+			left = 0;
+		switch (tm->kind) {
+		case NANOSLEEP:
+			ts = ns_timespec(left);
+			nanosleep(&ts, NULL);
+			break;
+		case CLOCK_NANOSLEEP_ABS:
+			ts = ns_timespec(due);
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+			break;
+		case POLL:
+			poll(NULL, 0, (left + 999999) / 1000000);
+			break;
+		case EPOLL_WAIT:
+			epoll_wait(epfd, &ev, 1, (left + 999999) / 1000000);
+			break;
+		case COND_TIMEDWAIT:
+			ts = ns_timespec(due);
+			pthread_mutex_lock(&mu);
+			while (pthread_cond_timedwait(&cond, &mu, &ts) != ETIMEDOUT)
+				;
+			pthread_mutex_unlock(&mu);
+			break;
+		default:
+			break;
+		}
+		uint64_t late = now_ns() - due;
+		if ((int64_t)late > (int64_t)tm->max_late)
+			tm->max_late = late;
+	}
+	close(epfd);
+	return NULL;
+}
+
+/* A wait with a long timeout, and a sleeper that ends it early. */
+static pthread_mutex_t pair_mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pair_cond;
+static int signalled;
+static int pipefd[2];
+/* How many of the waits ended early, as they should have. */
+static int cond_early, poll_early;
+
+static void *cond_waiter(void *arg)
+{
+	for (int i = 0; i < iters; ++i) {
+		struct timespec ts = ns_timespec(now_ns() + 3600 * 1000000000ULL);
+		int rv = 0;
+		pthread_mutex_lock(&pair_mu);
+		while (!signalled && rv != ETIMEDOUT)
+			rv = pthread_cond_timedwait(&pair_cond, &pair_mu, &ts);
+		cond_early += signalled;
+		signalled = 0;
+		pthread_mutex_unlock(&pair_mu);
+	}
+	return NULL;
+}
+
+static void *poll_waiter(void *arg)
+{
+	char c;
+
+	for (int i = 0; i < iters; ++i) {
+		struct pollfd p = {.fd = pipefd[0], .events = POLLIN};
+		if (poll(&p, 1, 3600 * 1000) == 1 && read(pipefd[0], &c, 1) == 1)
+			poll_early++;
+	}
+	return NULL;
+}
+
+static void *waker(void *arg)
+{
+	struct timespec ts = ns_timespec(period_ms * 1000000);
+
+	for (int i = 0; i < iters; ++i) {
+		nanosleep(&ts, NULL);
+		pthread_mutex_lock(&pair_mu);
+		signalled = 1;
+		pthread_cond_signal(&pair_cond);
+		pthread_mutex_unlock(&pair_mu);
+		CHECK(write(pipefd[1], "x", 1) == 1);
+		/* Let them both get there before the next round. */
+		while (1) {
+			pthread_mutex_lock(&pair_mu);
+			int s = signalled;
+			pthread_mutex_unlock(&pair_mu);
+			if (!s)
+				break;
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	struct timer timers[NKINDS];
+	pthread_t pair[3];
+	pthread_condattr_t attr;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:p:")) != -1) {
+		switch (opt) {
+		case 'n': iters = atoi(optarg); break;
+		case 'p': period_ms = atol(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-n iterations] [-p period ms]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&pair_cond, &attr);
+	CHECK(pipe(pipefd) == 0);
+
+	start = now_ns();
+	for (int k = 0; k < NKINDS; ++k) {
+		timers[k] = (struct timer){.kind = k, .period = (k + 1) * period_ms * 1000000};
+		CHECK(pthread_create(&timers[k].thread, NULL, timer_main, &timers[k]) == 0);
+	}
+	CHECK(pthread_create(&pair[0], NULL, cond_waiter, NULL) == 0);
+	CHECK(pthread_create(&pair[1], NULL, poll_waiter, NULL) == 0);
+	CHECK(pthread_create(&pair[2], NULL, waker, NULL) == 0);
+
+	for (int k = 0; k < NKINDS; ++k) {
+		pthread_join(timers[k].thread, NULL);
+		printf("kind=%s period_ms=%lu max_late_us=%.1f\n", kind_names[k],
+		       (unsigned long)(timers[k].period / 1000000), timers[k].max_late / 1e3);
+	}
+	for (int i = 0; i < 3; ++i)
+		pthread_join(pair[i], NULL);
+	printf("cond_woken=%d/%d poll_ready=%d/%d elapsed_ms=%.3f\n", cond_early, iters,
+	       poll_early, iters, (now_ns() - start) / 1e6);
+	return 0;
+}
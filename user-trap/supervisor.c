@@ -0,0 +1,409 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/futex.h>
+
+#include "supervisor.h"
+
+struct tracee_node {
+	struct tracee t;
+	struct tracee_node *prev, *next;
+};
+
+struct supervisor {
+	int epfd;
+	/* Readable once we're stopping; registered with a NULL ptr. */
+	int stopfd;
+	supervisor_handler handle;
+	void *data;
+	struct seccomp_notif_sizes sizes;
+
+	int nworkers;
+	/* Workers between getting an event and re-arming its listener. */
+	int busy;
+	pthread_t *threads;
+	struct supervisor_worker *workers;
+
+	pthread_mutex_t lock;
+	pthread_cond_t drained;
+	struct tracee_node *tracees;
+	int ntracees;
+};
+
+static int arm(struct supervisor *sv, struct tracee *t, int op)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN | EPOLLONESHOT,
+		.data.ptr = t,
+	};
+
+	if (epoll_ctl(sv->epfd, op, t->listener, &ev) < 0) {
+		perror("epoll_ctl");
+		return -1;
+	}
+	return 0;
+}
+
+static void remove_tracee(struct supervisor *sv, struct tracee *t)
+{
+	struct tracee_node *node = (struct tracee_node *)t;
+
+	epoll_ctl(sv->epfd, EPOLL_CTL_DEL, t->listener, NULL);
+	close(t->listener);
+	mem_regions_free(&t->regions);
+
+	pthread_mutex_lock(&sv->lock);
+	if (node->prev)
+		node->prev->next = node->next;
+	else
+		sv->tracees = node->next;
+	if (node->next)
+		node->next->prev = node->prev;
+	if (--sv->ntracees == 0)
+		pthread_cond_broadcast(&sv->drained);
+	pthread_mutex_unlock(&sv->lock);
+
+	free(node);
+}
+
+/* Receives, handles and responds to one notification from t. */
+static void handle_one(struct supervisor_worker *w, struct tracee *t)
+{
+	struct supervisor *sv = w->sv;
+	struct seccomp_notif *req = w->req;
+	struct seccomp_notif_resp *resp = w->resp;
+
+	memset(req, 0, sv->sizes.seccomp_notif);
+	if (ioctl(t->listener, SECCOMP_IOCTL_NOTIF_RECV, req) < 0) {
+		/*
+		 * ENOENT means the notification went away (the task got a
+		 * signal) between epoll telling us about it and now.
+		 */
+		if (errno != ENOENT && errno != EINTR)
+			perror("ioctl recv");
+		return;
+	}
+
+	memset(resp, 0, sv->sizes.seccomp_notif_resp);
+	resp->id = req->id;
+	switch (sv->handle(w, t, req, resp)) {
+	case SUPERVISOR_DEFERRED:
+		return;
+	case SUPERVISOR_RESPONDED:
+		__atomic_fetch_add(&w->handled, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	/*
+	 * ENOENT here means that the task may have gotten a signal and
+	 * restarted the syscall. It's up to the handler to decide what to do
+	 * in this case, but for now we just ignore it.
+	 */
+	if (ioctl(t->listener, SECCOMP_IOCTL_NOTIF_SEND, resp) < 0 &&
+	    errno != ENOENT)
+		perror("ioctl send");
+	__atomic_fetch_add(&w->handled, 1, __ATOMIC_RELAXED);
+}
+
+static void *worker_main(void *arg)
+{
+	struct supervisor_worker *w = arg;
+	struct supervisor *sv = w->sv;
+	struct epoll_event ev;
+
+	while (1) {
+		/*
+		 * One event at a time, so that a worker never sits on ready
+		 * tracees that an idle worker could be handling.
+		 */
+		int n = epoll_wait(sv->epfd, &ev, 1, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			break;
+		}
+		if (n == 0)
+			continue;
+
+		struct tracee *t = ev.data.ptr;
+		if (!t)
+			break;
+		__atomic_fetch_add(&sv->busy, 1, __ATOMIC_ACQ_REL);
+		/*
+		 * Hung up: nothing uses the filter any more, so nothing can be
+		 * waiting on it either.
+		 */
+		if (ev.events & (EPOLLHUP | EPOLLERR)) {
+			remove_tracee(sv, t);
+		} else {
+			handle_one(w, t);
+			arm(sv, t, EPOLL_CTL_MOD);
+		}
+		__atomic_fetch_sub(&sv->busy, 1, __ATOMIC_ACQ_REL);
+	}
+	return NULL;
+}
+
+struct supervisor *supervisor_new(int nworkers, supervisor_handler handle, void *data)
+{
+	struct supervisor *sv = calloc(1, sizeof(*sv));
+	if (!sv)
+		return NULL;
+
+	sv->handle = handle;
+	sv->data = data;
+	pthread_mutex_init(&sv->lock, NULL);
+	pthread_cond_init(&sv->drained, NULL);
+	if (syscall(__NR_seccomp, SECCOMP_GET_NOTIF_SIZES, 0, &sv->sizes) < 0) {
+		perror("seccomp(GET_NOTIF_SIZES)");
+		goto out_free;
+	}
+
+	sv->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (sv->epfd < 0) {
+		perror("epoll_create1");
+		goto out_free;
+	}
+	sv->stopfd = eventfd(0, EFD_CLOEXEC);
+	if (sv->stopfd < 0) {
+		perror("eventfd");
+		goto out_epoll;
+	}
+	struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+	if (epoll_ctl(sv->epfd, EPOLL_CTL_ADD, sv->stopfd, &ev) < 0) {
+		perror("epoll_ctl");
+		goto out_stop;
+	}
+
+	sv->threads = calloc(nworkers, sizeof(*sv->threads));
+	sv->workers = calloc(nworkers, sizeof(*sv->workers));
+	if (!sv->threads || !sv->workers)
+		goto out_stop;
+	for (int i = 0; i < nworkers; ++i) {
+		struct supervisor_worker *w = &sv->workers[i];
+		w->sv = sv;
+		w->id = i;
+		w->req = malloc(sv->sizes.seccomp_notif);
+		w->resp = malloc(sv->sizes.seccomp_notif_resp);
+		w->mem = malloc(sizeof(*w->mem));
+		if (!w->req || !w->resp || !w->mem ||
+		    pthread_create(&sv->threads[i], NULL, worker_main, w) != 0) {
+			perror("starting worker");
+			free(w->req);
+			free(w->resp);
+			free(w->mem);
+			break;
+		}
+		sv->nworkers++;
+	}
+	if (sv->nworkers == nworkers)
+		return sv;
+
+	supervisor_free(sv);
+	return NULL;
+
+out_stop:
+	free(sv->threads);
+	free(sv->workers);
+	close(sv->stopfd);
+out_epoll:
+	close(sv->epfd);
+out_free:
+	free(sv);
+	return NULL;
+}
+
+void *supervisor_data(struct supervisor *sv)
+{
+	return sv->data;
+}
+
+struct tracee *supervisor_add(struct supervisor *sv, int listener, pid_t pid)
+{
+	struct tracee_node *node = calloc(1, sizeof(*node));
+	if (!node) {
+		close(listener);
+		return NULL;
+	}
+	node->t.listener = listener;
+	node->t.pid = pid;
+
+	pthread_mutex_lock(&sv->lock);
+	node->next = sv->tracees;
+	if (node->next)
+		node->next->prev = node;
+	sv->tracees = node;
+	sv->ntracees++;
+	pthread_mutex_unlock(&sv->lock);
+
+	/* Once it's armed a worker can have it, and even free it. */
+	if (arm(sv, &node->t, EPOLL_CTL_ADD) < 0) {
+		remove_tracee(sv, &node->t);
+		return NULL;
+	}
+	return &node->t;
+}
+
+/* Passes the listener from a new tracee to us. In memory both can see. */
+struct handover {
+	/* The listener's fd number in the child plus one, or -1 if it failed. */
+	int fd;
+	/* Set once we have our own copy, so the child can close its own. */
+	uint32_t done;
+};
+
+pid_t supervisor_fork(struct supervisor *sv, int (*install_filter)(void *), void *arg)
+{
+	struct handover *h;
+	int listener = -1;
+	pid_t pid;
+
+	h = mmap(NULL, sizeof(*h), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (h == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+
+	/* Or the child gets a copy of whatever's buffered, and prints it too. */
+	fflush(NULL);
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		munmap(h, sizeof(*h));
+		return -1;
+	}
+
+	if (pid == 0) {
+		if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0) {
+			perror("prctl PR_SET_NO_NEW_PRIVS");
+			_exit(1);
+		}
+		listener = install_filter(arg);
+		if (listener < 0) {
+			perror("seccomp");
+			__atomic_store_n(&h->fd, -1, __ATOMIC_RELEASE);
+			_exit(1);
+		}
+		/*
+		 * From here on our syscalls may be waiting for the parent, which
+		 * is fine: it's watching h, not waiting on us.
+		 */
+		__atomic_store_n(&h->fd, listener + 1, __ATOMIC_RELEASE);
+		while (!__atomic_load_n(&h->done, __ATOMIC_ACQUIRE))
+			syscall(__NR_futex, &h->done, FUTEX_WAIT, 0, NULL, NULL, 0);
+		close(listener);
+		munmap(h, sizeof(*h));
+		return 0;
+	}
+
+	/* Poll, since the child's wakeups might be trapped. */
+	const struct timespec poll = {.tv_nsec = 100 * 1000};
+	int fd;
+	while (!(fd = __atomic_load_n(&h->fd, __ATOMIC_ACQUIRE))) {
+		siginfo_t info = {0};
+		if (waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid)
+			break;
+		nanosleep(&poll, NULL);
+	}
+	if (fd > 0) {
+		int pidfd = syscall(__NR_pidfd_open, pid, 0);
+		if (pidfd >= 0) {
+			listener = syscall(__NR_pidfd_getfd, pidfd, fd - 1, 0);
+			close(pidfd);
+		}
+		if (listener < 0)
+			perror("getting listener");
+	}
+	__atomic_store_n(&h->done, 1, __ATOMIC_RELEASE);
+	syscall(__NR_futex, &h->done, FUTEX_WAKE, 1, NULL, NULL, 0);
+	munmap(h, sizeof(*h));
+
+	if (listener < 0 || !supervisor_add(sv, listener, pid)) {
+		kill(pid, SIGKILL);
+		return -1;
+	}
+	return pid;
+}
+
+void supervisor_drain(struct supervisor *sv)
+{
+	pthread_mutex_lock(&sv->lock);
+	while (sv->ntracees > 0)
+		pthread_cond_wait(&sv->drained, &sv->lock);
+	pthread_mutex_unlock(&sv->lock);
+}
+
+int supervisor_idle(struct supervisor *sv)
+{
+	int idle = 1;
+
+	if (__atomic_load_n(&sv->busy, __ATOMIC_ACQUIRE))
+		return 0;
+	pthread_mutex_lock(&sv->lock);
+	for (struct tracee_node *node = sv->tracees; node && idle; node = node->next) {
+		/* Doesn't take the notification, or disturb the workers' epoll. */
+		struct pollfd p = {.fd = node->t.listener, .events = POLLIN};
+		if (poll(&p, 1, 0) > 0 && (p.revents & POLLIN))
+			idle = 0;
+	}
+	pthread_mutex_unlock(&sv->lock);
+	/* It might have picked one up while we were looking. */
+	return idle && !__atomic_load_n(&sv->busy, __ATOMIC_ACQUIRE);
+}
+
+int supervisor_pids(struct supervisor *sv, pid_t *pids, int max)
+{
+	int n = 0;
+
+	pthread_mutex_lock(&sv->lock);
+	for (struct tracee_node *node = sv->tracees; node; node = node->next) {
+		if (n < max)
+			pids[n] = node->t.pid;
+		++n;
+	}
+	pthread_mutex_unlock(&sv->lock);
+	return n;
+}
+
+uint64_t supervisor_handled(struct supervisor *sv)
+{
+	uint64_t n = 0;
+
+	for (int i = 0; i < sv->nworkers; ++i)
+		n += __atomic_load_n(&sv->workers[i].handled, __ATOMIC_RELAXED);
+	return n;
+}
+
+void supervisor_free(struct supervisor *sv)
+{
+	eventfd_write(sv->stopfd, 1);
+	for (int i = 0; i < sv->nworkers; ++i) {
+		pthread_join(sv->threads[i], NULL);
+		free(sv->workers[i].req);
+		free(sv->workers[i].resp);
+		free(sv->workers[i].mem);
+	}
+	while (sv->tracees)
+		remove_tracee(sv, &sv->tracees->t);
+	close(sv->stopfd);
+	close(sv->epfd);
+	free(sv->threads);
+	free(sv->workers);
+	free(sv);
+}
@@ -0,0 +1,105 @@
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include <linux/seccomp.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "mem.h"
+
+/*
+ * A seccomp user-notification supervisor for many tracees at once.
+ *
+ * Each tracee's listener fd goes into one epoll set, shared by a pool of
+ * worker threads. Listeners are registered EPOLLONESHOT: whichever worker
+ * wakes up for one receives a single notification, handles it, responds, and
+ * only then re-arms it. So a tracee's notifications are handled one at a
+ * time, in the order the kernel hands them out, while different tracees are
+ * handled in parallel by however many workers there are.
+ */
+
+struct supervisor;
+struct supervisor_worker;
+
+/* One listener fd, and everything (threads, children) that shares its filter. */
+struct tracee {
+	int listener;
+	/* The process supervisor_fork() started. */
+	pid_t pid;
+	/* Parts of its memory that we've mapped too; see mem.h. */
+	struct mem_regions regions;
+	/* For the handler. */
+	void *data;
+};
+
+/*
+ * Handles one notification. resp arrives with its id set, no error, no value
+ * and no flags. Returns SUPERVISOR_RESPOND to have resp sent to the kernel,
+ * SUPERVISOR_RESPONDED if the handler already answered (as
+ * SECCOMP_ADDFD_FLAG_SEND does), or SUPERVISOR_DEFERRED if it will answer
+ * later, from some other thread. Either way the tracee's next notification
+ * can be handled straight away.
+ */
+#define SUPERVISOR_RESPOND 0
+#define SUPERVISOR_RESPONDED 1
+#define SUPERVISOR_DEFERRED 2
+typedef int (*supervisor_handler)(struct supervisor_worker *w, struct tracee *t,
+				   struct seccomp_notif *req,
+				   struct seccomp_notif_resp *resp);
+
+struct supervisor_worker {
+	struct supervisor *sv;
+	int id;
+	/* Preallocated; only this worker ever touches them. */
+	struct seccomp_notif *req;
+	struct seccomp_notif_resp *resp;
+	/* For reading tracee memory. */
+	struct mem_batch *mem;
+	/* Notifications responded to. */
+	uint64_t handled;
+	/* For the handler. */
+	void *data;
+};
+
+struct supervisor *supervisor_new(int nworkers, supervisor_handler handle, void *data);
+
+/* The `data` passed to supervisor_new. */
+void *supervisor_data(struct supervisor *sv);
+
+/*
+ * Forks a tracee. The child calls install_filter(arg), which should install
+ * a filter with SECCOMP_FILTER_FLAG_NEW_LISTENER and return the listener,
+ * hands that to the parent, and then returns 0 like fork(). The parent starts
+ * supervising the listener and returns the child's pid, or -1.
+ *
+ * The filter can trap anything: the parent takes the listener with
+ * pidfd_getfd, so the child makes no syscalls that need answering before the
+ * parent's ready to answer them.
+ */
+pid_t supervisor_fork(struct supervisor *sv, int (*install_filter)(void *), void *arg);
+
+/* Supervises a listener that we already have. Takes ownership of it. */
+struct tracee *supervisor_add(struct supervisor *sv, int listener, pid_t pid);
+
+/*
+ * Waits until every listener has hung up, i.e. every process using it has
+ * exited and been reaped.
+ */
+void supervisor_drain(struct supervisor *sv);
+
+/*
+ * Whether we're caught up: no worker is handling a notification, and no
+ * listener has one waiting. Deferred ones don't count.
+ */
+int supervisor_idle(struct supervisor *sv);
+
+/* Fills in up to max tracees' pids. Returns how many there are. */
+int supervisor_pids(struct supervisor *sv, pid_t *pids, int max);
+
+/* Sum of the workers' `handled`. */
+uint64_t supervisor_handled(struct supervisor *sv);
+
+/* Stops the workers and frees everything, closing any listeners left. */
+void supervisor_free(struct supervisor *sv);
+
+#endif
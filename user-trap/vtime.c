@@ -0,0 +1,827 @@
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "../common/simclock.h"
+#include "vtime.h"
+
+#ifndef PIDFD_THREAD
+#define PIDFD_THREAD O_EXCL
+#endif
+
+/* Most fds a poll can have for us to hold on to it. */
+#define VTIME_MAX_FDS 16
+/* How long nothing has to happen for before we look at whether to jump. */
+#define VTIME_QUIET_NS (100 * 1000)
+
+#define NSEC 1000000000ULL
+
+/* A notification we haven't answered yet. */
+struct sleeper {
+	uint64_t deadline;
+	/* Ties go to whoever got here first. Never 0. */
+	uint64_t seq;
+	int pos;
+	/* Our own copy, so that it outlives the tracee struct. */
+	int listener;
+	__u64 id;
+	/* What the syscall fails with if the deadline comes first. */
+	int timeout_error;
+	/* Futex waits: the address a wake has to name. Only compared. */
+	const struct tracee *t;
+	uint64_t uaddr;
+	/* Poll and epoll: our copies of the fds being waited on. */
+	int nfds;
+	int fds[VTIME_MAX_FDS];
+};
+
+struct vtime {
+	struct supervisor *sv;
+	struct simclock *clock;
+
+	pthread_mutex_t lock;
+	/* Min-heap, by deadline then seq. */
+	struct sleeper **heap;
+	int n, cap;
+	uint64_t seq;
+	struct vtime_stats stats;
+
+	/* The sleepers' fds, by seq, and wakefd, with 0. */
+	int epfd;
+	int wakefd;
+	int stop;
+	pthread_t thread;
+};
+
+static uint64_t now(struct vtime *vt, int64_t *realtime_offset)
+{
+	return simclock_read(vt->clock, realtime_offset);
+}
+
+static uint64_t real_ns(clockid_t id)
+{
+	struct timespec ts;
+
+	clock_gettime(id, &ts);
+	return ts.tv_sec * NSEC + ts.tv_nsec;
+}
+
+/*
+ * Not needed for a stopped clock, but shimclock wants it to change the rate,
+ * and a page without one would be a trap for whoever tries.
+ */
+static uint64_t measure_tsc_mult(void)
+{
+	uint64_t ns0 = real_ns(CLOCK_MONOTONIC), tsc0 = __rdtsc();
+	usleep(10 * 1000);
+	uint64_t ns1 = real_ns(CLOCK_MONOTONIC), tsc1 = __rdtsc();
+	return ((unsigned __int128)(ns1 - ns0) << 32) / (tsc1 - tsc0);
+}
+
+static struct simclock *map_clock(const char *path)
+{
+	struct simclock *c;
+	int fd = -1;
+
+	if (path) {
+		fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+		if (fd < 0 || ftruncate(fd, sizeof(*c)) < 0) {
+			perror(path);
+			if (fd >= 0)
+				close(fd);
+			return NULL;
+		}
+	}
+	c = mmap(NULL, sizeof(*c), PROT_READ | PROT_WRITE,
+		 MAP_SHARED | (path ? 0 : MAP_ANONYMOUS), fd, 0);
+	if (fd >= 0)
+		close(fd);
+	if (c == MAP_FAILED) {
+		perror("mmap clock");
+		return NULL;
+	}
+
+	/* Stopped (mult 0), at the real time. Only jumps move it. */
+	uint64_t tsc_mult = measure_tsc_mult();
+	simclock_write_begin(c);
+	c->version = SIMCLOCK_VERSION;
+	c->tsc_mult = tsc_mult;
+	c->mult = 0;
+	c->base_tsc = __rdtsc();
+	c->base_ns = real_ns(CLOCK_MONOTONIC);
+	c->realtime_offset_ns = real_ns(CLOCK_REALTIME) - c->base_ns;
+	simclock_write_end(c);
+	__atomic_store_n(&c->magic, SIMCLOCK_MAGIC, __ATOMIC_RELEASE);
+	return c;
+}
+
+static int before(const struct sleeper *a, const struct sleeper *b)
+{
+	return a->deadline < b->deadline || (a->deadline == b->deadline && a->seq < b->seq);
+}
+
+static void heap_set(struct vtime *vt, int i, struct sleeper *s)
+{
+	vt->heap[i] = s;
+	s->pos = i;
+}
+
+static void sift_up(struct vtime *vt, int i)
+{
+	struct sleeper *s = vt->heap[i];
+
+	while (i > 0 && before(s, vt->heap[(i - 1) / 2])) {
+		heap_set(vt, i, vt->heap[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+	heap_set(vt, i, s);
+}
+
+static void sift_down(struct vtime *vt, int i)
+{
+	struct sleeper *s = vt->heap[i];
+
+	while (2 * i + 1 < vt->n) {
+		int c = 2 * i + 1;
+		if (c + 1 < vt->n && before(vt->heap[c + 1], vt->heap[c]))
+			++c;
+		if (!before(vt->heap[c], s))
+			break;
+		heap_set(vt, i, vt->heap[c]);
+		i = c;
+	}
+	heap_set(vt, i, s);
+}
+
+static int heap_push(struct vtime *vt, struct sleeper *s)
+{
+	if (vt->n == vt->cap) {
+		int cap = vt->cap ? 2 * vt->cap : 64;
+		struct sleeper **heap = realloc(vt->heap, cap * sizeof(*heap));
+		if (!heap)
+			return -1;
+		vt->heap = heap;
+		vt->cap = cap;
+	}
+	s->seq = vt->seq++;
+	heap_set(vt, vt->n++, s);
+	sift_up(vt, s->pos);
+	return 0;
+}
+
+static void heap_remove(struct vtime *vt, struct sleeper *s)
+{
+	int i = s->pos;
+
+	if (--vt->n == i)
+		return;
+	heap_set(vt, i, vt->heap[vt->n]);
+	sift_down(vt, i);
+	sift_up(vt, vt->heap[i]->pos);
+}
+
+static struct sleeper *sleeper_new(struct tracee *t, struct seccomp_notif *req)
+{
+	struct sleeper *s = calloc(1, sizeof(*s));
+
+	if (!s)
+		return NULL;
+	s->listener = fcntl(t->listener, F_DUPFD_CLOEXEC, 0);
+	if (s->listener < 0) {
+		free(s);
+		return NULL;
+	}
+	s->id = req->id;
+	return s;
+}
+
+static void sleeper_free(struct vtime *vt, struct sleeper *s)
+{
+	for (int i = 0; i < s->nfds; ++i) {
+		/* Our copy shares the tracee's file, so closing it isn't enough. */
+		epoll_ctl(vt->epfd, EPOLL_CTL_DEL, s->fds[i], NULL);
+		close(s->fds[i]);
+	}
+	close(s->listener);
+	free(s);
+}
+
+/* Answers s, and forgets it. Called with the lock held, if s is in the heap. */
+static void finish(struct vtime *vt, struct sleeper *s, long val, int error, __u32 flags)
+{
+	struct seccomp_notif_resp resp = {
+		.id = s->id,
+		.val = val,
+		.error = error,
+		.flags = flags,
+	};
+
+	heap_remove(vt, s);
+	/* ENOENT: it got a signal while we had it, and has moved on. */
+	if (ioctl(s->listener, SECCOMP_IOCTL_NOTIF_SEND, &resp) < 0 && errno != ENOENT)
+		perror("ioctl send");
+	sleeper_free(vt, s);
+}
+
+static int valid(const struct sleeper *s)
+{
+	return ioctl(s->listener, SECCOMP_IOCTL_NOTIF_ID_VALID, &s->id) == 0;
+}
+
+/* Adds s, with the lock held. Pokes the clock thread if it might be asleep. */
+static int add(struct vtime *vt, struct sleeper *s)
+{
+	if (heap_push(vt, s) < 0)
+		return -1;
+	vt->stats.deferred++;
+	if (vt->n == 1)
+		eventfd_write(vt->wakefd, 1);
+	return 0;
+}
+
+/* A timespec's worth of ns; saturates rather than overflowing. */
+static uint64_t timespec_ns(const struct timespec *ts)
+{
+	if ((uint64_t)ts->tv_sec >= UINT64_MAX / NSEC - 1)
+		return UINT64_MAX / 2;
+	return ts->tv_sec * NSEC + ts->tv_nsec;
+}
+
+static int timespec_ok(const struct timespec *ts)
+{
+	return ts->tv_sec >= 0 && ts->tv_nsec >= 0 && ts->tv_nsec < (long)NSEC;
+}
+
+/* Reads a timespec argument. -1 if we can't, or it's not a valid one. */
+static int read_timespec(struct supervisor_worker *w, struct tracee *t,
+			 struct seccomp_notif *req, uint64_t addr, uint64_t *ns)
+{
+	struct mem_batch *mem = w->mem;
+
+	mem_batch_init(mem, req->pid, &t->regions);
+	int i = mem_batch_add(mem, addr, sizeof(struct timespec));
+	if (mem_batch_read(mem))
+		return -1;
+	const struct timespec *ts = mem->reads[i].data;
+	if (!timespec_ok(ts))
+		return -1;
+	*ns = timespec_ns(ts);
+	return 0;
+}
+
+/*
+ * Holds on to a sleep until deadline (absolute, on our clock), or answers it
+ * now if that's already gone. resp is for the latter.
+ */
+static int sleep_until(struct vtime *vt, struct tracee *t, struct seccomp_notif *req,
+		       struct seccomp_notif_resp *resp, uint64_t deadline)
+{
+	struct sleeper *s = sleeper_new(t, req);
+
+	if (!s) {
+		/* Better late than never. */
+		resp->flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+		return SUPERVISOR_RESPOND;
+	}
+	s->deadline = deadline;
+
+	pthread_mutex_lock(&vt->lock);
+	if (deadline > now(vt, NULL) && add(vt, s) == 0) {
+		pthread_mutex_unlock(&vt->lock);
+		return SUPERVISOR_DEFERRED;
+	}
+	pthread_mutex_unlock(&vt->lock);
+	sleeper_free(vt, s);
+	return SUPERVISOR_RESPOND;
+}
+
+static int do_clock_nanosleep(struct vtime *vt, struct supervisor_worker *w, struct tracee *t,
+			      struct seccomp_notif *req, struct seccomp_notif_resp *resp)
+{
+	const __u64 *args = req->data.args;
+	clockid_t id = args[0];
+	int64_t offset;
+	uint64_t ns;
+
+	if ((id != CLOCK_REALTIME && id != CLOCK_MONOTONIC && id != CLOCK_BOOTTIME) ||
+	    read_timespec(w, t, req, args[2], &ns) < 0) {
+		/* CPU-time clocks, and bad arguments: the kernel's business. */
+		resp->flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+		return SUPERVISOR_RESPOND;
+	}
+	uint64_t at = now(vt, &offset);
+	if (!(args[1] & TIMER_ABSTIME))
+		return sleep_until(vt, t, req, resp, at + ns);
+	if (id == CLOCK_REALTIME)
+		ns = (int64_t)ns > offset ? ns - offset : 0;
+	return sleep_until(vt, t, req, resp, ns);
+}
+
+/*
+ * Gets our own copies of the tracee's fds into s. -1 if any of them is one we
+ * can't watch (a regular file, say), or isn't an fd at all; either way it's
+ * "ready", and the kernel may as well have the syscall.
+ */
+static int get_fds(struct seccomp_notif *req, struct tracee *t, struct sleeper *s,
+		   const int *fds, int nfds)
+{
+	int pidfd = syscall(__NR_pidfd_open, req->pid, 0);
+
+	/*
+	 * Not a thread group leader (EINVAL, or ENOENT on newer kernels), but
+	 * the fd table's the same.
+	 */
+	if (pidfd < 0 && (errno == EINVAL || errno == ENOENT))
+		pidfd = syscall(__NR_pidfd_open, req->pid, PIDFD_THREAD);
+	if (pidfd < 0)
+		return -1;
+	for (int i = 0; i < nfds; ++i) {
+		int fd = syscall(__NR_pidfd_getfd, pidfd, fds[i], 0);
+		if (fd < 0)
+			break;
+		s->fds[s->nfds++] = fd;
+	}
+	close(pidfd);
+	/* As with read_path in policy.c: is that pid still who we think it is? */
+	if (s->nfds < nfds || ioctl(t->listener, SECCOMP_IOCTL_NOTIF_ID_VALID, &req->id) < 0)
+		return -1;
+	return 0;
+}
+
+/*
+ * Holds on to a poll or epoll_wait until deadline, or until one of its fds is
+ * ready, at which point the kernel gets it (and returns straight away).
+ * events[i] is what to wait for on fds[i].
+ */
+static int wait_fds(struct vtime *vt, struct tracee *t, struct seccomp_notif *req,
+		    struct seccomp_notif_resp *resp, uint64_t deadline,
+		    const int *fds, const short *events, int nfds)
+{
+	struct sleeper *s = sleeper_new(t, req);
+
+	resp->flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+	if (!s)
+		return SUPERVISOR_RESPOND;
+	if (nfds && get_fds(req, t, s, fds, nfds) < 0) {
+		sleeper_free(vt, s);
+		return SUPERVISOR_RESPOND;
+	}
+	s->deadline = deadline;
+
+	pthread_mutex_lock(&vt->lock);
+	if (add(vt, s) < 0) {
+		pthread_mutex_unlock(&vt->lock);
+		sleeper_free(vt, s);
+		return SUPERVISOR_RESPOND;
+	}
+	for (int i = 0; i < s->nfds; ++i) {
+		/*
+		 * Same bits as poll's, for the ones poll has. By seq, not
+		 * pointer: an event can be on its way to the clock thread
+		 * after s is gone.
+		 */
+		struct epoll_event ev = {
+			.events = (uint16_t)events[i],
+			.data.u64 = s->seq,
+		};
+		if (epoll_ctl(vt->epfd, EPOLL_CTL_ADD, s->fds[i], &ev) < 0) {
+			/* Regular files can't be watched: they're always ready. */
+			heap_remove(vt, s);
+			vt->stats.deferred--;
+			pthread_mutex_unlock(&vt->lock);
+			sleeper_free(vt, s);
+			return SUPERVISOR_RESPOND;
+		}
+	}
+	pthread_mutex_unlock(&vt->lock);
+	return SUPERVISOR_DEFERRED;
+}
+
+static int do_poll(struct vtime *vt, struct supervisor_worker *w, struct tracee *t,
+		   struct seccomp_notif *req, struct seccomp_notif_resp *resp)
+{
+	const __u64 *args = req->data.args;
+	struct mem_batch *mem = w->mem;
+	int nfds = args[1], fds[VTIME_MAX_FDS], n = 0;
+	short events[VTIME_MAX_FDS];
+	uint64_t ns;
+
+	resp->flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+	if (nfds < 0 || nfds > VTIME_MAX_FDS)
+		return SUPERVISOR_RESPOND;
+
+	/* Both at once, for ppoll. No fds at all is just a sleep. */
+	mem_batch_init(mem, req->pid, &t->regions);
+	int p = nfds ? mem_batch_add(mem, args[0], nfds * sizeof(struct pollfd)) : -1;
+	int ts = req->data.nr == __NR_ppoll && args[2] ?
+		mem_batch_add(mem, args[2], sizeof(struct timespec)) : -1;
+	if (mem_batch_read(mem))
+		return SUPERVISOR_RESPOND;
+	if (req->data.nr == __NR_poll) {
+		if ((int)args[2] <= 0)
+			return SUPERVISOR_RESPOND;
+		ns = (uint64_t)(int)args[2] * 1000000;
+	} else {
+		if (ts < 0 || !timespec_ok(mem->reads[ts].data))
+			return SUPERVISOR_RESPOND;
+		ns = timespec_ns(mem->reads[ts].data);
+		if (!ns)
+			return SUPERVISOR_RESPOND;
+	}
+
+	const struct pollfd *pfds = nfds ? mem->reads[p].data : NULL;
+	for (int i = 0; i < nfds; ++i) {
+		/* Negative fds are ignored. */
+		if (pfds[i].fd < 0)
+			continue;
+		fds[n] = pfds[i].fd;
+		events[n++] = pfds[i].events;
+	}
+	return wait_fds(vt, t, req, resp, now(vt, NULL) + ns, fds, events, n);
+}
+
+static int do_epoll_wait(struct vtime *vt, struct tracee *t, struct seccomp_notif *req,
+			 struct seccomp_notif_resp *resp)
+{
+	const __u64 *args = req->data.args;
+	int fd = args[0], timeout = args[3];
+	short events = POLLIN;
+
+	if (timeout <= 0) {
+		resp->flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+		return SUPERVISOR_RESPOND;
+	}
+	/* An epoll fd is readable when it has events. */
+	return wait_fds(vt, t, req, resp, now(vt, NULL) + (uint64_t)timeout * 1000000,
+			&fd, &events, 1);
+}
+
+/* Wakes up to n futex waiters on uaddr. With the lock held. */
+static void wake(struct vtime *vt, const struct tracee *t, uint64_t uaddr, int n)
+{
+	for (int i = 0; i < vt->n && n > 0;) {
+		struct sleeper *s = vt->heap[i];
+		if (s->t != t || s->uaddr != uaddr || !s->uaddr) {
+			++i;
+			continue;
+		}
+		if (valid(s)) {
+			vt->stats.woken++;
+			--n;
+		}
+		/*
+		 * Either way, the heap's changed: the last sleeper may have
+		 * moved up past i, so look again from the top.
+		 */
+		finish(vt, s, 0, 0, 0);
+		i = 0;
+	}
+}
+
+static int do_futex(struct vtime *vt, struct supervisor_worker *w, struct tracee *t,
+		    struct seccomp_notif *req, struct seccomp_notif_resp *resp)
+{
+	const __u64 *args = req->data.args;
+	int op = args[1] & FUTEX_CMD_MASK;
+	struct mem_batch *mem = w->mem;
+	int64_t offset;
+	uint64_t ns;
+
+	resp->flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+	switch (op) {
+	case FUTEX_WAIT:
+	case FUTEX_WAIT_BITSET:
+		/* Without a timeout, the kernel can have it; wakes go there too. */
+		if (!args[3] || read_timespec(w, t, req, args[3], &ns) < 0)
+			return SUPERVISOR_RESPOND;
+		break;
+	case FUTEX_WAKE:
+	case FUTEX_WAKE_BITSET:
+		pthread_mutex_lock(&vt->lock);
+		wake(vt, t, args[0], (int)args[2]);
+		pthread_mutex_unlock(&vt->lock);
+		return SUPERVISOR_RESPOND;
+	case FUTEX_WAKE_OP:
+	case FUTEX_REQUEUE:
+	case FUTEX_CMP_REQUEUE:
+		/* Whoever's on either address. Spurious wakeups are allowed. */
+		pthread_mutex_lock(&vt->lock);
+		wake(vt, t, args[0], INT_MAX);
+		wake(vt, t, args[4], INT_MAX);
+		pthread_mutex_unlock(&vt->lock);
+		return SUPERVISOR_RESPOND;
+	default:
+		return SUPERVISOR_RESPOND;
+	}
+
+	/*
+	 * Check the word and go to sleep with the lock held, like the kernel
+	 * does, so that a wake can't get in between: the waker changes the
+	 * word before it calls FUTEX_WAKE, and that waits for the lock.
+	 */
+	pthread_mutex_lock(&vt->lock);
+	uint64_t at = now(vt, &offset), deadline = at + ns;
+	if (op == FUTEX_WAIT_BITSET)
+		deadline = !(args[1] & FUTEX_CLOCK_REALTIME) ? ns :
+			(int64_t)ns > offset ? ns - offset : 0;
+
+	mem_batch_init(mem, req->pid, &t->regions);
+	int v = mem_batch_add(mem, args[0], sizeof(uint32_t));
+	int err = mem_batch_read(mem);
+	struct sleeper *s = NULL;
+	resp->flags = 0;
+	if (err)
+		resp->error = -err;
+	else if (*(const uint32_t *)mem->reads[v].data != (uint32_t)args[2])
+		resp->error = -EAGAIN;
+	else if (deadline <= at)
+		resp->error = -ETIMEDOUT;
+	else if (!(s = sleeper_new(t, req)))
+		resp->flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+	if (!s) {
+		pthread_mutex_unlock(&vt->lock);
+		return SUPERVISOR_RESPOND;
+	}
+	s->deadline = deadline;
+	s->timeout_error = -ETIMEDOUT;
+	s->t = t;
+	s->uaddr = args[0];
+	if (add(vt, s) < 0) {
+		pthread_mutex_unlock(&vt->lock);
+		sleeper_free(vt, s);
+		resp->flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+		return SUPERVISOR_RESPOND;
+	}
+	pthread_mutex_unlock(&vt->lock);
+	return SUPERVISOR_DEFERRED;
+}
+
+bool vtime_covers(int nr)
+{
+	switch (nr) {
+	case __NR_nanosleep:
+	case __NR_clock_nanosleep:
+	case __NR_poll:
+	case __NR_ppoll:
+	case __NR_epoll_wait:
+	case __NR_epoll_pwait:
+	case __NR_futex:
+		return true;
+	default:
+		return false;
+	}
+}
+
+int vtime_handle(struct vtime *vt, struct supervisor_worker *w, struct tracee *t,
+		 struct seccomp_notif *req, struct seccomp_notif_resp *resp)
+{
+	uint64_t ns;
+
+	switch (req->data.nr) {
+	case __NR_nanosleep:
+		if (read_timespec(w, t, req, req->data.args[0], &ns) < 0)
+			break;
+		return sleep_until(vt, t, req, resp, now(vt, NULL) + ns);
+	case __NR_clock_nanosleep:
+		return do_clock_nanosleep(vt, w, t, req, resp);
+	case __NR_poll:
+	case __NR_ppoll:
+		return do_poll(vt, w, t, req, resp);
+	case __NR_epoll_wait:
+	case __NR_epoll_pwait:
+		return do_epoll_wait(vt, t, req, resp);
+	case __NR_futex:
+		return do_futex(vt, w, t, req, resp);
+	}
+	resp->flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+	return SUPERVISOR_RESPOND;
+}
+
+static ssize_t read_file(const char *path, char *buf, size_t size)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return -1;
+	ssize_t n = read(fd, buf, size - 1);
+	close(fd);
+	if (n >= 0)
+		buf[n] = '\0';
+	return n;
+}
+
+/* Whether any thread of pid, or of its descendants, is running (or could be). */
+static bool runnable(pid_t pid)
+{
+	char path[64], buf[4096];
+	bool r = false;
+	struct dirent *e;
+
+	snprintf(path, sizeof(path), "/proc/%d/task", pid);
+	DIR *d = opendir(path);
+	if (!d)
+		return false;
+	while (!r && (e = readdir(d))) {
+		pid_t tid = atoi(e->d_name);
+		if (tid <= 0)
+			continue;
+		/* The state's after the command, which can have anything in it. */
+		snprintf(path, sizeof(path), "/proc/%d/task/%d/stat", pid, tid);
+		char *state;
+		if (read_file(path, buf, sizeof(buf)) > 0 && (state = strrchr(buf, ')')) &&
+		    (state[2] == 'R' || state[2] == 'D'))
+			r = true;
+
+		snprintf(path, sizeof(path), "/proc/%d/task/%d/children", pid, tid);
+		if (r || read_file(path, buf, sizeof(buf)) <= 0)
+			continue;
+		for (char *p = buf, *end; !r && *p; p = end) {
+			pid_t child = strtol(p, &end, 10);
+			if (end == p)
+				break;
+			r = runnable(child);
+		}
+	}
+	closedir(d);
+	return r;
+}
+
+static bool all_blocked(struct vtime *vt)
+{
+	pid_t stack_pids[256], *pids = stack_pids;
+	int cap = 256, n;
+	bool r = true;
+
+	if (!supervisor_idle(vt->sv))
+		return false;
+	/* Every tracee, however many: one we don't look at might be running. */
+	while ((n = supervisor_pids(vt->sv, pids, cap)) > cap) {
+		if (pids != stack_pids)
+			free(pids);
+		cap = n * 2;
+		pids = malloc(cap * sizeof(*pids));
+		if (!pids)
+			return false;
+	}
+	for (int i = 0; r && i < n; ++i)
+		r = !runnable(pids[i]);
+	if (pids != stack_pids)
+		free(pids);
+	/* And nothing came in while we were looking. */
+	return r && supervisor_idle(vt->sv);
+}
+
+/* Everyone's waiting: moves the clock to the first deadline, and answers it. */
+static void jump(struct vtime *vt)
+{
+	pthread_mutex_lock(&vt->lock);
+	/* Ones that got a signal aren't waiting any more. */
+	while (vt->n && !valid(vt->heap[0]))
+		finish(vt, vt->heap[0], 0, 0, 0);
+	if (!vt->n) {
+		pthread_mutex_unlock(&vt->lock);
+		return;
+	}
+
+	uint64_t at = now(vt, NULL), deadline = vt->heap[0]->deadline;
+	if (deadline > at) {
+		simclock_write_begin(vt->clock);
+		vt->clock->base_ns = deadline;
+		vt->clock->base_tsc = __rdtsc();
+		simclock_write_end(vt->clock);
+		vt->stats.jumps++;
+		vt->stats.advanced_ns += deadline - at;
+		at = deadline;
+	}
+	while (vt->n && vt->heap[0]->deadline <= at) {
+		struct sleeper *s = vt->heap[0];
+		vt->stats.timed_out++;
+		finish(vt, s, 0, s->timeout_error, 0);
+	}
+	pthread_mutex_unlock(&vt->lock);
+}
+
+static void *clock_main(void *arg)
+{
+	struct vtime *vt = arg;
+	const struct timespec quiet = {.tv_nsec = VTIME_QUIET_NS};
+	struct epoll_event ev;
+
+	while (!__atomic_load_n(&vt->stop, __ATOMIC_ACQUIRE)) {
+		pthread_mutex_lock(&vt->lock);
+		int waiting = vt->n;
+		pthread_mutex_unlock(&vt->lock);
+
+		int n = epoll_pwait2(vt->epfd, &ev, 1, waiting ? &quiet : NULL, NULL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_pwait2");
+			break;
+		}
+		if (n == 0) {
+			if (all_blocked(vt))
+				jump(vt);
+			continue;
+		}
+
+		if (!ev.data.u64) {
+			eventfd_t v;
+			eventfd_read(vt->wakefd, &v);
+			continue;
+		}
+		/* One of its fds is ready; the kernel can take it from here. */
+		pthread_mutex_lock(&vt->lock);
+		for (int i = 0; i < vt->n; ++i) {
+			struct sleeper *s = vt->heap[i];
+			if (s->seq == ev.data.u64) {
+				vt->stats.ready++;
+				finish(vt, s, 0, 0, SECCOMP_USER_NOTIF_FLAG_CONTINUE);
+				break;
+			}
+		}
+		pthread_mutex_unlock(&vt->lock);
+	}
+	return NULL;
+}
+
+struct vtime *vtime_new(struct supervisor *sv, const char *clock_path)
+{
+	struct vtime *vt = calloc(1, sizeof(*vt));
+
+	if (!vt)
+		return NULL;
+	vt->sv = sv;
+	vt->seq = 1;
+	pthread_mutex_init(&vt->lock, NULL);
+	if (!(vt->clock = map_clock(clock_path)))
+		goto out_free;
+
+	vt->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (vt->epfd < 0) {
+		perror("epoll_create1");
+		goto out_clock;
+	}
+	vt->wakefd = eventfd(0, EFD_CLOEXEC);
+	struct epoll_event ev = {.events = EPOLLIN, .data.u64 = 0};
+	if (vt->wakefd < 0 || epoll_ctl(vt->epfd, EPOLL_CTL_ADD, vt->wakefd, &ev) < 0) {
+		perror("eventfd");
+		goto out_epoll;
+	}
+	if (pthread_create(&vt->thread, NULL, clock_main, vt) != 0) {
+		perror("starting clock thread");
+		goto out_epoll;
+	}
+	return vt;
+
+out_epoll:
+	if (vt->wakefd >= 0)
+		close(vt->wakefd);
+	close(vt->epfd);
+out_clock:
+	munmap(vt->clock, sizeof(*vt->clock));
+out_free:
+	free(vt);
+	return NULL;
+}
+
+void vtime_stats(struct vtime *vt, struct vtime_stats *stats)
+{
+	pthread_mutex_lock(&vt->lock);
+	*stats = vt->stats;
+	pthread_mutex_unlock(&vt->lock);
+}
+
+void vtime_free(struct vtime *vt)
+{
+	__atomic_store_n(&vt->stop, 1, __ATOMIC_RELEASE);
+	eventfd_write(vt->wakefd, 1);
+	pthread_join(vt->thread, NULL);
+
+	pthread_mutex_lock(&vt->lock);
+	while (vt->n)
+		finish(vt, vt->heap[0], 0, vt->heap[0]->timeout_error, 0);
+	pthread_mutex_unlock(&vt->lock);
+
+	close(vt->wakefd);
+	close(vt->epfd);
+	munmap(vt->clock, sizeof(*vt->clock));
+	free(vt->heap);
+	free(vt);
+}
@@ -0,0 +1,62 @@
+#ifndef VTIME_H
+#define VTIME_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "supervisor.h"
+
+/*
+ * Virtual time for tracees. Sleeps and timed waits don't sleep: each one is
+ * left unanswered, in a heap ordered by its deadline on a simulated clock.
+ * That clock stands still while any tracee thread is running. Once they're
+ * all blocked, it jumps straight to the earliest deadline, and whoever was
+ * waiting for it gets answered. So programs that mostly sleep run as fast as
+ * they can, and still wake up in the order they would have.
+ *
+ * Only those jumps move the clock: it doesn't advance while tracees compute,
+ * however long that takes. A tracee that busy-waits on clock_gettime for time
+ * to pass never blocks, so the clock never jumps, and it spins forever.
+ *
+ * Covered: nanosleep, clock_nanosleep, and the timeouts of poll, ppoll,
+ * epoll_wait, epoll_pwait and futex. A timed wait ends early, as usual, when
+ * one of its fds is ready (we watch them too), or for futex, when a trapped
+ * FUTEX_WAKE (or WAKE_OP, or REQUEUE) names its address. That means futex
+ * needs trapping whole, and a waiter may see the odd spurious wakeup.
+ *
+ * Tracees read the time without syscalls, from the vDSO, so for them to see
+ * the simulated clock they need golang-seccomp's seccomp.so with SHIM_CLOCK
+ * pointing at the clock page (see ../common/simclock.h).
+ */
+
+struct vtime;
+
+/*
+ * Starts the engine for sv's tracees. If clock_path isn't NULL, the clock
+ * page lives there, so that seccomp.so can map it; it's created if needed,
+ * and reset to the real time.
+ */
+struct vtime *vtime_new(struct supervisor *sv, const char *clock_path);
+
+/* Whether vtime_handle knows about nr. */
+bool vtime_covers(int nr);
+
+/* Like a supervisor_handler; may return SUPERVISOR_DEFERRED. */
+int vtime_handle(struct vtime *vt, struct supervisor_worker *w, struct tracee *t,
+		 struct seccomp_notif *req, struct seccomp_notif_resp *resp);
+
+struct vtime_stats {
+	/* Waits we held on to. */
+	uint64_t deferred;
+	/* Ended by their deadline, a futex wake, or a ready fd. */
+	uint64_t timed_out, woken, ready;
+	/* Times the clock moved, and how far altogether. */
+	uint64_t jumps, advanced_ns;
+};
+
+void vtime_stats(struct vtime *vt, struct vtime_stats *stats);
+
+/* Stops the engine. Anything still waiting is answered as timed out. */
+void vtime_free(struct vtime *vt);
+
+#endif